@@ -0,0 +1,23 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+// Heap allocations made through operator new by the calling thread since it started.
+// SQLite allocates with malloc directly, so only the library's own C++ allocations are counted.
+struct AllocationCounts {
+    uint64_t allocations = 0;   // Calls to any form of operator new
+    uint64_t bytes = 0;         // Bytes requested by those calls
+};
+
+/**
+ * @return The calling thread's counts, all zero when counting is not compiled in.
+ */
+AllocationCounts threadAllocationCounts();
+
+/**
+ * @return true if the bench was built with RECIPEDB_COUNT_ALLOCATIONS, which replaces the global operator new.
+ */
+bool allocationCountingEnabled();
+
+#endif // ALLOCATION_COUNTER_H
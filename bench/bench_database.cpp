@@ -0,0 +1,629 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+#include "database.h"
+#include "ingredient_parser.h"
+#include "allocation_counter.h"
+
+// Benchmark suite for the recipe database.
+// Usage: bench [recipe_count] [db_path]
+// Exits with 3 if an operation makes more heap allocations per call than its budget in kAllocationBudgets.
+
+using Clock = std::chrono::steady_clock;
+
+// Vocabulary the generated recipes draw from
+const std::vector<std::string> kIngredientNames = {
+    "Flour", "Sugar", "Butter", "Egg", "Milk", "Salt", "Pepper", "Garlic", "Onion", "Tomato",
+    "Olive Oil", "Chicken", "Beef", "Pork", "Rice", "Pasta", "Cheese", "Basil", "Parsley", "Lemon",
+    "Potato", "Carrot", "Celery", "Mushroom", "Spinach", "Cream", "Yogurt", "Honey", "Cinnamon", "Ginger",
+    "Soy Sauce", "Chili", "Cumin", "Paprika", "Beans", "Lentils", "Coconut Milk", "Bacon", "Shrimp", "Oats"
+};
+
+const std::vector<std::string> kTagNames = {
+    "breakfast", "lunch", "dinner", "dessert", "snack", "italian", "mexican", "indian", "chinese", "french",
+    "quick", "easy", "vegetarian", "vegan", "spicy", "healthy", "comfort", "baking", "grill", "soup"
+};
+
+const std::vector<std::string> kWords = {
+    "classic", "simple", "hearty", "creamy", "crispy", "roasted", "slow", "braised", "fresh", "golden",
+    "rustic", "zesty", "smoky", "sweet", "savory", "one-pot", "weeknight", "family", "holiday", "summer"
+};
+
+
+// Most heap allocations (operator new calls) one call of each operation may make on average. Measured with
+// the recipes generated below; searches use limits so the budgets hold for any reasonable recipe_count.
+struct AllocationBudget {
+    const char* operation;
+    double max_allocations;
+};
+
+const std::vector<AllocationBudget> kAllocationBudgets = {
+    {"getRecipeById", 18},
+    {"search (tag, top 20)", 30},
+    {"search (ingredients + exclude tag, top 20)", 56},
+    {"search (keyword, relevance, top 20)", 25},
+    {"search (cook range, total time, top 20)", 32},
+    {"searchExpression (or + not, top 20)", 125},
+    {"searchByCoverage (top 20)", 100},    // Grows with the log of the recipe count
+    {"addRecipe", 12},
+    {"deleteRecipe", 2},
+};
+
+
+// Deterministic pseudo-random generator so every run inserts the same data
+struct Lcg {
+    uint64_t state;
+    explicit Lcg(uint64_t seed) : state(seed) {}
+    uint32_t next() {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<uint32_t>(state >> 33);
+    }
+    size_t below(size_t n) { return next() % n; }
+};
+
+
+RecipeData generateRecipe(Lcg& rng, size_t index) {
+    RecipeData recipe;
+    recipe.name = kWords[rng.below(kWords.size())] + " " + kWords[rng.below(kWords.size())] + " " +
+                  kIngredientNames[rng.below(kIngredientNames.size())] + " #" + std::to_string(index);
+    recipe.description = "A " + kWords[rng.below(kWords.size())] + " dish that is " + kWords[rng.below(kWords.size())] +
+                         " and " + kWords[rng.below(kWords.size())] + ".";
+    recipe.prep_time_minutes = 5 + rng.below(60);
+    recipe.cook_time_minutes = rng.below(180);
+    recipe.servings = 1 + rng.below(8);
+    recipe.is_favorite = rng.below(10) == 0;
+    recipe.source = "Bench Kitchen " + std::to_string(rng.below(20));
+    recipe.author = "Author " + std::to_string(rng.below(200));
+
+    size_t ingredient_count = 3 + rng.below(10);
+    std::vector<size_t> picks;
+    while (picks.size() < ingredient_count) {
+        size_t pick = rng.below(kIngredientNames.size());
+        if (std::find(picks.begin(), picks.end(), pick) == picks.end()) picks.push_back(pick);
+    }
+    for (size_t pick : picks) {
+        recipe.ingredients.push_back({kIngredientNames[pick], 1.0 + rng.below(4), "cup", "", rng.below(6) == 0});
+    }
+
+    size_t tag_count = 1 + rng.below(4);
+    while (recipe.tags.size() < tag_count) {
+        const std::string& tag = kTagNames[rng.below(kTagNames.size())];
+        if (std::find(recipe.tags.begin(), recipe.tags.end(), tag) == recipe.tags.end()) recipe.tags.push_back(tag);
+    }
+
+    for (size_t step = 0; step < 3 + rng.below(5); ++step) {
+        recipe.instructions.push_back("Step " + std::to_string(step + 1) + ": " + kWords[rng.below(kWords.size())] + " everything.");
+    }
+    return recipe;
+}
+
+
+double elapsedMicros(Clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+
+void report(const std::string& name, std::vector<double> samples_us) {
+    std::sort(samples_us.begin(), samples_us.end());
+    double total = 0;
+    for (double sample : samples_us) total += sample;
+    auto percentile = [&](double p) { return samples_us[std::min(samples_us.size() - 1, static_cast<size_t>(p * samples_us.size()))]; };
+
+    std::cout << std::left << std::setw(36) << name << std::right << std::fixed << std::setprecision(1)
+              << " n=" << std::setw(6) << samples_us.size()
+              << "  mean=" << std::setw(10) << total / samples_us.size() << "us"
+              << "  p50=" << std::setw(10) << percentile(0.50) << "us"
+              << "  p99=" << std::setw(10) << percentile(0.99) << "us" << std::endl;
+}
+
+
+void benchOpen(Database& db, const std::string& db_path) {
+    std::cout << "\n--- Open ---" << std::endl;
+
+    std::vector<double> samples;
+    for (int i = 0; i < 50; ++i) {
+        db.close();
+        auto start = Clock::now();
+        if (!db.open(db_path)) {
+            std::cerr << "Failed to reopen database." << std::endl;
+            std::exit(1);
+        }
+        samples.push_back(elapsedMicros(start));
+    }
+    report("open (current schema)", samples);
+
+    samples.clear();
+    for (int i = 0; i < 3; ++i) {
+        auto start = Clock::now();
+        db.rebuildSearchIndex();
+        samples.push_back(elapsedMicros(start));
+    }
+    report("rebuildSearchIndex", samples);
+}
+
+
+void benchCheckpointing(Database& db, const std::string& db_path, size_t recipe_count) {
+    std::cout << "\n--- WAL checkpointing ---" << std::endl;
+
+    // Journal mode is stored in the file; reopening drops the background checkpointer, so COMMIT checkpoints inline
+    auto measure = [&](const std::string& name, uint64_t seed) {
+        Lcg rng(seed);
+        std::vector<double> samples;
+        for (size_t i = 0; i < recipe_count; ++i) {
+            RecipeData recipe = generateRecipe(rng, i);
+            recipe.name += " (wal)";
+            auto start = Clock::now();
+            db.addRecipe(recipe);
+            samples.push_back(elapsedMicros(start));
+        }
+        report(name, samples);
+    };
+
+    db.enableWal();
+    db.close();
+    db.open(db_path);
+    measure("addRecipe (inline checkpoint)", 7);
+
+    db.enableWal();
+    measure("addRecipe (background checkpoint)", 8);
+    if (std::optional<CheckpointMetrics> metrics = db.checkpointMetrics()) {
+        std::cout << "checkpoints=" << metrics->checkpoints << " frames_copied=" << metrics->frames_copied
+                  << " max_wal_frames=" << metrics->max_wal_frames
+                  << " max_duration=" << metrics->max_duration.count() << "us" << std::endl;
+    }
+}
+
+
+void benchIngredientParser(size_t line_count) {
+    std::cout << "\n--- Ingredient parsing ---" << std::endl;
+
+    const std::vector<std::string> templates = {
+        "1 1/2 cups all-purpose flour, sifted (optional)", "2 tbsp olive oil", "½ tsp salt",
+        "2-3 cloves garlic, minced", "1 (14 oz) can diced tomatoes, drained", "200g dark chocolate, chopped",
+        "A pinch of nutmeg", "Salt and pepper, to taste", "1¾ cups whole milk", "3 large eggs, beaten",
+        "8 fl. oz. heavy cream", "1 to 2 lbs. boneless chicken thighs (skin removed)",
+    };
+    Lcg rng(99);
+    std::vector<std::string> lines;
+    lines.reserve(line_count);
+    for (size_t i = 0; i < line_count; ++i) lines.push_back(templates[rng.below(templates.size())]);
+
+    // Lines are timed in batches; a single line takes well under the clock's resolution
+    constexpr size_t kBatch = 1000;
+    auto measure = [&](const std::string& name, auto&& parse) {
+        std::vector<double> samples;
+        size_t parsed = 0;
+        auto total_start = Clock::now();
+        for (size_t begin = 0; begin < lines.size(); begin += kBatch) {
+            auto start = Clock::now();
+            for (size_t i = begin; i < std::min(begin + kBatch, lines.size()); ++i) parsed += parse(lines[i]);
+            samples.push_back(elapsedMicros(start));
+        }
+        double total_us = elapsedMicros(total_start);
+        report(name, samples);
+        std::cout << std::fixed << std::setprecision(2) << "  " << parsed / total_us << "M lines/s" << std::endl;
+    };
+
+    ParsedIngredientLine parsed;
+    measure("parseIngredientLine (views) x1000", [&](const std::string& line) { return parseIngredientLine(line, parsed); });
+    RecipeIngredientInfo info;
+    measure("parseIngredientLine (info) x1000", [&](const std::string& line) { return parseIngredientLine(line, info); });
+}
+
+
+void benchSearchBundle(Database& db, const std::string& db_path) {
+    std::cout << "\n--- Search bundle ---" << std::endl;
+
+    const std::string bundle_path = db_path + ".bundle";
+    auto start = Clock::now();
+    std::optional<SearchBundleStats> stats = db.exportSearchBundle(bundle_path);
+    double export_us = elapsedMicros(start);
+    if (!stats) {
+        std::cerr << "Failed to export search bundle." << std::endl;
+        return;
+    }
+    SearchBundle bundle;
+    start = Clock::now();
+    bundle.load(bundle_path);
+    double load_us = elapsedMicros(start);
+
+    // Pages in use rather than the file size, which still includes the WAL and any freelist
+    std::optional<StorageStats> storage = db.storageStats();
+    int64_t db_bytes = storage ? storage->page_count * storage->page_size : 0;
+    std::cout << "db=" << db_bytes << "B bundle=" << stats->total_bytes << "B"
+              << " (ids=" << stats->id_bytes << " columns=" << stats->column_bytes << " summaries=" << stats->summary_bytes
+              << " terms=" << stats->term_bytes << " tags=" << stats->tag_bytes << " ingredients=" << stats->ingredient_bytes << ")"
+              << std::endl;
+    std::cout << std::fixed << std::setprecision(1) << "export=" << export_us / 1000 << "ms load=" << load_us / 1000 << "ms" << std::endl;
+
+    std::vector<std::pair<std::string, SearchData>> queries(4);
+    queries[0].first = "tag";
+    queries[0].second.tags = {"dinner"};
+    queries[1].first = "tags + exclude ingredient";
+    queries[1].second.tags = {"quick", "easy"};
+    queries[1].second.exclude_ingredients = {"Beef"};
+    queries[2].first = "ingredients + cook range";
+    queries[2].second.ingredients = {"Garlic", "Onion"};
+    queries[2].second.cook_time_range = {0, 60};
+    queries[3].first = "keyword, sorted, top 20";
+    queries[3].second.keywords = "creamy";
+    queries[3].second.sort_by = SortKey::Name;
+    queries[3].second.limit = 20;
+    for (const auto& [name, query] : queries) {
+        std::vector<double> db_samples;
+        std::vector<double> bundle_samples;
+        for (int i = 0; i < 50; ++i) {
+            start = Clock::now();
+            db.search(query);
+            db_samples.push_back(elapsedMicros(start));
+            start = Clock::now();
+            bundle.search(query);
+            bundle_samples.push_back(elapsedMicros(start));
+        }
+        report("search db (" + name + ")", db_samples);
+        report("search bundle (" + name + ")", bundle_samples);
+    }
+    std::filesystem::remove(bundle_path);
+}
+
+
+void benchMealPlanner(Database& db) {
+    std::cout << "\n--- Meal planner (7 dinners) ---" << std::endl;
+    MealPlanQuery query;
+    query.filters.tags = {"dinner"};
+    for (size_t threads : {1, 4}) {
+        for (int budget_ms : {0, 50, 200}) {
+            query.threads = threads;
+            query.time_budget = std::chrono::milliseconds(budget_ms);
+            auto start = Clock::now();
+            std::optional<MealPlan> plan = db.planMeals(query);
+            double elapsed = elapsedMicros(start);
+            if (!plan) continue;
+            std::cout << "threads=" << threads << " budget=" << std::setw(3) << budget_ms << "ms"
+                      << "  candidates=" << plan->candidates << "  shopping_list=" << std::setw(3) << plan->shopping_list.size()
+                      << "  shared=" << std::setw(3) << plan->shared_ingredients << "  plans_evaluated=" << std::setw(10) << plan->plans_evaluated
+                      << "  time=" << std::fixed << std::setprecision(1) << elapsed / 1000 << "ms" << std::endl;
+        }
+    }
+}
+
+
+void benchSimilarRecipes(Database& db) {
+    std::cout << "\n--- Similar recipes (top 10) ---" << std::endl;
+    constexpr size_t kQueries = 200;
+    std::vector<long long> ids = db.search({});
+    Lcg rng(11);
+
+    auto start = Clock::now();
+    db.similarRecipes(ids[0], 10);
+    std::cout << "signature load: " << std::fixed << std::setprecision(1) << elapsedMicros(start) / 1000 << "ms" << std::endl;
+    for (SimilarityMeasure measure : {SimilarityMeasure::Jaccard, SimilarityMeasure::WeightedJaccard}) {
+        std::vector<double> samples;
+        for (size_t i = 0; i < kQueries; ++i) {
+            long long id = ids[rng.below(ids.size())];
+            start = Clock::now();
+            db.similarRecipes(id, 10, {}, measure);
+            samples.push_back(elapsedMicros(start));
+        }
+        report(measure == SimilarityMeasure::Jaccard ? "similarRecipes (jaccard)" : "similarRecipes (weighted)", samples);
+    }
+
+    // The same search over a million in-memory signatures: 3000 ingredients, common ones far more likely
+    constexpr long long kSyntheticRecipes = 1000000;
+    std::vector<std::pair<long long, long long>> links;
+    links.reserve(kSyntheticRecipes * 9);
+    std::vector<long long> picks;
+    for (long long recipe = 0; recipe < kSyntheticRecipes; ++recipe) {
+        picks.clear();
+        for (size_t i = 0, count = 4 + rng.below(10); i < count; ++i) {
+            long long ingredient = static_cast<long long>(rng.below(3000) * rng.below(3000) / 3000);
+            if (std::find(picks.begin(), picks.end(), ingredient) == picks.end()) picks.push_back(ingredient);
+        }
+        std::sort(picks.begin(), picks.end());
+        for (long long ingredient : picks) links.emplace_back(recipe, ingredient);
+    }
+    RecipeSignatures signatures;
+    start = Clock::now();
+    signatures.assign(links);
+    std::cout << "1M signatures: build=" << std::fixed << std::setprecision(1) << elapsedMicros(start) / 1000 << "ms"
+              << "  bytes=" << signatures.bytes() << std::endl;
+    for (SimilarityMeasure measure : {SimilarityMeasure::Jaccard, SimilarityMeasure::WeightedJaccard}) {
+        std::vector<double> samples;
+        for (size_t i = 0; i < kQueries; ++i) {
+            long long id = static_cast<long long>(rng.below(kSyntheticRecipes));
+            start = Clock::now();
+            signatures.mostSimilar(id, 10, measure, nullptr);
+            samples.push_back(elapsedMicros(start));
+        }
+        report(measure == SimilarityMeasure::Jaccard ? "mostSimilar 1M (jaccard)" : "mostSimilar 1M (weighted)", samples);
+    }
+}
+
+
+void benchTextSimilarity(Database& db) {
+    std::cout << "\n--- Text similarity (top 10) ---" << std::endl;
+    constexpr size_t kQueries = 200;
+    std::vector<long long> ids = db.search({});
+    Lcg rng(13);
+
+    auto start = Clock::now();
+    db.similarRecipesByText(ids[0], 10);
+    std::cout << "text index load: " << std::fixed << std::setprecision(1) << elapsedMicros(start) / 1000 << "ms" << std::endl;
+    std::vector<double> samples;
+    for (size_t i = 0; i < kQueries; ++i) {
+        long long id = ids[rng.below(ids.size())];
+        start = Clock::now();
+        db.similarRecipesByText(id, 10);
+        samples.push_back(elapsedMicros(start));
+    }
+    report("similarRecipesByText", samples);
+
+    // A query after each insert only re-reads the new recipe
+    samples.clear();
+    std::vector<long long> added;
+    for (size_t i = 0; i < 50; ++i) {
+        added.push_back(db.addRecipe(generateRecipe(rng, ids.size() + i)));
+        start = Clock::now();
+        db.similarRecipesByText(added.back(), 10);
+        samples.push_back(elapsedMicros(start));
+    }
+    report("similarRecipesByText after insert", samples);
+    for (long long id : added) db.deleteRecipe(id);
+
+    // WAND against scoring every document, over 200k synthetic texts of about 40 words from a 20000-word vocabulary
+    constexpr long long kSyntheticRecipes = 200000;
+    RecipeTextIndex index;
+    std::string text;
+    start = Clock::now();
+    for (long long recipe = 0; recipe < kSyntheticRecipes; ++recipe) {
+        text.clear();
+        for (size_t i = 0, count = 20 + rng.below(40); i < count; ++i) {
+            text += "w" + std::to_string(rng.below(20000) * rng.below(20000) / 20000) + " ";
+        }
+        index.addDocument(recipe, text);
+    }
+    index.compact();
+    std::cout << "200k text index: build=" << std::fixed << std::setprecision(1) << elapsedMicros(start) / 1000 << "ms"
+              << "  bytes=" << index.bytes() << std::endl;
+    std::vector<double> wand_samples;
+    std::vector<double> exhaustive_samples;
+    for (size_t i = 0; i < 20; ++i) {
+        long long id = static_cast<long long>(rng.below(kSyntheticRecipes));
+        start = Clock::now();
+        index.mostSimilar(id, 10, nullptr);
+        wand_samples.push_back(elapsedMicros(start));
+        start = Clock::now();
+        std::vector<double> scores;
+        for (long long recipe = 0; recipe < kSyntheticRecipes; ++recipe) scores.push_back(index.similarity(id, recipe));
+        std::partial_sort(scores.begin(), scores.begin() + 11, scores.end(), std::greater<>());
+        exhaustive_samples.push_back(elapsedMicros(start));
+    }
+    report("mostSimilar 200k (wand)", wand_samples);
+    report("mostSimilar 200k (exhaustive)", exhaustive_samples);
+}
+
+
+// Runs the same concurrent read mix under SQLite's default memory setup and under a preallocated page-cache
+// arena, larger lookaside buffers and the pooled allocator, and compares the latency tails
+void benchSqliteMemory(Database& db, const std::string& db_path) {
+    std::cout << "\n--- SQLite memory configuration (4 threads) ---" << std::endl;
+    constexpr size_t kThreads = 4;
+    constexpr size_t kCallsPerThread = 2000;
+
+    std::vector<long long> ids = db.search({});
+    db.close();
+
+    auto measure = [&](const std::string& name) {
+        std::vector<std::vector<double>> samples(kThreads);
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < kThreads; ++t) {
+            threads.emplace_back([&, t] {
+                Database connection;
+                if (!connection.open(db_path)) return;
+                Lcg rng(100 + t);
+                samples[t].reserve(kCallsPerThread);
+                for (size_t i = 0; i < kCallsPerThread; ++i) {
+                    SearchData query;
+                    switch (i % 3) {
+                    case 0:
+                        query.tags = {kTagNames[rng.below(kTagNames.size())]};
+                        query.limit = 20;
+                        break;
+                    case 1:
+                        query.keywords = kWords[rng.below(kWords.size())];
+                        query.sort_by = SortKey::Relevance;
+                        query.sort_direction = SortDirection::Descending;
+                        query.limit = 20;
+                        break;
+                    }
+                    long long id = ids[rng.below(ids.size())];
+                    auto start = Clock::now();
+                    if (i % 3 == 2) connection.getRecipeById(id);
+                    else connection.search(query);
+                    samples[t].push_back(elapsedMicros(start));
+                }
+            });
+        }
+        for (std::thread& thread : threads) thread.join();
+
+        std::vector<double> all;
+        for (const std::vector<double>& thread_samples : samples) all.insert(all.end(), thread_samples.begin(), thread_samples.end());
+        if (all.empty()) return;
+        std::sort(all.begin(), all.end());
+        auto percentile = [&](double p) { return all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))]; };
+        std::cout << std::left << std::setw(38) << name << std::right << std::fixed << std::setprecision(1)
+                  << " n=" << std::setw(6) << all.size()
+                  << "  p50=" << std::setw(8) << percentile(0.50) << "us"
+                  << "  p99=" << std::setw(8) << percentile(0.99) << "us"
+                  << "  p99.9=" << std::setw(8) << percentile(0.999) << "us" << std::endl;
+    };
+
+    measure("search mix (SQLite defaults)");
+
+    SqliteMemoryConfig config;
+    config.allocator = SqliteAllocator::Pooled;
+    config.page_cache_slots = kThreads * 600;
+    config.lookaside_slot_size = 512;
+    config.lookaside_slots = 256;
+    if (Database::configureSqliteMemory(config)) {
+        measure("search mix (arena + lookaside + pool)");
+        PooledAllocatorStats stats = pooledAllocatorStats();
+        std::cout << "pool_hits=" << stats.pool_hits << " pool_misses=" << stats.pool_misses
+                  << " large_allocations=" << stats.large_allocations << std::endl;
+    }
+
+    Database::configureSqliteMemory(SqliteMemoryConfig());
+    db.open(db_path);
+}
+
+
+void benchAllocations(Database& db, size_t recipe_count, bool& within_budget) {
+    std::cout << "\n--- Heap allocations per call ---" << std::endl;
+    if (!allocationCountingEnabled()) {
+        std::cout << "Not counted: build with RECIPEDB_COUNT_ALLOCATIONS." << std::endl;
+        return;
+    }
+
+    constexpr size_t kCalls = 200;
+    Lcg rng(7);
+    auto measure = [&](const char* name, auto&& call) {
+        uint64_t allocations = 0;
+        uint64_t bytes = 0;
+        uint64_t most = 0;
+        for (size_t i = 0; i < kCalls; ++i) {
+            // Arguments are prepared by the caller before the counted region begins
+            AllocationCounts before = threadAllocationCounts();
+            call(i);
+            AllocationCounts after = threadAllocationCounts();
+            allocations += after.allocations - before.allocations;
+            bytes += after.bytes - before.bytes;
+            most = std::max(most, after.allocations - before.allocations);
+        }
+        double mean = static_cast<double>(allocations) / kCalls;
+        auto budget = std::find_if(kAllocationBudgets.begin(), kAllocationBudgets.end(),
+                                   [&](const AllocationBudget& entry) { return std::string(entry.operation) == name; });
+        bool ok = budget == kAllocationBudgets.end() || mean <= budget->max_allocations;
+        within_budget = within_budget && ok;
+        std::cout << std::left << std::setw(44) << name << std::right << std::fixed << std::setprecision(1)
+                  << " allocs/call=" << std::setw(8) << mean << "  max=" << std::setw(6) << most
+                  << "  bytes/call=" << std::setw(9) << static_cast<double>(bytes) / kCalls;
+        if (budget != kAllocationBudgets.end()) std::cout << "  budget=" << std::setw(6) << budget->max_allocations << (ok ? "" : "  OVER BUDGET");
+        std::cout << std::endl;
+    };
+
+    std::vector<long long> ids = db.search({});
+    std::vector<long long> picks(kCalls);
+    for (long long& id : picks) id = ids[rng.below(ids.size())];
+    measure("getRecipeById", [&](size_t i) { db.getRecipeById(picks[i]); });
+
+    std::vector<SearchData> queries(kCalls);
+    for (SearchData& query : queries) {
+        query.tags = {kTagNames[rng.below(kTagNames.size())]};
+        query.limit = 20;
+    }
+    measure("search (tag, top 20)", [&](size_t i) { db.search(queries[i]); });
+
+    for (SearchData& query : queries) {
+        query = {};
+        query.ingredients = {kIngredientNames[rng.below(kIngredientNames.size())], kIngredientNames[rng.below(kIngredientNames.size())]};
+        query.exclude_tags = {kTagNames[rng.below(kTagNames.size())]};
+        query.limit = 20;
+    }
+    measure("search (ingredients + exclude tag, top 20)", [&](size_t i) { db.search(queries[i]); });
+
+    for (SearchData& query : queries) {
+        query = {};
+        query.keywords = kWords[rng.below(kWords.size())];
+        query.sort_by = SortKey::Relevance;
+        query.sort_direction = SortDirection::Descending;
+        query.limit = 20;
+    }
+    measure("search (keyword, relevance, top 20)", [&](size_t i) { db.search(queries[i]); });
+
+    for (SearchData& query : queries) {
+        query = {};
+        uint16_t low = static_cast<uint16_t>(rng.below(150));
+        query.cook_time_range = {low, static_cast<uint16_t>(low + 30)};
+        query.sort_by = SortKey::TotalTime;
+        query.limit = 20;
+    }
+    measure("search (cook range, total time, top 20)", [&](size_t i) { db.search(queries[i]); });
+
+    std::vector<SearchExpression> expressions(kCalls);
+    for (SearchExpression& expression : expressions) {
+        SearchData first, second, excluded;
+        first.tags = {kTagNames[rng.below(kTagNames.size())]};
+        second.tags = {kTagNames[rng.below(kTagNames.size())]};
+        excluded.ingredients = {kIngredientNames[rng.below(kIngredientNames.size())]};
+        expression = SearchExpression::allOf({SearchExpression::anyOf({SearchExpression::leaf(first), SearchExpression::leaf(second)}),
+                                              SearchExpression::negate(SearchExpression::leaf(excluded))});
+    }
+    measure("searchExpression (or + not, top 20)",
+            [&](size_t i) { db.searchExpression(expressions[i], SortKey::DateAdded, SortDirection::Descending, 20); });
+
+    std::vector<CoverageQuery> coverage(kCalls);
+    for (CoverageQuery& query : coverage) {
+        for (int j = 0; j < 5; ++j) query.ingredients.push_back(kIngredientNames[rng.below(kIngredientNames.size())]);
+        query.min_matches = 2;
+        query.limit = 20;
+    }
+    measure("searchByCoverage (top 20)", [&](size_t i) { db.searchByCoverage(coverage[i]); });
+
+    std::vector<RecipeData> recipes;
+    for (size_t i = 0; i < kCalls; ++i) recipes.push_back(generateRecipe(rng, recipe_count + i));
+    std::vector<long long> added(kCalls);
+    measure("addRecipe", [&](size_t i) { added[i] = db.addRecipe(recipes[i]); });
+    measure("deleteRecipe", [&](size_t i) { db.deleteRecipe(added[i]); });
+}
+
+
+int main(int argc, char** argv) {
+    size_t recipe_count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 5000;
+    std::string db_path = argc > 2 ? argv[2] : "bench.db";
+
+    std::cout << "RecipeApp benchmark: " << recipe_count << " recipes in " << db_path << std::endl;
+
+    std::filesystem::remove(db_path);
+    Database db;
+    if (!db.open(db_path)) {
+        std::cerr << "Failed to open database." << std::endl;
+        return 1;
+    }
+
+    std::cout << "\n--- Populate ---" << std::endl;
+    Lcg rng(42);
+    std::vector<double> samples;
+    samples.reserve(recipe_count);
+    for (size_t i = 0; i < recipe_count; ++i) {
+        RecipeData recipe = generateRecipe(rng, i);
+        auto start = Clock::now();
+        db.addRecipe(recipe);
+        samples.push_back(elapsedMicros(start));
+    }
+    report("addRecipe", samples);
+
+    benchOpen(db, db_path);
+    benchCheckpointing(db, db_path, recipe_count);
+    benchSearchBundle(db, db_path);
+    benchIngredientParser(recipe_count * 100);
+    benchSqliteMemory(db, db_path);
+    benchMealPlanner(db);
+    benchSimilarRecipes(db);
+    benchTextSimilarity(db);
+    bool within_budget = true;
+    benchAllocations(db, recipe_count, within_budget);
+
+    db.close();
+    std::filesystem::remove(db_path);
+    if (!within_budget) {
+        std::cerr << "\nAllocation budget exceeded." << std::endl;
+        return 3;
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+#ifndef CALL_TRACE_H
+#define CALL_TRACE_H
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+
+class Database;
+struct RecipeData;
+struct SearchData;
+struct SearchExpression;
+struct CoverageQuery;
+struct CoverageMatch;
+struct AttachmentInfo;
+struct RecipeSummary;
+struct SimilarRecipe;
+struct TextMatch;
+enum class SortKey;
+enum class SortDirection;
+enum class SimilarityMeasure;
+
+// Version of the trace file format; readers reject other versions
+constexpr uint32_t kCallTraceVersion = 1;
+
+// Database calls a trace records. The values are stored in trace files, so never renumber them.
+enum class TraceCall : uint8_t {
+    AddRecipe = 1,
+    AddRecipes = 2,
+    DeleteRecipe = 3,
+    MergeDatabase = 4,
+    EmptyDatabase = 5,
+    Search = 6,
+    SearchExpression = 7,
+    SearchByCoverage = 8,
+    GetRecipeById = 9,
+    AddIngredientRelation = 10,
+    RemoveIngredientRelation = 11,
+    GetAttachments = 12,
+    DeleteAttachment = 13,
+    SearchSummaries = 14,
+    SimilarRecipes = 15,
+    SimilarRecipesByText = 16
+};
+
+// Highest TraceCall value, for tables indexed by call
+constexpr size_t kTraceCallCount = 17;
+
+// One recorded call
+struct TraceEvent {
+    TraceCall call = TraceCall::Search;
+    uint32_t connection = 0;    // Connection that made the call, numbered in the order they were attached to the recorder
+    uint64_t start_us = 0;      // When the call started, in microseconds since the recorder was created
+    uint64_t duration_us = 0;   // How long the call took
+    uint64_t result_hash = 0;   // Hash of the result, compared on replay to detect divergence
+    std::string arguments;      // The call's arguments in the trace encoding
+};
+
+/**
+ * @param call A traced call
+ * @return The name of the Database method, e.g. "search".
+ */
+const char* traceCallName(TraceCall call);
+
+// Appends the calls of any number of connections to one binary trace file. Events are buffered and written
+// in batches; the file is complete once the last connection has detached and the recorder is destroyed.
+class TraceRecorder {
+public:
+    /**
+     * Creates the trace file, replacing an existing one.
+     * @param path Path of the trace file
+     * @return The recorder, nullptr if the file cannot be created.
+     */
+    static std::shared_ptr<TraceRecorder> create(const std::string& path);
+
+    /**
+     * Destructor
+     * Writes out the buffered events.
+     */
+    ~TraceRecorder();
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    /**
+     * @return A new connection number for a Database that starts recording.
+     */
+    uint32_t attach();
+
+    /**
+     * Appends an event. Safe to call from any thread.
+     * @param call The call that finished
+     * @param connection The connection number returned by attach()
+     * @param start When the call started
+     * @param end When the call returned
+     * @param arguments The encoded arguments
+     * @param result_hash Hash of the result
+     */
+    void record(TraceCall call, uint32_t connection, std::chrono::steady_clock::time_point start,
+                std::chrono::steady_clock::time_point end, const std::string& arguments, uint64_t result_hash);
+
+    /**
+     * Writes the buffered events to the file.
+     * @return false if writing failed.
+     */
+    bool flush();
+
+    /**
+     * @return Number of events recorded so far.
+     */
+    uint64_t eventCount() const;
+
+private:
+    explicit TraceRecorder(std::ofstream out);
+
+    mutable std::mutex mutex_;
+    std::ofstream out_;
+    std::string buffer_;
+    uint64_t events_ = 0;
+    uint32_t next_connection_ = 0;
+    const std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * Reads every event of a trace file.
+ * @param path Path of the trace
+ * @return The events in the order they were recorded, std::nullopt if the file is missing, truncated or not a trace.
+ */
+std::optional<std::vector<TraceEvent>> readTrace(const std::string& path);
+
+/**
+ * Calls the recorded Database method again with the recorded arguments.
+ * @param db The database to call
+ * @param event The recorded call
+ * @return Hash of the new result, std::nullopt if the arguments cannot be decoded.
+ */
+std::optional<uint64_t> replayTraceEvent(Database& db, const TraceEvent& event);
+
+// Argument encodings of the traced calls
+std::string encodeTraceArguments(long long id);
+std::string encodeTraceArguments(const std::string& text);
+std::string encodeTraceArguments(const std::string& first, const std::string& second);
+std::string encodeTraceArguments(const RecipeData& recipe);
+std::string encodeTraceArguments(const std::vector<RecipeData>& recipes);
+std::string encodeTraceArguments(const SearchData& criteria);
+std::string encodeTraceArguments(const SearchExpression& expression, SortKey sort_by, SortDirection sort_direction, size_t limit);
+std::string encodeTraceArguments(const CoverageQuery& query);
+std::string encodeTraceArguments(long long id, size_t k, const SearchData& filters, SimilarityMeasure measure);
+std::string encodeTraceArguments(long long id, size_t k, const SearchData& filters);
+
+// Hashes of the results of the traced calls (FNV-1a over their contents)
+uint64_t hashTraceResult(bool result);
+uint64_t hashTraceResult(long long result);
+uint64_t hashTraceResult(const std::vector<long long>& result);
+uint64_t hashTraceResult(const std::optional<RecipeData>& result);
+uint64_t hashTraceResult(const std::vector<CoverageMatch>& result);
+uint64_t hashTraceResult(const std::vector<AttachmentInfo>& result);
+uint64_t hashTraceResult(const std::vector<RecipeSummary>& result);
+uint64_t hashTraceResult(const std::vector<SimilarRecipe>& result);
+uint64_t hashTraceResult(const std::vector<TextMatch>& result);
+
+#endif // CALL_TRACE_H
@@ -0,0 +1,94 @@
+#ifndef CHECKPOINTER_H
+#define CHECKPOINTER_H
+
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include "sqlite3.h"
+
+// Checkpoint modes, matching SQLITE_CHECKPOINT_PASSIVE, _FULL and _TRUNCATE
+enum class CheckpointMode {
+    Passive,    // Copy what it can without waiting for readers or writers
+    Full,       // Wait for writers, then copy every frame once readers allow it
+    Truncate    // Like Full, then reset the WAL file to zero bytes
+};
+
+// When and how the background checkpointer runs
+struct CheckpointPolicy {
+    CheckpointMode mode = CheckpointMode::Passive;          // Mode of routine checkpoints
+    int64_t wal_size_pages = 1000;                          // Checkpoint once the WAL holds this many frames, 0 to disable
+    std::chrono::milliseconds idle_after{250};              // Checkpoint once no commit has happened for this long, 0 to disable
+    int64_t escalate_pages = 10000;                         // Run a Truncate checkpoint once the WAL has grown past this without restarting, 0 to disable
+    int64_t reader_blocked_attempts = 4;                    // Run a Truncate checkpoint, which waits for readers, after this many in a row
+                                                            // left frames behind, 0 to disable
+    std::chrono::milliseconds reader_backoff_max{1000};     // Longest wait before retrying a checkpoint that left frames behind
+                                                            // while the WAL has not changed; waits double from poll_interval
+    std::chrono::milliseconds poll_interval{50};            // How often the thread re-evaluates the triggers
+    int busy_timeout_ms = 100;                              // How long Full and Truncate checkpoints wait for other connections
+};
+
+// Counters kept by the background checkpointer
+struct CheckpointMetrics {
+    int64_t checkpoints = 0;            // Checkpoints attempted
+    int64_t passive = 0;                // ... of which passive
+    int64_t full = 0;                   // ... of which full
+    int64_t truncate = 0;               // ... of which truncate
+    int64_t busy = 0;                   // Checkpoints that could not get the locks they needed
+    int64_t incomplete = 0;             // Checkpoints that left frames behind because readers still needed them
+    int64_t reader_escalations = 0;     // Truncate checkpoints run because readers kept blocking the others
+    int64_t frames_copied = 0;          // WAL frames copied into the database file
+    int64_t wal_frames = 0;             // WAL size in frames after the most recent commit or checkpoint
+    int64_t max_wal_frames = 0;         // Largest WAL size observed
+    std::chrono::microseconds last_duration{0};    // Duration of the most recent checkpoint
+    std::chrono::microseconds max_duration{0};     // Longest checkpoint
+    std::chrono::microseconds total_duration{0};   // Time spent checkpointing overall
+};
+
+// Moves WAL checkpointing off the commit path onto its own connection and thread.
+// The owning connection disables its inline autocheckpoint and reports every commit through its WAL hook.
+class Checkpointer {
+public:
+    /**
+     * Starts the checkpointer thread and takes over checkpointing for a connection.
+     * @param db The connection whose commits trigger checkpoints; must be in WAL mode and outlive the checkpointer
+     * @param db_path Path of the database file to open a separate connection to
+     * @param policy Modes and triggers
+     */
+    Checkpointer(sqlite3* db, std::string db_path, CheckpointPolicy policy);
+
+    /**
+     * Destructor
+     * Hands checkpointing back to the connection and waits for the thread to exit.
+     */
+    ~Checkpointer();
+
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+
+    /**
+     * @return A snapshot of the checkpointer's counters.
+     */
+    CheckpointMetrics metrics() const;
+
+private:
+    sqlite3* owner_;
+    std::string db_path_;
+    CheckpointPolicy policy_;
+    mutable std::mutex mutex_;
+    std::condition_variable wake_cv_;
+    bool stopping_ = false;
+    std::atomic<int64_t> wal_frames_{0};                    // Latest WAL size reported by the owner's WAL hook
+    std::atomic<int64_t> last_commit_ns_{0};                // steady_clock time of the owner's latest commit
+    CheckpointMetrics metrics_;
+    std::thread thread_;
+
+    static int onCommit(void* checkpointer, sqlite3* db, const char* schema, int wal_frames);
+    void run();
+    bool checkpoint(sqlite3* db, CheckpointMode mode, int64_t& last_log, int64_t& last_copied);
+};
+
+#endif // CHECKPOINTER_H
@@ -7,15 +7,45 @@
 #include <cstdint>
 #include <variant>
 #include <optional>
-#include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <chrono>
 #include "sqlite3.h"
+#include "search_index_job.h"
+#include "maintenance.h"
+#include "checkpointer.h"
+#include "name_id_cache.h"
+#include "recipe_signatures.h"
+#include "recipe_text_index.h"
+#include "search_bundle.h"
+#include "call_trace.h"
+#include "memory_report.h"
+#include "sqlite_memory.h"
+#include "logging.h"
 
 using SqlValue = std::variant<std::string, int, double, int64_t>;
 
+// Orderings available for search results
+enum class SortKey {
+    None,       // No ordering (results come back in recipe_id order)
+    DateAdded,  // Date the recipe was added
+    TotalTime,  // Preparation time plus cooking time
+    PrepTime,   // Preparation time
+    CookTime,   // Cooking time
+    Name,       // Recipe name
+    Relevance   // FTS5 rank of the keyword/name/author match (falls back to recipe_id without FTS criteria)
+};
+
+// Direction to apply to a SortKey. For Relevance, Descending returns the best matches first.
+enum class SortDirection {
+    Ascending,
+    Descending
+};
+
 // Structure to hold information for adding an ingredient to a recipe
 struct RecipeIngredientInfo {
     std::string name;        // Name of the ingredient
-    double quantity;         // Quantity of the ingredient --- if this isn't specified, it will equal -1
+    double quantity;         // Quantity of the ingredient --- if this isn't specified, it will equal 0
     std::string unit;        // Unit for the quantity (e.g., "grams", "ml", "pcs")
     std::string notes;       // Optional notes for this ingredient in the recipe
     bool optional;           // Is this ingredient optional?
@@ -61,11 +91,140 @@ struct SearchData {
     std::vector<std::string> tags;  // List of tags to search for
     std::vector<std::string> exclude_tags;  // List of tags to exclude
     std::vector<std::string> exclude_ingredients;   // List of ingredients to exclude
+    bool expand_ingredients = false;            // Also match variants of each ingredient (e.g. "butter" matches "unsalted butter")
+    bool expand_exclude_ingredients = false;    // Also exclude variants of each excluded ingredient (e.g. "dairy" excludes "milk")
+
+    // Ordering
+    SortKey sort_by = SortKey::None;    // Key to order the results by
+    SortDirection sort_direction = SortDirection::Ascending;    // Direction of the ordering
+    size_t limit = 0;   // Maximum number of results to return (top-k). 0 returns every match
+};
+
+// Metadata of an image or other file attached to a recipe. The bytes themselves are streamed separately.
+struct AttachmentInfo {
+    long long attachment_id = -1;   // ID of the attachment, assigned by addAttachment
+    long long recipe_id = -1;       // ID of the recipe the attachment belongs to
+    std::string mime_type;          // MIME type of the data (e.g., "image/jpeg")
+    uint32_t width = 0;             // Image width in pixels, 0 if unknown or not an image
+    uint32_t height = 0;            // Image height in pixels, 0 if unknown or not an image
+    int64_t byte_size = 0;          // Size of the data in bytes, filled in by addAttachment
+};
+
+// Parameters for an ingredient coverage search ("use up my leftovers")
+struct CoverageQuery {
+    std::vector<std::string> ingredients;   // Ingredients on hand (n)
+    size_t min_matches = 1;                 // Minimum number of the given ingredients a recipe must use (k)
+    size_t limit = 0;                       // Maximum number of results to return. 0 returns every recipe with at least min_matches
+    SearchData filters;                     // Additional criteria the recipes must satisfy (ordering fields are ignored)
+};
+
+// A recipe found by an ingredient coverage search
+struct CoverageMatch {
+    long long recipe_id;        // ID of the recipe
+    size_t matched;             // Number of the given ingredients the recipe uses
+    size_t required;            // Number of non-optional ingredients in the recipe
+    size_t matched_required;    // Number of the recipe's non-optional ingredients that were given
+    size_t missing_optional;    // Number of the recipe's optional ingredients that were not given
+    double score;               // matched_required / required, 1.0 when nothing else is needed
+};
+
+// Parameters of a meal plan ("plan my week"): `meals` distinct recipes matching `filters` whose shopping list, the
+// non-optional ingredients they need that are not in the pantry, is as short as possible. Between plans with equally
+// short lists, the one whose recipes use more of the same ingredients wins.
+struct MealPlanQuery {
+    size_t meals = 7;                           // Recipes per plan
+    SearchData filters;                         // Constraints every recipe must satisfy (ordering fields are ignored)
+    std::vector<std::string> pantry;            // Ingredients on hand, never put on the shopping list
+    std::chrono::milliseconds time_budget{50};  // How long the search may run, past which the remaining meals are picked greedily
+                                                // and improvement stops; 0 runs to the first local optimum however long it takes
+    size_t threads = 0;                         // Search threads, 0 for one per hardware thread
+    size_t beam_width = 32;                     // Partial plans kept per step of the beam search
+    uint64_t seed = 1;                          // Seed of the random choices of the search
+};
+
+// A plan found by Database::planMeals()
+struct MealPlan {
+    std::vector<long long> recipe_ids;          // The chosen recipes, in recipe_id order
+    std::vector<std::string> shopping_list;     // Ingredients to buy, sorted by name
+    size_t total_ingredients = 0;               // Shopping ingredients summed over the recipes, counting repeats
+    size_t shared_ingredients = 0;              // total_ingredients minus the shopping list: uses covered by another meal's purchase
+    size_t candidates = 0;                      // Recipes that satisfied the filters
+    uint64_t plans_evaluated = 0;               // Plans and partial plans scored by the search
+};
+
+// Boolean combination of search criteria, e.g. (italian OR mexican) AND NOT spicy AND cook_time < 30.
+// A Leaf holds a SearchData whose fields are ANDed together exactly as in search(); its ordering fields are ignored.
+struct SearchExpression {
+    enum class Type {
+        Leaf,   // Match criteria
+        And,    // Match every child (no children matches everything)
+        Or,     // Match at least one child (no children matches nothing)
+        Not     // Match anything the single child does not
+    };
+
+    Type type = Type::Leaf;
+    SearchData criteria;                        // Criteria for Leaf nodes
+    std::vector<SearchExpression> children;     // Operands for And, Or and Not nodes
+
+    static SearchExpression leaf(SearchData criteria) {
+        SearchExpression expression;
+        expression.criteria = std::move(criteria);
+        return expression;
+    }
+
+    static SearchExpression allOf(std::vector<SearchExpression> children) {
+        SearchExpression expression;
+        expression.type = Type::And;
+        expression.children = std::move(children);
+        return expression;
+    }
+
+    static SearchExpression anyOf(std::vector<SearchExpression> children) {
+        SearchExpression expression;
+        expression.type = Type::Or;
+        expression.children = std::move(children);
+        return expression;
+    }
+
+    static SearchExpression negate(SearchExpression child) {
+        SearchExpression expression;
+        expression.type = Type::Not;
+        expression.children.push_back(std::move(child));
+        return expression;
+    }
 };
 
+// A recipe library backed by one SQLite database file. Each object owns its own connection and background
+// jobs, so any number of libraries can be open at once; objects can be moved but not copied.
 class Database {
 public:
 
+    /**
+     * Constructor
+     * Creates a new Database object without opening a connection.
+     */
+    Database();
+
+    /**
+     * Move constructor
+     * Takes over the other object's connection and background jobs, leaving it closed.
+     */
+    Database(Database&& other) noexcept;
+
+    /**
+     * Move assignment
+     * Closes this object's connection, then takes over the other object's, leaving it closed.
+     */
+    Database& operator=(Database&& other) noexcept;
+
+    Database(const Database&) = delete;
+    Database& operator=(const Database&) = delete;
+
+    /**
+     * Compatibility shim for code written against the former singleton.
+     * New code should create and own Database objects directly.
+     * @return A process-wide Database object, created closed on first use.
+     */
     static Database* instance();
 
 
@@ -106,6 +265,14 @@ public:
      */
     long long addRecipe(const RecipeData& recipe);
 
+    /**
+     * Adds several recipes in a single transaction, which is much faster than adding them one by one.
+     * A recipe that cannot be added is skipped without affecting the rest of the batch.
+     * @param recipes The recipes to add
+     * @return The recipe_id of each recipe in order, -1 for those that were not added; empty if the batch failed as a whole.
+     */
+    std::vector<long long> addRecipes(const std::vector<RecipeData>& recipes);
+
     /**
      * Removes a recipe from the database by its ID.
      * This will also remove all connections to ingredients, tags, and delete associated instructions.
@@ -131,7 +298,146 @@ public:
     bool loadDatabase(const std::string& db_path);
 
     /**
-     * Deletes all data from the current database.
+     * Rebuilds the full-text search index from the recipe tables in a single transaction.
+     * open() only rebuilds the index when it was built by an older version of the library, so this is
+     * the recovery path for an index that has been damaged or has drifted from the tables.
+     * @return true if the index was rebuilt successfully, false otherwise.
+     */
+    bool rebuildSearchIndex();
+
+    /**
+     * Starts rebuilding the search index in the background on a separate connection.
+     * The live index keeps serving searches and writes; recipes written during the rebuild are re-indexed
+     * before the new index is swapped in. Only one background index job can run at a time.
+     * The database must be a file, since the job opens its own connection to it.
+     * @param options Batch size, throttling and progress callback
+     * @return true if the job was started, false otherwise.
+     */
+    bool startSearchIndexRebuild(const IndexJobOptions& options = {});
+
+    /**
+     * Starts verifying the search index in the background on a separate connection.
+     * Runs the FTS5 integrity-check, then compares every index row with the recipe tables.
+     * @param options Batch size, throttling and progress callback
+     * @return true if the job was started, false otherwise.
+     */
+    bool startSearchIndexVerification(const IndexJobOptions& options = {});
+
+    /**
+     * @return Progress of the current or most recent background index job, std::nullopt if none was started.
+     */
+    std::optional<IndexJobProgress> indexJobProgress() const;
+
+    /**
+     * Blocks until the background index job has finished.
+     * @return Its final progress, std::nullopt if no job was started.
+     */
+    std::optional<IndexJobProgress> waitForIndexJob();
+
+    /**
+     * Cancels the background index job, if any, and waits for it to stop.
+     * A cancelled rebuild leaves the live index untouched.
+     */
+    void cancelIndexJob();
+
+    /**
+     * Runs maintenance on this connection: PRAGMA optimize (or a full ANALYZE), incremental vacuum of freelist
+     * pages, FTS5 segment merging and trimming of the recipe text and ingredient change logs, each in short
+     * transactions within the options' time and page budgets. Without it, writes keep the change logs at about
+     * 100000 entries each.
+     * @param options Budgets and which steps to run
+     * @return What was done and the storage statistics before and after, std::nullopt on failure.
+     */
+    std::optional<MaintenanceReport> runMaintenance(const MaintenanceOptions& options = {});
+
+    /**
+     * @param measure_fragmentation Whether to also scan every page for unused bytes
+     * @return Page, freelist and auto-vacuum statistics of the database file, std::nullopt on failure.
+     */
+    std::optional<StorageStats> storageStats(bool measure_fragmentation = false);
+
+    /**
+     * Starts running maintenance periodically in the background on a separate connection, replacing any
+     * running schedule. Runs back off as soon as they would wait for a lock held by this connection.
+     * @param interval Time between runs
+     * @param options Budgets and which steps to run
+     * @return true if the scheduler was started, false otherwise.
+     */
+    bool startMaintenanceScheduler(std::chrono::milliseconds interval, const MaintenanceOptions& options = {});
+
+    /**
+     * Stops the background maintenance schedule, if any, and waits for a run in progress to finish.
+     */
+    void stopMaintenanceScheduler();
+
+    /**
+     * @return The report of the most recent scheduled run, std::nullopt if none has completed.
+     */
+    std::optional<MaintenanceReport> lastScheduledMaintenance() const;
+
+    /**
+     * Switches the database to write-ahead logging and moves checkpointing off the commit path onto a
+     * background thread with its own connection. The journal mode is stored in the file, but the background
+     * checkpointer is not: call this again after every open(), otherwise SQLite's inline autocheckpoint applies.
+     * Calling it while a checkpointer is running replaces its policy.
+     * @param policy Checkpoint modes and triggers
+     * @return true if WAL mode is active and the checkpointer was started, false otherwise.
+     */
+    bool enableWal(const CheckpointPolicy& policy = {});
+
+    /**
+     * @return Counters of the background checkpointer, std::nullopt if enableWal() has not been called since open().
+     */
+    std::optional<CheckpointMetrics> checkpointMetrics() const;
+
+    /**
+     * Exports a compact read-only search bundle for offline clients, which load it with SearchBundle.
+     * @param path Path of the bundle file to write
+     * @return Section sizes of the bundle, std::nullopt on failure.
+     */
+    std::optional<SearchBundleStats> exportSearchBundle(const std::string& path);
+
+    /**
+     * Starts or stops recording this object's recipe, search and lookup calls to a trace for replay with
+     * recipe_replay. Calls made from inside another recorded call are not recorded separately. Several
+     * objects may share one recorder; each gets its own connection number in the trace.
+     * @param recorder The recorder to append to, nullptr to stop recording
+     */
+    void setTraceRecorder(std::shared_ptr<TraceRecorder> recorder);
+
+    /**
+     * Reports where memory goes: SQLite's process-wide heap, this connection's page cache, schema,
+     * statements and lookaside, and the library's name caches. Resets the connection's hit and miss counters.
+     * @return The report, std::nullopt if the database is not open.
+     */
+    std::optional<MemoryReport> memoryReport();
+
+    /**
+     * Bounds this connection's page cache and name caches and sets how it reacts when the process nears
+     * its soft heap limit (see setProcessHeapLimits()). The limits stay in effect across close() and open().
+     * @param limits The bounds
+     * @return true if the limits were applied, false if they are invalid or could not be applied.
+     */
+    bool setMemoryLimits(const ConnectionMemoryLimits& limits);
+
+    /**
+     * Frees what this connection can give back without closing: unused page cache memory, the name caches and the
+     * similarity indexes, which are loaded again on next use.
+     * @return Bytes released, as far as they can be measured.
+     */
+    int64_t releaseMemory();
+
+    /**
+     * Sets up SQLite's process-wide memory: a preallocated page-cache arena shared by all connections, the
+     * lookaside buffer every new connection gets, and the allocator behind both. Call it at startup, before
+     * any Database is opened; SQLite is shut down and reinitialized to apply it.
+     * @param config The configuration; SqliteMemoryConfig() restores SQLite's defaults
+     * @return true if the configuration was applied, false if a connection is still open or SQLite rejected it.
+     */
+    static bool configureSqliteMemory(const SqliteMemoryConfig& config);
+
+    /**
+     * Deletes all data from the current database, including all but the newest entry of each change log.
      * This will not delete the database file itself, only its contents.
      * @return true if the database was emptied successfully, false otherwise.
      */
@@ -145,12 +451,144 @@ public:
     /**
      * Searches for recipes based on the provided search criteria.
      * This includes searching by name, description, preparation time, cooking time, servings, favorite status, source, source URL, author, ingredients, tags, and date ranges.
+     * Results are ordered by criteria.sort_by and truncated to criteria.limit. Every sort key is backed by an index,
+     * so ordering is done by walking that index (or the FTS5 rank for relevance) rather than sorting the result set.
+     * Listings by exact_author, source or is_favorite are instead read from a covering index of that listing and sorted.
      * @param search_data The SearchData struct containing all search criteria
-     * @return A vector of recipe IDs that match the search criteria.
+     * @return A vector of recipe IDs that match the search criteria, in the requested order.
      * If no recipes match the criteria, an empty vector is returned.
      */
     std::vector<long long> search(const SearchData& criteria);
 
+    /**
+     * Same as search(), but returns the summary columns of each match instead of only its ID. Listings by
+     * exact_author, source or is_favorite read these from a covering index without touching the recipes table,
+     * which makes them the cheapest way to show a favorites or author/source list.
+     * @param criteria The SearchData struct containing all search criteria
+     * @return A RecipeSummary for every match, in the requested order.
+     */
+    std::vector<RecipeSummary> searchSummaries(const SearchData& criteria);
+
+    /**
+     * Searches for recipes matching a boolean expression of search criteria.
+     * The expression is compiled into a single SQL statement: NOTs are pushed down to individual predicates,
+     * nested ANDs/ORs are flattened so every predicate can use its index, repeated predicates are merged,
+     * predicates shared by every branch of an OR are factored out, and cheaper, more selective predicates are evaluated first.
+     * @param expression The SearchExpression describing which recipes to match
+     * @param sort_by Key to order the results by
+     * @param sort_direction Direction of the ordering
+     * @param limit Maximum number of results to return. 0 returns every match
+     * @return A vector of recipe IDs that match the expression, in the requested order.
+     */
+    std::vector<long long> searchExpression(const SearchExpression& expression, SortKey sort_by = SortKey::None,
+                                            SortDirection sort_direction = SortDirection::Ascending, size_t limit = 0);
+
+    /**
+     * Finds recipes that use at least query.min_matches of the given ingredients.
+     * Results are ranked by the share of each recipe's required ingredients that were given, ties going to the recipe with
+     * fewer missing optional ingredients. The per-ingredient posting lists are merged with a heap that counts how many lists
+     * each recipe appears in, so cost grows with the size of the lists rather than with the number of recipes.
+     * @param query The CoverageQuery describing the ingredients on hand
+     * @return A vector of CoverageMatch, best match first.
+     */
+    std::vector<CoverageMatch> searchByCoverage(const CoverageQuery& query);
+
+    /**
+     * Plans meals: picks query.meals recipes that satisfy query.filters and need as few ingredients as possible.
+     * The candidates' non-optional ingredients are loaded once as bitsets, and a parallel beam and local search
+     * scores plans by popcount until query.time_budget runs out (see searchMealPlan()).
+     * @param query The MealPlanQuery describing the plan
+     * @return The best plan found, with fewer recipes only if fewer match the filters; std::nullopt on error.
+     */
+    std::optional<MealPlan> planMeals(const MealPlanQuery& query);
+
+    /**
+     * Finds the recipes whose ingredients are most like those of one recipe ("more like this").
+     * Works on in-memory ingredient signatures of every recipe, loaded on first use and reloaded after the
+     * recipes change, and prunes candidates through per-ingredient posting lists (see RecipeSignatures::mostSimilar()).
+     * @param recipe_id The recipe to compare with
+     * @param k Maximum number of results
+     * @param filters Additional criteria the results must satisfy (ordering fields are ignored)
+     * @param measure Plain or rarity-weighted Jaccard similarity of the ingredient sets
+     * @return Up to k recipes sharing at least one ingredient, most similar first; empty if the recipe has no ingredients or on error.
+     */
+    std::vector<SimilarRecipe> similarRecipes(long long recipe_id, size_t k, const SearchData& filters = {},
+                                              SimilarityMeasure measure = SimilarityMeasure::Jaccard);
+
+    /**
+     * Finds the recipes whose description and instructions read most like those of one recipe, by cosine
+     * similarity of TF-IDF vectors. Works on an in-memory inverted index loaded on first use; afterwards only
+     * recipes whose text changed are re-read (see RecipeTextIndex), and WAND upper bounds skip most documents.
+     * @param recipe_id The recipe to compare with
+     * @param k Maximum number of results
+     * @param filters Additional criteria the results must satisfy (ordering fields are ignored)
+     * @return Up to k recipes sharing at least one term, most similar first; empty if the recipe has no text or on error.
+     */
+    std::vector<TextMatch> similarRecipesByText(long long recipe_id, size_t k, const SearchData& filters = {});
+
+    /**
+     * Records that one ingredient is a variant of, or substitute for, another (e.g. "dairy" -> "butter" -> "unsalted butter").
+     * Either ingredient is created if it does not exist yet. The transitive closure used by expanded searches is
+     * extended in the same transaction, so the relation takes effect immediately.
+     * @param parent The name of the more general ingredient
+     * @param child The name of the variant
+     * @return true if the relation was recorded (or already existed), false otherwise.
+     */
+    bool addIngredientRelation(const std::string& parent, const std::string& child);
+
+    /**
+     * Removes a relation added with addIngredientRelation.
+     * Closure entries that depended on the relation are recomputed from the remaining relations.
+     * @param parent The name of the more general ingredient
+     * @param child The name of the variant
+     * @return true if the relation was removed (or did not exist), false otherwise.
+     */
+    bool removeIngredientRelation(const std::string& parent, const std::string& child);
+
+    /**
+     * Attaches a file (typically a photo) to a recipe.
+     * The data is streamed from the input into the database in fixed-size chunks using SQLite incremental blob I/O,
+     * so it is never held in memory as a whole. Attachments are stored apart from the recipe data and are not read by
+     * search() or getRecipeById().
+     * @param recipe_id The ID of the recipe to attach the file to
+     * @param info Metadata of the attachment (mime_type, width, height); IDs and byte_size are ignored
+     * @param data Stream to read the attachment bytes from
+     * @param size Number of bytes to read from data
+     * @param thumbnail Optional small preview image, stored alongside the attachment
+     * @return The attachment_id of the new attachment on success, -1 on failure.
+     */
+    long long addAttachment(long long recipe_id, const AttachmentInfo& info, std::istream& data, int64_t size,
+                            const std::vector<unsigned char>& thumbnail = {});
+
+    /**
+     * Streams the bytes of an attachment to an output stream in fixed-size chunks.
+     * @param attachment_id The ID of the attachment to read
+     * @param out Stream to write the attachment bytes to
+     * @return true if the whole attachment was written, false otherwise.
+     */
+    bool readAttachment(long long attachment_id, std::ostream& out);
+
+    /**
+     * Lists the attachments of a recipe without reading their data or thumbnails.
+     * @param recipe_id The ID of the recipe
+     * @return A vector of AttachmentInfo, oldest first.
+     */
+    std::vector<AttachmentInfo> getAttachments(long long recipe_id);
+
+    /**
+     * Retrieves the thumbnail stored with an attachment.
+     * @param attachment_id The ID of the attachment
+     * @return The thumbnail bytes (empty if none was stored), std::nullopt if the attachment does not exist or an error occurs.
+     */
+    std::optional<std::vector<unsigned char>> getAttachmentThumbnail(long long attachment_id);
+
+    /**
+     * Removes an attachment.
+     * @param attachment_id The ID of the attachment to remove
+     * @return true if the attachment was removed, false otherwise.
+     */
+    bool deleteAttachment(long long attachment_id);
+
     /**
      * Retrieves a recipe by its ID.
      * @param recipe_id The ID of the recipe to retrieve
@@ -164,13 +602,47 @@ private:
     sqlite3* db_;                // Pointer to the SQLite database connection object
     std::string db_path_;        // Path to the SQLite database file
     bool is_db_open_;            // Flag to track if the DB is open
-    static Database* inst; // Singleton instance of the Database class
+    std::unique_ptr<SearchIndexJob> index_job_;  // Current or most recent background index job
+    std::unique_ptr<MaintenanceScheduler> maintenance_scheduler_;  // Background maintenance schedule, if started
+    std::unique_ptr<Checkpointer> checkpointer_;  // Background WAL checkpointer, if enabled
+    std::unique_ptr<NameIdCaches> name_ids_;      // Ingredient and tag ids by name; heap-allocated so the connection's hooks survive moves
+    std::unique_ptr<RecipeSignatures> signatures_;  // Ingredient signatures for similarRecipes(), loaded on first use
+    std::unique_ptr<RecipeTextIndex> text_index_;   // TF-IDF index for similarRecipesByText(), loaded on first use
+    std::shared_ptr<TraceRecorder> trace_;      // Recorder of public calls, if tracing
+    uint32_t trace_connection_ = 0;             // This object's connection number in the trace
+    bool tracing_ = false;                      // A recorded call is in progress, so nested calls are not recorded
+    ConnectionMemoryLimits memory_limits_;      // Bounds applied on every open()
+    uint64_t pressure_releases_ = 0;            // Times relieveMemoryPressure() released the caches
+    int64_t changes_at_log_trim_ = 0;           // sqlite3_total_changes64() after the last trimChangeLogs()
 
     /**
-     * Constructor
-     * Creates a new Database object without opening a connection.
+     * Applies memory_limits_ to the open connection.
+     * @return true if the limits were applied, false otherwise.
+     */
+    bool applyMemoryLimits();
+
+    /**
+     * Releases this connection's unused page cache memory and name caches if SQLite's heap use has reached the
+     * pressure threshold of the process soft heap limit. Called before operations that load pages or names.
+     */
+    void relieveMemoryPressure();
+
+    /**
+     * Runs a public call with tracing suspended and records it.
+     * @param call The call being made
+     * @param arguments The encoded arguments
+     * @param body Makes the call
+     * @return The result of the call.
      */
-    explicit Database();
+    template <typename Call>
+    auto traceCall(TraceCall call, const std::string& arguments, Call&& body) -> decltype(body());
+
+    /**
+     * Deletes all but the newest kChangeLogMaxEntries entries of the recipe text and ingredient change logs.
+     * executeSQL() calls it once this connection has made kChangeLogTrimInterval changes since the last trim, so
+     * the logs stay bounded when runMaintenance() never runs. A failure is only logged; the next trim retries.
+     */
+    void trimChangeLogs();
 
     /**
      * Executes a simple SQL statement
@@ -179,12 +651,60 @@ private:
      */
     bool executeSQL(const char* sql);
 
+    /**
+     * Starts a background index job unless one is already running.
+     * @param mode Whether the job rebuilds or verifies the index
+     * @param options Batch size, throttling and progress callback
+     * @return true if the job was started, false otherwise.
+     */
+    bool startIndexJob(SearchIndexJob::Mode mode, const IndexJobOptions& options);
+
     /**
      * Creates all necessary tables if they do not already exist.
+     * Databases whose stored schema and search index versions are current are left untouched.
      * @return true if all tables were created successfully or already existed, false otherwise.
      */
     bool initialize();
 
+    /**
+     * Inserts a recipe with its ingredients, tags and instructions inside the caller's transaction.
+     * @param recipe The recipe to insert; its name must not be empty
+     * @return The recipe_id of the new recipe, -1 on failure. The caller rolls back on failure.
+     */
+    long long insertRecipe(const RecipeData& recipe);
+
+    /**
+     * @return The schema version stored in the database header (PRAGMA user_version), -1 on failure.
+     */
+    int readSchemaVersion();
+
+    /**
+     * Drops the log and shadow table of a search index rebuild that died, unless this Database runs a job itself.
+     */
+    void dropRebuildLeftovers();
+
+    /**
+     * Reads a value from the metadata table.
+     * @param key The key to read
+     * @return The stored value, or an empty string if it (or the metadata table) does not exist.
+     */
+    std::string readMetadata(const std::string& key);
+
+    /**
+     * Writes a value to the metadata table.
+     * @param key The key to write
+     * @param value The value to store
+     * @return true if the value was written, false otherwise.
+     */
+    bool writeMetadata(const std::string& key, const std::string& value);
+
+    /**
+     * Replaces the contents of the search index with the current recipe data.
+     * Must be called inside a transaction.
+     * @return true if the index was rebuilt successfully, false otherwise.
+     */
+    bool populateSearchIndex();
+
 
     /**
      * Gets the ID of an ingredient by name.
@@ -230,19 +750,57 @@ private:
      */
     bool linkTagToRecipe(long long recipe_id, const std::string& tag);
 
+    /**
+     * Resolves many names of a lookup table to ids at once, creating the missing rows.
+     * Cache misses are inserted with one INSERT ... ON CONFLICT DO NOTHING RETURNING statement,
+     * and the ids of names that already existed are read with one SELECT ... IN (...).
+     * @param table The lookup table (ingredients or tags)
+     * @param id_column The id column of that table
+     * @param cache The name cache of that table
+     * @param names The names to resolve; may contain duplicates
+     * @param ids Receives the id of every name
+     * @return true if every name was resolved, false otherwise.
+     */
+    bool resolveNameIds(const char* table, const char* id_column, NameIdCache& cache,
+                        const std::vector<std::string>& names, std::unordered_map<std::string, long long>& ids);
+
+    /**
+     * Links all ingredients of a recipe, resolving their ids in bulk.
+     * Missing ingredients are created.
+     * @param recipe_id The ID of the recipe
+     * @param ingredients The ingredients to link
+     * @return true if every ingredient was linked successfully, false otherwise.
+     */
+    bool linkIngredientsToRecipe(long long recipe_id, const std::vector<RecipeIngredientInfo>& ingredients);
+
+    /**
+     * Links all tags of a recipe, resolving their ids in bulk.
+     * Missing tags are created.
+     * @param recipe_id The ID of the recipe
+     * @param tags The names of the tags to link
+     * @return true if every tag was linked successfully, false otherwise.
+     */
+    bool linkTagsToRecipe(long long recipe_id, const std::vector<std::string>& tags);
+
     /**
      * Checks if a table exists in the database.
      * @param tableName The name of the table to check
+     * @param schema The schema (main or an attached database) to look in
      * @return true if the table exists, false otherwise.
      */
-    bool tableExists(const std::string& tableName);
+    bool tableExists(const std::string& tableName, const std::string& schema = "main");
 
     /**
      * Builds a search query
-     * @param criteria The SearchData struct to build the search based on
+     * @param expression The SearchExpression to build the search based on
+     * @param sort_by Key to order the results by
+     * @param sort_direction Direction of the ordering
+     * @param limit Maximum number of rows to return, 0 for no limit
+     * @param summaries Select the RecipeSummary columns instead of only the recipe ID
      * @return A pair containing the SQL query and the values to bind to it
      */
-    std::pair<std::string, std::vector<SqlValue>> buildSearchQuery(const SearchData& criteria);
+    std::pair<std::string, std::vector<SqlValue>> buildSearchQuery(const SearchExpression& expression, SortKey sort_by,
+                                                                   SortDirection sort_direction, size_t limit, bool summaries = false);
 
     /**
      * Executes a search
@@ -258,7 +816,7 @@ public:
     sqlite3_stmt* stmt = nullptr;
     SqliteStatement(sqlite3* db, const char* sql) {
         if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-            std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << std::endl;
+            LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Failed to prepare statement: " << sqlite3_errmsg(db);
             stmt = nullptr;
         }
     }
@@ -0,0 +1,59 @@
+#ifndef INGREDIENT_PARSER_H
+#define INGREDIENT_PARSER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <cstddef>
+#include "database.h"
+
+// Notes kept separately per parsed line; further notes are merged into the last one
+constexpr size_t kMaxIngredientNoteParts = 8;
+
+// One free-text ingredient line split into its parts without copying.
+// Every view points into the parsed line, except unit, which names a canonical unit with static storage.
+struct ParsedIngredientLine {
+    std::string_view name;          // Ingredient name, e.g. "all-purpose flour"
+    double quantity = 0;            // Amount, or the lower bound of a range; 0 if the line has none
+    double quantity_max = 0;        // Upper bound of a range such as "2-3", 0 if the amount is not a range
+    bool has_quantity = false;      // The line started with an amount
+    std::string_view unit;          // Canonical unit, e.g. "tbsp" for "Tablespoons"; empty if none
+    std::array<std::string_view, kMaxIngredientNoteParts> note_parts;   // Parenthetical and comma-separated notes
+    size_t note_count = 0;
+    bool optional = false;          // The line carried an "optional" marker
+
+    /**
+     * @return true if the amount is a range.
+     */
+    bool isRange() const { return quantity_max > 0; }
+};
+
+/**
+ * Splits a free-text ingredient line such as "1 1/2 cups all-purpose flour, sifted (optional)".
+ * Understands integers, decimals, fractions ("1/2", "1 1/2"), unicode vulgar fractions ("½", "1¾"), number words
+ * ("a", "two"), ranges ("2-3", "2 to 3"), unit names and their abbreviations, parenthetical notes, comma-separated
+ * notes and "optional" markers. Does not allocate.
+ * @param line One ingredient line, UTF-8
+ * @param parsed Receives the parts; views stay valid as long as line does
+ * @return false if the line holds no ingredient name, e.g. because it is blank.
+ */
+bool parseIngredientLine(std::string_view line, ParsedIngredientLine& parsed);
+
+/**
+ * Parses a line into an existing RecipeIngredientInfo, reusing the capacity of its strings.
+ * Notes are joined with ", "; a range keeps its lower bound as the quantity and adds "up to <max>" to the notes.
+ * @param line One ingredient line, UTF-8
+ * @param ingredient Receives the result; quantity is 0 when the line has no amount, as everywhere else in the library
+ * @return false if the line holds no ingredient name; ingredient is then left unchanged.
+ */
+bool parseIngredientLine(std::string_view line, RecipeIngredientInfo& ingredient);
+
+/**
+ * Parses a block of ingredient lines, one per line. Lines without an ingredient name are skipped.
+ * @param text The lines, separated by '\n' or "\r\n"
+ * @return The parsed ingredients in order.
+ */
+std::vector<RecipeIngredientInfo> parseIngredientLines(std::string_view text);
+
+#endif // INGREDIENT_PARSER_H
@@ -0,0 +1,42 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <optional>
+
+// A parsed JSON document. Objects keep their members in document order.
+struct JsonValue {
+    enum class Type { Null, Bool, Number, String, Array, Object };
+
+    Type type = Type::Null;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<JsonValue> array;
+    std::vector<std::pair<std::string, JsonValue>> object;
+
+    bool isNull() const { return type == Type::Null; }
+    bool isString() const { return type == Type::String; }
+    bool isNumber() const { return type == Type::Number; }
+    bool isArray() const { return type == Type::Array; }
+    bool isObject() const { return type == Type::Object; }
+
+    /**
+     * @param key Name of an object member
+     * @return The first member with that name, nullptr if this is not an object or has no such member.
+     */
+    const JsonValue* find(std::string_view key) const;
+};
+
+/**
+ * Parses a JSON document. Raw control characters inside strings are accepted, since hand-written
+ * embedded JSON often contains them.
+ * @param text The document
+ * @return The parsed value, std::nullopt if the text is not valid JSON or nests deeper than 256 levels.
+ */
+std::optional<JsonValue> parseJson(std::string_view text);
+
+#endif // JSON_H
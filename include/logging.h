@@ -0,0 +1,170 @@
+#ifndef LOGGING_H
+#define LOGGING_H
+
+#include <string>
+#include <sstream>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+// Severity of a log record; records below the configured level are never formatted
+enum class LogLevel {
+    Debug,
+    Info,
+    Warning,
+    Error,
+    Off     // Only meaningful as a level filter: nothing is logged
+};
+
+// One structured log record
+struct LogRecord {
+    LogLevel level = LogLevel::Info;
+    std::chrono::system_clock::time_point time;
+    std::string operation;      // Library function that logged, e.g. "addRecipe"
+    std::optional<long long> recipe_id; // Recipe the record is about, if any; may be any value, including invalid ids
+    int sqlite_code = 0;        // Extended SQLite result code of the failure, 0 if none
+    std::string message;
+};
+
+// Destination of log records. Implementations must accept write() from any thread.
+class LogSink {
+public:
+    virtual ~LogSink() = default;
+
+    /**
+     * @param record The record to write
+     */
+    virtual void write(const LogRecord& record) = 0;
+
+    /**
+     * Blocks until every record written so far has reached its destination.
+     */
+    virtual void flush() {}
+};
+
+// Writes records synchronously to std::cerr as one line each, without flushing per line
+class StderrSink : public LogSink {
+public:
+    void write(const LogRecord& record) override;
+    void flush() override;
+};
+
+// Hands records to a background thread through a bounded lock-free ring buffer, so logging never blocks
+// on I/O. Producers never wait: when the buffer is full the record is dropped and counted.
+class AsyncRingSink : public LogSink {
+public:
+    /**
+     * Starts the consumer thread.
+     * @param inner The sink the consumer thread writes to
+     * @param capacity Number of records the buffer holds; rounded up to a power of two
+     */
+    explicit AsyncRingSink(std::shared_ptr<LogSink> inner, size_t capacity = 4096);
+
+    /**
+     * Destructor
+     * Writes out what is still buffered and stops the consumer thread.
+     */
+    ~AsyncRingSink() override;
+
+    AsyncRingSink(const AsyncRingSink&) = delete;
+    AsyncRingSink& operator=(const AsyncRingSink&) = delete;
+
+    void write(const LogRecord& record) override;
+    void flush() override;
+
+    /**
+     * @return Number of records dropped because the buffer was full.
+     */
+    uint64_t dropped() const { return dropped_; }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> sequence{0};
+        LogRecord record;
+    };
+
+    std::shared_ptr<LogSink> inner_;
+    std::vector<Slot> slots_;
+    uint64_t mask_;
+    alignas(64) std::atomic<uint64_t> enqueue_pos_{0};
+    alignas(64) std::atomic<uint64_t> dequeue_pos_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> signal_{0};       // Bumped after every write and on shutdown to wake the consumer
+    std::atomic<bool> stopping_{false};
+    std::thread consumer_;
+
+    void consume();
+};
+
+/**
+ * Replaces the sink all library logging goes to. The default is an AsyncRingSink in front of a StderrSink.
+ * @param sink The new sink; nullptr discards all records
+ */
+void setLogSink(std::shared_ptr<LogSink> sink);
+
+/**
+ * @return The current sink, possibly nullptr.
+ */
+std::shared_ptr<LogSink> logSink();
+
+/**
+ * Sets the lowest level that is logged. The default is LogLevel::Warning.
+ * @param level The new minimum level
+ */
+void setLogLevel(LogLevel level);
+
+/**
+ * @param level The level to check
+ * @return true if records of this level are currently logged.
+ */
+bool logEnabled(LogLevel level);
+
+/**
+ * Blocks until everything logged so far has been written by the current sink.
+ */
+void flushLog();
+
+/**
+ * @param level A log level
+ * @return Its lower-case name, e.g. "warning".
+ */
+const char* logLevelName(LogLevel level);
+
+// Builds one record with stream syntax and hands it to the sink when it goes out of scope:
+//     LogLine(LogLevel::Error, __func__).recipe(recipe_id).sqlite(rc) << "Failed to delete recipe";
+// Nothing is formatted when the level is disabled.
+class LogLine {
+public:
+    LogLine(LogLevel level, const char* operation);
+    ~LogLine();
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    LogLine& recipe(long long recipe_id) {
+        record_.recipe_id = recipe_id;
+        return *this;
+    }
+
+    LogLine& sqlite(int sqlite_code) {
+        record_.sqlite_code = sqlite_code;
+        return *this;
+    }
+
+    template <typename T>
+    LogLine& operator<<(const T& value) {
+        if (stream_) *stream_ << value;
+        return *this;
+    }
+
+private:
+    bool enabled_;
+    LogRecord record_;
+    std::optional<std::ostringstream> stream_;     // Only constructed when the level is enabled
+};
+
+#endif // LOGGING_H
@@ -0,0 +1,129 @@
+#ifndef MAINTENANCE_H
+#define MAINTENANCE_H
+
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <optional>
+#include <cstdint>
+#include "sqlite3.h"
+
+// Page-level storage statistics of a database file
+struct StorageStats {
+    int64_t page_size = 0;          // Bytes per page
+    int64_t page_count = 0;         // Pages in the file
+    int64_t freelist_count = 0;     // Pages on the freelist, reclaimable by incremental vacuum
+    int auto_vacuum = 0;            // 0 = none, 1 = full, 2 = incremental (PRAGMA auto_vacuum)
+    int64_t unused_bytes = -1;      // Bytes left unused inside in-use pages (fragmentation), -1 if not measured
+
+    /**
+     * @return Fraction of the file occupied by freelist pages, 0 for an empty file.
+     */
+    double freeFraction() const {
+        return page_count > 0 ? static_cast<double>(freelist_count) / static_cast<double>(page_count) : 0.0;
+    }
+};
+
+// What a maintenance run may do and how long it may take
+struct MaintenanceOptions {
+    std::chrono::milliseconds time_budget{200};    // Stop starting new steps once this much time has passed; a step already
+                                                   // started runs to the end (see analysis_limit and search_merge_pages)
+    int analysis_limit = 400;                      // Rows sampled per index by ANALYZE (PRAGMA analysis_limit), 0 for no limit
+    bool full_analyze = false;                     // Run a full ANALYZE instead of PRAGMA optimize
+    int64_t vacuum_step_pages = 64;                // Freelist pages released per incremental_vacuum transaction
+    int64_t max_vacuum_pages = 0;                  // Page budget for incremental vacuum per run, 0 for no limit
+    int search_merge_pages = 64;                   // Leaf pages of FTS5 segment merging per run, 0 to skip
+    int64_t text_changes_kept = 10000;             // Newest recipe_text_changes entries kept when trimming the log, 0 to skip
+    int64_t ingredient_changes_kept = 10000;       // Newest recipe_ingredient_changes entries kept, 0 to skip
+    bool measure_fragmentation = false;            // Scan every page (dbstat) to report unused bytes; O(file size)
+};
+
+// Outcome of a maintenance run
+struct MaintenanceReport {
+    StorageStats before;
+    StorageStats after;
+    bool analyzed = false;              // PRAGMA optimize / ANALYZE completed
+    int64_t pages_reclaimed = 0;        // Freelist pages returned to the file system, measured with PRAGMA freelist_count
+    bool search_merged = false;         // FTS5 segment merge step completed
+    int64_t text_changes_trimmed = 0;   // Old recipe_text_changes entries deleted
+    int64_t ingredient_changes_trimmed = 0; // Old recipe_ingredient_changes entries deleted
+    bool budget_exhausted = false;      // Stopped early because the time or page budget ran out
+    bool skipped_busy = false;          // Stopped early because another connection held a lock
+    std::chrono::milliseconds elapsed{0};
+};
+
+/**
+ * Reads page statistics of the main database.
+ * @param db The connection to read from
+ * @param measure_fragmentation Whether to also scan every page for unused bytes
+ * @return The statistics, std::nullopt on failure.
+ */
+std::optional<StorageStats> readStorageStats(sqlite3* db, bool measure_fragmentation = false);
+
+/**
+ * Runs ANALYZE (through PRAGMA optimize by default), FTS5 segment merging, trimming of the recipe text change
+ * log and incremental vacuum in short transactions, stopping once the time or page budget is spent or another connection holds a lock.
+ * The time budget is checked before each step, so a run can overshoot it by one step: the ANALYZE step is bounded
+ * by analysis_limit, the merge step by search_merge_pages and each vacuum step by vacuum_step_pages.
+ * Incremental vacuum only reclaims pages in databases created with auto_vacuum = INCREMENTAL; the mode of an
+ * existing file only changes with a full VACUUM, which maintenance does not run.
+ * @param db The connection to run on; must not be inside a transaction
+ * @param options Budgets and which steps to run
+ * @return The report, std::nullopt on failure.
+ */
+std::optional<MaintenanceReport> runMaintenance(sqlite3* db, const MaintenanceOptions& options);
+
+// Runs maintenance periodically on its own connection and thread.
+// The connection uses a short busy timeout and gives up on a run as soon as it would wait for foreground writers.
+class MaintenanceScheduler {
+public:
+    /**
+     * Starts the scheduler thread. The first run happens one interval after starting.
+     * @param db_path Path of the database file to open a separate connection to
+     * @param interval Time between runs
+     * @param options Budgets and steps of every run
+     */
+    MaintenanceScheduler(std::string db_path, std::chrono::milliseconds interval, MaintenanceOptions options);
+
+    /**
+     * Destructor
+     * Stops the scheduler and waits for its thread to exit.
+     */
+    ~MaintenanceScheduler();
+
+    MaintenanceScheduler(const MaintenanceScheduler&) = delete;
+    MaintenanceScheduler& operator=(const MaintenanceScheduler&) = delete;
+
+    /**
+     * Stops the scheduler after the current run, if any, and waits for its thread to exit.
+     */
+    void stop();
+
+    /**
+     * @return Number of runs completed so far, including runs cut short by budgets or locks.
+     */
+    int64_t runs() const;
+
+    /**
+     * @return The report of the most recent run, std::nullopt before the first run.
+     */
+    std::optional<MaintenanceReport> lastReport() const;
+
+private:
+    std::string db_path_;
+    std::chrono::milliseconds interval_;
+    MaintenanceOptions options_;
+    mutable std::mutex mutex_;
+    std::condition_variable stop_cv_;
+    bool stopping_ = false;
+    std::atomic<int64_t> runs_{0};
+    std::optional<MaintenanceReport> last_report_;
+    std::thread thread_;
+
+    void run();
+};
+
+#endif // MAINTENANCE_H
@@ -0,0 +1,55 @@
+#ifndef MEAL_PLANNER_H
+#define MEAL_PLANNER_H
+
+#include <utility>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct MealPlanQuery;
+struct MealPlan;
+
+// Candidate recipes of a meal plan with the ingredients each one adds to the shopping list, one bit per ingredient
+struct MealPlanCandidates {
+    std::vector<long long> recipe_ids;          // Candidate recipes, in recipe_id order
+    std::vector<long long> ingredient_ids;      // ingredient_id of each bit
+    size_t words = 0;                           // 64-bit words per bitset
+    std::vector<uint64_t> bits;                 // recipe_ids.size() bitsets of `words` words each
+
+    /**
+     * @param candidate Index into recipe_ids
+     * @return The first word of the candidate's bitset.
+     */
+    const uint64_t* row(size_t candidate) const { return bits.data() + candidate * words; }
+};
+
+/**
+ * Builds the bitsets of the candidates from (recipe_id, ingredient_id) rows.
+ * @param recipe_ids The candidate recipes in ascending order
+ * @param links Non-optional ingredients by recipe; rows of recipes that are not candidates are skipped
+ * @param pantry ingredient_ids on hand; they get no bit
+ * @return The candidates.
+ */
+MealPlanCandidates buildMealPlanCandidates(std::vector<long long> recipe_ids, const std::vector<std::pair<long long, long long>>& links,
+                                           const std::vector<long long>& pantry);
+
+/**
+ * Picks query.meals candidates with the shortest combined shopping list. Every thread first runs a beam
+ * search over partial plans, then improves its plan by local search (replacing one recipe at a time with
+ * the best candidate, perturbing local optima while time remains). Thread 0 breaks ties deterministically;
+ * the others break them at random so the threads explore different plans. The best plan of all threads is returned.
+ * @param candidates The candidate recipes
+ * @param query The plan size, time budget, thread count, beam width and seed
+ * @return The best plan found; it has fewer than query.meals recipes only if there are fewer candidates. Its shopping_list
+ *         is left empty, see mealPlanShoppingIds().
+ */
+MealPlan searchMealPlan(const MealPlanCandidates& candidates, const MealPlanQuery& query);
+
+/**
+ * @param candidates The candidates the plan was chosen from
+ * @param recipe_ids The plan's recipes, all of them candidates
+ * @return The ingredient_ids the plan needs to buy, in ascending order.
+ */
+std::vector<long long> mealPlanShoppingIds(const MealPlanCandidates& candidates, const std::vector<long long>& recipe_ids);
+
+#endif // MEAL_PLANNER_H
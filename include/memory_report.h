@@ -0,0 +1,88 @@
+#ifndef MEMORY_REPORT_H
+#define MEMORY_REPORT_H
+
+#include <optional>
+#include <cstdint>
+#include <cstddef>
+#include "sqlite3.h"
+
+// SQLite heap usage of the whole process (sqlite3_status), shared by every connection including the
+// background connections of index jobs, maintenance and checkpointing
+struct SqliteHeapStats {
+    int64_t memory_used = 0;            // Bytes currently allocated by SQLite
+    int64_t memory_highwater = 0;       // Most bytes ever allocated at once
+    int64_t allocations = 0;            // Outstanding allocations
+    int64_t largest_allocation = 0;     // Largest single allocation request seen
+    int64_t pagecache_overflow = 0;     // Page cache bytes that did not fit a configured page-cache arena
+    int64_t soft_heap_limit = 0;        // Current soft heap limit, 0 if none
+    int64_t hard_heap_limit = 0;        // Current hard heap limit, 0 if none
+};
+
+// Memory used by one connection (sqlite3_db_status)
+struct ConnectionMemoryStats {
+    int64_t page_cache = 0;             // Bytes held by the connection's page cache
+    int64_t page_cache_limit = 0;       // Bytes the page cache may grow to (PRAGMA cache_size)
+    int64_t schema = 0;                 // Bytes used by the parsed schema
+    int64_t statements = 0;             // Bytes used by prepared statements that are still open
+    int64_t lookaside_slots_used = 0;   // Lookaside slots in use
+    int64_t lookaside_hits = 0;         // Allocations served from lookaside since the last reset
+    int64_t lookaside_misses = 0;       // Allocations that were too large or found lookaside full
+    int64_t cache_hits = 0;             // Page cache hits since the last reset
+    int64_t cache_misses = 0;           // Page cache misses since the last reset
+};
+
+// Memory the library itself keeps next to a connection
+struct LibraryMemoryStats {
+    size_t name_cache_entries = 0;      // Cached ingredient and tag names
+    int64_t name_cache_bytes = 0;       // Estimated heap use of those entries
+    uint64_t name_cache_evictions = 0;  // Entries evicted to stay under the name cache bound
+    int64_t signature_bytes = 0;        // Ingredient signatures loaded for similarRecipes()
+    int64_t text_index_bytes = 0;       // TF-IDF index loaded for similarRecipesByText()
+    uint64_t pressure_releases = 0;     // Times the connection released its caches because the process neared its soft limit
+};
+
+// Everything Database::memoryReport() returns
+struct MemoryReport {
+    SqliteHeapStats process;
+    ConnectionMemoryStats connection;
+    LibraryMemoryStats library;
+
+    /**
+     * @return Bytes attributable to this connection: SQLite's per-connection figures plus the library's caches.
+     */
+    int64_t connectionBytes() const {
+        return connection.page_cache + connection.schema + connection.statements + library.name_cache_bytes + library.signature_bytes +
+               library.text_index_bytes;
+    }
+};
+
+// Per-connection memory bounds, applied with Database::setMemoryLimits() and kept across reopening
+struct ConnectionMemoryLimits {
+    int64_t page_cache_bytes = 0;       // Page cache bound (PRAGMA cache_size), 0 for SQLite's default of about 2 MB
+    int64_t name_cache_bytes = 0;       // Bound on the ingredient and tag name caches, 0 for none
+    double pressure_threshold = 0.9;    // Share of the process soft heap limit at which the connection releases its caches
+};
+
+/**
+ * Sets SQLite's process-wide heap limits. Near the soft limit SQLite recycles page cache pages instead of
+ * allocating new ones, and connections with a pressure threshold release their caches; allocations that
+ * would pass the hard limit fail with SQLITE_NOMEM.
+ * @param soft_bytes Soft limit in bytes, 0 to remove it, -1 to leave it unchanged
+ * @param hard_bytes Hard limit in bytes, 0 to remove it, -1 to leave it unchanged
+ * @return false if the limits are inconsistent (a soft limit above the hard limit).
+ */
+bool setProcessHeapLimits(int64_t soft_bytes, int64_t hard_bytes);
+
+/**
+ * @return Process-wide SQLite heap figures.
+ */
+SqliteHeapStats readSqliteHeapStats();
+
+/**
+ * Reads the memory figures of one connection and resets its hit and miss counters.
+ * @param db The connection to read
+ * @return The figures, std::nullopt on failure.
+ */
+std::optional<ConnectionMemoryStats> readConnectionMemoryStats(sqlite3* db);
+
+#endif // MEMORY_REPORT_H
@@ -0,0 +1,145 @@
+#ifndef NAME_ID_CACHE_H
+#define NAME_ID_CACHE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <shared_mutex>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+#include "sqlite3.h"
+
+// Read-optimized, thread-safe map from the name of an ingredient or tag to its id.
+// Entries added inside an open transaction stay tentative until it commits, so a rollback cannot leave
+// ids behind that no longer exist in the table. Rows deleted by other connections are handled by
+// NameIdCaches::syncWithDatabase(), which empties the caches after any commit from elsewhere.
+class NameIdCache {
+public:
+    /**
+     * @param name The name to look up
+     * @return The cached id, std::nullopt if the name is not cached.
+     */
+    std::optional<long long> find(const std::string& name) const;
+
+    /**
+     * Caches an id.
+     * @param name The name of the row
+     * @param id The id of the row
+     * @param in_transaction Whether the row was read or written inside a transaction that may still roll back
+     */
+    void insert(const std::string& name, long long id, bool in_transaction);
+
+    /**
+     * Removes a name, e.g. after its row was deleted.
+     * @param name The name to remove
+     */
+    void erase(const std::string& name);
+
+    /**
+     * Removes every entry, e.g. after the table was emptied or another database was opened.
+     */
+    void clear();
+
+    /**
+     * Makes the entries added during the transaction that committed permanent. Only call once COMMIT has
+     * returned successfully: SQLite's commit hook runs before the commit can still fail, e.g. with SQLITE_BUSY.
+     */
+    void commit();
+
+    /**
+     * Drops the entries added during the transaction that just rolled back.
+     */
+    void rollback();
+
+    /**
+     * @return Number of cached names.
+     */
+    size_t size() const;
+
+    /**
+     * @return Estimated heap memory held by the cached entries, in bytes.
+     */
+    size_t bytes() const;
+
+    /**
+     * Bounds the cache. When an insert takes it past the bound, arbitrary entries are evicted until it is
+     * back under half the bound; evicted names are simply looked up again when next needed.
+     * @param max_bytes The bound on bytes(), 0 for none
+     */
+    void setMaxBytes(size_t max_bytes);
+
+    /**
+     * @return Number of entries evicted to stay under the bound.
+     */
+    uint64_t evictions() const;
+
+private:
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string, long long> ids_;
+    std::vector<std::string> tentative_;    // Names added since the current transaction began
+    size_t bytes_ = 0;
+    size_t max_bytes_ = 0;
+    uint64_t evictions_ = 0;
+
+    void evictLocked();
+};
+
+// The ingredient and tag caches of one connection, with the rollback hook that keeps them in step. Entries added
+// in a transaction are confirmed by confirmCommitted() once the connection is back in autocommit mode; a COMMIT
+// that failed leaves the transaction open until its ROLLBACK, which drops them.
+struct NameIdCaches {
+    NameIdCache ingredients;
+    NameIdCache tags;
+
+    NameIdCaches() = default;
+    ~NameIdCaches();
+    NameIdCaches(const NameIdCaches&) = delete;
+    NameIdCaches& operator=(const NameIdCaches&) = delete;
+
+    /**
+     * Registers the rollback hook on a connection and prepares the statement syncWithDatabase() runs.
+     * @param db The connection whose transactions the caches follow
+     */
+    void attach(sqlite3* db);
+
+    /**
+     * Finalizes the prepared statement; must be called before the connection is closed.
+     */
+    void detach();
+
+    /**
+     * Makes the tentative entries permanent if no transaction is open any more, i.e. the one that added them
+     * committed (a rollback would already have dropped them). Called after every statement that may end a transaction.
+     */
+    void confirmCommitted();
+
+    /**
+     * Confirms committed entries, then empties both caches if another connection has committed since the last
+     * call, since it may have deleted orphaned ingredients or tags whose ids are still cached. Steps a prepared
+     * PRAGMA data_version, which does no I/O, so a cache hit costs no statement compile.
+     */
+    void syncWithDatabase();
+
+    void clear() {
+        ingredients.clear();
+        tags.clear();
+    }
+
+    size_t bytes() const {
+        return ingredients.bytes() + tags.bytes();
+    }
+
+    // Splits a bound on both caches evenly between them
+    void setMaxBytes(size_t max_bytes) {
+        ingredients.setMaxBytes(max_bytes / 2);
+        tags.setMaxBytes(max_bytes / 2);
+    }
+
+private:
+    sqlite3* db_ = nullptr;                         // The attached connection
+    sqlite3_stmt* data_version_stmt_ = nullptr;    // PRAGMA data_version on the attached connection
+    long long data_version_ = -1;   // PRAGMA data_version at the last sync
+};
+
+#endif // NAME_ID_CACHE_H
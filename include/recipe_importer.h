@@ -0,0 +1,73 @@
+#ifndef RECIPE_IMPORTER_H
+#define RECIPE_IMPORTER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <chrono>
+#include <filesystem>
+#include <cstddef>
+#include "database.h"
+#include "json.h"
+
+// How a directory of saved pages is imported
+struct ImportOptions {
+    size_t threads = 0;             // Parser threads, 0 for one per hardware thread
+    size_t batch_size = 200;        // Recipes added per transaction
+    size_t queue_capacity = 2000;   // Parsed recipes waiting to be inserted before parser threads pause
+};
+
+// Outcome of an import
+struct ImportReport {
+    size_t pages = 0;               // HTML files read
+    size_t unreadable_pages = 0;    // Files that could not be read
+    size_t pages_with_recipes = 0;  // Pages holding at least one Recipe
+    size_t invalid_blocks = 0;      // JSON-LD blocks that were not valid JSON
+    size_t recipes_found = 0;       // Recipes extracted from the pages
+    size_t recipes_added = 0;       // Recipes written to the database
+    std::chrono::milliseconds elapsed{0};
+
+    /**
+     * @return Pages read per second of wall-clock time.
+     */
+    double pagesPerSecond() const {
+        return elapsed.count() > 0 ? pages * 1000.0 / static_cast<double>(elapsed.count()) : 0.0;
+    }
+};
+
+/**
+ * Converts an ISO-8601 duration such as "PT1H30M" or "P1DT2H" to minutes; seconds are rounded up.
+ * @param duration The duration
+ * @return The duration in minutes, std::nullopt if it is not an ISO-8601 duration.
+ */
+std::optional<int> parseIsoDuration(std::string_view duration);
+
+/**
+ * Maps a schema.org Recipe object onto RecipeData. Ingredient lines go through parseIngredientLine;
+ * keywords, recipeCategory and recipeCuisine become lower-case tags.
+ * @param recipe A JSON-LD object whose @type is Recipe
+ * @return The recipe, std::nullopt if it has no name.
+ */
+std::optional<RecipeData> mapJsonLdRecipe(const JsonValue& recipe);
+
+/**
+ * Extracts every schema.org Recipe from the <script type="application/ld+json"> blocks of an HTML page,
+ * including recipes nested in @graph arrays and mainEntity.
+ * @param html The page
+ * @param invalid_blocks If not nullptr, incremented for every block that is not valid JSON
+ * @return The recipes in page order.
+ */
+std::vector<RecipeData> extractJsonLdRecipes(std::string_view html, size_t* invalid_blocks = nullptr);
+
+/**
+ * Imports the recipes of every .html and .htm file below a directory. Pages are read and parsed on a pool of
+ * threads; the calling thread adds the recipes with Database::addRecipes in batches.
+ * @param db The open database to add to; only used from the calling thread
+ * @param directory The directory to walk recursively
+ * @param options Thread count and batching
+ * @return What was imported, std::nullopt if the database is not open or the directory cannot be read.
+ */
+std::optional<ImportReport> importRecipePages(Database& db, const std::filesystem::path& directory, const ImportOptions& options = {});
+
+#endif // RECIPE_IMPORTER_H
@@ -0,0 +1,94 @@
+#ifndef RECIPE_SIGNATURES_H
+#define RECIPE_SIGNATURES_H
+
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include "sqlite3.h"
+
+// How similarRecipes() compares two ingredient sets
+enum class SimilarityMeasure {
+    Jaccard,            // Shared ingredients divided by the ingredients of either recipe
+    WeightedJaccard     // The same with every ingredient weighted by its rarity (inverse document frequency),
+                        // so sharing saffron counts for more than sharing salt
+};
+
+// A recipe found by Database::similarRecipes()
+struct SimilarRecipe {
+    long long recipe_id;        // ID of the similar recipe
+    double similarity;          // Between 0 and 1, 1 for identical ingredient sets
+    size_t shared_ingredients;  // Number of ingredients both recipes use
+};
+
+// In-memory ingredient signature of every recipe, for similarity search without touching SQLite.
+// Each recipe's ingredients are stored as a sorted list of dense ingredient numbers, and every ingredient
+// has a posting list of the recipes that use it. Triggers append the recipes whose ingredient links changed to
+// the recipe_ingredient_changes log; refresh() re-reads only those recipes and merges them into the signatures,
+// so writes that leave the links alone (favorites, ratings, text edits) cost it nothing. The log is trimmed like
+// the recipe_text_changes log (see RecipeTextIndex), with ingredient_changes_kept as the maintenance option.
+class RecipeSignatures {
+public:
+    /**
+     * Loads the signatures on first use and afterwards applies the recipes whose ingredients changed since.
+     * @param db The connection to load from
+     * @return false if loading failed; the signatures are then empty.
+     */
+    bool refresh(sqlite3* db);
+
+    /**
+     * Builds the signatures from (recipe_id, ingredient_id) pairs.
+     * @param links Every ingredient link, ordered by recipe_id
+     */
+    void assign(const std::vector<std::pair<long long, long long>>& links);
+
+    /**
+     * Drops the signatures; the next refresh() loads them again.
+     */
+    void clear();
+
+    /**
+     * @return Number of recipes with a signature (those with at least one ingredient).
+     */
+    size_t recipeCount() const;
+
+    /**
+     * @return Heap memory held by the signatures, in bytes.
+     */
+    size_t bytes() const;
+
+    /**
+     * Finds the k recipes most similar to one recipe. Posting lists are walked rarest ingredient first; once k
+     * results are held, the walk stops as soon as the ingredients left could not give an unseen recipe a higher
+     * similarity than the k-th best (prefix filtering), and candidates whose size and first shared ingredient alone
+     * rule them out are skipped without comparing their ingredients.
+     * @param recipe_id The recipe to compare with
+     * @param k Number of results
+     * @param measure How to compare ingredient sets
+     * @param allowed If not null, the recipes that may be returned, in ascending order
+     * @return Up to k recipes sharing at least one ingredient, most similar first, ties going to the lower recipe_id.
+     */
+    std::vector<SimilarRecipe> mostSimilar(long long recipe_id, size_t k, SimilarityMeasure measure,
+                                           const std::vector<long long>* allowed) const;
+
+private:
+    std::vector<long long> recipe_ids_;         // Recipes in ascending order; a recipe's index is its row
+    std::vector<uint32_t> ingredient_offsets_;  // Start of each row's ingredients, plus one final end offset
+    std::vector<uint32_t> ingredients_;         // Dense ingredient numbers of every row, sorted within the row
+    std::vector<double> row_weights_;           // Sum of the ingredient weights of each row, added up like shared weights
+    std::vector<uint32_t> posting_offsets_;     // Start of each ingredient's posting list, plus one final end offset
+    std::vector<uint32_t> postings_;            // Rows using each ingredient, in ascending order
+    std::vector<float> weights_;                // Weight of each ingredient: log(1 + recipes / recipes using it)
+    std::vector<long long> ingredient_ids_;     // ingredient_id of each dense ingredient number
+
+    bool load(sqlite3* db);
+    bool applyChanges(sqlite3* db);
+
+    bool loaded_ = false;
+    bool uncommitted_ = false;                  // Changes were read inside an open transaction, which may still roll back
+    long long last_change_seq_ = 0;             // recipe_ingredient_changes entries up to this one are applied
+    long long data_version_ = -1;               // PRAGMA data_version when last refreshed
+    int64_t total_changes_ = -1;                // sqlite3_total_changes64() when last refreshed
+};
+
+#endif // RECIPE_SIGNATURES_H
@@ -0,0 +1,146 @@
+#ifndef RECIPE_TEXT_INDEX_H
+#define RECIPE_TEXT_INDEX_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+#include "sqlite3.h"
+
+// A recipe found by Database::similarRecipesByText()
+struct TextMatch {
+    long long recipe_id;        // ID of the similar recipe
+    double similarity;          // Cosine similarity of the TF-IDF vectors, between 0 and 1
+    size_t shared_terms;        // Number of distinct terms both texts use
+};
+
+/**
+ * Splits recipe text into index terms: lowercase runs of letters and digits, without numbers, one-letter words
+ * and common English stop words, and with a plural "s" dropped ("braises" and "braise" are the same term).
+ * @param text Description or instruction text
+ * @return The terms in text order, repeated as often as they occur.
+ */
+std::vector<std::string> recipeTextTerms(std::string_view text);
+
+// In-memory TF-IDF vectors of the description and instructions of every recipe, with an inverted index for
+// top-k cosine similarity. A document's weight for a term is (1 + ln tf) * idf, scaled to unit length, with
+// idf = ln(1 + documents / documents using the term).
+//
+// The index is kept up to date one recipe at a time: triggers append the recipes whose text changed to the
+// recipe_text_changes log, and refresh() re-reads only the recipes logged after the last entry it applied, so
+// writes that leave the text alone cost it nothing. The log is trimmed by runMaintenance() (text_changes_kept),
+// by emptyDatabase() and, as a bound when maintenance never runs, by writes once it is 100000 entries long; an
+// index that had not applied trimmed entries reloads. A changed recipe is appended as a new document and its old
+// one is only marked dead, so the posting lists stay in document order. IDF values are fixed when a term first
+// appears and recomputed when the index is compacted, which happens once a quarter of the documents changed.
+class RecipeTextIndex {
+public:
+    /**
+     * Loads the index on first use and afterwards applies the recipes changed since the last refresh.
+     * @param db The connection to read from
+     * @return false if reading failed; the index is then empty.
+     */
+    bool refresh(sqlite3* db);
+
+    /**
+     * Indexes a recipe's text, replacing any earlier version. Text without terms leaves the recipe unindexed.
+     * @param recipe_id The recipe
+     * @param text Its description and instructions
+     */
+    void addDocument(long long recipe_id, std::string_view text);
+
+    /**
+     * Drops a recipe from the index.
+     * @param recipe_id The recipe
+     */
+    void removeDocument(long long recipe_id);
+
+    /**
+     * Rebuilds the posting lists from the live documents only, with IDF values recomputed from them.
+     */
+    void compact();
+
+    /**
+     * Drops the index; the next refresh() loads it again.
+     */
+    void clear();
+
+    /**
+     * @return Number of indexed recipes.
+     */
+    size_t documentCount() const;
+
+    /**
+     * @return Heap memory held by the index, in bytes (estimated for the hash tables).
+     */
+    size_t bytes() const;
+
+    /**
+     * Scores two recipes directly from their term lists, without the inverted index.
+     * @return Cosine similarity of the two recipes' vectors, 0 if either is not indexed.
+     */
+    double similarity(long long first_recipe_id, long long second_recipe_id) const;
+
+    /**
+     * Finds the k recipes whose vectors have the highest cosine similarity with one recipe's. Uses block-max
+     * WAND: the posting lists of the query's terms are walked together in document order, and a document is only
+     * considered once the upper bounds of the lists that reached it (query weight times the largest weight in the
+     * list) add up to at least the k-th best score; lists behind that pivot skip ahead to it with a binary search.
+     * It is then only scored if the largest weights of the blocks holding it still reach that score; otherwise
+     * the lists skip to the end of those blocks.
+     * @param recipe_id The recipe to compare with
+     * @param k Number of results
+     * @param allowed If not null, the recipes that may be returned, in ascending order
+     * @return Up to k recipes sharing at least one term, most similar first, ties going to the lower recipe_id.
+     */
+    std::vector<TextMatch> mostSimilar(long long recipe_id, size_t k, const std::vector<long long>* allowed) const;
+
+private:
+    struct Document {
+        long long recipe_id;
+        uint32_t offset;        // First entry in term_counts_
+        uint32_t length;        // Number of distinct terms
+        float norm;             // Length of the unscaled weight vector
+        bool live;              // false once the recipe was changed or deleted
+    };
+
+    struct TermCount {
+        uint32_t term;
+        uint32_t count;
+    };
+
+    struct Posting {
+        uint32_t document;
+        float weight;           // The document's scaled weight for the term
+    };
+
+    const Document* find(long long recipe_id) const;
+    bool appendDocument(long long recipe_id, std::string_view text);   // Document and term counts only; false if the text has no terms
+    float termWeight(const TermCount& term_count) const;
+    void addPosting(uint32_t term, uint32_t document, float weight);
+    bool load(sqlite3* db);
+    bool applyChanges(sqlite3* db);
+
+    std::unordered_map<std::string, uint32_t> term_ids_;
+    std::vector<float> idf_;                        // By term
+    std::vector<float> max_weights_;                // Largest posting weight of each term, the WAND upper bound
+    std::vector<std::vector<Posting>> postings_;    // By term, in document order
+    std::vector<std::vector<float>> block_max_weights_;  // By term, the largest weight of each block of kPostingBlock postings
+    std::vector<Document> documents_;               // Sorted by recipe_id up to sorted_documents_, then in order of change
+    std::vector<TermCount> term_counts_;            // Each document's terms, sorted by term
+    size_t sorted_documents_ = 0;
+    std::unordered_map<long long, uint32_t> appended_;  // Live documents after the sorted ones, by recipe_id
+    size_t live_documents_ = 0;
+    size_t changes_since_compaction_ = 0;
+    std::string term_buffer_;                       // Reused for dictionary lookups
+
+    bool loaded_ = false;
+    bool uncommitted_ = false;                      // Changes were read inside an open transaction, which may still roll back
+    long long last_change_seq_ = 0;                 // recipe_text_changes entries up to this one are applied
+    long long data_version_ = -1;                   // PRAGMA data_version when last refreshed
+    int64_t total_changes_ = -1;                    // sqlite3_total_changes64() when last refreshed
+};
+
+#endif // RECIPE_TEXT_INDEX_H
@@ -0,0 +1,124 @@
+#ifndef SEARCH_BUNDLE_H
+#define SEARCH_BUNDLE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <cstdint>
+#include <cstddef>
+#include "sqlite3.h"
+
+struct SearchData;
+
+// Version of the bundle file format; readers reject other versions
+constexpr uint32_t kSearchBundleVersion = 1;
+
+// Sizes of the sections of an exported bundle, in bytes
+struct SearchBundleStats {
+    size_t recipes = 0;             // Recipes in the bundle
+    size_t terms = 0;               // Distinct full-text terms
+    size_t total_bytes = 0;         // Size of the bundle file
+    size_t id_bytes = 0;            // Delta-encoded recipe ids
+    size_t column_bytes = 0;        // Packed numeric columns
+    size_t summary_bytes = 0;       // Recipe summaries
+    size_t term_bytes = 0;          // Term dictionary and postings
+    size_t tag_bytes = 0;           // Tag dictionary and postings
+    size_t ingredient_bytes = 0;    // Ingredient dictionary and postings, including ingredient families
+};
+
+// What a bundle keeps about each recipe
+struct RecipeSummary {
+    long long recipe_id = -1;
+    std::string name;
+    std::string author;
+    std::string source;
+    std::string source_url;
+    uint16_t prep_time_minutes = 0;
+    uint16_t cook_time_minutes = 0;
+    uint16_t servings = 0;
+    bool is_favorite = false;
+    int64_t date_added = 0;     // Seconds since the Unix epoch, UTC
+};
+
+/**
+ * Writes a read-only search bundle of every recipe: a term dictionary with delta-encoded posting lists,
+ * posting lists per tag, ingredient and ingredient family, packed numeric columns and recipe summaries.
+ * Reads the tables inside one transaction, so the bundle is a consistent snapshot.
+ * @param db The connection to export from
+ * @param path Path of the bundle file; written to a temporary file first and renamed into place
+ * @return Section sizes of the written bundle, std::nullopt on failure.
+ */
+std::optional<SearchBundleStats> writeSearchBundle(sqlite3* db, const std::string& path);
+
+// Reader of a bundle written by writeSearchBundle, for clients that filter recipes without SQLite.
+// Keeps the file in memory and decodes posting lists on demand.
+class SearchBundle {
+public:
+    SearchBundle() = default;
+    SearchBundle(SearchBundle&&) = default;
+    SearchBundle& operator=(SearchBundle&&) = default;
+    SearchBundle(const SearchBundle&) = delete;
+    SearchBundle& operator=(const SearchBundle&) = delete;
+
+    /**
+     * Reads and validates a bundle file, replacing anything loaded before.
+     * @param path Path of the bundle
+     * @return true if the bundle was loaded, false if it cannot be read or is not a valid bundle.
+     */
+    bool load(const std::string& path);
+
+    /**
+     * @return Number of recipes in the loaded bundle.
+     */
+    size_t recipeCount() const { return recipe_ids_.size(); }
+
+    /**
+     * Evaluates the filters of a SearchData against the bundle, matching Database::search with these differences:
+     * keywords, name and author match whole words (a trailing '*' matches a prefix) with plural folding instead of
+     * FTS5 query syntax and Porter stemming, and SortKey::Relevance orders by recipe_id since there is no rank.
+     * @param criteria The filters, ordering and limit
+     * @return Matching recipe ids.
+     */
+    std::vector<long long> search(const SearchData& criteria) const;
+
+    /**
+     * @param recipe_id A recipe id
+     * @return The recipe's summary, std::nullopt if it is not in the bundle.
+     */
+    std::optional<RecipeSummary> summary(long long recipe_id) const;
+
+private:
+    // Sorted keys with the position of each key's posting list in a shared buffer
+    struct Dictionary {
+        std::vector<std::string_view> keys;
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> counts;
+        std::string_view postings;
+        bool with_fields = false;       // Every posting carries a byte of field flags
+
+        bool parse(std::string_view section, bool fields, uint32_t doc_count);   // false unless every list is in bounds and ascending below doc_count
+        std::vector<uint32_t> postingsOf(size_t entry, uint8_t field_mask = 0xFF) const;
+        std::vector<uint32_t> postingsOf(std::string_view key) const;
+    };
+
+    std::vector<char> data_;
+    std::vector<long long> recipe_ids_;
+    std::string_view prep_column_;
+    std::string_view cook_column_;
+    std::string_view servings_column_;
+    std::string_view date_column_;
+    std::string_view favorite_bits_;
+    std::string_view summary_offsets_;
+    std::string_view summaries_;
+    Dictionary terms_;
+    Dictionary tags_;
+    Dictionary ingredients_;
+    Dictionary families_;
+
+    RecipeSummary summaryAt(uint32_t doc) const;
+    std::string_view summaryField(uint32_t doc, size_t field) const;
+    std::optional<std::vector<uint32_t>> termMatches(std::string_view text, uint8_t field_mask) const;
+};
+
+#endif // SEARCH_BUNDLE_H
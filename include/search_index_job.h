@@ -0,0 +1,135 @@
+#ifndef SEARCH_INDEX_JOB_H
+#define SEARCH_INDEX_JOB_H
+
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include "sqlite3.h"
+
+// Progress of a background search index job
+struct IndexJobProgress {
+    enum class Phase {
+        Starting,           // Opening the connection and preparing the shadow table
+        IntegrityCheck,     // Running the FTS5 integrity-check (verification only)
+        Building,           // Copying recipes into the shadow index in batches
+        CatchingUp,         // Re-indexing recipes written while the shadow index was being built
+        Swapping,           // Replacing the live index with the shadow index
+        Verifying,          // Comparing index rows with the recipe tables in batches (verification only)
+        Done,               // Finished successfully
+        Failed,             // Stopped because of an error
+        Cancelled           // Stopped by cancelIndexJob()
+    };
+
+    Phase phase = Phase::Starting;
+    long long processed = 0;    // Recipes processed so far in the current phase
+    long long total = 0;        // Recipes to process in the current phase
+    long long mismatches = 0;   // Verification: index rows missing, stale or without a recipe
+    bool integrity_ok = true;   // Verification: result of the FTS5 integrity-check
+};
+
+// Tuning for background search index jobs
+struct IndexJobOptions {
+    size_t batch_size = 500;                    // Recipes per transaction, bounding how long other writers wait
+    std::chrono::milliseconds pause{0};         // Sleep between batches to throttle the job's I/O
+    std::function<void(const IndexJobProgress&)> on_progress;  // Called from the job thread after every batch
+};
+
+// SQL shared by Database::initialize() and SearchIndexJob, so the live and shadow indexes are always built the same way
+
+/**
+ * @param table_name Name of the FTS5 table to create
+ * @return CREATE VIRTUAL TABLE statement for a search index table
+ */
+std::string searchTableSql(const std::string& table_name);
+
+// Triggers keeping the "search" table in step with recipes, recipe_ingredients and recipe_tags
+extern const char* const kSearchTriggersSql;
+
+// Drops every trigger created by kSearchTriggersSql
+extern const char* const kDropSearchTriggersSql;
+
+// SELECT producing (recipe_id, name, description, author, ingredients, tags) rows for "recipes AS r"; append a WHERE clause
+extern const char* const kSearchRowsSql;
+
+/**
+ * Drops the write log, its triggers and the shadow table left behind by a rebuild that crashed or was killed, which
+ * would otherwise keep taxing every write. A rebuild still running in another process or connection writes a heartbeat
+ * with every batch and is left alone; if its leftovers are dropped anyway it fails without touching the live index.
+ * @param db The connection to use
+ * @return false if the leftovers could not be dropped.
+ */
+bool dropAbandonedRebuild(sqlite3* db);
+
+// Runs a search index rebuild or verification on its own connection and thread.
+// A rebuild fills a shadow FTS table in bounded transactions while the live index keeps serving searches,
+// re-indexes recipes written in the meantime (recorded by triggers that live only as long as the rebuild), then swaps
+// the tables in one transaction.
+class SearchIndexJob {
+public:
+    enum class Mode {
+        Rebuild,    // Build a new index and swap it in
+        Verify      // Run the FTS5 integrity-check and compare every index row with the recipe tables
+    };
+
+    /**
+     * Starts the job on a new thread.
+     * @param db_path Path of the database file to open a separate connection to
+     * @param mode Whether to rebuild or verify the index
+     * @param options Batch size, throttling and progress callback
+     */
+    SearchIndexJob(std::string db_path, Mode mode, IndexJobOptions options);
+
+    /**
+     * Destructor
+     * Cancels the job if it is still running and waits for its thread to exit.
+     */
+    ~SearchIndexJob();
+
+    SearchIndexJob(const SearchIndexJob&) = delete;
+    SearchIndexJob& operator=(const SearchIndexJob&) = delete;
+
+    /**
+     * Asks the job to stop after the current batch. A cancelled rebuild leaves the live index untouched.
+     */
+    void cancel();
+
+    /**
+     * Blocks until the job has finished.
+     * @return The final progress, with phase Done, Failed or Cancelled.
+     */
+    IndexJobProgress wait();
+
+    /**
+     * @return A snapshot of the job's current progress.
+     */
+    IndexJobProgress progress() const;
+
+    /**
+     * @return true once the job has finished, successfully or not.
+     */
+    bool finished() const;
+
+private:
+    std::string db_path_;
+    Mode mode_;
+    IndexJobOptions options_;
+    std::atomic<bool> cancelled_{false};
+    mutable std::mutex mutex_;
+    std::condition_variable finished_cv_;
+    IndexJobProgress progress_;
+    bool finished_ = false;
+    std::thread thread_;
+
+    void run();
+    bool rebuild(sqlite3* db);
+    bool verify(sqlite3* db);
+    bool reindexLogged(sqlite3* db, size_t max_recipes, long long& reindexed);
+    void report(IndexJobProgress::Phase phase, long long processed, long long total);
+    void throttle();
+};
+
+#endif // SEARCH_INDEX_JOB_H
@@ -0,0 +1,50 @@
+#ifndef SQLITE_MEMORY_H
+#define SQLITE_MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Where SQLite gets its heap memory from
+enum class SqliteAllocator {
+    System,     // malloc and free; once Pooled was used, with its block header so that its blocks stay valid
+    Pooled      // Per-thread free lists of small size classes in front of malloc, so threads do not contend on the
+                // global allocator for SQLite's many small, short-lived allocations
+};
+
+// Process-wide SQLite memory setup, applied with Database::configureSqliteMemory() while no connection is open
+struct SqliteMemoryConfig {
+    SqliteAllocator allocator = SqliteAllocator::System;
+    size_t page_cache_slots = 0;        // Pages preallocated in one arena shared by all connections (SQLITE_CONFIG_PAGECACHE), 0 for none
+    size_t page_size = 4096;            // Page size the arena's slots are sized for; larger pages fall back to the heap
+    size_t lookaside_slot_size = 1200;  // Bytes per slot of each connection's lookaside buffer (SQLite's default)
+    size_t lookaside_slots = 100;       // Slots per connection, 0 to disable lookaside (SQLite's default is 100)
+    bool memory_statistics = true;      // Keep sqlite3_status counters. Without them heap limits and the process figures of
+                                        // memoryReport() do not work, but allocations skip a global mutex
+};
+
+// Counters of the pooled allocator, summed over all threads
+struct PooledAllocatorStats {
+    uint64_t pool_hits = 0;             // Allocations served from a thread's free list
+    uint64_t pool_misses = 0;           // Small allocations that went to malloc because the free list was empty
+    uint64_t large_allocations = 0;     // Allocations above the largest size class, always served by malloc
+};
+
+/**
+ * Shuts SQLite down, applies a configuration and initializes it again. Only safe while no connection exists
+ * anywhere in the process; Database::configureSqliteMemory() checks that for the library's own connections.
+ * @param config The configuration
+ * @return true if SQLite accepted every setting, false otherwise (SQLite is then left with its defaults).
+ */
+bool applySqliteMemoryConfig(const SqliteMemoryConfig& config);
+
+/**
+ * @return The configuration currently applied.
+ */
+SqliteMemoryConfig currentSqliteMemoryConfig();
+
+/**
+ * @return Counters of the pooled allocator since it was last installed; all zero if it is not in use.
+ */
+PooledAllocatorStats pooledAllocatorStats();
+
+#endif // SQLITE_MEMORY_H
@@ -0,0 +1,725 @@
+#include "call_trace.h"
+#include "database.h"
+#include "logging.h"
+#include <cstring>
+#include <iterator>
+#include <string_view>
+
+
+// Marks the start of a trace file
+constexpr char kTraceMagic[8] = {'R', 'C', 'P', 'T', 'R', 'A', 'C', 'E'};
+
+// Buffered events are written out once they take this many bytes
+constexpr size_t kTraceFlushBytes = 64 * 1024;
+
+// Deepest SearchExpression a trace may contain, so a corrupt trace cannot exhaust the stack
+constexpr size_t kMaxTraceExpressionDepth = 256;
+
+
+// Appends values in the trace encoding: unsigned varints, zigzag varints for signed values,
+// length-prefixed strings and doubles as their 8-byte bit pattern
+struct TraceEncoder {
+    std::string out;
+
+    void varint(uint64_t value) {
+        while (value >= 0x80) {
+            out += static_cast<char>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        out += static_cast<char>(value);
+    }
+
+    void signedVarint(int64_t value) {
+        varint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+    }
+
+    void fixed64(uint64_t value) {
+        for (int i = 0; i < 8; ++i) out += static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+
+    void real(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        fixed64(bits);
+    }
+
+    void text(const std::string& value) {
+        varint(value.size());
+        out += value;
+    }
+
+    void texts(const std::vector<std::string>& values) {
+        varint(values.size());
+        for (const std::string& value : values) text(value);
+    }
+
+    void numbers(const std::vector<uint16_t>& values) {
+        varint(values.size());
+        for (uint16_t value : values) varint(value);
+    }
+};
+
+
+// Reads values written by TraceEncoder. Reading past the end clears ok and yields zeros.
+struct TraceDecoder {
+    std::string_view data;
+    size_t pos = 0;
+    bool ok = true;
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64 && pos < data.size(); shift += 7) {
+            uint8_t byte = static_cast<uint8_t>(data[pos++]);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) return value;
+        }
+        ok = false;
+        return 0;
+    }
+
+    int64_t signedVarint() {
+        uint64_t value = varint();
+        return static_cast<int64_t>((value >> 1) ^ (~(value & 1) + 1));
+    }
+
+    uint64_t fixed64() {
+        if (data.size() - pos < 8) {
+            ok = false;
+            return 0;
+        }
+        uint64_t value = 0;
+        for (int i = 0; i < 8; ++i) value |= static_cast<uint64_t>(static_cast<uint8_t>(data[pos++])) << (8 * i);
+        return value;
+    }
+
+    double real() {
+        uint64_t bits = fixed64();
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    std::string text() {
+        uint64_t size = varint();
+        if (!ok || size > data.size() - pos) {
+            ok = false;
+            return {};
+        }
+        std::string value(data.substr(pos, size));
+        pos += size;
+        return value;
+    }
+
+    // Element counts are bounded by the remaining bytes, since every element takes at least one
+    size_t count() {
+        uint64_t size = varint();
+        if (size > data.size() - pos) {
+            ok = false;
+            return 0;
+        }
+        return static_cast<size_t>(size);
+    }
+
+    std::vector<std::string> texts() {
+        std::vector<std::string> values(count());
+        for (std::string& value : values) value = text();
+        return values;
+    }
+
+    std::vector<uint16_t> numbers() {
+        std::vector<uint16_t> values(count());
+        for (uint16_t& value : values) value = static_cast<uint16_t>(varint());
+        return values;
+    }
+
+    bool finished() const { return ok && pos == data.size(); }
+};
+
+
+// 64-bit FNV-1a over a sequence of values; strings are length-prefixed so adjacent fields cannot run together
+struct TraceHasher {
+    uint64_t hash = 14695981039346656037ULL;
+
+    void bytes(const void* data, size_t size) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= p[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    void value(uint64_t v) { bytes(&v, sizeof(v)); }
+
+    void real(double v) {
+        uint64_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        value(bits);
+    }
+
+    void text(const std::string& s) {
+        value(s.size());
+        bytes(s.data(), s.size());
+    }
+};
+
+
+const char* traceCallName(TraceCall call) {
+    switch (call) {
+        case TraceCall::AddRecipe: return "addRecipe";
+        case TraceCall::AddRecipes: return "addRecipes";
+        case TraceCall::DeleteRecipe: return "deleteRecipe";
+        case TraceCall::MergeDatabase: return "mergeDatabase";
+        case TraceCall::EmptyDatabase: return "emptyDatabase";
+        case TraceCall::Search: return "search";
+        case TraceCall::SearchExpression: return "searchExpression";
+        case TraceCall::SearchByCoverage: return "searchByCoverage";
+        case TraceCall::GetRecipeById: return "getRecipeById";
+        case TraceCall::AddIngredientRelation: return "addIngredientRelation";
+        case TraceCall::RemoveIngredientRelation: return "removeIngredientRelation";
+        case TraceCall::GetAttachments: return "getAttachments";
+        case TraceCall::DeleteAttachment: return "deleteAttachment";
+        case TraceCall::SearchSummaries: return "searchSummaries";
+        case TraceCall::SimilarRecipes: return "similarRecipes";
+        case TraceCall::SimilarRecipesByText: return "similarRecipesByText";
+    }
+    return "unknown";
+}
+
+
+std::shared_ptr<TraceRecorder> TraceRecorder::create(const std::string& path) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        LogLine(LogLevel::Error, __func__) << "Cannot create trace file " << path;
+        return nullptr;
+    }
+    TraceEncoder header;
+    header.out.append(kTraceMagic, sizeof(kTraceMagic));
+    header.varint(kCallTraceVersion);
+    out.write(header.out.data(), static_cast<std::streamsize>(header.out.size()));
+    return std::shared_ptr<TraceRecorder>(new TraceRecorder(std::move(out)));
+}
+
+
+TraceRecorder::TraceRecorder(std::ofstream out) : out_(std::move(out)), start_(std::chrono::steady_clock::now())
+{
+}
+
+
+TraceRecorder::~TraceRecorder() {
+    flush();
+}
+
+
+uint32_t TraceRecorder::attach() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return next_connection_++;
+}
+
+
+void TraceRecorder::record(TraceCall call, uint32_t connection, std::chrono::steady_clock::time_point start,
+                           std::chrono::steady_clock::time_point end, const std::string& arguments, uint64_t result_hash) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    TraceEncoder event;
+    event.out += static_cast<char>(call);
+    event.varint(connection);
+    event.varint(start > start_ ? static_cast<uint64_t>(duration_cast<microseconds>(start - start_).count()) : 0);
+    event.varint(static_cast<uint64_t>(duration_cast<microseconds>(end - start).count()));
+    event.fixed64(result_hash);
+    event.text(arguments);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer_ += event.out;
+    ++events_;
+    if (buffer_.size() >= kTraceFlushBytes) {
+        out_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        buffer_.clear();
+    }
+}
+
+
+bool TraceRecorder::flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    out_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    buffer_.clear();
+    out_.flush();
+    if (!out_) {
+        LogLine(LogLevel::Error, __func__) << "Failed to write the trace file";
+        return false;
+    }
+    return true;
+}
+
+
+uint64_t TraceRecorder::eventCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return events_;
+}
+
+
+std::optional<std::vector<TraceEvent>> readTrace(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        LogLine(LogLevel::Error, __func__) << "Cannot open trace file " << path;
+        return std::nullopt;
+    }
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    if (contents.size() < sizeof(kTraceMagic) || contents.compare(0, sizeof(kTraceMagic), kTraceMagic, sizeof(kTraceMagic)) != 0) {
+        LogLine(LogLevel::Error, __func__) << path << " is not a trace file";
+        return std::nullopt;
+    }
+    TraceDecoder decoder{contents, sizeof(kTraceMagic)};
+    if (decoder.varint() != kCallTraceVersion) {
+        LogLine(LogLevel::Error, __func__) << path << " has an unsupported trace version";
+        return std::nullopt;
+    }
+
+    std::vector<TraceEvent> events;
+    while (decoder.ok && decoder.pos < contents.size()) {
+        TraceEvent event;
+        uint8_t call = static_cast<uint8_t>(contents[decoder.pos++]);
+        if (call == 0 || call >= kTraceCallCount) {
+            decoder.ok = false;
+            break;
+        }
+        event.call = static_cast<TraceCall>(call);
+        event.connection = static_cast<uint32_t>(decoder.varint());
+        event.start_us = decoder.varint();
+        event.duration_us = decoder.varint();
+        event.result_hash = decoder.fixed64();
+        event.arguments = decoder.text();
+        if (decoder.ok) events.push_back(std::move(event));
+    }
+    if (!decoder.ok) {
+        LogLine(LogLevel::Error, __func__) << path << " is truncated or corrupt after " << events.size() << " events";
+        return std::nullopt;
+    }
+    return events;
+}
+
+
+void encodeRecipe(TraceEncoder& encoder, const RecipeData& recipe) {
+    encoder.text(recipe.name);
+    encoder.text(recipe.description);
+    encoder.varint(recipe.prep_time_minutes);
+    encoder.varint(recipe.cook_time_minutes);
+    encoder.varint(recipe.servings);
+    encoder.varint(recipe.is_favorite);
+    encoder.text(recipe.source);
+    encoder.text(recipe.source_url);
+    encoder.text(recipe.author);
+    encoder.varint(recipe.ingredients.size());
+    for (const RecipeIngredientInfo& ingredient : recipe.ingredients) {
+        encoder.text(ingredient.name);
+        encoder.real(ingredient.quantity);
+        encoder.text(ingredient.unit);
+        encoder.text(ingredient.notes);
+        encoder.varint(ingredient.optional);
+    }
+    encoder.texts(recipe.tags);
+    encoder.texts(recipe.instructions);
+}
+
+
+RecipeData decodeRecipe(TraceDecoder& decoder) {
+    RecipeData recipe;
+    recipe.name = decoder.text();
+    recipe.description = decoder.text();
+    recipe.prep_time_minutes = static_cast<uint16_t>(decoder.varint());
+    recipe.cook_time_minutes = static_cast<uint16_t>(decoder.varint());
+    recipe.servings = static_cast<uint16_t>(decoder.varint());
+    recipe.is_favorite = decoder.varint() != 0;
+    recipe.source = decoder.text();
+    recipe.source_url = decoder.text();
+    recipe.author = decoder.text();
+    recipe.ingredients.resize(decoder.count());
+    for (RecipeIngredientInfo& ingredient : recipe.ingredients) {
+        ingredient.name = decoder.text();
+        ingredient.quantity = decoder.real();
+        ingredient.unit = decoder.text();
+        ingredient.notes = decoder.text();
+        ingredient.optional = decoder.varint() != 0;
+    }
+    recipe.tags = decoder.texts();
+    recipe.instructions = decoder.texts();
+    return recipe;
+}
+
+
+void encodeSearch(TraceEncoder& encoder, const SearchData& criteria) {
+    encoder.text(criteria.exact_name);
+    encoder.numbers(criteria.prep_time_range);
+    encoder.numbers(criteria.cook_time_range);
+    encoder.numbers(criteria.servings_range);
+    encoder.varint(criteria.is_favorite);
+    encoder.text(criteria.source);
+    encoder.text(criteria.source_url);
+    encoder.text(criteria.exact_author);
+    encoder.texts(criteria.dates);
+    encoder.text(criteria.name);
+    encoder.text(criteria.keywords);
+    encoder.text(criteria.author);
+    encoder.texts(criteria.ingredients);
+    encoder.texts(criteria.tags);
+    encoder.texts(criteria.exclude_tags);
+    encoder.texts(criteria.exclude_ingredients);
+    encoder.varint(criteria.expand_ingredients);
+    encoder.varint(criteria.expand_exclude_ingredients);
+    encoder.varint(static_cast<uint64_t>(criteria.sort_by));
+    encoder.varint(static_cast<uint64_t>(criteria.sort_direction));
+    encoder.varint(criteria.limit);
+}
+
+
+SearchData decodeSearch(TraceDecoder& decoder) {
+    SearchData criteria;
+    criteria.exact_name = decoder.text();
+    criteria.prep_time_range = decoder.numbers();
+    criteria.cook_time_range = decoder.numbers();
+    criteria.servings_range = decoder.numbers();
+    criteria.is_favorite = decoder.varint() != 0;
+    criteria.source = decoder.text();
+    criteria.source_url = decoder.text();
+    criteria.exact_author = decoder.text();
+    criteria.dates = decoder.texts();
+    criteria.name = decoder.text();
+    criteria.keywords = decoder.text();
+    criteria.author = decoder.text();
+    criteria.ingredients = decoder.texts();
+    criteria.tags = decoder.texts();
+    criteria.exclude_tags = decoder.texts();
+    criteria.exclude_ingredients = decoder.texts();
+    criteria.expand_ingredients = decoder.varint() != 0;
+    criteria.expand_exclude_ingredients = decoder.varint() != 0;
+    criteria.sort_by = static_cast<SortKey>(decoder.varint());
+    criteria.sort_direction = static_cast<SortDirection>(decoder.varint());
+    criteria.limit = static_cast<size_t>(decoder.varint());
+    return criteria;
+}
+
+
+void encodeExpression(TraceEncoder& encoder, const SearchExpression& expression) {
+    encoder.varint(static_cast<uint64_t>(expression.type));
+    if (expression.type == SearchExpression::Type::Leaf) {
+        encodeSearch(encoder, expression.criteria);
+        return;
+    }
+    encoder.varint(expression.children.size());
+    for (const SearchExpression& child : expression.children) encodeExpression(encoder, child);
+}
+
+
+SearchExpression decodeExpression(TraceDecoder& decoder, size_t depth = 0) {
+    SearchExpression expression;
+    if (depth > kMaxTraceExpressionDepth) {
+        decoder.ok = false;
+        return expression;
+    }
+    expression.type = static_cast<SearchExpression::Type>(decoder.varint());
+    if (expression.type == SearchExpression::Type::Leaf) {
+        expression.criteria = decodeSearch(decoder);
+        return expression;
+    }
+    size_t children = decoder.count();
+    for (size_t i = 0; i < children && decoder.ok; ++i) expression.children.push_back(decodeExpression(decoder, depth + 1));
+    return expression;
+}
+
+
+std::string encodeTraceArguments(long long id) {
+    TraceEncoder encoder;
+    encoder.signedVarint(id);
+    return encoder.out;
+}
+
+
+std::string encodeTraceArguments(const std::string& text) {
+    TraceEncoder encoder;
+    encoder.text(text);
+    return encoder.out;
+}
+
+
+std::string encodeTraceArguments(const std::string& first, const std::string& second) {
+    TraceEncoder encoder;
+    encoder.text(first);
+    encoder.text(second);
+    return encoder.out;
+}
+
+
+std::string encodeTraceArguments(const RecipeData& recipe) {
+    TraceEncoder encoder;
+    encodeRecipe(encoder, recipe);
+    return encoder.out;
+}
+
+
+std::string encodeTraceArguments(const std::vector<RecipeData>& recipes) {
+    TraceEncoder encoder;
+    encoder.varint(recipes.size());
+    for (const RecipeData& recipe : recipes) encodeRecipe(encoder, recipe);
+    return encoder.out;
+}
+
+
+std::string encodeTraceArguments(const SearchData& criteria) {
+    TraceEncoder encoder;
+    encodeSearch(encoder, criteria);
+    return encoder.out;
+}
+
+
+std::string encodeTraceArguments(const SearchExpression& expression, SortKey sort_by, SortDirection sort_direction, size_t limit) {
+    TraceEncoder encoder;
+    encodeExpression(encoder, expression);
+    encoder.varint(static_cast<uint64_t>(sort_by));
+    encoder.varint(static_cast<uint64_t>(sort_direction));
+    encoder.varint(limit);
+    return encoder.out;
+}
+
+
+std::string encodeTraceArguments(const CoverageQuery& query) {
+    TraceEncoder encoder;
+    encoder.texts(query.ingredients);
+    encoder.varint(query.min_matches);
+    encoder.varint(query.limit);
+    encodeSearch(encoder, query.filters);
+    return encoder.out;
+}
+
+
+std::string encodeTraceArguments(long long id, size_t k, const SearchData& filters, SimilarityMeasure measure) {
+    TraceEncoder encoder;
+    encoder.signedVarint(id);
+    encoder.varint(k);
+    encodeSearch(encoder, filters);
+    encoder.varint(static_cast<uint64_t>(measure));
+    return encoder.out;
+}
+
+
+std::string encodeTraceArguments(long long id, size_t k, const SearchData& filters) {
+    TraceEncoder encoder;
+    encoder.signedVarint(id);
+    encoder.varint(k);
+    encodeSearch(encoder, filters);
+    return encoder.out;
+}
+
+
+uint64_t hashTraceResult(bool result) {
+    TraceHasher hasher;
+    hasher.value(result);
+    return hasher.hash;
+}
+
+
+uint64_t hashTraceResult(long long result) {
+    TraceHasher hasher;
+    hasher.value(static_cast<uint64_t>(result));
+    return hasher.hash;
+}
+
+
+uint64_t hashTraceResult(const std::vector<long long>& result) {
+    TraceHasher hasher;
+    hasher.value(result.size());
+    for (long long id : result) hasher.value(static_cast<uint64_t>(id));
+    return hasher.hash;
+}
+
+
+uint64_t hashTraceResult(const std::optional<RecipeData>& result) {
+    TraceHasher hasher;
+    hasher.value(result.has_value());
+    if (!result) return hasher.hash;
+    hasher.text(result->name);
+    hasher.text(result->description);
+    hasher.value(result->prep_time_minutes);
+    hasher.value(result->cook_time_minutes);
+    hasher.value(result->servings);
+    hasher.value(result->is_favorite);
+    hasher.text(result->source);
+    hasher.text(result->source_url);
+    hasher.text(result->author);
+    hasher.value(result->ingredients.size());
+    for (const RecipeIngredientInfo& ingredient : result->ingredients) {
+        hasher.text(ingredient.name);
+        hasher.real(ingredient.quantity);
+        hasher.text(ingredient.unit);
+        hasher.text(ingredient.notes);
+        hasher.value(ingredient.optional);
+    }
+    hasher.value(result->tags.size());
+    for (const std::string& tag : result->tags) hasher.text(tag);
+    hasher.value(result->instructions.size());
+    for (const std::string& step : result->instructions) hasher.text(step);
+    return hasher.hash;
+}
+
+
+uint64_t hashTraceResult(const std::vector<CoverageMatch>& result) {
+    TraceHasher hasher;
+    hasher.value(result.size());
+    for (const CoverageMatch& match : result) {
+        hasher.value(static_cast<uint64_t>(match.recipe_id));
+        hasher.value(match.matched);
+        hasher.value(match.required);
+        hasher.value(match.matched_required);
+        hasher.value(match.missing_optional);
+        hasher.real(match.score);
+    }
+    return hasher.hash;
+}
+
+
+uint64_t hashTraceResult(const std::vector<RecipeSummary>& result) {
+    TraceHasher hasher;
+    hasher.value(result.size());
+    for (const RecipeSummary& summary : result) {
+        hasher.value(static_cast<uint64_t>(summary.recipe_id));
+        hasher.text(summary.name);
+        hasher.text(summary.author);
+        hasher.text(summary.source);
+        hasher.text(summary.source_url);
+        hasher.value(summary.prep_time_minutes);
+        hasher.value(summary.cook_time_minutes);
+        hasher.value(summary.servings);
+        hasher.value(summary.is_favorite);
+        hasher.value(static_cast<uint64_t>(summary.date_added));
+    }
+    return hasher.hash;
+}
+
+
+uint64_t hashTraceResult(const std::vector<SimilarRecipe>& result) {
+    TraceHasher hasher;
+    hasher.value(result.size());
+    for (const SimilarRecipe& match : result) {
+        hasher.value(static_cast<uint64_t>(match.recipe_id));
+        hasher.real(match.similarity);
+        hasher.value(match.shared_ingredients);
+    }
+    return hasher.hash;
+}
+
+
+uint64_t hashTraceResult(const std::vector<TextMatch>& result) {
+    TraceHasher hasher;
+    hasher.value(result.size());
+    for (const TextMatch& match : result) {
+        hasher.value(static_cast<uint64_t>(match.recipe_id));
+        hasher.real(match.similarity);
+        hasher.value(match.shared_terms);
+    }
+    return hasher.hash;
+}
+
+
+uint64_t hashTraceResult(const std::vector<AttachmentInfo>& result) {
+    TraceHasher hasher;
+    hasher.value(result.size());
+    for (const AttachmentInfo& info : result) {
+        hasher.value(static_cast<uint64_t>(info.attachment_id));
+        hasher.value(static_cast<uint64_t>(info.recipe_id));
+        hasher.text(info.mime_type);
+        hasher.value(info.width);
+        hasher.value(info.height);
+        hasher.value(static_cast<uint64_t>(info.byte_size));
+    }
+    return hasher.hash;
+}
+
+
+std::optional<uint64_t> replayTraceEvent(Database& db, const TraceEvent& event) {
+    TraceDecoder decoder{event.arguments};
+    // Decode everything before calling, so a corrupt event never reaches the database
+    auto run = [&](auto&& call) -> std::optional<uint64_t> {
+        if (!decoder.finished()) return std::nullopt;
+        return hashTraceResult(call());
+    };
+
+    switch (event.call) {
+        case TraceCall::AddRecipe: {
+            RecipeData recipe = decodeRecipe(decoder);
+            return run([&] { return db.addRecipe(recipe); });
+        }
+        case TraceCall::AddRecipes: {
+            std::vector<RecipeData> recipes(decoder.count());
+            for (RecipeData& recipe : recipes) recipe = decodeRecipe(decoder);
+            return run([&] { return db.addRecipes(recipes); });
+        }
+        case TraceCall::DeleteRecipe: {
+            long long id = decoder.signedVarint();
+            return run([&] { return db.deleteRecipe(id); });
+        }
+        case TraceCall::MergeDatabase: {
+            std::string path = decoder.text();
+            return run([&] { return db.mergeDatabase(path); });
+        }
+        case TraceCall::EmptyDatabase:
+            return run([&] { return db.emptyDatabase(); });
+        case TraceCall::Search: {
+            SearchData criteria = decodeSearch(decoder);
+            return run([&] { return db.search(criteria); });
+        }
+        case TraceCall::SearchExpression: {
+            SearchExpression expression = decodeExpression(decoder);
+            SortKey sort_by = static_cast<SortKey>(decoder.varint());
+            SortDirection sort_direction = static_cast<SortDirection>(decoder.varint());
+            size_t limit = static_cast<size_t>(decoder.varint());
+            return run([&] { return db.searchExpression(expression, sort_by, sort_direction, limit); });
+        }
+        case TraceCall::SearchByCoverage: {
+            CoverageQuery query;
+            query.ingredients = decoder.texts();
+            query.min_matches = static_cast<size_t>(decoder.varint());
+            query.limit = static_cast<size_t>(decoder.varint());
+            query.filters = decodeSearch(decoder);
+            return run([&] { return db.searchByCoverage(query); });
+        }
+        case TraceCall::GetRecipeById: {
+            long long id = decoder.signedVarint();
+            return run([&] { return db.getRecipeById(id); });
+        }
+        case TraceCall::AddIngredientRelation: {
+            std::string parent = decoder.text();
+            std::string child = decoder.text();
+            return run([&] { return db.addIngredientRelation(parent, child); });
+        }
+        case TraceCall::RemoveIngredientRelation: {
+            std::string parent = decoder.text();
+            std::string child = decoder.text();
+            return run([&] { return db.removeIngredientRelation(parent, child); });
+        }
+        case TraceCall::GetAttachments: {
+            long long id = decoder.signedVarint();
+            return run([&] { return db.getAttachments(id); });
+        }
+        case TraceCall::DeleteAttachment: {
+            long long id = decoder.signedVarint();
+            return run([&] { return db.deleteAttachment(id); });
+        }
+        case TraceCall::SearchSummaries: {
+            SearchData criteria = decodeSearch(decoder);
+            return run([&] { return db.searchSummaries(criteria); });
+        }
+        case TraceCall::SimilarRecipes: {
+            long long id = decoder.signedVarint();
+            size_t k = static_cast<size_t>(decoder.varint());
+            SearchData filters = decodeSearch(decoder);
+            SimilarityMeasure measure = static_cast<SimilarityMeasure>(decoder.varint());
+            return run([&] { return db.similarRecipes(id, k, filters, measure); });
+        }
+        case TraceCall::SimilarRecipesByText: {
+            long long id = decoder.signedVarint();
+            size_t k = static_cast<size_t>(decoder.varint());
+            SearchData filters = decodeSearch(decoder);
+            return run([&] { return db.similarRecipesByText(id, k, filters); });
+        }
+    }
+    return std::nullopt;
+}
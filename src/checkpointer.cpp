@@ -0,0 +1,206 @@
+#include "checkpointer.h"
+#include "logging.h"
+#include <algorithm>
+
+
+// Matches SQLITE_DEFAULT_WAL_AUTOCHECKPOINT; restored on the owning connection when the checkpointer stops
+constexpr int kDefaultAutocheckpointPages = 1000;
+
+
+int64_t steadyNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+int sqliteCheckpointMode(CheckpointMode mode) {
+    switch (mode) {
+        case CheckpointMode::Passive:  return SQLITE_CHECKPOINT_PASSIVE;
+        case CheckpointMode::Full:     return SQLITE_CHECKPOINT_FULL;
+        case CheckpointMode::Truncate: return SQLITE_CHECKPOINT_TRUNCATE;
+    }
+    return SQLITE_CHECKPOINT_PASSIVE;
+}
+
+
+Checkpointer::Checkpointer(sqlite3* db, std::string db_path, CheckpointPolicy policy)
+    : owner_(db), db_path_(std::move(db_path)), policy_(std::move(policy))
+{
+    last_commit_ns_ = steadyNowNs();
+    // Replaces the connection's autocheckpoint hook, so COMMIT never runs a checkpoint inline
+    sqlite3_wal_hook(owner_, &Checkpointer::onCommit, this);
+    thread_ = std::thread(&Checkpointer::run, this);
+}
+
+
+Checkpointer::~Checkpointer() {
+    sqlite3_wal_autocheckpoint(owner_, kDefaultAutocheckpointPages);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+}
+
+
+CheckpointMetrics Checkpointer::metrics() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CheckpointMetrics snapshot = metrics_;
+    snapshot.wal_frames = wal_frames_;
+    return snapshot;
+}
+
+
+int Checkpointer::onCommit(void* checkpointer, sqlite3*, const char*, int wal_frames) {
+    // Runs on the committing thread, so it only records the WAL size and wakes the checkpointer if needed
+    Checkpointer* self = static_cast<Checkpointer*>(checkpointer);
+    self->wal_frames_ = wal_frames;
+    self->last_commit_ns_ = steadyNowNs();
+    if (self->policy_.wal_size_pages > 0 && wal_frames >= self->policy_.wal_size_pages) {
+        self->wake_cv_.notify_one();
+    }
+    return SQLITE_OK;
+}
+
+
+void Checkpointer::run() {
+    sqlite3* db = nullptr;
+    if (sqlite3_open_v2(db_path_.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Checkpointer cannot open database: " << sqlite3_errmsg(db);
+        sqlite3_close(db);
+        return;
+    }
+    sqlite3_busy_timeout(db, policy_.busy_timeout_ms);
+    // This connection never writes, but make sure it never checkpoints from anywhere but checkpoint()
+    sqlite3_wal_autocheckpoint(db, 0);
+    // A connection only notices WAL mode once it has read the database; until then checkpoints are no-ops
+    if (sqlite3_exec(db, "PRAGMA schema_version;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Checkpointer cannot read database: " << sqlite3_errmsg(db);
+    }
+
+    // State of the current WAL file as of the last checkpoint: its size and how many frames were already copied
+    int64_t last_log = 0;
+    int64_t last_copied = 0;
+
+    // Readers on old snapshots keep frames from being copied, and retrying every poll changes nothing until they move
+    // on. So after a checkpoint that left frames behind, retries of the same WAL wait twice as long each time.
+    int64_t blocked_attempts = 0;           // Checkpoints in a row that left frames behind
+    int64_t blocked_frames = -1;            // WAL size when the last of them ran
+    std::chrono::milliseconds backoff{0};
+    auto retry_at = std::chrono::steady_clock::time_point::min();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_cv_.wait_for(lock, policy_.poll_interval, [this, &last_log, &last_copied, &blocked_frames] {
+            return stopping_ || (policy_.wal_size_pages > 0 && wal_frames_ != blocked_frames
+                                 && wal_frames_ - (wal_frames_ < last_log ? 0 : last_copied) >= policy_.wal_size_pages);
+        });
+        if (stopping_) break;
+
+        int64_t wal_frames = wal_frames_;
+        metrics_.max_wal_frames = std::max(metrics_.max_wal_frames, wal_frames);
+        lock.unlock();
+        const auto now = std::chrono::steady_clock::now();
+        if (wal_frames == blocked_frames && now < retry_at) {
+            lock.lock();
+            continue;
+        }
+
+        // Frames not yet copied; a smaller WAL than last time means a writer has restarted it from the beginning
+        int64_t pending = wal_frames - (wal_frames < last_log ? 0 : last_copied);
+        bool idle = policy_.idle_after.count() > 0
+            && steadyNowNs() - last_commit_ns_ >= std::chrono::duration_cast<std::chrono::nanoseconds>(policy_.idle_after).count();
+        bool large = policy_.wal_size_pages > 0 && pending >= policy_.wal_size_pages;
+        // The WAL is only restarted when a writer finds it fully copied with no reader inside it; readers on old
+        // snapshots or back-to-back commits can prevent that indefinitely, so past the limit force a reset
+        bool escalate = policy_.escalate_pages > 0 && wal_frames >= policy_.escalate_pages;
+        // A Truncate checkpoint waits up to busy_timeout_ms for readers to reach the latest snapshot
+        bool readers_blocking = policy_.reader_blocked_attempts > 0 && blocked_attempts >= policy_.reader_blocked_attempts;
+
+        bool ran = true;
+        bool complete = true;
+        if (escalate) {
+            complete = checkpoint(db, CheckpointMode::Truncate, last_log, last_copied);
+        } else if (pending > 0 && readers_blocking) {
+            complete = checkpoint(db, CheckpointMode::Truncate, last_log, last_copied);
+            blocked_attempts = 0;
+            std::lock_guard<std::mutex> metrics_lock(mutex_);
+            ++metrics_.reader_escalations;
+        } else if (pending > 0 && (large || idle)) {
+            complete = checkpoint(db, policy_.mode, last_log, last_copied);
+        } else {
+            ran = false;
+        }
+
+        if (ran && complete) {
+            blocked_attempts = 0;
+            blocked_frames = -1;
+            backoff = std::chrono::milliseconds(0);
+        } else if (ran) {
+            ++blocked_attempts;
+            blocked_frames = wal_frames;
+            backoff = std::min(std::max(backoff * 2, policy_.poll_interval), std::max(policy_.reader_backoff_max, policy_.poll_interval));
+            retry_at = now + backoff;
+        }
+
+        lock.lock();
+    }
+    lock.unlock();
+
+    sqlite3_close(db);
+}
+
+
+bool Checkpointer::checkpoint(sqlite3* db, CheckpointMode mode, int64_t& last_log, int64_t& last_copied) {
+    const auto started = std::chrono::steady_clock::now();
+    int64_t copied = 0;
+
+    // Checkpointed frames are cumulative per WAL file; count only what this call added
+    auto record = [&](int log, int checkpointed) {
+        int64_t base = (log < last_log) ? 0 : last_copied;
+        if (checkpointed > base) copied += checkpointed - base;
+        last_log = log;
+        last_copied = checkpointed;
+    };
+
+    int log = 0;
+    int checkpointed = 0;
+    int rc = SQLITE_OK;
+    if (mode == CheckpointMode::Truncate) {
+        // A truncating checkpoint reports an empty WAL, so copy with a passive one first to count the frames
+        rc = sqlite3_wal_checkpoint_v2(db, "main", SQLITE_CHECKPOINT_PASSIVE, &log, &checkpointed);
+        if (rc == SQLITE_OK) record(log, checkpointed);
+        int64_t remaining = last_log - last_copied;
+
+        rc = sqlite3_wal_checkpoint_v2(db, "main", SQLITE_CHECKPOINT_TRUNCATE, &log, &checkpointed);
+        if (rc == SQLITE_OK) {
+            copied += remaining;
+            last_log = 0;
+            last_copied = 0;
+            wal_frames_ = 0;
+        }
+    } else {
+        rc = sqlite3_wal_checkpoint_v2(db, "main", sqliteCheckpointMode(mode), &log, &checkpointed);
+        if (rc == SQLITE_OK) record(log, checkpointed);
+    }
+
+    const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+    if (rc != SQLITE_OK && rc != SQLITE_BUSY) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Checkpoint failed: " << sqlite3_errmsg(db);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++metrics_.checkpoints;
+    switch (mode) {
+        case CheckpointMode::Passive:  ++metrics_.passive; break;
+        case CheckpointMode::Full:     ++metrics_.full; break;
+        case CheckpointMode::Truncate: ++metrics_.truncate; break;
+    }
+    if (rc == SQLITE_BUSY) ++metrics_.busy;
+    if (rc == SQLITE_OK && last_copied < last_log) ++metrics_.incomplete;
+    metrics_.frames_copied += copied;
+    metrics_.last_duration = duration;
+    metrics_.max_duration = std::max(metrics_.max_duration, duration);
+    metrics_.total_duration += duration;
+    return rc == SQLITE_OK && last_copied >= last_log;
+}
@@ -1,4 +1,6 @@
 #include "database.h"
+#include "logging.h"
+#include "meal_planner.h"
 #include <iostream>
 #include <vector>
 #include <sstream>
@@ -6,22 +8,210 @@
 #include <iterator>
 #include <ranges>
 #include <numeric>
+#include <queue>
+#include <array>
+#include <unordered_map>
+#include <string_view>
+#include <charconv>
+#include <atomic>
 
 
-Database* Database::inst = nullptr;
+// Version of the table/index/trigger layout created by initialize(). Bump it whenever the schema script changes,
+// so existing databases run the (idempotent) schema script once more on their next open. CREATE ... IF NOT EXISTS
+// keeps an old definition, so the script drops a changed trigger or index before creating it again.
+constexpr int kSchemaVersion = 4;
 
 
-std::vector<RecipeIngredientInfo> parseAllIngredients(const std::string& all_ingredients_str);
+// Version of the search index contents. Bump it whenever the tokenizer or the indexed text changes,
+// so existing databases rebuild the index once on their next open.
+constexpr int kSearchIndexVersion = 1;
 
 
-std::vector<std::string> splitString(const std::string& str, char delimiter);
+// How long a statement waits for a lock held by another connection, such as a background index job
+constexpr int kBusyTimeoutMs = 5000;
 
 
-RecipeIngredientInfo getIngredientInfo(const std::string& ingredient_str);
+std::vector<RecipeIngredientInfo> parseAllIngredients(std::string_view all_ingredients_str);
 
 
-Database::Database() : db_(nullptr), is_db_open_(false)
+std::vector<std::string> splitString(std::string_view str, char delimiter);
+
+
+RecipeIngredientInfo getIngredientInfo(std::string_view ingredient_str);
+
+
+std::string placeholderList(size_t count);
+
+
+// Recipes with more ingredient or tag links than this resolve all their names with one bulk upsert
+constexpr size_t kBulkResolveThreshold = 4;
+
+
+// Names per bulk upsert statement, well below SQLite's limit on bound parameters
+constexpr size_t kBulkResolveChunk = 500;
+
+
+// Changes a connection makes between trims of the change logs, and the entries a trim keeps of each log. Maintenance
+// keeps fewer; this only bounds the logs of libraries where it never runs.
+constexpr int64_t kChangeLogTrimInterval = 1000;
+constexpr int64_t kChangeLogMaxEntries = 100000;
+
+
+// Connections opened by Database objects in this process; SQLite's memory setup can only change while there are none
+std::atomic<int> g_open_database_connections{0};
+
+
+Database::Database() : db_(nullptr), is_db_open_(false), name_ids_(std::make_unique<NameIdCaches>()),
+                       signatures_(std::make_unique<RecipeSignatures>()), text_index_(std::make_unique<RecipeTextIndex>())
+{
+}
+
+
+Database::Database(Database&& other) noexcept
+    : db_(other.db_),
+      db_path_(std::move(other.db_path_)),
+      is_db_open_(other.is_db_open_),
+      index_job_(std::move(other.index_job_)),
+      maintenance_scheduler_(std::move(other.maintenance_scheduler_)),
+      checkpointer_(std::move(other.checkpointer_)),
+      name_ids_(std::move(other.name_ids_)),
+      signatures_(std::move(other.signatures_)),
+      text_index_(std::move(other.text_index_)),
+      trace_(std::move(other.trace_)),
+      trace_connection_(other.trace_connection_),
+      memory_limits_(other.memory_limits_),
+      pressure_releases_(other.pressure_releases_)
 {
+    other.db_ = nullptr;
+    other.is_db_open_ = false;
+}
+
+
+Database& Database::operator=(Database&& other) noexcept {
+    if (this != &other) {
+        close();
+        db_ = other.db_;
+        db_path_ = std::move(other.db_path_);
+        is_db_open_ = other.is_db_open_;
+        index_job_ = std::move(other.index_job_);
+        maintenance_scheduler_ = std::move(other.maintenance_scheduler_);
+        checkpointer_ = std::move(other.checkpointer_);
+        name_ids_ = std::move(other.name_ids_);
+        signatures_ = std::move(other.signatures_);
+        text_index_ = std::move(other.text_index_);
+        trace_ = std::move(other.trace_);
+        trace_connection_ = other.trace_connection_;
+        memory_limits_ = other.memory_limits_;
+        pressure_releases_ = other.pressure_releases_;
+        other.db_ = nullptr;
+        other.is_db_open_ = false;
+    }
+    return *this;
+}
+
+
+std::optional<MemoryReport> Database::memoryReport() {
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot report memory.";
+        return std::nullopt;
+    }
+
+    std::optional<ConnectionMemoryStats> connection = readConnectionMemoryStats(db_);
+    if (!connection) return std::nullopt;
+
+    MemoryReport report;
+    report.process = readSqliteHeapStats();
+    report.connection = *connection;
+    report.library.name_cache_entries = name_ids_->ingredients.size() + name_ids_->tags.size();
+    report.library.name_cache_bytes = static_cast<int64_t>(name_ids_->bytes());
+    report.library.name_cache_evictions = name_ids_->ingredients.evictions() + name_ids_->tags.evictions();
+    report.library.signature_bytes = static_cast<int64_t>(signatures_->bytes());
+    report.library.text_index_bytes = static_cast<int64_t>(text_index_->bytes());
+    report.library.pressure_releases = pressure_releases_;
+    return report;
+}
+
+
+bool Database::setMemoryLimits(const ConnectionMemoryLimits& limits) {
+    if (limits.page_cache_bytes < 0 || limits.name_cache_bytes < 0 || limits.pressure_threshold <= 0 || limits.pressure_threshold > 1) {
+        LogLine(LogLevel::Error, __func__) << "Invalid memory limits.";
+        return false;
+    }
+    memory_limits_ = limits;
+    return !isOpen() || applyMemoryLimits();
+}
+
+
+bool Database::applyMemoryLimits() {
+    name_ids_->setMaxBytes(static_cast<size_t>(memory_limits_.name_cache_bytes));
+    if (memory_limits_.page_cache_bytes == 0) return true;
+
+    // A negative cache_size is a bound in KiB rather than in pages
+    std::string sql = "PRAGMA cache_size = -" + std::to_string(std::max<int64_t>(1, memory_limits_.page_cache_bytes / 1024)) + ";";
+    if (!executeSQL(sql.c_str())) {
+        LogLine(LogLevel::Error, __func__) << "Failed to set the page cache size.";
+        return false;
+    }
+    return true;
+}
+
+
+int64_t Database::releaseMemory() {
+    if (!isOpen()) return 0;
+    int64_t before = sqlite3_memory_used();
+    int64_t library_bytes = static_cast<int64_t>(name_ids_->bytes() + signatures_->bytes() + text_index_->bytes());
+    sqlite3_db_release_memory(db_);
+    name_ids_->clear();
+    // clear() keeps the vectors' capacity, so swap in an empty object to hand the memory back
+    *signatures_ = RecipeSignatures();
+    *text_index_ = RecipeTextIndex();
+    return std::max<int64_t>(0, before - sqlite3_memory_used()) + library_bytes;
+}
+
+
+bool Database::configureSqliteMemory(const SqliteMemoryConfig& config) {
+    if (int open_connections = g_open_database_connections.load(); open_connections > 0) {
+        LogLine(LogLevel::Error, __func__) << "Cannot change SQLite's memory configuration while " << open_connections
+                                           << " connection(s) are open.";
+        return false;
+    }
+    if (config.page_cache_slots > 0 && (config.page_size < 512 || config.page_size > 65536 || (config.page_size & (config.page_size - 1)) != 0)) {
+        LogLine(LogLevel::Error, __func__) << "Page size " << config.page_size << " is not a power of two between 512 and 65536.";
+        return false;
+    }
+    return applySqliteMemoryConfig(config);
+}
+
+
+void Database::relieveMemoryPressure() {
+    int64_t soft_limit = sqlite3_soft_heap_limit64(-1);
+    if (soft_limit <= 0) return;
+    if (static_cast<double>(sqlite3_memory_used()) < memory_limits_.pressure_threshold * static_cast<double>(soft_limit)) return;
+    // Only what the pressure is measured on, plus the name caches, which refill one name at a time. The ingredient
+    // signatures and the text index live on the C++ heap: dropping them would not lower sqlite3_memory_used(), and
+    // every call made while the pressure lasts would rebuild them in full. releaseMemory() still drops them.
+    sqlite3_db_release_memory(db_);
+    name_ids_->clear();
+    ++pressure_releases_;
+    LogLine(LogLevel::Debug, __func__) << "Released caches at " << sqlite3_memory_used() << " of a " << soft_limit << " byte soft heap limit";
+}
+
+
+void Database::setTraceRecorder(std::shared_ptr<TraceRecorder> recorder) {
+    if (recorder && recorder != trace_) trace_connection_ = recorder->attach();
+    trace_ = std::move(recorder);
+}
+
+
+template <typename Call>
+auto Database::traceCall(TraceCall call, const std::string& arguments, Call&& body) -> decltype(body()) {
+    tracing_ = true;
+    const auto start = std::chrono::steady_clock::now();
+    auto result = body();
+    const auto end = std::chrono::steady_clock::now();
+    tracing_ = false;
+    trace_->record(call, trace_connection_, start, end, arguments, hashTraceResult(result));
+    return result;
 }
 
 
@@ -37,17 +227,30 @@ bool Database::open() {
     int rc = sqlite3_open_v2(db_path_.c_str(), &db_, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, nullptr);
 
     if (rc != SQLITE_OK) {
-        std::cerr << "Cannot open database: " << sqlite3_errmsg(db_) << std::endl;
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Cannot open database: " << sqlite3_errmsg(db_);
         sqlite3_close(db_);
         db_ = nullptr;
         return false;
     }
 
     is_db_open_ = true;
+    g_open_database_connections.fetch_add(1);
+    sqlite3_busy_timeout(db_, kBusyTimeoutMs);
+
+    // A moved-from object gets fresh caches when it is reopened
+    if (!name_ids_) name_ids_ = std::make_unique<NameIdCaches>();
+    if (!signatures_) signatures_ = std::make_unique<RecipeSignatures>();
+    if (!text_index_) text_index_ = std::make_unique<RecipeTextIndex>();
+    name_ids_->attach(db_);
 
     // Create necessary tables if they do not already exist
     if (!initialize()) {
-        std::cerr << "Failed to create necessary tables." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Failed to create necessary tables.";
+        close();
+        return false;
+    }
+
+    if (!applyMemoryLimits()) {
         close();
         return false;
     }
@@ -70,11 +273,24 @@ Database::~Database() {
 
 
 void Database::close() {
+    // Background jobs hold their own connections to this file, so stop them before the path can change
+    index_job_.reset();
+    maintenance_scheduler_.reset();
+    checkpointer_.reset();
+
     if (is_db_open_ && db_ != nullptr) {
+        // Cheap when statistics are current; keeps query plans from drifting as the data changes
+        executeSQL("PRAGMA analysis_limit = 400; PRAGMA optimize;");
+        if (name_ids_) name_ids_->detach();
         sqlite3_close(db_);
         db_ = nullptr;
         is_db_open_ = false;
+        changes_at_log_trim_ = 0;
+        g_open_database_connections.fetch_sub(1);
     }
+    if (name_ids_) name_ids_->clear();
+    if (signatures_) *signatures_ = RecipeSignatures();
+    if (text_index_) *text_index_ = RecipeTextIndex();
 }
 
 
@@ -85,27 +301,46 @@ bool Database::isOpen() const {
 
 bool Database::executeSQL(const char* sql) {
     if (!isOpen()) {
-        std::cerr << "Database not open. Cannot execute SQL." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot execute SQL.";
         return false;
     }
     char* err_msg = nullptr;
     int rc = sqlite3_exec(db_, sql, nullptr, nullptr, &err_msg);
     if (rc != SQLITE_OK) {
-        std::cerr << "SQL error: " << err_msg << " (Query: " << sql << ")" << std::endl;
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "SQL error: " << (err_msg ? err_msg : sqlite3_errmsg(db_)) << " (Query: " << sql << ")";
         sqlite3_free(err_msg);
         return false;
     }
+    // A COMMIT that returned OK makes the names its transaction added permanent
+    name_ids_->confirmCommitted();
+    if (sqlite3_get_autocommit(db_) && sqlite3_total_changes64(db_) - changes_at_log_trim_ >= kChangeLogTrimInterval) {
+        trimChangeLogs();
+    }
     return true;
 }
 
 
-bool Database::tableExists(const std::string& tableName) {
+void Database::trimChangeLogs() {
+    const std::string kept = std::to_string(kChangeLogMaxEntries);
+    const std::string trim_sql =
+        "DELETE FROM recipe_text_changes WHERE change_seq <= (SELECT MAX(change_seq) FROM recipe_text_changes) - " + kept + ";"
+        "DELETE FROM recipe_ingredient_changes WHERE change_seq <= (SELECT MAX(change_seq) FROM recipe_ingredient_changes) - " + kept + ";";
+    char* err_msg = nullptr;
+    if (sqlite3_exec(db_, trim_sql.c_str(), nullptr, nullptr, &err_msg) != SQLITE_OK) {
+        LogLine(LogLevel::Warning, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Could not trim the change logs: " << (err_msg ? err_msg : sqlite3_errmsg(db_));
+        sqlite3_free(err_msg);
+    }
+    changes_at_log_trim_ = sqlite3_total_changes64(db_);
+}
+
+
+bool Database::tableExists(const std::string& tableName, const std::string& schema) {
     if (!isOpen()) {
-        std::cerr << "Database not open. Cannot check if table exists." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot check if table exists.";
         return false;
     }
 
-    std::string sql = "SELECT name FROM sqlite_master WHERE type='table' AND name=?;";
+    std::string sql = "SELECT name FROM \"" + schema + "\".sqlite_master WHERE type='table' AND name=?;";
     SqliteStatement stmt_wrapper(db_, sql.c_str());
     sqlite3_stmt* stmt = stmt_wrapper.stmt;
     
@@ -120,23 +355,47 @@ bool Database::tableExists(const std::string& tableName) {
 
 bool Database::initialize() {
     if (!isOpen()) {
-        std::cerr << "Database not open. Cannot create tables." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot create tables.";
         return false;
     }
 
     // Prevents things like deleting a recipe without also handling its ingredients and tags or inserting an ingredient into the recipe_ingredients table with an invalid recipe
     if (!executeSQL("PRAGMA foreign_keys = ON;")) {
-        std::cerr << "Failed to enable foreign key constraints." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Failed to enable foreign key constraints.";
         close();
         return false;
     }
 
+    // Up-to-date databases skip all DDL and index rebuilding, so open time does not depend on the number of recipes
+    int schema_version = readSchemaVersion();
+    if (schema_version > kSchemaVersion) {
+        LogLine(LogLevel::Error, __func__) << "Database schema version " << schema_version << " is newer than the supported version " << kSchemaVersion << ".";
+        return false;
+    }
+    if (schema_version == kSchemaVersion && readMetadata("search_index_version") == std::to_string(kSearchIndexVersion)) {
+        dropRebuildLeftovers();
+        return true;
+    }
+
+    // Lets runMaintenance() return freed pages to the file system. Only takes effect on a new, empty file: an existing
+    // file keeps its mode, since switching needs a VACUUM that rewrites the whole file, which opening should not do.
+    if (!executeSQL("PRAGMA auto_vacuum = INCREMENTAL;")) {
+        LogLine(LogLevel::Error, __func__) << "Failed to enable incremental auto-vacuum.";
+        return false;
+    }
+
     if (!executeSQL("BEGIN TRANSACTION;")) {
-        std::cerr << "Failed to begin transaction." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Failed to begin transaction.";
         return false;
     }
 
     const char* schema_script = R"(
+        -- Schema and index versions (see kSchemaVersion and kSearchIndexVersion)
+        CREATE TABLE IF NOT EXISTS metadata (
+            key TEXT PRIMARY KEY,
+            value TEXT
+        ) WITHOUT ROWID;
+
         CREATE TABLE IF NOT EXISTS recipes (
             recipe_id INTEGER PRIMARY KEY AUTOINCREMENT,
             name TEXT NOT NULL,
@@ -189,323 +448,662 @@ bool Database::initialize() {
             FOREIGN KEY (recipe_id) REFERENCES recipes(recipe_id) ON DELETE CASCADE,
             UNIQUE (recipe_id, step_number)
         );
-    )";
 
-    if (!executeSQL(schema_script)) {
-        std::cerr << "Failed to create base tables." << std::endl;
-        executeSQL("ROLLBACK;");
-        return false;
-    }
+        -- Ingredient hierarchy/equivalences: child is a variant of (or substitute for) parent
+        CREATE TABLE IF NOT EXISTS ingredient_relations (
+            parent_id INTEGER NOT NULL,
+            child_id INTEGER NOT NULL,
+            PRIMARY KEY (parent_id, child_id),
+            FOREIGN KEY (parent_id) REFERENCES ingredients(ingredient_id) ON DELETE CASCADE,
+            FOREIGN KEY (child_id) REFERENCES ingredients(ingredient_id) ON DELETE CASCADE,
+            CHECK (parent_id != child_id)
+        );
 
-    // Create FTS5 virtual table
-    const char* create_fts_table_sql = R"(
-        CREATE VIRTUAL TABLE IF NOT EXISTS search USING fts5(
-            recipe_id,
-            name,
-            description,
-            author,
-            ingredients,
-            tags,
-            tokenize = 'porter unicode61'
+        -- Transitive closure of ingredient_relations, kept up to date as relations change
+        CREATE TABLE IF NOT EXISTS ingredient_closure (
+            ancestor_id INTEGER NOT NULL,
+            descendant_id INTEGER NOT NULL,
+            PRIMARY KEY (ancestor_id, descendant_id),
+            FOREIGN KEY (ancestor_id) REFERENCES ingredients(ingredient_id) ON DELETE CASCADE,
+            FOREIGN KEY (descendant_id) REFERENCES ingredients(ingredient_id) ON DELETE CASCADE
+        ) WITHOUT ROWID;
+
+        CREATE INDEX IF NOT EXISTS idx_ingredient_relations_child ON ingredient_relations (child_id);
+        CREATE INDEX IF NOT EXISTS idx_ingredient_closure_descendant ON ingredient_closure (descendant_id, ancestor_id);
+
+        -- Photos and other files attached to recipes. The blobs are the last columns so listing
+        -- attachments never walks their overflow pages, and no search or hydration query touches this table.
+        CREATE TABLE IF NOT EXISTS recipe_attachments (
+            attachment_id INTEGER PRIMARY KEY AUTOINCREMENT,
+            recipe_id INTEGER NOT NULL,
+            mime_type TEXT NOT NULL,
+            width INTEGER,
+            height INTEGER,
+            byte_size INTEGER NOT NULL,
+            date_added TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+            thumbnail BLOB,
+            data BLOB NOT NULL,
+            FOREIGN KEY (recipe_id) REFERENCES recipes(recipe_id) ON DELETE CASCADE
         );
 
-        CREATE TRIGGER IF NOT EXISTS recipe_after_insert
-        AFTER INSERT ON recipes
-        BEGIN
-            INSERT OR REPLACE INTO search(rowid, name, description, author)
-            VALUES (new.recipe_id, new.name, new.description, new.author);
-        END;
+        CREATE INDEX IF NOT EXISTS idx_recipe_attachments_recipe ON recipe_attachments (recipe_id);
+
+        -- Sort orders used by search(). Each index carries recipe_id (the rowid) as an implicit
+        -- final column, so "ORDER BY <key>, recipe_id" is satisfied by walking the index in order.
+        CREATE INDEX IF NOT EXISTS idx_recipes_date_added ON recipes (date_added);
+        CREATE INDEX IF NOT EXISTS idx_recipes_total_time ON recipes (prep_time_minutes + cook_time_minutes);
+        CREATE INDEX IF NOT EXISTS idx_recipes_prep_time ON recipes (prep_time_minutes);
+        CREATE INDEX IF NOT EXISTS idx_recipes_cook_time ON recipes (cook_time_minutes);
+        CREATE INDEX IF NOT EXISTS idx_recipes_name ON recipes (name);
+
+        -- Posting list of recipes per ingredient, in recipe_id order, for coverage search
+        CREATE INDEX IF NOT EXISTS idx_recipe_ingredients_ingredient ON recipe_ingredients (ingredient_id, recipe_id, optional);
+
+        -- Listing views: everything by an author, everything from a source and the favorites. Each index holds
+        -- every summary column, so these lists and their summaries are read from the index without touching recipes.
+        CREATE INDEX IF NOT EXISTS idx_recipes_author_listing ON recipes
+            (author, date_added, name, prep_time_minutes, cook_time_minutes, servings, is_favorite, source, source_url);
+        CREATE INDEX IF NOT EXISTS idx_recipes_source_listing ON recipes
+            (source, date_added, name, prep_time_minutes, cook_time_minutes, servings, is_favorite, author, source_url);
+        CREATE INDEX IF NOT EXISTS idx_recipes_favorites ON recipes
+            (date_added, name, prep_time_minutes, cook_time_minutes, servings, is_favorite, author, source, source_url) WHERE is_favorite = 1;
+
+        -- Append-only log of recipes whose description or instructions changed, so every connection's text index
+        -- (RecipeTextIndex) re-reads only the recipes logged after the last entry it applied; a recipe logged several
+        -- times is read once. Maintenance trims old entries but keeps the newest, so entry numbers never repeat; an
+        -- index that finds entries it had not applied gone reloads. Writes trim it too, see trimChangeLogs().
+        CREATE TABLE IF NOT EXISTS recipe_text_changes (
+            change_seq INTEGER PRIMARY KEY,
+            recipe_id INTEGER NOT NULL
+        );
 
-        CREATE TRIGGER IF NOT EXISTS recipe_after_update AFTER UPDATE ON recipes
+        -- Version 3 skipped logging a recipe that was already the newest entry
+        DROP TRIGGER IF EXISTS recipe_text_after_insert;
+        DROP TRIGGER IF EXISTS recipe_text_after_update;
+        DROP TRIGGER IF EXISTS recipe_text_after_delete;
+        DROP TRIGGER IF EXISTS instruction_text_after_insert;
+        DROP TRIGGER IF EXISTS instruction_text_after_update;
+        DROP TRIGGER IF EXISTS instruction_text_after_delete;
+
+        CREATE TRIGGER IF NOT EXISTS recipe_text_after_insert AFTER INSERT ON recipes
+        BEGIN INSERT INTO recipe_text_changes (recipe_id) VALUES (new.recipe_id); END;
+        CREATE TRIGGER IF NOT EXISTS recipe_text_after_update AFTER UPDATE OF description ON recipes
+        BEGIN INSERT INTO recipe_text_changes (recipe_id) VALUES (new.recipe_id); END;
+        CREATE TRIGGER IF NOT EXISTS recipe_text_after_delete AFTER DELETE ON recipes
+        BEGIN INSERT INTO recipe_text_changes (recipe_id) VALUES (old.recipe_id); END;
+        CREATE TRIGGER IF NOT EXISTS instruction_text_after_insert AFTER INSERT ON instructions
+        BEGIN INSERT INTO recipe_text_changes (recipe_id) VALUES (new.recipe_id); END;
+        CREATE TRIGGER IF NOT EXISTS instruction_text_after_update AFTER UPDATE OF recipe_id, instruction ON instructions
         BEGIN
-            UPDATE search
-            SET
-                name = new.name,
-                description = new.description,
-                author = new.author
-            WHERE rowid = new.recipe_id;
+            INSERT INTO recipe_text_changes (recipe_id) VALUES (old.recipe_id);
+            INSERT INTO recipe_text_changes (recipe_id) SELECT new.recipe_id WHERE new.recipe_id IS NOT old.recipe_id;
         END;
+        CREATE TRIGGER IF NOT EXISTS instruction_text_after_delete AFTER DELETE ON instructions
+        BEGIN INSERT INTO recipe_text_changes (recipe_id) VALUES (old.recipe_id); END;
 
-        CREATE TRIGGER IF NOT EXISTS recipe_after_delete AFTER DELETE ON recipes
-        BEGIN
-            DELETE FROM search WHERE rowid = old.recipe_id;
-        END;
+        -- The same for ingredient links, read by every connection's ingredient signatures (RecipeSignatures)
+        CREATE TABLE IF NOT EXISTS recipe_ingredient_changes (
+            change_seq INTEGER PRIMARY KEY,
+            recipe_id INTEGER NOT NULL
+        );
 
-        CREATE TRIGGER IF NOT EXISTS update_ingredients_on_insert
-        AFTER INSERT ON recipe_ingredients
+        CREATE TRIGGER IF NOT EXISTS recipe_ingredient_after_insert AFTER INSERT ON recipe_ingredients
+        BEGIN INSERT INTO recipe_ingredient_changes (recipe_id) VALUES (new.recipe_id); END;
+        CREATE TRIGGER IF NOT EXISTS recipe_ingredient_after_update AFTER UPDATE OF recipe_id, ingredient_id ON recipe_ingredients
         BEGIN
-            UPDATE search
-            SET ingredients = (
-                SELECT COALESCE(group_concat(name, '|'), '')
-                from INGREDIENTS i
-                JOIN recipe_ingredients ri ON i.ingredient_id = ri.ingredient_id
-                WHERE ri.recipe_id = new.recipe_id
-            )
-            WHERE rowid = NEW.recipe_id;
+            INSERT INTO recipe_ingredient_changes (recipe_id) VALUES (old.recipe_id);
+            INSERT INTO recipe_ingredient_changes (recipe_id) SELECT new.recipe_id WHERE new.recipe_id IS NOT old.recipe_id;
         END;
+        CREATE TRIGGER IF NOT EXISTS recipe_ingredient_after_delete AFTER DELETE ON recipe_ingredients
+        BEGIN INSERT INTO recipe_ingredient_changes (recipe_id) VALUES (old.recipe_id); END;
+    )";
 
-        CREATE TRIGGER IF NOT EXISTS update_ingredients_on_delete
-        AFTER DELETE ON recipe_ingredients
-        BEGIN
-            UPDATE search
-            SET ingredients = (
-                SELECT COALESCE(group_concat(name, '|'), '')
-                FROM ingredients i
-                JOIN recipe_ingredients ri ON i.ingredient_id = ri.ingredient_id
-                WHERE ri.recipe_id = OLD.recipe_id
-            )
-            WHERE rowid = OLD.recipe_id;
-        END;
+    if (!executeSQL(schema_script)) {
+        LogLine(LogLevel::Error, __func__) << "Failed to create base tables.";
+        executeSQL("ROLLBACK;");
+        return false;
+    }
 
-        CREATE TRIGGER IF NOT EXISTS update_tags_on_insert
-        AFTER INSERT ON recipe_tags
-        BEGIN
-            UPDATE search
-            SET tags = (
-                SELECT COALESCE(group_concat(name, '|'), '')
-                FROM tags t
-                JOIN recipe_tags rt ON t.tag_id = rt.tag_id
-                WHERE rt.recipe_id = NEW.recipe_id
-            )
-            WHERE rowid = NEW.recipe_id;
-        END;
+    // Create FTS5 virtual table and the triggers that keep it up to date
+    const std::string create_fts_table_sql = searchTableSql("search") + kSearchTriggersSql;
+    if (!executeSQL(create_fts_table_sql.c_str())) {
+        LogLine(LogLevel::Error, __func__) << "Failed to create FTS5 virtual table.";
+        executeSQL("ROLLBACK;");
+        return false;
+    }
 
-        CREATE TRIGGER IF NOT EXISTS update_tags_on_delete
-        AFTER DELETE ON recipe_tags
-        BEGIN
-            UPDATE search
-            SET tags = (
-                SELECT COALESCE(group_concat(name, '|'), '')
-                FROM tags t
-                JOIN recipe_tags rt ON t.tag_id = rt.tag_id
-                WHERE rt.recipe_id = OLD.recipe_id
-            )
-            WHERE rowid = OLD.recipe_id;
-        END;
+    // Only rebuild the search index when its contents were produced by an older version of this code
+    if (readMetadata("search_index_version") != std::to_string(kSearchIndexVersion)) {
+        if (!populateSearchIndex() || !writeMetadata("search_index_version", std::to_string(kSearchIndexVersion))) {
+            LogLine(LogLevel::Error, __func__) << "Failed to build search index.";
+            executeSQL("ROLLBACK;");
+            return false;
+        }
+    }
 
-        INSERT OR REPLACE INTO search (rowid, name, description, author, ingredients, tags)
-        SELECT
-            r.recipe_id,
-            r.name,
-            r.description,
-            r.author,
-            COALESCE(group_concat(i.name, '|'), ''),
-            COALESCE(group_concat(t.name, '|'), '')
-        FROM recipes AS r
-        LEFT JOIN recipe_ingredients AS ri ON r.recipe_id = ri.recipe_id
-        LEFT JOIN ingredients AS i ON ri.ingredient_id = i.ingredient_id
-        LEFT JOIN recipe_tags AS rt ON r.recipe_id = rt.recipe_id
-        LEFT JOIN tags AS t ON rt.tag_id = t.tag_id
-        GROUP BY
-            r.recipe_id;
-    )";
-    if (!executeSQL(create_fts_table_sql)) {
-        std::cerr << "Failed to create FTS5 virtual table." << std::endl;
+    if (!executeSQL(("PRAGMA user_version = " + std::to_string(kSchemaVersion) + ";").c_str())) {
+        LogLine(LogLevel::Error, __func__) << "Failed to record schema version.";
         executeSQL("ROLLBACK;");
         return false;
     }
 
     if (!executeSQL("COMMIT;")) {
-        std::cerr << "Failed to commit transaction." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Failed to commit transaction.";
         // Attempt to rollback, though the state might be inconsistent if commit itself fails
         executeSQL("ROLLBACK;");
         return false;
     }
 
+    dropRebuildLeftovers();
     return true;
 }
 
 
-long long Database::addRecipe(const RecipeData& recipe) {
-    if (!isOpen()) {
-        std::cerr << "Database not open. Cannot execute SQL." << std::endl;
-        return false;
-    }
-
-    if (recipe.name.empty()) {
-        std::cerr << "Recipe name cannot be empty. Recipe not added." << std::endl;
-        return -1;
-    }
-
-    if (!executeSQL("BEGIN TRANSACTION;")) {
-        std::cerr << "Failed to begin transaction." << std::endl;
-        return -1;
+void Database::dropRebuildLeftovers() {
+    // Not fatal: the database works with the leftovers, only writes are slower until a later open drops them
+    if (!index_job_ && !dropAbandonedRebuild(db_)) {
+        LogLine(LogLevel::Warning, __func__) << "Could not drop the leftovers of an abandoned search index rebuild.";
     }
+}
 
-    long long new_recipe_id = -1;
-
-    // Insert into recipes table
-    const char* recipe_sql = R"(
-        INSERT INTO recipes (name, description, prep_time_minutes, cook_time_minutes, servings, is_favorite, source, source_url, author)
-        VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);
-    )";
 
-    SqliteStatement stmt_wrapper(db_, recipe_sql);
+int Database::readSchemaVersion() {
+    SqliteStatement stmt_wrapper(db_, "PRAGMA user_version;");
     sqlite3_stmt* stmt = stmt_wrapper.stmt;
 
-    if (stmt == nullptr) {
-        executeSQL("ROLLBACK;");
-        return -1;
-    }
+    if (stmt == nullptr || sqlite3_step(stmt) != SQLITE_ROW) return -1;
+    return sqlite3_column_int(stmt, 0);
+}
 
-    sqlite3_bind_text(stmt, 1, recipe.name.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, recipe.description.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 3, recipe.prep_time_minutes);
-    sqlite3_bind_int(stmt, 4, recipe.cook_time_minutes);
-    sqlite3_bind_int(stmt, 5, recipe.servings);
-    sqlite3_bind_int(stmt, 6, recipe.is_favorite ? 1 : 0);
-    sqlite3_bind_text(stmt, 7, recipe.source.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 8, recipe.source_url.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 9, recipe.author.c_str(), -1, SQLITE_STATIC);
 
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        std::cerr << "Failed to insert recipe: " << sqlite3_errmsg(db_) << std::endl;
-        executeSQL("ROLLBACK;");
-        return -1;
+std::string Database::readMetadata(const std::string& key) {
+    // The table does not exist yet in databases created before versioning; that reads as "no value"
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db_, "SELECT value FROM metadata WHERE key = ?;", -1, &stmt, nullptr) != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return "";
     }
-    new_recipe_id = sqlite3_last_insert_rowid(db_);
-    stmt = nullptr;
 
-    // Insert ingredients into recipe_ingredients table
-    for (const RecipeIngredientInfo& ingredient : recipe.ingredients) {
-        if (linkIngredientToRecipe(new_recipe_id, ingredient) == false) {
-            std::cerr << "Failed to link ingredient: " << ingredient.name << " to recipe ID: " << new_recipe_id << std::endl;
-            executeSQL("ROLLBACK;");
-            return -1;
-        }
+    sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_STATIC);
+    std::string value;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* temp_ptr = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        value = (temp_ptr ? temp_ptr : "");
     }
+    sqlite3_finalize(stmt);
+    return value;
+}
 
-    // Insert tags into recipe_tags table
-    for (const std::string& tag : recipe.tags) {
-        if (linkTagToRecipe(new_recipe_id, tag) == false) {
-            std::cerr << "Failed to link tag: " << tag << " to recipe ID: " << new_recipe_id << std::endl;
-            executeSQL("ROLLBACK;");
-            return -1;
-        }
-    }
 
-    // Insert instructions
-    for (size_t i = 0; i < recipe.instructions.size(); ++i) {
-        if (!addInstruction(new_recipe_id, i + 1, recipe.instructions[i])) {
-            std::cerr << "Failed to add instruction step " << (i + 1) << " for recipe ID: " << new_recipe_id << std::endl;
-            executeSQL("ROLLBACK;");
-            return -1;
-        }
-    }
+bool Database::writeMetadata(const std::string& key, const std::string& value) {
+    SqliteStatement stmt_wrapper(db_, "INSERT OR REPLACE INTO metadata (key, value) VALUES (?, ?);");
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
 
-    // Commit the transaction
-    if (!executeSQL("COMMIT;")) {
-        std::cerr << "Failed to commit transaction." << std::endl;
-        // Attempt to rollback, though the state might be inconsistent if commit itself fails
-        executeSQL("ROLLBACK;");
-        return -1;
+    if (stmt == nullptr) return false;
+
+    sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, value.c_str(), -1, SQLITE_STATIC);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to write metadata '" << key << "': " << sqlite3_errmsg(db_);
+        return false;
     }
+    return true;
+}
 
-    return new_recipe_id;
+
+bool Database::populateSearchIndex() {
+    const std::string rebuild_sql = std::string("DELETE FROM search; INSERT INTO search (rowid, name, description, author, ingredients, tags) ")
+        + kSearchRowsSql + ";";
+    return executeSQL(rebuild_sql.c_str());
 }
 
 
-bool Database::deleteRecipe(long long recipe_id) {
+bool Database::rebuildSearchIndex() {
     if (!isOpen()) {
-        std::cerr << "Database not open. Cannot remove recipe." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot rebuild search index.";
         return false;
     }
 
-    if (recipe_id <= 0) {
-        std::cerr << "Invalid recipe ID: " << recipe_id << std::endl;
+    if (!executeSQL("BEGIN TRANSACTION;")) {
+        LogLine(LogLevel::Error, __func__) << "Failed to begin transaction.";
         return false;
     }
 
-    if (!executeSQL("BEGIN TRANSACTION;")) {
-        std::cerr << "Failed to begin transaction." << std::endl;
+    if (!populateSearchIndex() || !writeMetadata("search_index_version", std::to_string(kSearchIndexVersion))) {
+        LogLine(LogLevel::Error, __func__) << "Failed to rebuild search index.";
+        executeSQL("ROLLBACK;");
         return false;
     }
 
-    const char* delete_recipe_sql = "DELETE FROM recipes WHERE recipe_id = ?;";
-    SqliteStatement stmt_wrapper(db_, delete_recipe_sql);
-    sqlite3_stmt* stmt = stmt_wrapper.stmt;
-
-    if (stmt == nullptr) {
+    if (!executeSQL("COMMIT;")) {
+        LogLine(LogLevel::Error, __func__) << "Failed to commit transaction.";
         executeSQL("ROLLBACK;");
         return false;
     }
 
-    sqlite3_bind_int64(stmt, 1, recipe_id);
+    return true;
+}
 
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        std::cerr << "Failed to delete recipe: " << sqlite3_errmsg(db_) << std::endl;
-        executeSQL("ROLLBACK;");
+
+bool Database::startIndexJob(SearchIndexJob::Mode mode, const IndexJobOptions& options) {
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot start search index job.";
         return false;
     }
-    stmt = nullptr;
-    
-    const char* clean_ingredients_sql = R"(
-        DELETE FROM ingredients
-        WHERE ingredient_id NOT IN (SELECT DISTINCT ingredient_id FROM recipe_ingredients);
-    )";
-    if (!executeSQL(clean_ingredients_sql)) {
-        std::cerr << "Failed to clean ingredients table." << std::endl;
-    }
 
-    const char* clean_tags_sql = R"(
-        DELETE FROM tags
-        WHERE tag_id NOT IN (SELECT DISTINCT tag_id FROM recipe_tags);
-    )";
-    if (!executeSQL(clean_tags_sql)) {
-        std::cerr << "Failed to clean tags table." << std::endl;
+    if (db_path_.empty() || db_path_ == ":memory:") {
+        LogLine(LogLevel::Error, __func__) << "Background search index jobs need a database file.";
+        return false;
     }
 
-    // Commit the transaction
-    if (!executeSQL("COMMIT;")) {
-        std::cerr << "Failed to commit transaction." << std::endl;
-        // Attempt to rollback, though the state might be inconsistent if commit itself fails
-        executeSQL("ROLLBACK;");
+    if (index_job_ && !index_job_->finished()) {
+        LogLine(LogLevel::Warning, __func__) << "A search index job is already running.";
         return false;
     }
 
+    index_job_ = std::make_unique<SearchIndexJob>(db_path_, mode, options);
     return true;
 }
 
 
-bool Database::mergeDatabase(const std::string& source_db_path) {
-    if (!isOpen()) {
-        std::cerr << "Database not open. Cannot merge databases." << std::endl;
-        return false;
-    }
+bool Database::startSearchIndexRebuild(const IndexJobOptions& options) {
+    return startIndexJob(SearchIndexJob::Mode::Rebuild, options);
+}
 
-    const char* attach_db_sql = R"(
-        ATTACH DATABASE ? AS source_db;
-    )";
 
-    SqliteStatement stmt_wrapper(db_, attach_db_sql);
-    sqlite3_stmt* stmt = stmt_wrapper.stmt;
+bool Database::startSearchIndexVerification(const IndexJobOptions& options) {
+    return startIndexJob(SearchIndexJob::Mode::Verify, options);
+}
 
-    if (stmt == nullptr) return false;
 
-    sqlite3_bind_text(stmt, 1, source_db_path.c_str(), -1, SQLITE_STATIC);
+std::optional<IndexJobProgress> Database::indexJobProgress() const {
+    if (!index_job_) return std::nullopt;
+    return index_job_->progress();
+}
 
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        std::cerr << "Failed to delete recipe: " << sqlite3_errmsg(db_) << std::endl;
-        executeSQL("ROLLBACK;");
-        return false;
-    }
-    stmt = nullptr;
 
-    const char* merge_script = R"(
-        BEGIN TRANSACTION;
+std::optional<IndexJobProgress> Database::waitForIndexJob() {
+    if (!index_job_) return std::nullopt;
+    return index_job_->wait();
+}
 
-        PRAGMA foreign_keys = OFF;
 
-        -- STEP 1: Merge independent (ingredients and tags) tables
-        INSERT INTO main.ingredients (name) SELECT s.name FROM source_db.ingredients AS s
-        WHERE NOT EXISTS (SELECT 1 FROM main.ingredients AS t WHERE lower(t.name) = lower(s.name));
+void Database::cancelIndexJob() {
+    if (!index_job_) return;
+    index_job_->cancel();
+    index_job_->wait();
+}
 
-        CREATE TEMP TABLE ingredient_id_map (source_id INTEGER PRIMARY KEY, target_id INTEGER NOT NULL);
-        INSERT INTO ingredient_id_map (source_id, target_id)
-        SELECT s.ingredient_id, t.ingredient_id FROM source_db.ingredients AS s JOIN main.ingredients AS t ON lower(s.name) = lower(t.name);
 
-        INSERT INTO main.tags (name) SELECT s.name FROM source_db.tags AS s
-        WHERE NOT EXISTS (SELECT 1 FROM main.tags AS t WHERE lower(t.name) = lower(s.name));
+std::optional<MaintenanceReport> Database::runMaintenance(const MaintenanceOptions& options) {
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot run maintenance.";
+        return std::nullopt;
+    }
+    return ::runMaintenance(db_, options);
+}
+
+
+std::optional<StorageStats> Database::storageStats(bool measure_fragmentation) {
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot read storage statistics.";
+        return std::nullopt;
+    }
+    return readStorageStats(db_, measure_fragmentation);
+}
+
+
+std::optional<SearchBundleStats> Database::exportSearchBundle(const std::string& path) {
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot export search bundle.";
+        return std::nullopt;
+    }
+    return writeSearchBundle(db_, path);
+}
+
+
+bool Database::startMaintenanceScheduler(std::chrono::milliseconds interval, const MaintenanceOptions& options) {
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot start maintenance scheduler.";
+        return false;
+    }
+
+    if (db_path_.empty() || db_path_ == ":memory:") {
+        LogLine(LogLevel::Error, __func__) << "Background maintenance needs a database file.";
+        return false;
+    }
+
+    maintenance_scheduler_.reset();
+    maintenance_scheduler_ = std::make_unique<MaintenanceScheduler>(db_path_, interval, options);
+    return true;
+}
+
+
+void Database::stopMaintenanceScheduler() {
+    maintenance_scheduler_.reset();
+}
+
+
+std::optional<MaintenanceReport> Database::lastScheduledMaintenance() const {
+    if (!maintenance_scheduler_) return std::nullopt;
+    return maintenance_scheduler_->lastReport();
+}
+
+
+bool Database::enableWal(const CheckpointPolicy& policy) {
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot enable WAL.";
+        return false;
+    }
+
+    if (db_path_.empty() || db_path_ == ":memory:") {
+        LogLine(LogLevel::Error, __func__) << "WAL mode needs a database file.";
+        return false;
+    }
+
+    SqliteStatement stmt_wrapper(db_, "PRAGMA journal_mode = WAL;");
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
+    if (stmt == nullptr || sqlite3_step(stmt) != SQLITE_ROW) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to switch to WAL mode: " << sqlite3_errmsg(db_);
+        return false;
+    }
+    const char* journal_mode = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    if (journal_mode == nullptr || std::string(journal_mode) != "wal") {
+        LogLine(LogLevel::Error, __func__) << "Database stayed in journal mode " << (journal_mode ? journal_mode : "unknown") << ".";
+        return false;
+    }
+
+    checkpointer_.reset();
+    checkpointer_ = std::make_unique<Checkpointer>(db_, db_path_, policy);
+    return true;
+}
+
+
+std::optional<CheckpointMetrics> Database::checkpointMetrics() const {
+    if (!checkpointer_) return std::nullopt;
+    return checkpointer_->metrics();
+}
+
+
+long long Database::addRecipe(const RecipeData& recipe) {
+    if (trace_ && !tracing_) return traceCall(TraceCall::AddRecipe, encodeTraceArguments(recipe), [&] { return addRecipe(recipe); });
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot execute SQL.";
+        return -1;
+    }
+
+    if (recipe.name.empty()) {
+        LogLine(LogLevel::Error, __func__) << "Recipe name cannot be empty. Recipe not added.";
+        return -1;
+    }
+
+    if (!executeSQL("BEGIN TRANSACTION;")) {
+        LogLine(LogLevel::Error, __func__) << "Failed to begin transaction.";
+        return -1;
+    }
+
+    long long new_recipe_id = insertRecipe(recipe);
+    if (new_recipe_id == -1) {
+        executeSQL("ROLLBACK;");
+        return -1;
+    }
+
+    // Commit the transaction
+    if (!executeSQL("COMMIT;")) {
+        LogLine(LogLevel::Error, __func__) << "Failed to commit transaction.";
+        // Attempt to rollback, though the state might be inconsistent if commit itself fails
+        executeSQL("ROLLBACK;");
+        return -1;
+    }
+
+    return new_recipe_id;
+}
+
+
+std::vector<long long> Database::addRecipes(const std::vector<RecipeData>& recipes) {
+    if (trace_ && !tracing_) return traceCall(TraceCall::AddRecipes, encodeTraceArguments(recipes), [&] { return addRecipes(recipes); });
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot execute SQL.";
+        return {};
+    }
+
+    if (!executeSQL("BEGIN TRANSACTION;")) {
+        LogLine(LogLevel::Error, __func__) << "Failed to begin transaction.";
+        return {};
+    }
+
+    std::vector<long long> recipe_ids;
+    recipe_ids.reserve(recipes.size());
+    for (const RecipeData& recipe : recipes) {
+        if (recipe.name.empty()) {
+            LogLine(LogLevel::Error, __func__) << "Recipe name cannot be empty. Recipe not added.";
+            recipe_ids.push_back(-1);
+            continue;
+        }
+
+        // Each recipe gets a savepoint, so a failing one is undone without losing the rest of the batch
+        if (!executeSQL("SAVEPOINT add_recipe;")) {
+            executeSQL("ROLLBACK;");
+            return {};
+        }
+        long long recipe_id = insertRecipe(recipe);
+        if (recipe_id == -1) {
+            executeSQL("ROLLBACK TO add_recipe;");
+            // The rollback hook does not fire for savepoints; drop the ids this recipe may have cached
+            name_ids_->ingredients.rollback();
+            name_ids_->tags.rollback();
+        }
+        executeSQL("RELEASE add_recipe;");
+        recipe_ids.push_back(recipe_id);
+    }
+
+    if (!executeSQL("COMMIT;")) {
+        LogLine(LogLevel::Error, __func__) << "Failed to commit transaction.";
+        executeSQL("ROLLBACK;");
+        return {};
+    }
+
+    return recipe_ids;
+}
+
+
+long long Database::insertRecipe(const RecipeData& recipe) {
+    relieveMemoryPressure();
+    long long new_recipe_id = -1;
+
+    // Insert into recipes table
+    const char* recipe_sql = R"(
+        INSERT INTO recipes (name, description, prep_time_minutes, cook_time_minutes, servings, is_favorite, source, source_url, author)
+        VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)
+        RETURNING recipe_id;
+    )";
+
+    SqliteStatement stmt_wrapper(db_, recipe_sql);
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
+
+    if (stmt == nullptr) {
+        return -1;
+    }
+
+    sqlite3_bind_text(stmt, 1, recipe.name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, recipe.description.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 3, recipe.prep_time_minutes);
+    sqlite3_bind_int(stmt, 4, recipe.cook_time_minutes);
+    sqlite3_bind_int(stmt, 5, recipe.servings);
+    sqlite3_bind_int(stmt, 6, recipe.is_favorite ? 1 : 0);
+    sqlite3_bind_text(stmt, 7, recipe.source.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 8, recipe.source_url.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 9, recipe.author.c_str(), -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) new_recipe_id = sqlite3_column_int64(stmt, 0);
+    if (new_recipe_id == -1 || sqlite3_step(stmt) != SQLITE_DONE) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to insert recipe: " << sqlite3_errmsg(db_);
+        return -1;
+    }
+    stmt = nullptr;
+
+    // Insert ingredients into recipe_ingredients table
+    if (recipe.ingredients.size() > kBulkResolveThreshold) {
+        if (!linkIngredientsToRecipe(new_recipe_id, recipe.ingredients)) {
+            LogLine(LogLevel::Error, __func__).recipe(new_recipe_id) << "Failed to link ingredients to recipe ID: " << new_recipe_id;
+                return -1;
+        }
+    } else {
+        for (const RecipeIngredientInfo& ingredient : recipe.ingredients) {
+            if (linkIngredientToRecipe(new_recipe_id, ingredient) == false) {
+                LogLine(LogLevel::Error, __func__).recipe(new_recipe_id) << "Failed to link ingredient: " << ingredient.name << " to recipe ID: " << new_recipe_id;
+                        return -1;
+            }
+        }
+    }
+
+    // Insert tags into recipe_tags table
+    if (recipe.tags.size() > kBulkResolveThreshold) {
+        if (!linkTagsToRecipe(new_recipe_id, recipe.tags)) {
+            LogLine(LogLevel::Error, __func__).recipe(new_recipe_id) << "Failed to link tags to recipe ID: " << new_recipe_id;
+                return -1;
+        }
+    } else {
+        for (const std::string& tag : recipe.tags) {
+            if (linkTagToRecipe(new_recipe_id, tag) == false) {
+                LogLine(LogLevel::Error, __func__).recipe(new_recipe_id) << "Failed to link tag: " << tag << " to recipe ID: " << new_recipe_id;
+                        return -1;
+            }
+        }
+    }
+
+    // Insert instructions
+    for (size_t i = 0; i < recipe.instructions.size(); ++i) {
+        if (!addInstruction(new_recipe_id, i + 1, recipe.instructions[i])) {
+            LogLine(LogLevel::Error, __func__).recipe(new_recipe_id) << "Failed to add instruction step " << (i + 1) << " for recipe ID: " << new_recipe_id;
+                return -1;
+        }
+    }
+
+    return new_recipe_id;
+}
+
+
+bool Database::deleteRecipe(long long recipe_id) {
+    if (trace_ && !tracing_) return traceCall(TraceCall::DeleteRecipe, encodeTraceArguments(recipe_id), [&] { return deleteRecipe(recipe_id); });
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot remove recipe.";
+        return false;
+    }
+
+    if (recipe_id <= 0) {
+        LogLine(LogLevel::Error, __func__).recipe(recipe_id) << "Invalid recipe ID: " << recipe_id;
+        return false;
+    }
+
+    if (!executeSQL("BEGIN TRANSACTION;")) {
+        LogLine(LogLevel::Error, __func__) << "Failed to begin transaction.";
+        return false;
+    }
+
+    const char* delete_recipe_sql = "DELETE FROM recipes WHERE recipe_id = ?;";
+    SqliteStatement stmt_wrapper(db_, delete_recipe_sql);
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
+
+    if (stmt == nullptr) {
+        executeSQL("ROLLBACK;");
+        return false;
+    }
+
+    sqlite3_bind_int64(stmt, 1, recipe_id);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to delete recipe: " << sqlite3_errmsg(db_);
+        executeSQL("ROLLBACK;");
+        return false;
+    }
+    stmt = nullptr;
+    
+    // Orphaned names are returned so they can be dropped from the name caches as well
+    auto clean_orphans = [this](const char* sql, NameIdCache& cache) {
+        SqliteStatement clean_wrapper(db_, sql);
+        sqlite3_stmt* clean_stmt = clean_wrapper.stmt;
+        if (clean_stmt == nullptr) return false;
+
+        int rc;
+        while ((rc = sqlite3_step(clean_stmt)) == SQLITE_ROW) {
+            cache.erase(reinterpret_cast<const char*>(sqlite3_column_text(clean_stmt, 0)));
+        }
+        return rc == SQLITE_DONE;
+    };
+
+    const char* clean_ingredients_sql = R"(
+        DELETE FROM ingredients
+        WHERE ingredient_id NOT IN (SELECT DISTINCT ingredient_id FROM recipe_ingredients)
+            AND ingredient_id NOT IN (SELECT parent_id FROM ingredient_relations)
+            AND ingredient_id NOT IN (SELECT child_id FROM ingredient_relations)
+        RETURNING name;
+    )";
+    if (!clean_orphans(clean_ingredients_sql, name_ids_->ingredients)) {
+        LogLine(LogLevel::Error, __func__) << "Failed to clean ingredients table.";
+    }
+
+    const char* clean_tags_sql = R"(
+        DELETE FROM tags
+        WHERE tag_id NOT IN (SELECT DISTINCT tag_id FROM recipe_tags)
+        RETURNING name;
+    )";
+    if (!clean_orphans(clean_tags_sql, name_ids_->tags)) {
+        LogLine(LogLevel::Error, __func__) << "Failed to clean tags table.";
+    }
+
+    // Commit the transaction
+    if (!executeSQL("COMMIT;")) {
+        LogLine(LogLevel::Error, __func__) << "Failed to commit transaction.";
+        // Attempt to rollback, though the state might be inconsistent if commit itself fails
+        executeSQL("ROLLBACK;");
+        return false;
+    }
+
+    return true;
+}
+
+
+bool Database::mergeDatabase(const std::string& source_db_path) {
+    if (trace_ && !tracing_) return traceCall(TraceCall::MergeDatabase, encodeTraceArguments(source_db_path), [&] { return mergeDatabase(source_db_path); });
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot merge databases.";
+        return false;
+    }
+
+    const char* attach_db_sql = R"(
+        ATTACH DATABASE ? AS source_db;
+    )";
+
+    SqliteStatement stmt_wrapper(db_, attach_db_sql);
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
+
+    if (stmt == nullptr) return false;
+
+    sqlite3_bind_text(stmt, 1, source_db_path.c_str(), -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to delete recipe: " << sqlite3_errmsg(db_);
+        executeSQL("ROLLBACK;");
+        return false;
+    }
+    stmt = nullptr;
+
+    const char* merge_script = R"(
+        BEGIN TRANSACTION;
+
+        PRAGMA foreign_keys = OFF;
+
+        -- STEP 1: Merge independent (ingredients and tags) tables
+        INSERT INTO main.ingredients (name) SELECT s.name FROM source_db.ingredients AS s
+        WHERE NOT EXISTS (SELECT 1 FROM main.ingredients AS t WHERE lower(t.name) = lower(s.name));
+
+        CREATE TEMP TABLE ingredient_id_map (source_id INTEGER PRIMARY KEY, target_id INTEGER NOT NULL);
+        INSERT INTO ingredient_id_map (source_id, target_id)
+        SELECT s.ingredient_id, t.ingredient_id FROM source_db.ingredients AS s JOIN main.ingredients AS t ON lower(s.name) = lower(t.name);
+
+        INSERT INTO main.tags (name) SELECT s.name FROM source_db.tags AS s
+        WHERE NOT EXISTS (SELECT 1 FROM main.tags AS t WHERE lower(t.name) = lower(s.name));
 
         CREATE TEMP TABLE tag_id_map (source_id INTEGER PRIMARY KEY, target_id INTEGER NOT NULL);
         INSERT INTO tag_id_map (source_id, target_id)
@@ -616,7 +1214,38 @@ bool Database::mergeDatabase(const std::string& source_db_path) {
         FROM source_db.instructions AS s_inst
         JOIN recipe_id_map AS map ON s_inst.recipe_id = map.source_id
         WHERE map.is_duplicate = 0;
+    )";
+
+    // Attachments of newly merged recipes, when the source database has them
+    const char* merge_attachments_script = R"(
+        INSERT INTO main.recipe_attachments (recipe_id, mime_type, width, height, byte_size, date_added, thumbnail, data)
+        SELECT map.target_id, s_att.mime_type, s_att.width, s_att.height, s_att.byte_size, s_att.date_added, s_att.thumbnail, s_att.data
+        FROM source_db.recipe_attachments AS s_att
+        JOIN recipe_id_map AS map ON s_att.recipe_id = map.source_id
+        WHERE map.is_duplicate = 0
+        ORDER BY s_att.attachment_id;
+    )";
 
+    // Relations only exist in databases created since the ingredient hierarchy was added
+    const char* merge_relations_script = R"(
+        INSERT OR IGNORE INTO main.ingredient_relations (parent_id, child_id)
+        SELECT parent_map.target_id, child_map.target_id
+        FROM source_db.ingredient_relations AS s_rel
+        JOIN ingredient_id_map AS parent_map ON s_rel.parent_id = parent_map.source_id
+        JOIN ingredient_id_map AS child_map ON s_rel.child_id = child_map.source_id
+        WHERE parent_map.target_id != child_map.target_id;
+
+        DELETE FROM main.ingredient_closure;
+        WITH RECURSIVE reach(ancestor_id, descendant_id) AS (
+            SELECT parent_id, child_id FROM main.ingredient_relations
+            UNION
+            SELECT rel.parent_id, reach.descendant_id
+            FROM main.ingredient_relations AS rel JOIN reach ON rel.child_id = reach.ancestor_id
+        )
+        INSERT INTO main.ingredient_closure (ancestor_id, descendant_id) SELECT ancestor_id, descendant_id FROM reach;
+    )";
+
+    const char* finalize_script = R"(
         --STEP 5: Finalize
         DROP TABLE ingredient_id_map;
         DROP TABLE tag_id_map;
@@ -632,14 +1261,23 @@ bool Database::mergeDatabase(const std::string& source_db_path) {
     )";
 
     bool script_ran_successfully = executeSQL(merge_script);
+    if (script_ran_successfully && tableExists("recipe_attachments", "source_db")) {
+        script_ran_successfully = executeSQL(merge_attachments_script);
+    }
+    if (script_ran_successfully && tableExists("ingredient_relations", "source_db")) {
+        script_ran_successfully = executeSQL(merge_relations_script);
+    }
+    if (script_ran_successfully) {
+        script_ran_successfully = executeSQL(finalize_script);
+    }
 
     if (!script_ran_successfully) {
-        std::cerr << "Failed to execute merge script" << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Failed to execute merge script";
         executeSQL("ROLLBACK;");
     }
 
     if (!executeSQL("DETACH DATABASE source_db;")) {
-        std::cerr << "Failed to detach source database";
+        LogLine(LogLevel::Error, __func__) << "Failed to detach source database";
         return false;
     }
 
@@ -655,8 +1293,9 @@ bool Database::loadDatabase(const std::string& db_path) {
 
 
 bool Database::emptyDatabase() {
+    if (trace_ && !tracing_) return traceCall(TraceCall::EmptyDatabase, std::string(), [&] { return emptyDatabase(); });
     if (!isOpen()) {
-        std::cerr << "Database not open. Cannot empty database." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot empty database.";
         return false;
     }
 
@@ -667,13 +1306,20 @@ bool Database::emptyDatabase() {
         DELETE FROM ingredients;
         DELETE FROM tags;
         DELETE FROM search;
-        DELETE FROM sqlite_sequence WHERE name IN ('recipes', 'ingredients', 'tags', 'instructions');
+        DELETE FROM sqlite_sequence WHERE name IN ('recipes', 'ingredients', 'tags', 'instructions', 'recipe_attachments');
+
+        -- Every logged recipe is gone. The newest entry stays so entry numbers never repeat; readers see the gap and reload.
+        DELETE FROM recipe_text_changes WHERE change_seq < (SELECT MAX(change_seq) FROM recipe_text_changes);
+        DELETE FROM recipe_ingredient_changes WHERE change_seq < (SELECT MAX(change_seq) FROM recipe_ingredient_changes);
 
         COMMIT;
     )";
 
+    // Ids are handed out again from 1, so no cached id can be trusted afterwards
+    name_ids_->clear();
+
     if (!executeSQL(delete_all_sql)) {
-        std::cerr << "Failed to begin transaction." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Failed to begin transaction.";
         return false;
     }
 
@@ -683,15 +1329,20 @@ bool Database::emptyDatabase() {
 
 long long Database::getOrCreateIngredientId(const std::string& name) {
     if (!isOpen()) {
-        std::cerr << "Database not open. Cannot get or create ingredient ID." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot get or create ingredient ID.";
         return -1;
     }
 
     if (name.empty()) {
-        std::cerr << "Ingredient name cannot be empty." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Ingredient name cannot be empty.";
         return -1;
     }
 
+    name_ids_->syncWithDatabase();
+    if (std::optional<long long> cached = name_ids_->ingredients.find(name)) {
+        return *cached;
+    }
+
     const char* select_sql = "SELECT ingredient_id FROM ingredients WHERE name = ?;";
     SqliteStatement stmt_wrapper(db_, select_sql);
     sqlite3_stmt* stmt = stmt_wrapper.stmt;
@@ -705,45 +1356,46 @@ long long Database::getOrCreateIngredientId(const std::string& name) {
     
     stmt = nullptr;
     if (ingredient_id != -1) {
+        name_ids_->ingredients.insert(name, ingredient_id, !sqlite3_get_autocommit(db_));
         return ingredient_id;
     }
 
     // Ingredient not found, insert it
-    const char* insert_sql = "INSERT INTO ingredients (name) VALUES (?);";
+    const char* insert_sql = "INSERT INTO ingredients (name) VALUES (?) RETURNING ingredient_id;";
     SqliteStatement insert_stmt_wrapper(db_, insert_sql);
     stmt = insert_stmt_wrapper.stmt;
 
     if (stmt == nullptr) return -1;
 
     sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_STATIC);
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        std::cerr << "Failed to insert ingredient: " << sqlite3_errmsg(db_) << std::endl;
+    if (sqlite3_step(stmt) == SQLITE_ROW) ingredient_id = sqlite3_column_int64(stmt, 0);
+    if (ingredient_id == -1 || sqlite3_step(stmt) != SQLITE_DONE) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to insert ingredient: " << sqlite3_errmsg(db_);
         return -1;
     }
 
     stmt = nullptr;
-
-    // Return the newly created ingredient ID
-    ingredient_id = sqlite3_last_insert_rowid(db_);
-    if (ingredient_id == -1) {
-        std::cerr << "Failed to retrieve last insert row ID for ingredient." << std::endl;
-        return -1;
-    }
+    name_ids_->ingredients.insert(name, ingredient_id, !sqlite3_get_autocommit(db_));
     return ingredient_id;
 }
 
 
 long long Database::getOrCreateTagId(const std::string& name) {
     if (!isOpen()) {
-        std::cerr << "Database not open. Cannot get or create tag ID." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot get or create tag ID.";
         return -1;
     }
 
     if (name.empty()) {
-        std::cerr << "Tag name cannot be empty." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Tag name cannot be empty.";
         return -1;
     }
 
+    name_ids_->syncWithDatabase();
+    if (std::optional<long long> cached = name_ids_->tags.find(name)) {
+        return *cached;
+    }
+
     const char* select_sql = "SELECT tag_id FROM tags WHERE name = ?;";
     SqliteStatement stmt_wrapper(db_, select_sql);
     sqlite3_stmt* stmt = stmt_wrapper.stmt;
@@ -757,42 +1409,40 @@ long long Database::getOrCreateTagId(const std::string& name) {
     }
 
     stmt = nullptr;
-    if (tag_id != -1) return tag_id;
+    if (tag_id != -1) {
+        name_ids_->tags.insert(name, tag_id, !sqlite3_get_autocommit(db_));
+        return tag_id;
+    }
 
     // Tag not found, insert it
-    const char* insert_sql = "INSERT INTO tags (name) VALUES (?);";
+    const char* insert_sql = "INSERT INTO tags (name) VALUES (?) RETURNING tag_id;";
     SqliteStatement insert_stmt_wrapper(db_, insert_sql);
     stmt = insert_stmt_wrapper.stmt;
 
     if (stmt == nullptr) return -1;
 
     sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_STATIC);
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        std::cerr << "Failed to insert tag: " << sqlite3_errmsg(db_) << std::endl;
+    if (sqlite3_step(stmt) == SQLITE_ROW) tag_id = sqlite3_column_int64(stmt, 0);
+    if (tag_id == -1 || sqlite3_step(stmt) != SQLITE_DONE) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to insert tag: " << sqlite3_errmsg(db_);
         return -1;
     }
 
     stmt = nullptr;
-    
-    // Return the newly created tag ID
-    tag_id = sqlite3_last_insert_rowid(db_);
-    if (tag_id == -1) {
-        std::cerr << "Failed to retrieve last insert row ID for tag." << std::endl;
-        return -1;
-    }
-    
+
+    name_ids_->tags.insert(name, tag_id, !sqlite3_get_autocommit(db_));
     return tag_id;
 }
 
 
 bool Database::addInstruction(long long recipe_id, int step_number, const std::string& instruction) {
     if (!isOpen()) {
-        std::cerr << "Database not open. Cannot add instruction." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot add instruction.";
         return false;
     }
 
     if (recipe_id <= 0 || step_number <= 0 || instruction.empty()) {
-        std::cerr << "Invalid parameters for adding instruction." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Invalid parameters for adding instruction.";
         return false;
     }
 
@@ -810,105 +1460,654 @@ bool Database::addInstruction(long long recipe_id, int step_number, const std::s
     sqlite3_bind_text(stmt, 3, instruction.c_str(), -1, SQLITE_STATIC);
 
     if (sqlite3_step(stmt) != SQLITE_DONE) {
-        std::cerr << "Failed to insert instruction: " << sqlite3_errmsg(db_) << std::endl;
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to insert instruction: " << sqlite3_errmsg(db_);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool Database::linkIngredientToRecipe(long long recipe_id, const RecipeIngredientInfo& ingredient) {
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot link ingredient to recipe.";
+        return false;
+    }
+
+    if (recipe_id <= 0 || ingredient.name.empty()) {
+        LogLine(LogLevel::Error, __func__) << "Invalid parameters for linking ingredient to recipe.";
+        return false;
+    }
+
+    long long ingredient_id = getOrCreateIngredientId(ingredient.name);
+    if (ingredient_id == -1) {
+        LogLine(LogLevel::Error, __func__) << "Failed to get or create ingredient ID for: " << ingredient.name;
+        return false;
+    }
+
+    const char* insert_sql = R"(
+        INSERT INTO recipe_ingredients (recipe_id, ingredient_id, quantity, unit, notes, optional)
+        VALUES (?, ?, ?, ?, ?, ?);
+    )";
+
+    SqliteStatement stmt_wrapper(db_, insert_sql);
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
+
+    if (stmt == nullptr) return false;
+
+    sqlite3_bind_int64(stmt, 1, recipe_id);
+    sqlite3_bind_int64(stmt, 2, ingredient_id);
+    sqlite3_bind_double(stmt, 3, ingredient.quantity);
+    sqlite3_bind_text(stmt, 4, ingredient.unit.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 5, ingredient.notes.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 6, ingredient.optional ? 1 : 0);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to insert recipe_ingredient: " << sqlite3_errmsg(db_);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool Database::linkTagToRecipe(long long recipe_id, const std::string& tag) {
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot link tag to recipe.";
+        return false;
+    }
+
+    if (recipe_id <= 0 || tag.empty()) {
+        LogLine(LogLevel::Error, __func__) << "Invalid parameters for linking tag to recipe.";
+        return false;
+    }
+
+    long long tag_id = getOrCreateTagId(tag);
+    if (tag_id == -1) {
+        LogLine(LogLevel::Error, __func__) << "Failed to get or create tag ID for: " << tag;
         return false;
     }
 
+    const char* insert_sql = R"(
+        INSERT INTO recipe_tags (recipe_id, tag_id)
+        VALUES (?, ?);
+    )";
+    SqliteStatement stmt_wrapper(db_, insert_sql);
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
+
+    if (stmt == nullptr) return false;
+
+    sqlite3_bind_int64(stmt, 1, recipe_id);
+    sqlite3_bind_int64(stmt, 2, tag_id);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to insert recipe_tag: " << sqlite3_errmsg(db_);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool Database::resolveNameIds(const char* table, const char* id_column, NameIdCache& cache,
+                              const std::vector<std::string>& names, std::unordered_map<std::string, long long>& ids) {
+    name_ids_->syncWithDatabase();
+    std::vector<std::string> missing;
+    for (const std::string& name : names) {
+        if (name.empty()) {
+            LogLine(LogLevel::Error, __func__) << "Cannot resolve an empty name in " << table << ".";
+            return false;
+        }
+        if (ids.contains(name)) continue;
+
+        if (std::optional<long long> cached = cache.find(name)) {
+            ids.emplace(name, *cached);
+        } else {
+            ids.emplace(name, -1);
+            missing.push_back(name);
+        }
+    }
+
+    const bool in_transaction = !sqlite3_get_autocommit(db_);
+    auto collect = [&](sqlite3_stmt* stmt) {
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            std::string name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+            long long id = sqlite3_column_int64(stmt, 0);
+            cache.insert(name, id, in_transaction);
+            ids[name] = id;
+        }
+        return rc == SQLITE_DONE;
+    };
+
+    for (size_t begin = 0; begin < missing.size(); begin += kBulkResolveChunk) {
+        const size_t count = std::min(kBulkResolveChunk, missing.size() - begin);
+
+        // New names are inserted and come back through RETURNING; names that already exist are left untouched
+        std::string values;
+        for (size_t i = 0; i < count; ++i) {
+            values += (i == 0 ? "(?)" : ", (?)");
+        }
+        const std::string insert_sql = std::string("INSERT INTO ") + table + " (name) VALUES " + values
+            + " ON CONFLICT (name) DO NOTHING RETURNING " + id_column + ", name;";
+        SqliteStatement insert_wrapper(db_, insert_sql.c_str());
+        if (insert_wrapper.stmt == nullptr) return false;
+        for (size_t i = 0; i < count; ++i) {
+            sqlite3_bind_text(insert_wrapper.stmt, static_cast<int>(i + 1), missing[begin + i].c_str(), -1, SQLITE_STATIC);
+        }
+        if (!collect(insert_wrapper.stmt)) {
+            LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to insert names into " << table << ": " << sqlite3_errmsg(db_);
+            return false;
+        }
+
+        // Whatever the upsert skipped already existed; fetch those ids in one query
+        std::vector<const std::string*> existing;
+        for (size_t i = 0; i < count; ++i) {
+            if (ids[missing[begin + i]] == -1) existing.push_back(&missing[begin + i]);
+        }
+        if (existing.empty()) continue;
+
+        const std::string select_sql = std::string("SELECT ") + id_column + ", name FROM " + table
+            + " WHERE name IN (" + placeholderList(existing.size()) + ");";
+        SqliteStatement select_wrapper(db_, select_sql.c_str());
+        if (select_wrapper.stmt == nullptr) return false;
+        for (size_t i = 0; i < existing.size(); ++i) {
+            sqlite3_bind_text(select_wrapper.stmt, static_cast<int>(i + 1), existing[i]->c_str(), -1, SQLITE_STATIC);
+        }
+        if (!collect(select_wrapper.stmt)) {
+            LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to look up names in " << table << ": " << sqlite3_errmsg(db_);
+            return false;
+        }
+    }
+
+    for (const std::string& name : missing) {
+        if (ids[name] == -1) {
+            LogLine(LogLevel::Error, __func__) << "Failed to resolve " << name << " in " << table << ".";
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool Database::linkIngredientsToRecipe(long long recipe_id, const std::vector<RecipeIngredientInfo>& ingredients) {
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot link ingredients to recipe.";
+        return false;
+    }
+
+    if (recipe_id <= 0) {
+        LogLine(LogLevel::Error, __func__) << "Invalid parameters for linking ingredients to recipe.";
+        return false;
+    }
+
+    std::vector<std::string> names;
+    names.reserve(ingredients.size());
+    for (const RecipeIngredientInfo& ingredient : ingredients) {
+        names.push_back(ingredient.name);
+    }
+
+    std::unordered_map<std::string, long long> ids;
+    if (!resolveNameIds("ingredients", "ingredient_id", name_ids_->ingredients, names, ids)) {
+        return false;
+    }
+
+    const char* insert_sql = R"(
+        INSERT INTO recipe_ingredients (recipe_id, ingredient_id, quantity, unit, notes, optional)
+        VALUES (?, ?, ?, ?, ?, ?);
+    )";
+    SqliteStatement stmt_wrapper(db_, insert_sql);
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
+
+    if (stmt == nullptr) return false;
+
+    for (const RecipeIngredientInfo& ingredient : ingredients) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, recipe_id);
+        sqlite3_bind_int64(stmt, 2, ids[ingredient.name]);
+        sqlite3_bind_double(stmt, 3, ingredient.quantity);
+        sqlite3_bind_text(stmt, 4, ingredient.unit.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 5, ingredient.notes.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 6, ingredient.optional ? 1 : 0);
+
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to insert recipe_ingredient " << ingredient.name << ": " << sqlite3_errmsg(db_);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool Database::linkTagsToRecipe(long long recipe_id, const std::vector<std::string>& tags) {
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot link tags to recipe.";
+        return false;
+    }
+
+    if (recipe_id <= 0) {
+        LogLine(LogLevel::Error, __func__) << "Invalid parameters for linking tags to recipe.";
+        return false;
+    }
+
+    std::unordered_map<std::string, long long> ids;
+    if (!resolveNameIds("tags", "tag_id", name_ids_->tags, tags, ids)) {
+        return false;
+    }
+
+    const char* insert_sql = R"(
+        INSERT INTO recipe_tags (recipe_id, tag_id)
+        VALUES (?, ?);
+    )";
+    SqliteStatement stmt_wrapper(db_, insert_sql);
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
+
+    if (stmt == nullptr) return false;
+
+    for (const std::string& tag : tags) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, recipe_id);
+        sqlite3_bind_int64(stmt, 2, ids[tag]);
+
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to insert recipe_tag " << tag << ": " << sqlite3_errmsg(db_);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool Database::addIngredientRelation(const std::string& parent, const std::string& child) {
+    if (trace_ && !tracing_) return traceCall(TraceCall::AddIngredientRelation, encodeTraceArguments(parent, child),
+                                           [&] { return addIngredientRelation(parent, child); });
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot add ingredient relation.";
+        return false;
+    }
+
+    if (parent.empty() || child.empty() || parent == child) {
+        LogLine(LogLevel::Error, __func__) << "Invalid parameters for adding ingredient relation.";
+        return false;
+    }
+
+    if (!executeSQL("BEGIN TRANSACTION;")) {
+        LogLine(LogLevel::Error, __func__) << "Failed to begin transaction.";
+        return false;
+    }
+
+    long long parent_id = getOrCreateIngredientId(parent);
+    long long child_id = getOrCreateIngredientId(child);
+    if (parent_id == -1 || child_id == -1) {
+        LogLine(LogLevel::Error, __func__) << "Failed to get or create ingredient IDs for relation: " << parent << " -> " << child;
+        executeSQL("ROLLBACK;");
+        return false;
+    }
+
+    const char* insert_sql = "INSERT OR IGNORE INTO ingredient_relations (parent_id, child_id) VALUES (?, ?);";
+    SqliteStatement insert_wrapper(db_, insert_sql);
+    sqlite3_stmt* stmt = insert_wrapper.stmt;
+
+    if (stmt == nullptr) {
+        executeSQL("ROLLBACK;");
+        return false;
+    }
+
+    sqlite3_bind_int64(stmt, 1, parent_id);
+    sqlite3_bind_int64(stmt, 2, child_id);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to insert ingredient relation: " << sqlite3_errmsg(db_);
+        executeSQL("ROLLBACK;");
+        return false;
+    }
+
+    // Every ancestor of the parent (and the parent) now reaches every descendant of the child (and the child)
+    const char* closure_sql = R"(
+        INSERT OR IGNORE INTO ingredient_closure (ancestor_id, descendant_id)
+        SELECT a.ancestor_id, d.descendant_id
+        FROM (SELECT ?1 AS ancestor_id UNION SELECT ancestor_id FROM ingredient_closure WHERE descendant_id = ?1) AS a,
+             (SELECT ?2 AS descendant_id UNION SELECT descendant_id FROM ingredient_closure WHERE ancestor_id = ?2) AS d;
+    )";
+    SqliteStatement closure_wrapper(db_, closure_sql);
+    stmt = closure_wrapper.stmt;
+
+    if (stmt == nullptr) {
+        executeSQL("ROLLBACK;");
+        return false;
+    }
+
+    sqlite3_bind_int64(stmt, 1, parent_id);
+    sqlite3_bind_int64(stmt, 2, child_id);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to update ingredient closure: " << sqlite3_errmsg(db_);
+        executeSQL("ROLLBACK;");
+        return false;
+    }
+
+    if (!executeSQL("COMMIT;")) {
+        LogLine(LogLevel::Error, __func__) << "Failed to commit transaction.";
+        executeSQL("ROLLBACK;");
+        return false;
+    }
+
+    return true;
+}
+
+
+bool Database::removeIngredientRelation(const std::string& parent, const std::string& child) {
+    if (trace_ && !tracing_) return traceCall(TraceCall::RemoveIngredientRelation, encodeTraceArguments(parent, child),
+                                           [&] { return removeIngredientRelation(parent, child); });
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot remove ingredient relation.";
+        return false;
+    }
+
+    if (!executeSQL("BEGIN TRANSACTION;")) {
+        LogLine(LogLevel::Error, __func__) << "Failed to begin transaction.";
+        return false;
+    }
+
+    // Remove the edge and remember which closure rows could have depended on it
+    const char* remove_sql = R"(
+        CREATE TEMP TABLE relation_affected_ancestors (ingredient_id INTEGER PRIMARY KEY);
+        CREATE TEMP TABLE relation_affected_descendants (ingredient_id INTEGER PRIMARY KEY);
+
+        INSERT INTO relation_affected_ancestors
+        SELECT ingredient_id FROM ingredients WHERE name = ?1
+        UNION
+        SELECT c.ancestor_id FROM ingredient_closure c JOIN ingredients i ON c.descendant_id = i.ingredient_id WHERE i.name = ?1;
+
+        INSERT INTO relation_affected_descendants
+        SELECT ingredient_id FROM ingredients WHERE name = ?2
+        UNION
+        SELECT c.descendant_id FROM ingredient_closure c JOIN ingredients i ON c.ancestor_id = i.ingredient_id WHERE i.name = ?2;
+
+        DELETE FROM ingredient_relations
+        WHERE parent_id = (SELECT ingredient_id FROM ingredients WHERE name = ?1)
+            AND child_id = (SELECT ingredient_id FROM ingredients WHERE name = ?2);
+
+        DELETE FROM ingredient_closure
+        WHERE ancestor_id IN relation_affected_ancestors AND descendant_id IN relation_affected_descendants;
+
+        -- Re-derive paths into the affected descendants from the relations that remain
+        WITH RECURSIVE reach(ancestor_id, descendant_id) AS (
+            SELECT parent_id, child_id FROM ingredient_relations WHERE child_id IN relation_affected_descendants
+            UNION
+            SELECT rel.parent_id, reach.descendant_id
+            FROM ingredient_relations AS rel JOIN reach ON rel.child_id = reach.ancestor_id
+        )
+        INSERT OR IGNORE INTO ingredient_closure (ancestor_id, descendant_id) SELECT ancestor_id, descendant_id FROM reach;
+
+        DROP TABLE relation_affected_ancestors;
+        DROP TABLE relation_affected_descendants;
+    )";
+
+    // Run the script one statement at a time so the names can be bound to each of them
+    const char* tail = remove_sql;
+    while (tail != nullptr && *tail != '\0') {
+        sqlite3_stmt* raw_stmt = nullptr;
+        if (sqlite3_prepare_v2(db_, tail, -1, &raw_stmt, &tail) != SQLITE_OK) {
+            LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to prepare statement: " << sqlite3_errmsg(db_);
+            executeSQL("ROLLBACK;");
+            return false;
+        }
+        if (raw_stmt == nullptr) break; // Only whitespace left
+
+        if (sqlite3_bind_parameter_count(raw_stmt) >= 1) sqlite3_bind_text(raw_stmt, 1, parent.c_str(), -1, SQLITE_STATIC);
+        if (sqlite3_bind_parameter_count(raw_stmt) >= 2) sqlite3_bind_text(raw_stmt, 2, child.c_str(), -1, SQLITE_STATIC);
+        int rc = sqlite3_step(raw_stmt);
+        sqlite3_finalize(raw_stmt);
+        if (rc != SQLITE_DONE) {
+            LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to remove ingredient relation: " << sqlite3_errmsg(db_);
+            executeSQL("ROLLBACK;");
+            return false;
+        }
+    }
+
+    if (!executeSQL("COMMIT;")) {
+        LogLine(LogLevel::Error, __func__) << "Failed to commit transaction.";
+        executeSQL("ROLLBACK;");
+        return false;
+    }
+
+    return true;
+}
+
+
+// Size of each read/write when streaming attachment data
+constexpr int kAttachmentChunkSize = 64 * 1024;
+
+
+long long Database::addAttachment(long long recipe_id, const AttachmentInfo& info, std::istream& data, int64_t size,
+                                  const std::vector<unsigned char>& thumbnail) {
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot add attachment.";
+        return -1;
+    }
+
+    // Incremental blob I/O addresses blobs with int offsets
+    if (recipe_id <= 0 || size < 0 || size > INT32_MAX || info.mime_type.empty()) {
+        LogLine(LogLevel::Error, __func__) << "Invalid parameters for adding attachment.";
+        return -1;
+    }
+
+    if (!executeSQL("BEGIN TRANSACTION;")) {
+        LogLine(LogLevel::Error, __func__) << "Failed to begin transaction.";
+        return -1;
+    }
+
+    // Reserve the space with a zeroblob, then fill it in place
+    const char* insert_sql = R"(
+        INSERT INTO recipe_attachments (recipe_id, mime_type, width, height, byte_size, thumbnail, data)
+        VALUES (?, ?, ?, ?, ?, ?, ?)
+        RETURNING attachment_id;
+    )";
+    SqliteStatement stmt_wrapper(db_, insert_sql);
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
+
+    if (stmt == nullptr) {
+        executeSQL("ROLLBACK;");
+        return -1;
+    }
+
+    sqlite3_bind_int64(stmt, 1, recipe_id);
+    sqlite3_bind_text(stmt, 2, info.mime_type.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, info.width);
+    sqlite3_bind_int64(stmt, 4, info.height);
+    sqlite3_bind_int64(stmt, 5, size);
+    if (thumbnail.empty()) {
+        sqlite3_bind_null(stmt, 6);
+    } else {
+        sqlite3_bind_blob64(stmt, 6, thumbnail.data(), thumbnail.size(), SQLITE_STATIC);
+    }
+    sqlite3_bind_zeroblob64(stmt, 7, size);
+
+    long long attachment_id = -1;
+    if (sqlite3_step(stmt) == SQLITE_ROW) attachment_id = sqlite3_column_int64(stmt, 0);
+    if (attachment_id == -1 || sqlite3_step(stmt) != SQLITE_DONE) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to insert attachment: " << sqlite3_errmsg(db_);
+        executeSQL("ROLLBACK;");
+        return -1;
+    }
+
+    sqlite3_blob* blob = nullptr;
+    if (sqlite3_blob_open(db_, "main", "recipe_attachments", "data", attachment_id, 1, &blob) != SQLITE_OK) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to open attachment blob: " << sqlite3_errmsg(db_);
+        sqlite3_blob_close(blob);
+        executeSQL("ROLLBACK;");
+        return -1;
+    }
+
+    std::array<char, kAttachmentChunkSize> buffer;
+    int64_t offset = 0;
+    while (offset < size) {
+        int chunk = static_cast<int>(std::min<int64_t>(kAttachmentChunkSize, size - offset));
+        data.read(buffer.data(), chunk);
+        if (data.gcount() != chunk) {
+            LogLine(LogLevel::Error, __func__) << "Attachment stream ended after " << (offset + data.gcount()) << " of " << size << " bytes.";
+            sqlite3_blob_close(blob);
+            executeSQL("ROLLBACK;");
+            return -1;
+        }
+        if (sqlite3_blob_write(blob, buffer.data(), chunk, static_cast<int>(offset)) != SQLITE_OK) {
+            LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to write attachment data: " << sqlite3_errmsg(db_);
+            sqlite3_blob_close(blob);
+            executeSQL("ROLLBACK;");
+            return -1;
+        }
+        offset += chunk;
+    }
+
+    if (sqlite3_blob_close(blob) != SQLITE_OK) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to close attachment blob: " << sqlite3_errmsg(db_);
+        executeSQL("ROLLBACK;");
+        return -1;
+    }
+
+    if (!executeSQL("COMMIT;")) {
+        LogLine(LogLevel::Error, __func__) << "Failed to commit transaction.";
+        executeSQL("ROLLBACK;");
+        return -1;
+    }
+
+    return attachment_id;
+}
+
+
+bool Database::readAttachment(long long attachment_id, std::ostream& out) {
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot read attachment.";
+        return false;
+    }
+
+    if (attachment_id <= 0) {
+        LogLine(LogLevel::Error, __func__) << "Invalid attachment ID: " << attachment_id;
+        return false;
+    }
+
+    sqlite3_blob* blob = nullptr;
+    if (sqlite3_blob_open(db_, "main", "recipe_attachments", "data", attachment_id, 0, &blob) != SQLITE_OK) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to open attachment blob: " << sqlite3_errmsg(db_);
+        sqlite3_blob_close(blob);
+        return false;
+    }
+
+    std::array<char, kAttachmentChunkSize> buffer;
+    const int size = sqlite3_blob_bytes(blob);
+    for (int offset = 0; offset < size; offset += kAttachmentChunkSize) {
+        int chunk = std::min(kAttachmentChunkSize, size - offset);
+        if (sqlite3_blob_read(blob, buffer.data(), chunk, offset) != SQLITE_OK) {
+            LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to read attachment data: " << sqlite3_errmsg(db_);
+            sqlite3_blob_close(blob);
+            return false;
+        }
+        if (!out.write(buffer.data(), chunk)) {
+            LogLine(LogLevel::Error, __func__) << "Failed to write attachment data to output stream.";
+            sqlite3_blob_close(blob);
+            return false;
+        }
+    }
+
+    sqlite3_blob_close(blob);
     return true;
 }
 
 
-bool Database::linkIngredientToRecipe(long long recipe_id, const RecipeIngredientInfo& ingredient) {
+std::vector<AttachmentInfo> Database::getAttachments(long long recipe_id) {
+    if (trace_ && !tracing_) return traceCall(TraceCall::GetAttachments, encodeTraceArguments(recipe_id), [&] { return getAttachments(recipe_id); });
     if (!isOpen()) {
-        std::cerr << "Database not open. Cannot link ingredient to recipe." << std::endl;
-        return false;
-    }
-
-    if (recipe_id <= 0 || ingredient.name.empty()) {
-        std::cerr << "Invalid parameters for linking ingredient to recipe." << std::endl;
-        return false;
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot get attachments.";
+        return {};
     }
 
-    long long ingredient_id = getOrCreateIngredientId(ingredient.name);
-    if (ingredient_id == -1) {
-        std::cerr << "Failed to get or create ingredient ID for: " << ingredient.name << std::endl;
-        return false;
-    }
-
-    const char* insert_sql = R"(
-        INSERT INTO recipe_ingredients (recipe_id, ingredient_id, quantity, unit, notes, optional)
-        VALUES (?, ?, ?, ?, ?, ?);
+    const char* select_sql = R"(
+        SELECT attachment_id, recipe_id, mime_type, width, height, byte_size
+        FROM recipe_attachments
+        WHERE recipe_id = ?
+        ORDER BY attachment_id;
     )";
-
-    SqliteStatement stmt_wrapper(db_, insert_sql);
+    SqliteStatement stmt_wrapper(db_, select_sql);
     sqlite3_stmt* stmt = stmt_wrapper.stmt;
 
-    if (stmt == nullptr) return false;
+    if (stmt == nullptr) return {};
 
     sqlite3_bind_int64(stmt, 1, recipe_id);
-    sqlite3_bind_int64(stmt, 2, ingredient_id);
-    sqlite3_bind_double(stmt, 3, ingredient.quantity);
-    sqlite3_bind_text(stmt, 4, ingredient.unit.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 5, ingredient.notes.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 6, ingredient.optional ? 1 : 0);
-
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        std::cerr << "Failed to insert recipe_ingredient: " << sqlite3_errmsg(db_) << std::endl;
-        return false;
-    }
 
-    return true;
+    std::vector<AttachmentInfo> attachments;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        AttachmentInfo info;
+        info.attachment_id = sqlite3_column_int64(stmt, 0);
+        info.recipe_id = sqlite3_column_int64(stmt, 1);
+        const char* temp_ptr = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+        info.mime_type = (temp_ptr ? temp_ptr : "");
+        info.width = static_cast<uint32_t>(sqlite3_column_int64(stmt, 3));
+        info.height = static_cast<uint32_t>(sqlite3_column_int64(stmt, 4));
+        info.byte_size = sqlite3_column_int64(stmt, 5);
+        attachments.push_back(std::move(info));
+    }
+
+    return attachments;
 }
 
 
-bool Database::linkTagToRecipe(long long recipe_id, const std::string& tag) {
+std::optional<std::vector<unsigned char>> Database::getAttachmentThumbnail(long long attachment_id) {
     if (!isOpen()) {
-        std::cerr << "Database not open. Cannot link tag to recipe." << std::endl;
-        return false;
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot get attachment thumbnail.";
+        return std::nullopt;
     }
 
-    if (recipe_id <= 0 || tag.empty()) {
-        std::cerr << "Invalid parameters for linking tag to recipe." << std::endl;
-        return false;
-    }
+    const char* select_sql = "SELECT thumbnail FROM recipe_attachments WHERE attachment_id = ?;";
+    SqliteStatement stmt_wrapper(db_, select_sql);
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
 
-    long long tag_id = getOrCreateTagId(tag);
-    if (tag_id == -1) {
-        std::cerr << "Failed to get or create tag ID for: " << tag << std::endl;
+    if (stmt == nullptr) return std::nullopt;
+
+    sqlite3_bind_int64(stmt, 1, attachment_id);
+    if (sqlite3_step(stmt) != SQLITE_ROW) return std::nullopt;
+
+    const unsigned char* bytes = static_cast<const unsigned char*>(sqlite3_column_blob(stmt, 0));
+    int size = sqlite3_column_bytes(stmt, 0);
+    return std::vector<unsigned char>(bytes, bytes + size);
+}
+
+
+bool Database::deleteAttachment(long long attachment_id) {
+    if (trace_ && !tracing_) return traceCall(TraceCall::DeleteAttachment, encodeTraceArguments(attachment_id), [&] { return deleteAttachment(attachment_id); });
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot delete attachment.";
         return false;
     }
 
-    const char* insert_sql = R"(
-        INSERT INTO recipe_tags (recipe_id, tag_id)
-        VALUES (?, ?);
-    )";
-    SqliteStatement stmt_wrapper(db_, insert_sql);
+    const char* delete_sql = "DELETE FROM recipe_attachments WHERE attachment_id = ?;";
+    SqliteStatement stmt_wrapper(db_, delete_sql);
     sqlite3_stmt* stmt = stmt_wrapper.stmt;
 
     if (stmt == nullptr) return false;
 
-    sqlite3_bind_int64(stmt, 1, recipe_id);
-    sqlite3_bind_int64(stmt, 2, tag_id);
-
+    sqlite3_bind_int64(stmt, 1, attachment_id);
     if (sqlite3_step(stmt) != SQLITE_DONE) {
-        std::cerr << "Failed to insert recipe_tag: " << sqlite3_errmsg(db_) << std::endl;
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to delete attachment: " << sqlite3_errmsg(db_);
         return false;
     }
 
-    return true;
+    return sqlite3_changes(db_) > 0;
 }
 
 
 std::optional<RecipeData> Database::getRecipeById(long long recipe_id) {
+    if (trace_ && !tracing_) return traceCall(TraceCall::GetRecipeById, encodeTraceArguments(recipe_id), [&] { return getRecipeById(recipe_id); });
     if (!isOpen()) {
-        std::cerr << "Database not open. Cannot get recipe by ID." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot get recipe by ID.";
         return std::nullopt;
     }
 
     if (recipe_id <= 0) {
-        std::cerr << "Invalid recipe ID: " << recipe_id << std::endl;
+        LogLine(LogLevel::Error, __func__).recipe(recipe_id) << "Invalid recipe ID: " << recipe_id;
         return std::nullopt;
     }
+    relieveMemoryPressure();
 
     // Get information from recipes table
     const char* select_sql = R"(
@@ -952,7 +2151,7 @@ std::optional<RecipeData> Database::getRecipeById(long long recipe_id) {
     if (stmt == nullptr) return std::nullopt;
 
     if (sqlite3_bind_int64(stmt, 1, recipe_id) != SQLITE_OK) {
-        std::cerr << "Failed to bind recipe ID: " << sqlite3_errmsg(db_) << std::endl;
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to bind recipe ID: " << sqlite3_errmsg(db_);
         return std::nullopt;
     }
 
@@ -991,74 +2190,142 @@ std::optional<RecipeData> Database::getRecipeById(long long recipe_id) {
     } else if (rc == SQLITE_DONE) {
         return std::nullopt;
     } else {
-        std::cerr << "Failed to get recipe by ID: " << sqlite3_errmsg(db_) << std::endl;
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to get recipe by ID: " << sqlite3_errmsg(db_);
         return std::nullopt;
     }
 }
 
 
-std::vector<std::string> splitString(const std::string& str, char delimiter) {
+/**
+ * Removes the text up to the next delimiter (or the end) from the front of str.
+ * @return The removed token, without the delimiter.
+ */
+std::string_view nextToken(std::string_view& str, char delimiter) {
+    size_t end = str.find(delimiter);
+    std::string_view token = str.substr(0, end);
+    str.remove_prefix(end == std::string_view::npos ? str.size() : end + 1);
+    return token;
+}
+
+
+std::vector<std::string> splitString(std::string_view str, char delimiter) {
     std::vector<std::string> tokens;
-    std::stringstream ss(str);
-    std::string token;
-    while (std::getline(ss, token, delimiter)) {
+    while (!str.empty()) {
+        std::string_view token = nextToken(str, delimiter);
         if (!token.empty()) {
-            tokens.push_back(token);
+            tokens.emplace_back(token);
         }
     }
     return tokens;
 }
 
 
-RecipeIngredientInfo getIngredientInfo(const std::string& ingredient_str) {
+// Works on views of the row so hydrating a recipe allocates only the strings it returns
+RecipeIngredientInfo getIngredientInfo(std::string_view ingredient_str) {
     RecipeIngredientInfo ingredient;
-    std::stringstream ss(ingredient_str);
-    std::string token;
-
-    std::getline(ss, token, '|');
-    ingredient.name = token;
-
-    if (std::getline(ss, token, '|')) {
-    if (!token.empty()) {
-        try {
-            ingredient.quantity = std::stod(token);
-        } catch (const std::exception& e) {
-            std::cerr << "Warning: Could not parse quantity '" << token << "'. Defaulting to 0.\n";
-            ingredient.quantity = 0.0;
-        }
-    } else {
+    ingredient.name = nextToken(ingredient_str, '|');
+
+    std::string_view quantity = nextToken(ingredient_str, '|');
+    ingredient.quantity = 0.0;
+    if (!quantity.empty() && std::from_chars(quantity.data(), quantity.data() + quantity.size(), ingredient.quantity).ec != std::errc()) {
+        LogLine(LogLevel::Warning, __func__) << "Could not parse quantity '" << quantity << "'. Defaulting to 0.";
         ingredient.quantity = 0.0;
     }
+
+    ingredient.unit = nextToken(ingredient_str, '|');
+    ingredient.notes = nextToken(ingredient_str, '|');
+    ingredient.optional = nextToken(ingredient_str, '|') == "1";
+
+    return ingredient;
 }
 
-    std::getline(ss, token, '|');
-    ingredient.unit = token;
 
-    std::getline(ss, token, '|');
-    ingredient.notes = token;
+std::vector<RecipeIngredientInfo> parseAllIngredients(std::string_view all_ingredients_str) {
+    std::vector<RecipeIngredientInfo> ingredients;
+    ingredients.reserve(std::count(all_ingredients_str.begin(), all_ingredients_str.end(), '\n') + 1);
+    while (!all_ingredients_str.empty()) {
+        std::string_view line = nextToken(all_ingredients_str, '\n');
+        if (!line.empty()) {
+            ingredients.push_back(getIngredientInfo(line));
+        }
+    }
+    return ingredients;
+}
+
 
-    std::getline(ss, token, '|');
-    if (token == "1") {
-        ingredient.optional = true;
-    } else {
-        ingredient.optional = false;
+// Node of a compiled search plan: a predicate over "recipes AS r", or an AND/OR/NOT of other nodes
+struct PlanNode {
+    SearchExpression::Type type = SearchExpression::Type::Leaf;
+    std::string sql;                // Predicate for leaf nodes
+    std::vector<SqlValue> params;   // Values bound by sql
+    std::string fts_query;          // MATCH expression when the leaf is the full-text predicate
+    const char* listing_index = nullptr;    // Covering index that can drive the whole query when this leaf is a top-level term
+    bool selective = false;         // Narrows the recipes down through an index or a rowid list, so no scan is needed
+    int cost = 0;                   // Estimated cost; cheap, selective predicates are evaluated first
+    std::vector<PlanNode> children; // Operands for And, Or and Not nodes
+    std::string key;                // Canonical form used to detect shared subexpressions
+};
+
+
+// Relative cost of each kind of predicate
+constexpr int kIndexedPredicateCost = 1;   // Equality on an indexed column
+constexpr int kColumnPredicateCost = 2;    // Comparison on a recipes column
+constexpr int kFtsPredicateCost = 3;       // FTS5 MATCH, evaluated once into a rowid list
+constexpr int kLinkPredicateCost = 4;      // Tag/ingredient subquery, evaluated once into a rowid list
+constexpr int kExclusionPredicateCost = 5; // Correlated NOT EXISTS, evaluated per row
+
+
+std::string sqlValueKey(const SqlValue& value) {
+    return std::visit([](auto&& arg) -> std::string {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, std::string>) {
+            return "s" + std::to_string(arg.size()) + ":" + arg;
+        } else {
+            return "n" + std::to_string(arg);
+        }
+    }, value);
+}
+
+
+PlanNode makePredicate(std::string sql, std::vector<SqlValue> params, int cost) {
+    PlanNode node;
+    node.key = sql;
+    for (const SqlValue& value : params) {
+        node.key += "|" + sqlValueKey(value);
     }
+    node.sql = std::move(sql);
+    node.params = std::move(params);
+    node.cost = cost;
+    return node;
+}
 
-    return ingredient;
+
+std::string placeholderList(size_t count) {
+    std::string placeholders;
+    for (size_t i = 0; i < count; ++i) {
+        placeholders += (i == 0 ? "?" : ", ?");
+    }
+    return placeholders;
 }
 
 
-std::vector<RecipeIngredientInfo> parseAllIngredients(const std::string& all_ingredients_str) {
-    auto result_view = splitString(all_ingredients_str, '\n') | std::views::transform(getIngredientInfo);
-    
-    return std::vector<RecipeIngredientInfo>(result_view.begin(), result_view.end());
+// Rows (requested, variant_id) for each named ingredient and every ingredient below it in the hierarchy.
+// Binds the list of names twice. Both halves are index lookups: ingredients by name, ingredient_closure by ancestor.
+std::string ingredientVariantsSql(size_t count) {
+    std::string placeholders = placeholderList(count);
+    return R"(
+                SELECT i.name AS requested, i.ingredient_id AS variant_id FROM ingredients i
+                WHERE i.name IN ()" + placeholders + R"()
+                UNION ALL
+                SELECT i.name, c.descendant_id FROM ingredients i JOIN ingredient_closure c ON c.ancestor_id = i.ingredient_id
+                WHERE i.name IN ()" + placeholders + R"()
+            )";
 }
 
 
-std::pair<std::string, std::vector<SqlValue>> Database::buildSearchQuery(const SearchData& criteria) {
-    std::string sql = "SELECT DISTINCT r.recipe_id FROM recipes AS r";
-    std::vector<std::string> conditions;
-    std::vector<SqlValue> params;
+// Converts the fields of a SearchData into individual predicates, all of which must hold
+std::vector<PlanNode> criteriaPredicates(const SearchData& criteria) {
+    std::vector<PlanNode> predicates;
 
     // Handle FTS criteria
     std::string fts_match_query;
@@ -1076,140 +2343,392 @@ std::pair<std::string, std::vector<SqlValue>> Database::buildSearchQuery(const S
         if (fts_match_query.back() == ' ') {
             fts_match_query.pop_back();
         }
-        
-        conditions.push_back("r.recipe_id IN (SELECT rowid FROM search WHERE search MATCH ?)");
-        params.push_back(fts_match_query);
+
+        PlanNode fts = makePredicate("r.recipe_id IN (SELECT rowid FROM search WHERE search MATCH ?)", {fts_match_query}, kFtsPredicateCost);
+        fts.fts_query = fts_match_query;
+        fts.selective = true;
+        predicates.push_back(std::move(fts));
     }
 
     // Handle main table criteria
     if (!criteria.exact_name.empty()) {
-        conditions.push_back("r.name = ?");
-        params.push_back(criteria.exact_name);
+        predicates.push_back(makePredicate("r.name = ?", {criteria.exact_name}, kIndexedPredicateCost));
+        predicates.back().selective = true;
     }
     if (!criteria.exact_author.empty()) {
-        conditions.push_back("r.author = ?");
-        params.push_back(criteria.exact_author);
+        predicates.push_back(makePredicate("r.author = ?", {criteria.exact_author}, kIndexedPredicateCost));
+        predicates.back().listing_index = "idx_recipes_author_listing";
     }
     if (criteria.prep_time_range.size() == 2) {
-        conditions.push_back("r.prep_time_minutes BETWEEN ? AND ?");
-        params.push_back(criteria.prep_time_range[0]);
-        params.push_back(criteria.prep_time_range[1]);
+        predicates.push_back(makePredicate("r.prep_time_minutes BETWEEN ? AND ?",
+            {criteria.prep_time_range[0], criteria.prep_time_range[1]}, kColumnPredicateCost));
     }
     if (criteria.cook_time_range.size() == 2) {
-        conditions.push_back("r.cook_time_minutes BETWEEN ? AND ?");
-        params.push_back(criteria.cook_time_range[0]);
-        params.push_back(criteria.cook_time_range[1]);
+        predicates.push_back(makePredicate("r.cook_time_minutes BETWEEN ? AND ?",
+            {criteria.cook_time_range[0], criteria.cook_time_range[1]}, kColumnPredicateCost));
     }
     if (criteria.servings_range.size() == 2) {
-        conditions.push_back("r.servings BETWEEN ? AND ?");
-        params.push_back(criteria.servings_range[0]);
-        params.push_back(criteria.servings_range[1]);
+        predicates.push_back(makePredicate("r.servings BETWEEN ? AND ?",
+            {criteria.servings_range[0], criteria.servings_range[1]}, kColumnPredicateCost));
     }
     if (criteria.is_favorite) {
-        conditions.push_back("r.is_favorite = 1");
+        // Must match the WHERE clause of idx_recipes_favorites exactly, or SQLite will not use the partial index
+        predicates.push_back(makePredicate("r.is_favorite = 1", {}, kIndexedPredicateCost));
+        predicates.back().listing_index = "idx_recipes_favorites";
     }
     if (criteria.dates.size() == 2 && !criteria.dates[0].empty() && !criteria.dates[1].empty()) {
-        conditions.push_back("date(r.date_added) BETWEEN ? AND ?");
-        params.push_back(criteria.dates[0]);
-        params.push_back(criteria.dates[1]);
+        predicates.push_back(makePredicate("date(r.date_added) BETWEEN ? AND ?",
+            {criteria.dates[0], criteria.dates[1]}, kColumnPredicateCost));
     }
     if (!criteria.source.empty()) {
-        conditions.push_back("r.source = ?");
-        params.push_back(criteria.source);
+        predicates.push_back(makePredicate("r.source = ?", {criteria.source}, kIndexedPredicateCost));
+        predicates.back().listing_index = "idx_recipes_source_listing";
     }
     if (!criteria.source_url.empty()) {
-        conditions.push_back("r.source_url = ?");
-        params.push_back(criteria.source_url);
+        predicates.push_back(makePredicate("r.source_url = ?", {criteria.source_url}, kColumnPredicateCost));
     }
 
     // Many-to-Many
     if (!criteria.tags.empty()) {
-        std::string placeholders;
-        for (int i = 0; i < criteria.tags.size(); ++i) {
-            placeholders += (i == 0 ? "?" : ", ?");
-        }
         std::string subquery = R"(r.recipe_id IN (
             SELECT rt.recipe_id FROM recipe_tags rt JOIN tags t ON rt.tag_id = t.tag_id
-            WHERE t.name in ()" + placeholders + R"()
+            WHERE t.name in ()" + placeholderList(criteria.tags.size()) + R"()
             GROUP BY rt.recipe_id
             HAVING COUNT (DISTINCT t.name) = ?
         ))";
-        conditions.push_back(subquery);
-        for (const auto& tag : criteria.tags) {
-            params.push_back(tag);
-        }
+        std::vector<SqlValue> params(criteria.tags.begin(), criteria.tags.end());
         params.push_back(static_cast<int64_t>(criteria.tags.size()));
+        predicates.push_back(makePredicate(subquery, std::move(params), kLinkPredicateCost));
+        predicates.back().selective = true;
     }
     if (!criteria.exclude_tags.empty()) {
-        std::string placeholders;
-        for (size_t i = 0; i < criteria.exclude_tags.size(); ++i) {
-            placeholders += (i == 0 ? "?" : ", ?");
-        }
-
         std::string subquery = R"(NOT EXISTS (
             SELECT 1 FROM recipe_tags rt JOIN tags t ON rt.tag_id = t.tag_id
-            WHERE rt.recipe_id = r.recipe_id AND t.name IN ()" + placeholders + R"()
+            WHERE rt.recipe_id = r.recipe_id AND t.name IN ()" + placeholderList(criteria.exclude_tags.size()) + R"()
         ))";
-
-        conditions.push_back(subquery);
-
-        for (const auto& tag : criteria.exclude_tags) {
-            params.push_back(tag);
-        }
+        std::vector<SqlValue> params(criteria.exclude_tags.begin(), criteria.exclude_tags.end());
+        predicates.push_back(makePredicate(subquery, std::move(params), kExclusionPredicateCost));
     }
-    if (!criteria.ingredients.empty()) {
-        std::string placeholders;
-        for (int i = 0; i < criteria.ingredients.size(); ++i) {
-            placeholders += (i == 0 ? "?" : ", ?");
-        }
+    if (!criteria.ingredients.empty() && criteria.expand_ingredients) {
+        // Every requested ingredient must be matched by itself or by one of its variants
+        std::string subquery = R"(r.recipe_id IN (
+            SELECT ri.recipe_id FROM ()" + ingredientVariantsSql(criteria.ingredients.size()) + R"() AS v
+            JOIN recipe_ingredients ri ON ri.ingredient_id = v.variant_id
+            GROUP BY ri.recipe_id
+            HAVING COUNT (DISTINCT v.requested) = ?
+        ))";
+        std::vector<SqlValue> params(criteria.ingredients.begin(), criteria.ingredients.end());
+        params.insert(params.end(), criteria.ingredients.begin(), criteria.ingredients.end());
+        params.push_back(static_cast<int64_t>(criteria.ingredients.size()));
+        predicates.push_back(makePredicate(subquery, std::move(params), kLinkPredicateCost));
+        predicates.back().selective = true;
+    } else if (!criteria.ingredients.empty()) {
         std::string subquery = R"(r.recipe_id IN (
             SELECT ri.recipe_id FROM recipe_ingredients ri JOIN ingredients i ON ri.ingredient_id = i.ingredient_id
-            WHERE i.name in ()" + placeholders + R"()
+            WHERE i.name in ()" + placeholderList(criteria.ingredients.size()) + R"()
             GROUP BY ri.recipe_id
             HAVING COUNT (DISTINCT i.name) = ?
         ))";
-        conditions.push_back(subquery);
-        for (const auto& ingredient : criteria.ingredients) {
-            params.push_back(ingredient);
-        }
+        std::vector<SqlValue> params(criteria.ingredients.begin(), criteria.ingredients.end());
         params.push_back(static_cast<int64_t>(criteria.ingredients.size()));
+        predicates.push_back(makePredicate(subquery, std::move(params), kLinkPredicateCost));
+        predicates.back().selective = true;
     }
-    if (!criteria.exclude_ingredients.empty()) {
-        std::string placeholders;
-        for (size_t i = 0; i < criteria.exclude_ingredients.size(); ++i) {
-            placeholders += (i == 0 ? "?" : ", ?");
-        }
-
+    if (!criteria.exclude_ingredients.empty() && criteria.expand_exclude_ingredients) {
+        std::string subquery = R"(r.recipe_id NOT IN (
+            SELECT ri.recipe_id FROM ()" + ingredientVariantsSql(criteria.exclude_ingredients.size()) + R"() AS v
+            JOIN recipe_ingredients ri ON ri.ingredient_id = v.variant_id
+        ))";
+        std::vector<SqlValue> params(criteria.exclude_ingredients.begin(), criteria.exclude_ingredients.end());
+        params.insert(params.end(), criteria.exclude_ingredients.begin(), criteria.exclude_ingredients.end());
+        predicates.push_back(makePredicate(subquery, std::move(params), kLinkPredicateCost));
+    } else if (!criteria.exclude_ingredients.empty()) {
         std::string subquery = R"(NOT EXISTS (
             SELECT 1 FROM recipe_ingredients ri JOIN ingredients i ON ri.ingredient_id = i.ingredient_id
-            WHERE ri.recipe_id = r.recipe_id AND i.name IN ()" + placeholders + R"()
+            WHERE ri.recipe_id = r.recipe_id AND i.name IN ()" + placeholderList(criteria.exclude_ingredients.size()) + R"()
         ))";
+        std::vector<SqlValue> params(criteria.exclude_ingredients.begin(), criteria.exclude_ingredients.end());
+        predicates.push_back(makePredicate(subquery, std::move(params), kExclusionPredicateCost));
+    }
+
+    return predicates;
+}
+
+
+PlanNode makeGroup(SearchExpression::Type type, std::vector<PlanNode> children) {
+    PlanNode node;
+    node.type = type;
+    node.children = std::move(children);
+    return node;
+}
+
+
+bool isTrue(const PlanNode& node) {
+    return node.type == SearchExpression::Type::And && node.children.empty();
+}
+
+
+bool isFalse(const PlanNode& node) {
+    return node.type == SearchExpression::Type::Or && node.children.empty();
+}
 
-        conditions.push_back(subquery);
 
-        for (const auto& ingredient : criteria.exclude_ingredients) {
-            params.push_back(ingredient);
+// Conjuncts of a node: the children of an AND, or the node itself
+std::vector<PlanNode> conjuncts(const PlanNode& node) {
+    if (node.type == SearchExpression::Type::And) return node.children;
+    return {node};
+}
+
+
+// Same as above for a plan that is no longer needed, moving its nodes instead of copying them
+std::vector<PlanNode> conjuncts(PlanNode&& node) {
+    if (node.type == SearchExpression::Type::And) return std::move(node.children);
+    std::vector<PlanNode> terms;
+    terms.push_back(std::move(node));
+    return terms;
+}
+
+
+PlanNode normalizePlan(PlanNode node, bool negate);
+
+
+// Flattens, folds and deduplicates the operands of an AND/OR, then orders them by cost
+PlanNode finishGroup(SearchExpression::Type type, std::vector<PlanNode> operands) {
+    const bool is_and = type == SearchExpression::Type::And;
+    std::vector<PlanNode> children;
+    for (PlanNode& operand : operands) {
+        // TRUE is the identity of AND and absorbs OR; FALSE is the reverse
+        if (is_and ? isTrue(operand) : isFalse(operand)) continue;
+        if (is_and ? isFalse(operand) : isTrue(operand)) return operand;
+
+        if (operand.type == type) {
+            for (PlanNode& child : operand.children) children.push_back(std::move(child));
+        } else {
+            children.push_back(std::move(operand));
         }
     }
-    if (!conditions.empty()) {
-        sql += " WHERE " + conditions[0];
-        for (size_t i = 1; i < conditions.size(); ++i) {
-            sql += " AND " + conditions[i];
+
+    // Repeated subexpressions are only evaluated once
+    std::sort(children.begin(), children.end(), [](const PlanNode& a, const PlanNode& b) { return a.key < b.key; });
+    children.erase(std::unique(children.begin(), children.end(), [](const PlanNode& a, const PlanNode& b) { return a.key == b.key; }), children.end());
+
+    if (!is_and && children.size() > 1) {
+        // Factor out predicates shared by every branch: (a AND b) OR (a AND c) becomes a AND (b OR c)
+        std::vector<PlanNode> common = conjuncts(children[0]);
+        for (size_t i = 1; i < children.size() && !common.empty(); ++i) {
+            std::vector<PlanNode> branch = conjuncts(children[i]);
+            std::erase_if(common, [&](const PlanNode& shared) {
+                return std::none_of(branch.begin(), branch.end(), [&](const PlanNode& c) { return c.key == shared.key; });
+            });
+        }
+
+        if (!common.empty()) {
+            std::vector<PlanNode> branches;
+            for (const PlanNode& child : children) {
+                std::vector<PlanNode> remaining = conjuncts(child);
+                std::erase_if(remaining, [&](const PlanNode& c) {
+                    return std::any_of(common.begin(), common.end(), [&](const PlanNode& shared) { return shared.key == c.key; });
+                });
+                branches.push_back(finishGroup(SearchExpression::Type::And, std::move(remaining)));
+            }
+            common.push_back(finishGroup(SearchExpression::Type::Or, std::move(branches)));
+            return finishGroup(SearchExpression::Type::And, std::move(common));
         }
     }
-    sql += ";";
 
-    return {sql, params};
+    if (children.size() == 1) return std::move(children[0]);
+
+    // Cheapest first, so short-circuit evaluation skips the expensive predicates as often as possible
+    std::stable_sort(children.begin(), children.end(), [](const PlanNode& a, const PlanNode& b) { return a.cost < b.cost; });
+
+    PlanNode group = makeGroup(type, std::move(children));
+    std::vector<std::string> keys;
+    group.selective = !is_and;
+    for (const PlanNode& child : group.children) {
+        group.cost += child.cost;
+        keys.push_back(child.key);
+        // An AND is narrowed down by any selective operand, an OR only if every branch is
+        group.selective = is_and ? group.selective || child.selective : group.selective && child.selective;
+    }
+    std::sort(keys.begin(), keys.end());
+    group.key = is_and ? "AND(" : "OR(";
+    for (const std::string& key : keys) group.key += key + ";";
+    group.key += ")";
+    return group;
 }
 
 
-std::vector<long long> Database::executeSearch(std::pair<std::string, std::vector<SqlValue>> query_parts) {
-    const std::string& sql = query_parts.first;
-    const std::vector<SqlValue>& params = query_parts.second;
+// Pushes negations down to the predicates (De Morgan) and simplifies every group
+PlanNode normalizePlan(PlanNode node, bool negate) {
+    switch (node.type) {
+        case SearchExpression::Type::Leaf: {
+            if (!negate) return node;
+            PlanNode negated = makePredicate("NOT (" + node.sql + ")", node.params, node.cost);
+            return negated;
+        }
+        case SearchExpression::Type::Not:
+            if (node.children.empty()) return normalizePlan(makeGroup(SearchExpression::Type::And, {}), negate);
+            return normalizePlan(std::move(node.children[0]), !negate);
+        case SearchExpression::Type::And:
+        case SearchExpression::Type::Or: {
+            SearchExpression::Type type = node.type;
+            if (negate) {
+                type = (type == SearchExpression::Type::And) ? SearchExpression::Type::Or : SearchExpression::Type::And;
+            }
+            std::vector<PlanNode> operands;
+            for (PlanNode& child : node.children) {
+                operands.push_back(normalizePlan(std::move(child), negate));
+            }
+            return finishGroup(type, std::move(operands));
+        }
+    }
+    return node;
+}
+
+
+PlanNode planFromExpression(const SearchExpression& expression) {
+    if (expression.type == SearchExpression::Type::Leaf) {
+        return makeGroup(SearchExpression::Type::And, criteriaPredicates(expression.criteria));
+    }
+
+    std::vector<PlanNode> children;
+    for (const SearchExpression& child : expression.children) {
+        children.push_back(planFromExpression(child));
+    }
+    return makeGroup(expression.type, std::move(children));
+}
+
+
+void renderPlan(const PlanNode& node, std::string& sql, std::vector<SqlValue>& params) {
+    if (node.type == SearchExpression::Type::Leaf) {
+        sql += node.sql;
+        params.insert(params.end(), node.params.begin(), node.params.end());
+        return;
+    }
+    if (node.children.empty()) {
+        sql += isTrue(node) ? "1" : "0";
+        return;
+    }
+
+    const char* separator = node.type == SearchExpression::Type::And ? " AND " : " OR ";
+    sql += "(";
+    for (size_t i = 0; i < node.children.size(); ++i) {
+        if (i > 0) sql += separator;
+        renderPlan(node.children[i], sql, params);
+    }
+    sql += ")";
+}
+
+
+// Index that provides each sort order, used to force an index-ordered scan when nothing narrows the recipes down
+const char* sortIndexName(SortKey key) {
+    switch (key) {
+        case SortKey::DateAdded: return "idx_recipes_date_added";
+        case SortKey::TotalTime: return "idx_recipes_total_time";
+        case SortKey::PrepTime: return "idx_recipes_prep_time";
+        case SortKey::CookTime: return "idx_recipes_cook_time";
+        case SortKey::Name: return "idx_recipes_name";
+        default: return nullptr;
+    }
+}
+
+
+// Listing indexes in order of preference when a query has several listing terms: an author or source
+// usually narrows the recipes down further than the favorites flag
+const std::array<const char*, 3> kListingIndexes = {"idx_recipes_author_listing", "idx_recipes_source_listing", "idx_recipes_favorites"};
+
+
+// Columns of a RecipeSummary, all of which every listing index covers
+constexpr const char* kSummaryColumns = "r.recipe_id, r.name, r.author, r.source, r.source_url, r.prep_time_minutes, r.cook_time_minutes, "
+                                        "r.servings, r.is_favorite, COALESCE(CAST(strftime('%s', r.date_added) AS INTEGER), 0)";
 
-    SqliteStatement stmt_wrapper(db_, sql.c_str());
-    sqlite3_stmt* stmt = stmt_wrapper.stmt;
 
+// Column expression matching the sort index exactly, so the planner can use it for ORDER BY
+const char* sortExpression(SortKey key) {
+    switch (key) {
+        case SortKey::DateAdded: return "r.date_added";
+        case SortKey::TotalTime: return "r.prep_time_minutes + r.cook_time_minutes";
+        case SortKey::PrepTime: return "r.prep_time_minutes";
+        case SortKey::CookTime: return "r.cook_time_minutes";
+        case SortKey::Name: return "r.name";
+        default: return nullptr;
+    }
+}
+
+
+std::pair<std::string, std::vector<SqlValue>> Database::buildSearchQuery(const SearchExpression& expression, SortKey sort_by,
+                                                                         SortDirection sort_direction, size_t limit, bool summaries) {
+    std::string sql = std::string("SELECT ") + (summaries ? kSummaryColumns : "r.recipe_id") + " FROM recipes AS r";
+    std::vector<SqlValue> params;
+    std::string order_by;
+    const char* direction = sort_direction == SortDirection::Descending ? " DESC" : " ASC";
+
+    // Every top-level conjunct is a separate WHERE term, so each one can drive an index on its own
+    std::vector<PlanNode> terms = conjuncts(normalizePlan(planFromExpression(expression), false));
+
+    std::string where;
+    std::vector<SqlValue> where_params;
+    size_t listing_rank = kListingIndexes.size();
+    bool selective = false;
+    for (const PlanNode& term : terms) {
+        if (!where.empty()) where += " AND ";
+        selective = selective || term.selective;
+        if (term.listing_index) {
+            size_t rank = std::find(kListingIndexes.begin(), kListingIndexes.end(), std::string_view(term.listing_index)) - kListingIndexes.begin();
+            listing_rank = std::min(listing_rank, rank);
+        }
+
+        if (sort_by == SortKey::Relevance && order_by.empty() && !term.fts_query.empty()) {
+            // Join the FTS table directly so its rank is available; FTS5 hands rows back already ordered by rank
+            sql += " JOIN search ON search.rowid = r.recipe_id";
+            where += "search MATCH ?";
+            where_params.push_back(term.fts_query);
+            // bm25 ranks are negative with the best match lowest, so "most relevant first" is ascending rank
+            order_by = std::string("search.rank") + (sort_direction == SortDirection::Descending ? " ASC" : " DESC");
+            continue;
+        }
+        renderPlan(term, where, where_params);
+    }
+
+    if (listing_rank < kListingIndexes.size() && order_by.empty()) {
+        // A listing is small, so reading it from its covering index and sorting beats walking a sort index over every
+        // recipe. The listing indexes are ordered by date_added after their key, so that order only sorts ties. A tag,
+        // ingredient, name or keyword match may narrow the recipes down further, so the planner chooses there.
+        if (!selective) sql += std::string(" INDEXED BY ") + kListingIndexes[listing_rank];
+        if (const char* sort_column = sortExpression(sort_by)) {
+            order_by = std::string(sort_column) + direction + ", r.recipe_id" + direction;
+        } else if (sort_by != SortKey::None) {
+            order_by = std::string("r.recipe_id") + direction;
+        }
+    } else if (const char* index = sortIndexName(sort_by)) {
+        // Without a selective predicate, walk the sort index instead of sorting the matches; with a limit the scan
+        // stops after k rows. A tag, ingredient, name or keyword match is better read through its own index and
+        // sorted, so the planner chooses there.
+        if (!selective) sql += std::string(" INDEXED BY ") + index;
+        order_by = std::string(sortExpression(sort_by)) + direction + ", r.recipe_id" + direction;
+    } else if (order_by.empty() && sort_by != SortKey::None) {
+        // Relevance without FTS criteria has nothing to rank, so fall back to primary key order
+        order_by = std::string("r.recipe_id") + direction;
+    }
+
+    if (!where.empty()) {
+        sql += " WHERE " + where;
+        params = std::move(where_params);
+    }
+    if (!order_by.empty()) {
+        sql += " ORDER BY " + order_by;
+    }
+    if (limit > 0) {
+        sql += " LIMIT ?";
+        params.push_back(static_cast<int64_t>(limit));
+    }
+    sql += ";";
+
+    return {std::move(sql), std::move(params)};
+}
+
+
+void bindSearchParameters(sqlite3_stmt* stmt, const std::vector<SqlValue>& params) {
     for (int i = 0; i < params.size(); ++i) {
         std::visit([&](auto&& arg) {
             using T = std::decay_t<decltype(arg)>;
@@ -1224,6 +2743,14 @@ std::vector<long long> Database::executeSearch(std::pair<std::string, std::vecto
             }
         }, params[i]);
     }
+}
+
+
+std::vector<long long> Database::executeSearch(std::pair<std::string, std::vector<SqlValue>> query_parts) {
+    relieveMemoryPressure();
+    SqliteStatement stmt_wrapper(db_, query_parts.first.c_str());
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
+    bindSearchParameters(stmt, query_parts.second);
 
     std::vector<long long> results;
     while (sqlite3_step(stmt) == SQLITE_ROW) {
@@ -1235,10 +2762,325 @@ std::vector<long long> Database::executeSearch(std::pair<std::string, std::vecto
 
 
 std::vector<long long> Database::search(const SearchData& criteria) {
+    if (trace_ && !tracing_) return traceCall(TraceCall::Search, encodeTraceArguments(criteria), [&] { return search(criteria); });
     if (!isOpen()) {
-        std::cerr << "Database not open. Cannot get recipe by ID." << std::endl;
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot get recipe by ID.";
         return {}; // Return empty recipe
     }
 
-    return executeSearch(buildSearchQuery(criteria));
+    return executeSearch(buildSearchQuery(SearchExpression::leaf(criteria), criteria.sort_by, criteria.sort_direction, criteria.limit));
+}
+
+
+std::vector<RecipeSummary> Database::searchSummaries(const SearchData& criteria) {
+    if (trace_ && !tracing_) return traceCall(TraceCall::SearchSummaries, encodeTraceArguments(criteria), [&] { return searchSummaries(criteria); });
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot search.";
+        return {};
+    }
+
+    relieveMemoryPressure();
+    auto [sql, params] = buildSearchQuery(SearchExpression::leaf(criteria), criteria.sort_by, criteria.sort_direction, criteria.limit, true);
+    SqliteStatement stmt_wrapper(db_, sql.c_str());
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
+    bindSearchParameters(stmt, params);
+
+    auto text = [&](int column) {
+        const char* value = reinterpret_cast<const char*>(sqlite3_column_text(stmt, column));
+        return std::string(value ? value : "");
+    };
+    std::vector<RecipeSummary> summaries;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        RecipeSummary summary;
+        summary.recipe_id = sqlite3_column_int64(stmt, 0);
+        summary.name = text(1);
+        summary.author = text(2);
+        summary.source = text(3);
+        summary.source_url = text(4);
+        summary.prep_time_minutes = static_cast<uint16_t>(sqlite3_column_int(stmt, 5));
+        summary.cook_time_minutes = static_cast<uint16_t>(sqlite3_column_int(stmt, 6));
+        summary.servings = static_cast<uint16_t>(sqlite3_column_int(stmt, 7));
+        summary.is_favorite = sqlite3_column_int(stmt, 8) != 0;
+        summary.date_added = sqlite3_column_int64(stmt, 9);
+        summaries.push_back(std::move(summary));
+    }
+    return summaries;
+}
+
+
+std::vector<long long> Database::searchExpression(const SearchExpression& expression, SortKey sort_by, SortDirection sort_direction, size_t limit) {
+    if (trace_ && !tracing_) return traceCall(TraceCall::SearchExpression, encodeTraceArguments(expression, sort_by, sort_direction, limit),
+                                           [&] { return searchExpression(expression, sort_by, sort_direction, limit); });
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot search.";
+        return {};
+    }
+
+    return executeSearch(buildSearchQuery(expression, sort_by, sort_direction, limit));
+}
+
+
+std::vector<CoverageMatch> Database::searchByCoverage(const CoverageQuery& query) {
+    if (trace_ && !tracing_) return traceCall(TraceCall::SearchByCoverage, encodeTraceArguments(query), [&] { return searchByCoverage(query); });
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot search by coverage.";
+        return {};
+    }
+
+    std::vector<std::string> names = query.ingredients;
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    if (names.empty() || query.min_matches > names.size()) return {};
+    const size_t min_matches = std::max<size_t>(query.min_matches, 1);
+
+    // Load the posting list of every given ingredient from idx_recipe_ingredients_ingredient, along with each recipe's
+    // ingredient totals, counted in the same statement for the recipes in those lists only
+    struct Posting {
+        long long recipe_id;
+        bool optional;              // The given ingredient is optional in this recipe
+        uint32_t total;             // Ingredients of the recipe
+        uint32_t optional_total;    // Optional ones among them
+    };
+    std::vector<std::vector<Posting>> postings;
+    {
+        const std::string placeholders = placeholderList(names.size());
+        std::string sql = R"(
+            SELECT ri.ingredient_id, ri.recipe_id, ri.optional, t.total, t.optional_total
+            FROM ingredients i JOIN recipe_ingredients ri ON ri.ingredient_id = i.ingredient_id
+            JOIN (
+                SELECT a.recipe_id, COUNT(*) AS total, COALESCE(SUM(a.optional), 0) AS optional_total
+                FROM recipe_ingredients a
+                WHERE a.recipe_id IN (
+                    SELECT ci.recipe_id FROM ingredients ni JOIN recipe_ingredients ci ON ci.ingredient_id = ni.ingredient_id
+                    WHERE ni.name IN ()" + placeholders + R"()
+                )
+                GROUP BY a.recipe_id
+            ) AS t ON t.recipe_id = ri.recipe_id
+            WHERE i.name IN ()" + placeholders + R"()
+            ORDER BY ri.ingredient_id, ri.recipe_id;
+        )";
+        SqliteStatement stmt_wrapper(db_, sql.c_str());
+        sqlite3_stmt* stmt = stmt_wrapper.stmt;
+        if (stmt == nullptr) return {};
+
+        for (size_t i = 0; i < names.size(); ++i) {
+            sqlite3_bind_text(stmt, i + 1, names[i].c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, names.size() + i + 1, names[i].c_str(), -1, SQLITE_STATIC);
+        }
+
+        long long current_ingredient = -1;
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            long long ingredient_id = sqlite3_column_int64(stmt, 0);
+            if (ingredient_id != current_ingredient) {
+                postings.emplace_back();
+                current_ingredient = ingredient_id;
+            }
+            postings.back().push_back({sqlite3_column_int64(stmt, 1), sqlite3_column_int(stmt, 2) != 0,
+                                       static_cast<uint32_t>(sqlite3_column_int64(stmt, 3)), static_cast<uint32_t>(sqlite3_column_int64(stmt, 4))});
+        }
+        if (rc != SQLITE_DONE) {
+            LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to load ingredient postings: " << sqlite3_errmsg(db_);
+            return {};
+        }
+    }
+    if (postings.size() < min_matches) return {};
+
+    // Recipes allowed by the additional filters, in recipe_id order
+    std::optional<std::vector<long long>> allowed;
+    if (!criteriaPredicates(query.filters).empty()) {
+        allowed = executeSearch(buildSearchQuery(SearchExpression::leaf(query.filters), SortKey::None, SortDirection::Ascending, 0));
+        std::sort(allowed->begin(), allowed->end());
+    }
+
+    // Worst match on top, so the heap holds the best `limit` matches seen so far
+    auto better = [](const CoverageMatch& a, const CoverageMatch& b) {
+        if (a.score != b.score) return a.score > b.score;
+        if (a.missing_optional != b.missing_optional) return a.missing_optional < b.missing_optional;
+        if (a.matched != b.matched) return a.matched > b.matched;
+        return a.recipe_id < b.recipe_id;
+    };
+    std::priority_queue<CoverageMatch, std::vector<CoverageMatch>, decltype(better)> top(better);
+
+    // k-way merge: the heap holds one cursor per posting list, ordered by the recipe_id it points at
+    using Cursor = std::pair<long long, size_t>; // (recipe_id, posting list index)
+    std::priority_queue<Cursor, std::vector<Cursor>, std::greater<Cursor>> cursors;
+    std::vector<size_t> positions(postings.size(), 0);
+    for (size_t list = 0; list < postings.size(); ++list) {
+        cursors.emplace(postings[list][0].recipe_id, list);
+    }
+
+    while (!cursors.empty()) {
+        const long long recipe_id = cursors.top().first;
+        size_t matched = 0;
+        size_t matched_optional = 0;
+        size_t total = 0;
+        size_t optional = 0;
+
+        // Pop every cursor positioned on this recipe, counting the lists it appears in
+        while (!cursors.empty() && cursors.top().first == recipe_id) {
+            size_t list = cursors.top().second;
+            cursors.pop();
+            const Posting& posting = postings[list][positions[list]];
+            ++matched;
+            if (posting.optional) ++matched_optional;
+            total = posting.total;
+            optional = posting.optional_total;
+            if (++positions[list] < postings[list].size()) {
+                cursors.emplace(postings[list][positions[list]].recipe_id, list);
+            }
+        }
+
+        if (matched < min_matches) continue;
+        if (allowed && !std::binary_search(allowed->begin(), allowed->end(), recipe_id)) continue;
+
+        CoverageMatch match;
+        match.recipe_id = recipe_id;
+        match.matched = matched;
+        match.required = total - optional;
+        match.matched_required = matched - matched_optional;
+        match.missing_optional = optional - matched_optional;
+        match.score = match.required == 0 ? 1.0 : static_cast<double>(match.matched_required) / match.required;
+
+        if (query.limit == 0 || top.size() < query.limit) {
+            top.push(match);
+        } else if (better(match, top.top())) {
+            top.pop();
+            top.push(match);
+        }
+    }
+
+    std::vector<CoverageMatch> results;
+    results.reserve(top.size());
+    while (!top.empty()) {
+        results.push_back(top.top());
+        top.pop();
+    }
+    std::reverse(results.begin(), results.end());
+    return results;
+}
+
+
+std::optional<MealPlan> Database::planMeals(const MealPlanQuery& query) {
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot plan meals.";
+        return std::nullopt;
+    }
+
+    relieveMemoryPressure();
+
+    // The candidates with their non-optional ingredients, which are the ones that go on the shopping list. Recipes
+    // without any still come back once, with a NULL ingredient.
+    std::vector<long long> recipe_ids;
+    std::vector<std::pair<long long, long long>> links;
+    {
+        auto [filter_sql, params] = buildSearchQuery(SearchExpression::leaf(query.filters), SortKey::None, SortDirection::Ascending, 0);
+        filter_sql.pop_back();  // Trailing ';'
+        const std::string sql = "SELECT c.recipe_id, ri.ingredient_id FROM (" + filter_sql + ") AS c"
+            " LEFT JOIN recipe_ingredients AS ri ON ri.recipe_id = c.recipe_id AND ri.optional = 0 ORDER BY c.recipe_id;";
+        SqliteStatement stmt_wrapper(db_, sql.c_str());
+        sqlite3_stmt* stmt = stmt_wrapper.stmt;
+        if (stmt == nullptr) return std::nullopt;
+        bindSearchParameters(stmt, params);
+
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            const long long recipe_id = sqlite3_column_int64(stmt, 0);
+            if (recipe_ids.empty() || recipe_ids.back() != recipe_id) recipe_ids.push_back(recipe_id);
+            if (sqlite3_column_type(stmt, 1) != SQLITE_NULL) links.emplace_back(recipe_id, sqlite3_column_int64(stmt, 1));
+        }
+        if (rc != SQLITE_DONE) {
+            LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to load recipe ingredients: " << sqlite3_errmsg(db_);
+            return std::nullopt;
+        }
+    }
+
+    // Pantry names that are not in the library cannot be on any shopping list
+    std::vector<long long> pantry;
+    for (size_t begin = 0; begin < query.pantry.size(); begin += kBulkResolveChunk) {
+        const size_t count = std::min(kBulkResolveChunk, query.pantry.size() - begin);
+        const std::string sql = "SELECT ingredient_id FROM ingredients WHERE name IN (" + placeholderList(count) + ");";
+        SqliteStatement stmt_wrapper(db_, sql.c_str());
+        sqlite3_stmt* stmt = stmt_wrapper.stmt;
+        if (stmt == nullptr) return std::nullopt;
+        for (size_t i = 0; i < count; ++i) {
+            sqlite3_bind_text(stmt, static_cast<int>(i + 1), query.pantry[begin + i].c_str(), -1, SQLITE_STATIC);
+        }
+
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) pantry.push_back(sqlite3_column_int64(stmt, 0));
+        if (rc != SQLITE_DONE) {
+            LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to look up pantry ingredients: " << sqlite3_errmsg(db_);
+            return std::nullopt;
+        }
+    }
+
+    const MealPlanCandidates candidates = buildMealPlanCandidates(std::move(recipe_ids), links, pantry);
+    MealPlan plan = searchMealPlan(candidates, query);
+
+    // Names are only needed for the ingredients of the chosen plan
+    const std::vector<long long> shopping_ids = mealPlanShoppingIds(candidates, plan.recipe_ids);
+    for (size_t begin = 0; begin < shopping_ids.size(); begin += kBulkResolveChunk) {
+        const size_t count = std::min(kBulkResolveChunk, shopping_ids.size() - begin);
+        const std::string sql = "SELECT name FROM ingredients WHERE ingredient_id IN (" + placeholderList(count) + ");";
+        SqliteStatement stmt_wrapper(db_, sql.c_str());
+        sqlite3_stmt* stmt = stmt_wrapper.stmt;
+        if (stmt == nullptr) return std::nullopt;
+        for (size_t i = 0; i < count; ++i) {
+            sqlite3_bind_int64(stmt, static_cast<int>(i + 1), shopping_ids[begin + i]);
+        }
+
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            plan.shopping_list.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+        }
+        if (rc != SQLITE_DONE) {
+            LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db_)) << "Failed to load shopping list names: " << sqlite3_errmsg(db_);
+            return std::nullopt;
+        }
+    }
+    std::sort(plan.shopping_list.begin(), plan.shopping_list.end());
+    return plan;
+}
+
+
+std::vector<SimilarRecipe> Database::similarRecipes(long long recipe_id, size_t k, const SearchData& filters, SimilarityMeasure measure) {
+    if (trace_ && !tracing_) return traceCall(TraceCall::SimilarRecipes, encodeTraceArguments(recipe_id, k, filters, measure),
+                                           [&] { return similarRecipes(recipe_id, k, filters, measure); });
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot find similar recipes.";
+        return {};
+    }
+
+    relieveMemoryPressure();
+    if (!signatures_->refresh(db_)) return {};
+
+    // Recipes allowed by the additional filters, in recipe_id order
+    std::optional<std::vector<long long>> allowed;
+    if (!criteriaPredicates(filters).empty()) {
+        allowed = executeSearch(buildSearchQuery(SearchExpression::leaf(filters), SortKey::None, SortDirection::Ascending, 0));
+        std::sort(allowed->begin(), allowed->end());
+    }
+    return signatures_->mostSimilar(recipe_id, k, measure, allowed ? &*allowed : nullptr);
+}
+
+
+std::vector<TextMatch> Database::similarRecipesByText(long long recipe_id, size_t k, const SearchData& filters) {
+    if (trace_ && !tracing_) return traceCall(TraceCall::SimilarRecipesByText, encodeTraceArguments(recipe_id, k, filters),
+                                           [&] { return similarRecipesByText(recipe_id, k, filters); });
+    if (!isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot find similar recipes.";
+        return {};
+    }
+
+    relieveMemoryPressure();
+    if (!text_index_->refresh(db_)) return {};
+
+    // Recipes allowed by the additional filters, in recipe_id order
+    std::optional<std::vector<long long>> allowed;
+    if (!criteriaPredicates(filters).empty()) {
+        allowed = executeSearch(buildSearchQuery(SearchExpression::leaf(filters), SortKey::None, SortDirection::Ascending, 0));
+        std::sort(allowed->begin(), allowed->end());
+    }
+    return text_index_->mostSimilar(recipe_id, k, allowed ? &*allowed : nullptr);
 }
\ No newline at end of file
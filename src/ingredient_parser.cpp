@@ -0,0 +1,497 @@
+#include "ingredient_parser.h"
+#include <charconv>
+
+
+// A spelling of a unit, in lower case, and the canonical unit it stands for
+struct UnitAlias {
+    std::string_view spelling;
+    std::string_view unit;
+};
+
+
+// Matched case-insensitively; the case-sensitive "T" (tablespoon) and "t" (teaspoon) are handled in parseUnit
+constexpr UnitAlias kUnitAliases[] = {
+    {"cup", "cup"}, {"cups", "cup"}, {"c", "cup"},
+    {"tablespoon", "tbsp"}, {"tablespoons", "tbsp"}, {"tbsp", "tbsp"}, {"tbsps", "tbsp"}, {"tbs", "tbsp"}, {"tbl", "tbsp"}, {"tblsp", "tbsp"},
+    {"teaspoon", "tsp"}, {"teaspoons", "tsp"}, {"tsp", "tsp"}, {"tsps", "tsp"},
+    {"g", "g"}, {"gr", "g"}, {"gram", "g"}, {"grams", "g"}, {"gramme", "g"}, {"grammes", "g"},
+    {"kg", "kg"}, {"kgs", "kg"}, {"kilogram", "kg"}, {"kilograms", "kg"}, {"kilo", "kg"}, {"kilos", "kg"},
+    {"mg", "mg"}, {"milligram", "mg"}, {"milligrams", "mg"},
+    {"ml", "ml"}, {"milliliter", "ml"}, {"milliliters", "ml"}, {"millilitre", "ml"}, {"millilitres", "ml"},
+    {"l", "l"}, {"liter", "l"}, {"liters", "l"}, {"litre", "l"}, {"litres", "l"},
+    {"oz", "oz"}, {"ounce", "oz"}, {"ounces", "oz"},
+    {"lb", "lb"}, {"lbs", "lb"}, {"pound", "lb"}, {"pounds", "lb"},
+    {"pint", "pint"}, {"pints", "pint"}, {"pt", "pint"}, {"pts", "pint"},
+    {"quart", "quart"}, {"quarts", "quart"}, {"qt", "quart"}, {"qts", "quart"},
+    {"gallon", "gallon"}, {"gallons", "gallon"}, {"gal", "gallon"}, {"gals", "gallon"},
+    {"pinch", "pinch"}, {"pinches", "pinch"},
+    {"dash", "dash"}, {"dashes", "dash"},
+    {"clove", "clove"}, {"cloves", "clove"},
+    {"can", "can"}, {"cans", "can"}, {"tin", "can"}, {"tins", "can"},
+    {"package", "package"}, {"packages", "package"}, {"pkg", "package"}, {"pkgs", "package"}, {"packet", "package"}, {"packets", "package"},
+    {"slice", "slice"}, {"slices", "slice"},
+    {"stick", "stick"}, {"sticks", "stick"},
+    {"bunch", "bunch"}, {"bunches", "bunch"},
+    {"sprig", "sprig"}, {"sprigs", "sprig"},
+    {"piece", "piece"}, {"pieces", "piece"}, {"pc", "piece"}, {"pcs", "piece"},
+    {"handful", "handful"}, {"handfuls", "handful"},
+    {"jar", "jar"}, {"jars", "jar"},
+    {"bottle", "bottle"}, {"bottles", "bottle"},
+};
+
+
+// Amounts written as words; "a" and "an" count as one
+struct NumberWord {
+    std::string_view spelling;
+    double value;
+};
+
+
+constexpr NumberWord kNumberWords[] = {
+    {"a", 1}, {"an", 1}, {"one", 1}, {"two", 2}, {"three", 3}, {"four", 4}, {"five", 5}, {"six", 6},
+    {"seven", 7}, {"eight", 8}, {"nine", 9}, {"ten", 10}, {"eleven", 11}, {"twelve", 12},
+};
+
+
+bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+
+bool isAsciiLetter(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+
+/**
+ * @param text Any text
+ * @param lower A lower-case ASCII word
+ * @return true if text equals lower, ignoring the case of ASCII letters.
+ */
+bool equalsIgnoreCase(std::string_view text, std::string_view lower) {
+    if (text.size() != lower.size()) return false;
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+        if (c != lower[i]) return false;
+    }
+    return true;
+}
+
+
+/**
+ * @return Length of the whitespace character at pos (space, tab, CR or UTF-8 no-break space), 0 if there is none.
+ */
+size_t spaceAt(std::string_view s, size_t pos) {
+    if (pos >= s.size()) return 0;
+    char c = s[pos];
+    if (c == ' ' || c == '\t' || c == '\r') return 1;
+    if (c == '\xC2' && pos + 1 < s.size() && s[pos + 1] == '\xA0') return 2;
+    return 0;
+}
+
+
+size_t skipSpaces(std::string_view s, size_t pos) {
+    while (size_t length = spaceAt(s, pos)) pos += length;
+    return pos;
+}
+
+
+std::string_view trimSpaces(std::string_view s) {
+    s.remove_prefix(skipSpaces(s, 0));
+    while (!s.empty()) {
+        if (s.back() == ' ' || s.back() == '\t' || s.back() == '\r') {
+            s.remove_suffix(1);
+        } else if (s.size() >= 2 && s[s.size() - 2] == '\xC2' && s.back() == '\xA0') {
+            s.remove_suffix(2);
+        } else {
+            break;
+        }
+    }
+    return s;
+}
+
+
+/**
+ * @return The ASCII word starting at pos, empty if pos is not at a letter.
+ */
+std::string_view wordAt(std::string_view s, size_t pos) {
+    size_t end = pos;
+    while (end < s.size() && isAsciiLetter(s[end])) ++end;
+    return s.substr(pos, end - pos);
+}
+
+
+/**
+ * Reads a unicode vulgar fraction such as "½".
+ * @param value Receives the fraction's value
+ * @return Bytes consumed, 0 if there is no vulgar fraction at pos.
+ */
+size_t vulgarFractionAt(std::string_view s, size_t pos, double& value) {
+    if (pos + 1 < s.size() && s[pos] == '\xC2') {
+        switch (s[pos + 1]) {
+            case '\xBC': value = 0.25; return 2;
+            case '\xBD': value = 0.5; return 2;
+            case '\xBE': value = 0.75; return 2;
+            default: return 0;
+        }
+    }
+    if (pos + 2 < s.size() && s[pos] == '\xE2' && s[pos + 1] == '\x85') {
+        // U+2150 to U+215E
+        static constexpr double kValues[] = {
+            1.0 / 7, 1.0 / 9, 1.0 / 10, 1.0 / 3, 2.0 / 3, 1.0 / 5, 2.0 / 5, 3.0 / 5,
+            4.0 / 5, 1.0 / 6, 5.0 / 6, 1.0 / 8, 3.0 / 8, 5.0 / 8, 7.0 / 8,
+        };
+        unsigned char last = static_cast<unsigned char>(s[pos + 2]);
+        if (last >= 0x90 && last <= 0x9E) {
+            value = kValues[last - 0x90];
+            return 3;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @return Length of the fraction bar at pos ('/' or U+2044 FRACTION SLASH), 0 if there is none.
+ */
+size_t fractionBarAt(std::string_view s, size_t pos) {
+    if (pos < s.size() && s[pos] == '/') return 1;
+    if (pos + 2 < s.size() && s[pos] == '\xE2' && s[pos + 1] == '\x81' && s[pos + 2] == '\x84') return 3;
+    return 0;
+}
+
+
+/**
+ * Reads an unsigned integer or decimal number.
+ * @param is_integer Set to whether the number had no decimal part
+ * @return Bytes consumed, 0 if there is no digit at pos.
+ */
+size_t decimalAt(std::string_view s, size_t pos, double& value, bool& is_integer) {
+    size_t i = pos;
+    double result = 0;
+    while (i < s.size() && isDigit(s[i])) result = result * 10 + (s[i++] - '0');
+    if (i == pos) return 0;
+    is_integer = true;
+    if (i + 1 < s.size() && s[i] == '.' && isDigit(s[i + 1])) {
+        is_integer = false;
+        double scale = 0.1;
+        for (++i; i < s.size() && isDigit(s[i]); ++i, scale *= 0.1) result += (s[i] - '0') * scale;
+    }
+    value = result;
+    return i - pos;
+}
+
+
+/**
+ * Reads a simple fraction such as "3/4".
+ * @return Bytes consumed, 0 if there is no fraction at pos.
+ */
+size_t simpleFractionAt(std::string_view s, size_t pos, double& value) {
+    double numerator = 0;
+    double denominator = 0;
+    bool is_integer = false;
+    size_t i = pos;
+    size_t length = decimalAt(s, i, numerator, is_integer);
+    if (length == 0 || !is_integer) return 0;
+    i += length;
+    size_t bar = fractionBarAt(s, i);
+    if (bar == 0) return 0;
+    i += bar;
+    length = decimalAt(s, i, denominator, is_integer);
+    if (length == 0 || !is_integer || denominator == 0) return 0;
+    value = numerator / denominator;
+    return i + length - pos;
+}
+
+
+/**
+ * Reads one amount: "2", "1.5", "3/4", "1 1/2", "1-1/2", "½", "1½", "1 ½" or a number word.
+ * @param pos Position to read from; advanced past the amount on success
+ * @param value Receives the amount
+ * @return true if there was an amount at pos.
+ */
+bool parseAmount(std::string_view s, size_t& pos, double& value) {
+    double fraction = 0;
+    if (size_t length = simpleFractionAt(s, pos, fraction)) {
+        value = fraction;
+        pos += length;
+        return true;
+    }
+    if (size_t length = vulgarFractionAt(s, pos, fraction)) {
+        value = fraction;
+        pos += length;
+        return true;
+    }
+
+    double whole = 0;
+    bool is_integer = false;
+    if (size_t length = decimalAt(s, pos, whole, is_integer)) {
+        size_t i = pos + length;
+        if (is_integer) {
+            // A mixed number: "1½", "1 ½" or "1 1/2"
+            if (size_t attached = vulgarFractionAt(s, i, fraction)) {
+                value = whole + fraction;
+                pos = i + attached;
+                return true;
+            }
+            size_t j = skipSpaces(s, i);
+            if (j > i) {
+                size_t part = vulgarFractionAt(s, j, fraction);
+                if (part == 0) part = simpleFractionAt(s, j, fraction);
+                if (part > 0) {
+                    value = whole + fraction;
+                    pos = j + part;
+                    return true;
+                }
+            }
+            // A hyphenated mixed number, "1-1/2": read as a range it would end below its start
+            if (i < s.size() && s[i] == '-') {
+                size_t part = simpleFractionAt(s, i + 1, fraction);
+                if (part == 0) part = vulgarFractionAt(s, i + 1, fraction);
+                if (part > 0 && fraction < 1) {
+                    value = whole + fraction;
+                    pos = i + 1 + part;
+                    return true;
+                }
+            }
+        }
+        value = whole;
+        pos = i;
+        return true;
+    }
+
+    std::string_view word = wordAt(s, pos);
+    if (word.empty() || spaceAt(s, pos + word.size()) == 0) return false;
+    for (const NumberWord& number : kNumberWords) {
+        if (equalsIgnoreCase(word, number.spelling)) {
+            value = number.value;
+            pos += word.size();
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * Reads the upper bound of a range following an amount: "-3", " - 3", "–3" or " to 3".
+ * @param pos Position right after the first amount; advanced past the upper bound on success
+ * @param lower The first amount
+ * @param value Receives the upper bound
+ * @return true if a range continues at pos and ends above lower.
+ */
+bool parseRangeEnd(std::string_view s, size_t& pos, double lower, double& value) {
+    size_t i = skipSpaces(s, pos);
+    if (i < s.size() && s[i] == '-') {
+        i += 1;
+    } else if (i + 2 < s.size() && s[i] == '\xE2' && s[i + 1] == '\x80' && (s[i + 2] == '\x93' || s[i + 2] == '\x94')) {
+        i += 3;     // En dash or em dash
+    } else if (equalsIgnoreCase(wordAt(s, i), "to")) {
+        i += 2;
+    } else {
+        return false;
+    }
+    i = skipSpaces(s, i);
+    if (!parseAmount(s, i, value) || value <= lower) return false;
+    pos = i;
+    return true;
+}
+
+
+/**
+ * Reads a unit name or abbreviation, including a trailing abbreviation dot.
+ * @param pos Position to read from; advanced past the unit on success
+ * @param unit Receives the canonical unit
+ * @return true if there was a known unit at pos.
+ */
+bool parseUnit(std::string_view s, size_t& pos, std::string_view& unit) {
+    std::string_view word = wordAt(s, pos);
+    if (word.empty()) return false;
+    size_t end = pos + word.size();
+
+    auto skipDot = [&](size_t i) {
+        return (i < s.size() && s[i] == '.' && !(i + 1 < s.size() && isDigit(s[i + 1]))) ? i + 1 : i;
+    };
+
+    if (word == "T") {
+        unit = "tbsp";
+    } else if (word == "t") {
+        unit = "tsp";
+    } else if (equalsIgnoreCase(word, "fl") || equalsIgnoreCase(word, "fluid")) {
+        size_t i = skipSpaces(s, skipDot(end));
+        std::string_view next = wordAt(s, i);
+        if (!equalsIgnoreCase(next, "oz") && !equalsIgnoreCase(next, "ounce") && !equalsIgnoreCase(next, "ounces")) return false;
+        unit = "fl oz";
+        end = i + next.size();
+    } else {
+        const UnitAlias* match = nullptr;
+        for (const UnitAlias& alias : kUnitAliases) {
+            if (equalsIgnoreCase(word, alias.spelling)) {
+                match = &alias;
+                break;
+            }
+        }
+        if (!match) return false;
+        unit = match->unit;
+    }
+    pos = skipDot(end);
+    return true;
+}
+
+
+/**
+ * Records one note segment, or the optional flag if the segment is an "optional" marker.
+ */
+void addNoteSegment(std::string_view segment, ParsedIngredientLine& parsed) {
+    segment = trimSpaces(segment);
+    if (segment.empty()) return;
+    if (equalsIgnoreCase(segment, "optional")) {
+        parsed.optional = true;
+        return;
+    }
+    if (parsed.note_count < kMaxIngredientNoteParts) {
+        parsed.note_parts[parsed.note_count++] = segment;
+    } else {
+        // Out of slots: stretch the last note over this one, separators included
+        std::string_view& last = parsed.note_parts[kMaxIngredientNoteParts - 1];
+        last = std::string_view(last.data(), static_cast<size_t>(segment.data() + segment.size() - last.data()));
+    }
+}
+
+
+bool parseIngredientLine(std::string_view line, ParsedIngredientLine& parsed) {
+    parsed = ParsedIngredientLine();
+    std::string_view s = trimSpaces(line);
+
+    // List bullets
+    size_t pos = 0;
+    while (true) {
+        if (pos < s.size() && (s[pos] == '-' || s[pos] == '*')) {
+            pos = skipSpaces(s, pos + 1);
+        } else if (pos + 2 < s.size() && s[pos] == '\xE2' && s[pos + 1] == '\x80' && s[pos + 2] == '\xA2') {
+            pos = skipSpaces(s, pos + 3);
+        } else {
+            break;
+        }
+    }
+
+    // "Optional: ..." prefix
+    std::string_view first_word = wordAt(s, pos);
+    if (equalsIgnoreCase(first_word, "optional")) {
+        size_t i = pos + first_word.size();
+        if (i < s.size() && s[i] == ':') {
+            parsed.optional = true;
+            pos = skipSpaces(s, i + 1);
+        }
+    }
+
+    // Amount, unit and a package size in parentheses between them: "1 (14 oz) can tomatoes"
+    size_t unit_start = 0;
+    size_t unit_end = 0;
+    double quantity = 0;
+    if (parseAmount(s, pos, quantity)) {
+        parsed.quantity = quantity;
+        parsed.has_quantity = true;
+        double quantity_max = 0;
+        if (parseRangeEnd(s, pos, quantity, quantity_max)) parsed.quantity_max = quantity_max;
+
+        pos = skipSpaces(s, pos);
+        while (pos < s.size() && s[pos] == '(') {
+            size_t close = s.find(')', pos);
+            if (close == std::string_view::npos) break;
+            std::string_view inner = s.substr(pos + 1, close - pos - 1);
+            for (size_t comma; (comma = inner.find(',')) != std::string_view::npos; inner.remove_prefix(comma + 1)) {
+                addNoteSegment(inner.substr(0, comma), parsed);
+            }
+            addNoteSegment(inner, parsed);
+            pos = skipSpaces(s, close + 1);
+        }
+
+        unit_start = pos;
+        if (parseUnit(s, pos, parsed.unit)) {
+            unit_end = pos;
+            pos = skipSpaces(s, pos);
+            if (equalsIgnoreCase(wordAt(s, pos), "of") && spaceAt(s, pos + 2)) pos = skipSpaces(s, pos + 2);
+        }
+    }
+
+    // The rest splits at parentheses, commas and semicolons. The first piece outside parentheses and before the
+    // first comma is the name; everything else is notes.
+    size_t start = pos;
+    int depth = 0;
+    bool after_comma = false;
+    auto segment = [&](size_t end) {
+        std::string_view text = s.substr(start, end - start);
+        if (parsed.name.empty() && depth == 0 && !after_comma) {
+            text = trimSpaces(text);
+            if (!text.empty() && !equalsIgnoreCase(text, "optional")) {
+                parsed.name = text;
+                return;
+            }
+        }
+        addNoteSegment(text, parsed);
+    };
+    for (size_t i = pos; i < s.size(); ++i) {
+        char c = s[i];
+        if (c == '(') {
+            segment(i);
+            ++depth;
+            start = i + 1;
+        } else if (c == ')') {
+            segment(i);
+            if (depth > 0) --depth;
+            start = i + 1;
+        } else if (c == ',' || c == ';') {
+            segment(i);
+            if (depth == 0) after_comma = true;
+            start = i + 1;
+        }
+    }
+    segment(s.size());
+
+    // "3 cloves" names the spice, not a unit
+    if (parsed.name.empty() && unit_end > unit_start) {
+        parsed.name = trimSpaces(s.substr(unit_start, unit_end - unit_start));
+        if (!parsed.name.empty() && parsed.name.back() == '.') parsed.name.remove_suffix(1);
+        parsed.unit = {};
+    }
+    return !parsed.name.empty();
+}
+
+
+bool parseIngredientLine(std::string_view line, RecipeIngredientInfo& ingredient) {
+    ParsedIngredientLine parsed;
+    if (!parseIngredientLine(line, parsed)) return false;
+
+    ingredient.name.assign(parsed.name);
+    ingredient.quantity = parsed.quantity;
+    ingredient.unit.assign(parsed.unit);
+    ingredient.notes.clear();
+    for (size_t i = 0; i < parsed.note_count; ++i) {
+        if (!ingredient.notes.empty()) ingredient.notes += ", ";
+        ingredient.notes += parsed.note_parts[i];
+    }
+    if (parsed.isRange()) {
+        char buffer[32];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), parsed.quantity_max, std::chars_format::general, 4);
+        if (!ingredient.notes.empty()) ingredient.notes += ", ";
+        ingredient.notes += "up to ";
+        ingredient.notes.append(buffer, result.ptr);
+    }
+    ingredient.optional = parsed.optional;
+    return true;
+}
+
+
+std::vector<RecipeIngredientInfo> parseIngredientLines(std::string_view text) {
+    std::vector<RecipeIngredientInfo> ingredients;
+    RecipeIngredientInfo ingredient;
+    while (!text.empty()) {
+        size_t end = text.find('\n');
+        std::string_view line = text.substr(0, end);
+        text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+        if (parseIngredientLine(line, ingredient)) ingredients.push_back(ingredient);
+    }
+    return ingredients;
+}
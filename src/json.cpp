@@ -0,0 +1,192 @@
+#include "json.h"
+#include <charconv>
+
+
+// Deeper documents are rejected rather than risking the stack
+constexpr int kMaxJsonDepth = 256;
+
+
+const JsonValue* JsonValue::find(std::string_view key) const {
+    for (const auto& [name, value] : object) {
+        if (name == key) return &value;
+    }
+    return nullptr;
+}
+
+
+// Recursive-descent parser over a string_view; every method returns false on malformed input
+struct JsonParser {
+    std::string_view text;
+    size_t pos = 0;
+
+    void skipWhitespace() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) ++pos;
+    }
+
+    bool consume(std::string_view literal) {
+        if (text.substr(pos, literal.size()) != literal) return false;
+        pos += literal.size();
+        return true;
+    }
+
+    bool parseHex4(unsigned& code) {
+        if (pos + 4 > text.size()) return false;
+        code = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = text[pos++];
+            code <<= 4;
+            if (c >= '0' && c <= '9') code |= c - '0';
+            else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+            else return false;
+        }
+        return true;
+    }
+
+    static void appendUtf8(std::string& out, unsigned code) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+
+    bool parseString(std::string& out) {
+        if (!consume("\"")) return false;
+        out.clear();
+        while (pos < text.size()) {
+            // Copy the run up to the next quote or escape in one go
+            size_t end = text.find_first_of("\"\\", pos);
+            if (end == std::string_view::npos) return false;
+            out.append(text.substr(pos, end - pos));
+            pos = end;
+            if (text[pos] == '"') {
+                ++pos;
+                return true;
+            }
+
+            if (++pos >= text.size()) return false;
+            char escape = text[pos++];
+            switch (escape) {
+                case '"':  out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/':  out += '/'; break;
+                case 'b':  out += '\b'; break;
+                case 'f':  out += '\f'; break;
+                case 'n':  out += '\n'; break;
+                case 'r':  out += '\r'; break;
+                case 't':  out += '\t'; break;
+                case 'u': {
+                    unsigned code = 0;
+                    if (!parseHex4(code)) return false;
+                    // A high surrogate combines with the low surrogate that follows it
+                    if (code >= 0xD800 && code <= 0xDBFF && text.substr(pos, 2) == "\\u") {
+                        size_t saved = pos;
+                        pos += 2;
+                        unsigned low = 0;
+                        if (parseHex4(low) && low >= 0xDC00 && low <= 0xDFFF) {
+                            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        } else {
+                            pos = saved;
+                        }
+                    }
+                    if (code >= 0xD800 && code <= 0xDFFF) code = 0xFFFD;
+                    appendUtf8(out, code);
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+        return false;
+    }
+
+    bool parseNumber(double& out) {
+        size_t start = pos;
+        if (pos < text.size() && text[pos] == '-') ++pos;
+        while (pos < text.size() && ((text[pos] >= '0' && text[pos] <= '9') || text[pos] == '.' || text[pos] == 'e'
+                                     || text[pos] == 'E' || text[pos] == '+' || text[pos] == '-')) {
+            ++pos;
+        }
+        auto result = std::from_chars(text.data() + start, text.data() + pos, out);
+        return result.ec == std::errc() && result.ptr == text.data() + pos;
+    }
+
+    bool parseValue(JsonValue& value, int depth) {
+        if (depth > kMaxJsonDepth) return false;
+        skipWhitespace();
+        if (pos >= text.size()) return false;
+
+        char c = text[pos];
+        if (c == '{') {
+            ++pos;
+            value.type = JsonValue::Type::Object;
+            skipWhitespace();
+            if (consume("}")) return true;
+            while (true) {
+                skipWhitespace();
+                std::string key;
+                if (!parseString(key)) return false;
+                skipWhitespace();
+                if (!consume(":")) return false;
+                value.object.emplace_back(std::move(key), JsonValue());
+                if (!parseValue(value.object.back().second, depth + 1)) return false;
+                skipWhitespace();
+                if (consume("}")) return true;
+                if (!consume(",")) return false;
+            }
+        }
+        if (c == '[') {
+            ++pos;
+            value.type = JsonValue::Type::Array;
+            skipWhitespace();
+            if (consume("]")) return true;
+            while (true) {
+                value.array.emplace_back();
+                if (!parseValue(value.array.back(), depth + 1)) return false;
+                skipWhitespace();
+                if (consume("]")) return true;
+                if (!consume(",")) return false;
+            }
+        }
+        if (c == '"') {
+            value.type = JsonValue::Type::String;
+            return parseString(value.string);
+        }
+        if (consume("true")) {
+            value.type = JsonValue::Type::Bool;
+            value.boolean = true;
+            return true;
+        }
+        if (consume("false")) {
+            value.type = JsonValue::Type::Bool;
+            return true;
+        }
+        if (consume("null")) {
+            value.type = JsonValue::Type::Null;
+            return true;
+        }
+        value.type = JsonValue::Type::Number;
+        return parseNumber(value.number);
+    }
+};
+
+
+std::optional<JsonValue> parseJson(std::string_view text) {
+    JsonParser parser{text};
+    JsonValue value;
+    if (!parser.parseValue(value, 0)) return std::nullopt;
+    parser.skipWhitespace();
+    if (parser.pos != text.size()) return std::nullopt;
+    return value;
+}
@@ -0,0 +1,190 @@
+#include "logging.h"
+#include <iostream>
+#include <cstdlib>
+
+
+// The default sink is created on first use and never destroyed, so objects logging from static
+// destructors still find it; an atexit handler writes out what is buffered.
+std::atomic<std::shared_ptr<LogSink>>& sinkSlot() {
+    static auto* slot = [] {
+        auto* created = new std::atomic<std::shared_ptr<LogSink>>(
+            std::make_shared<AsyncRingSink>(std::make_shared<StderrSink>()));
+        std::atexit(flushLog);
+        return created;
+    }();
+    return *slot;
+}
+
+
+std::atomic<LogLevel> g_log_level{LogLevel::Warning};
+
+
+const char* logLevelName(LogLevel level) {
+    switch (level) {
+        case LogLevel::Debug:   return "debug";
+        case LogLevel::Info:    return "info";
+        case LogLevel::Warning: return "warning";
+        case LogLevel::Error:   return "error";
+        case LogLevel::Off:     return "off";
+    }
+    return "unknown";
+}
+
+
+void StderrSink::write(const LogRecord& record) {
+    std::string line;
+    line.reserve(record.message.size() + record.operation.size() + 48);
+    line += '[';
+    line += logLevelName(record.level);
+    line += "] ";
+    if (!record.operation.empty()) {
+        line += record.operation;
+        line += ": ";
+    }
+    line += record.message;
+    if (record.recipe_id) {
+        line += " recipe_id=" + std::to_string(*record.recipe_id);
+    }
+    if (record.sqlite_code != 0) {
+        line += " sqlite_code=" + std::to_string(record.sqlite_code);
+    }
+    line += '\n';
+    std::cerr << line;
+}
+
+
+void StderrSink::flush() {
+    std::cerr.flush();
+}
+
+
+AsyncRingSink::AsyncRingSink(std::shared_ptr<LogSink> inner, size_t capacity)
+    : inner_(std::move(inner))
+{
+    size_t rounded = 2;
+    while (rounded < capacity) rounded <<= 1;
+    slots_ = std::vector<Slot>(rounded);
+    mask_ = rounded - 1;
+    for (size_t i = 0; i < rounded; ++i) {
+        slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    consumer_ = std::thread(&AsyncRingSink::consume, this);
+}
+
+
+AsyncRingSink::~AsyncRingSink() {
+    stopping_ = true;
+    signal_.fetch_add(1, std::memory_order_release);
+    signal_.notify_all();
+    if (consumer_.joinable()) consumer_.join();
+}
+
+
+void AsyncRingSink::write(const LogRecord& record) {
+    // Bounded multi-producer queue: a producer claims a slot by advancing enqueue_pos_, and each slot's
+    // sequence number says whether it is free for that lap (== pos) or still holds an unread record
+    uint64_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+        slot = &slots_[pos & mask_];
+        uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        int64_t difference = static_cast<int64_t>(sequence) - static_cast<int64_t>(pos);
+        if (difference == 0) {
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (difference < 0) {
+            ++dropped_;
+            return;
+        } else {
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->record = record;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    signal_.fetch_add(1, std::memory_order_release);
+    signal_.notify_one();
+}
+
+
+void AsyncRingSink::consume() {
+    uint64_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+        const uint64_t signalled = signal_.load(std::memory_order_acquire);
+        Slot& slot = slots_[pos & mask_];
+        if (slot.sequence.load(std::memory_order_acquire) == pos + 1) {
+            if (inner_) inner_->write(slot.record);
+            slot.record = LogRecord();
+            slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+            dequeue_pos_.store(++pos, std::memory_order_release);
+            dequeue_pos_.notify_all();
+            continue;
+        }
+
+        // Empty, or a producer has claimed the slot but not filled it yet
+        if (stopping_ && enqueue_pos_.load(std::memory_order_acquire) == pos) break;
+        if (enqueue_pos_.load(std::memory_order_acquire) == pos) {
+            signal_.wait(signalled, std::memory_order_acquire);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    if (inner_) inner_->flush();
+}
+
+
+void AsyncRingSink::flush() {
+    const uint64_t target = enqueue_pos_.load(std::memory_order_acquire);
+    uint64_t done = dequeue_pos_.load(std::memory_order_acquire);
+    while (done < target) {
+        dequeue_pos_.wait(done, std::memory_order_acquire);
+        done = dequeue_pos_.load(std::memory_order_acquire);
+    }
+    if (inner_) inner_->flush();
+}
+
+
+void setLogSink(std::shared_ptr<LogSink> sink) {
+    std::shared_ptr<LogSink> previous = sinkSlot().exchange(std::move(sink));
+    if (previous) previous->flush();
+}
+
+
+std::shared_ptr<LogSink> logSink() {
+    return sinkSlot().load();
+}
+
+
+void setLogLevel(LogLevel level) {
+    g_log_level = level;
+}
+
+
+bool logEnabled(LogLevel level) {
+    return level != LogLevel::Off && level >= g_log_level.load(std::memory_order_relaxed);
+}
+
+
+void flushLog() {
+    if (std::shared_ptr<LogSink> sink = logSink()) sink->flush();
+}
+
+
+LogLine::LogLine(LogLevel level, const char* operation)
+    : enabled_(logEnabled(level))
+{
+    if (enabled_) {
+        record_.level = level;
+        record_.operation = operation;
+        stream_.emplace();
+    }
+}
+
+
+LogLine::~LogLine() {
+    if (!enabled_) return;
+    std::shared_ptr<LogSink> sink = logSink();
+    if (!sink) return;
+    record_.time = std::chrono::system_clock::now();
+    record_.message = stream_->str();
+    sink->write(record_);
+}
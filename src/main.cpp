@@ -100,8 +100,7 @@ void printRecipe(const RecipeData& recipe) {
 int main() {
     std::cout << "Recipe Manager C++ Demo" << std::endl;
 
-    Database* recipe_db_ptr = Database::instance();
-    Database& recipe_db = *recipe_db_ptr;
+    Database recipe_db;
 
     // Test open
     std::cout << "--- Testing Database Open ---" << std::endl;
@@ -0,0 +1,234 @@
+#include "maintenance.h"
+#include "database.h"
+#include "logging.h"
+#include <algorithm>
+#include <array>
+#include <tuple>
+
+
+// The scheduler's connection gives way to foreground writers almost immediately
+constexpr int kSchedulerBusyTimeoutMs = 50;
+
+
+// Runs a statement to completion, returning the SQLite result code; SQLITE_BUSY is left for the caller to report
+int execMaintenanceSQL(sqlite3* db, const char* sql) {
+    char* err_msg = nullptr;
+    int rc = sqlite3_exec(db, sql, nullptr, nullptr, &err_msg);
+    if (rc != SQLITE_OK && rc != SQLITE_BUSY && rc != SQLITE_LOCKED) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Maintenance SQL error: " << (err_msg ? err_msg : sqlite3_errmsg(db));
+    }
+    sqlite3_free(err_msg);
+    return rc;
+}
+
+
+// Returns the single integer produced by a PRAGMA or query, or std::nullopt on failure
+std::optional<int64_t> queryPragmaInt(sqlite3* db, const char* sql) {
+    SqliteStatement stmt_wrapper(db, sql);
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
+    if (stmt == nullptr || sqlite3_step(stmt) != SQLITE_ROW) return std::nullopt;
+    return sqlite3_column_int64(stmt, 0);
+}
+
+
+std::optional<StorageStats> readStorageStats(sqlite3* db, bool measure_fragmentation) {
+    if (db == nullptr) return std::nullopt;
+
+    StorageStats stats;
+    std::optional<int64_t> page_size = queryPragmaInt(db, "PRAGMA page_size;");
+    std::optional<int64_t> page_count = queryPragmaInt(db, "PRAGMA page_count;");
+    std::optional<int64_t> freelist_count = queryPragmaInt(db, "PRAGMA freelist_count;");
+    std::optional<int64_t> auto_vacuum = queryPragmaInt(db, "PRAGMA auto_vacuum;");
+    if (!page_size || !page_count || !freelist_count || !auto_vacuum) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Failed to read storage statistics: " << sqlite3_errmsg(db);
+        return std::nullopt;
+    }
+    stats.page_size = *page_size;
+    stats.page_count = *page_count;
+    stats.freelist_count = *freelist_count;
+    stats.auto_vacuum = static_cast<int>(*auto_vacuum);
+
+    if (measure_fragmentation) {
+        std::optional<int64_t> unused = queryPragmaInt(db, "SELECT COALESCE(SUM(unused), 0) FROM dbstat WHERE name NOT LIKE 'sqlite_%';");
+        if (!unused) {
+            LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Failed to measure fragmentation: " << sqlite3_errmsg(db);
+            return std::nullopt;
+        }
+        stats.unused_bytes = *unused;
+    }
+
+    return stats;
+}
+
+
+std::optional<MaintenanceReport> runMaintenance(sqlite3* db, const MaintenanceOptions& options) {
+    if (db == nullptr) return std::nullopt;
+    if (!sqlite3_get_autocommit(db)) {
+        LogLine(LogLevel::Error, __func__) << "Cannot run maintenance inside a transaction.";
+        return std::nullopt;
+    }
+
+    const auto started = std::chrono::steady_clock::now();
+    auto budget_left = [&]() {
+        return std::chrono::steady_clock::now() - started < options.time_budget;
+    };
+
+    std::optional<StorageStats> before = readStorageStats(db, options.measure_fragmentation);
+    if (!before) return std::nullopt;
+
+    MaintenanceReport report;
+    report.before = *before;
+
+    auto finish = [&]() -> std::optional<MaintenanceReport> {
+        std::optional<StorageStats> after = readStorageStats(db, options.measure_fragmentation);
+        if (!after) return std::nullopt;
+        report.after = *after;
+        report.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+        return report;
+    };
+
+    // Returns true to carry on, false if the run has to stop here
+    auto step = [&](const std::string& sql, bool& completed) {
+        int rc = execMaintenanceSQL(db, sql.c_str());
+        if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+            report.skipped_busy = true;
+            return false;
+        }
+        completed = (rc == SQLITE_OK);
+        return completed;
+    };
+
+    // Statistics first: PRAGMA optimize only analyzes tables whose statistics are missing or stale
+    const std::string analyze_sql = "PRAGMA analysis_limit = " + std::to_string(options.analysis_limit) + ";"
+        + (options.full_analyze ? "ANALYZE;" : "PRAGMA optimize;");
+    if (!step(analyze_sql, report.analyzed)) {
+        return report.skipped_busy ? finish() : std::nullopt;
+    }
+
+    // Merge FTS5 segments left behind by many small trigger writes, before vacuuming so the pages it frees are reclaimed too
+    if (options.search_merge_pages > 0) {
+        if (!budget_left()) {
+            report.budget_exhausted = true;
+            return finish();
+        }
+        const std::string merge_sql = "INSERT INTO search(search, rank) VALUES('merge', " + std::to_string(options.search_merge_pages) + ");";
+        if (!step(merge_sql, report.search_merged)) {
+            return report.skipped_busy ? finish() : std::nullopt;
+        }
+    }
+
+    // Text indexes and ingredient signatures that had not yet applied the trimmed entries notice the gap and reload
+    const std::array<std::tuple<const char*, int64_t, int64_t*>, 2> change_logs = {{
+        {"recipe_text_changes", options.text_changes_kept, &report.text_changes_trimmed},
+        {"recipe_ingredient_changes", options.ingredient_changes_kept, &report.ingredient_changes_trimmed},
+    }};
+    for (const auto& [table, kept, trimmed_entries] : change_logs) {
+        if (kept <= 0) continue;
+        if (!budget_left()) {
+            report.budget_exhausted = true;
+            return finish();
+        }
+        const std::string trim_sql = std::string("DELETE FROM ") + table + " WHERE change_seq <= (SELECT MAX(change_seq) FROM " + table +
+                                     ") - " + std::to_string(kept) + ";";
+        bool trimmed = false;
+        if (!step(trim_sql, trimmed)) {
+            return report.skipped_busy ? finish() : std::nullopt;
+        }
+        *trimmed_entries = sqlite3_changes64(db);
+    }
+
+    // Release freelist pages a few at a time, so each write transaction stays short
+    if (report.before.auto_vacuum == 2) {
+        const int64_t step_pages = std::max<int64_t>(options.vacuum_step_pages, 1);
+        while (true) {
+            std::optional<int64_t> freelist = queryPragmaInt(db, "PRAGMA freelist_count;");
+            if (!freelist) return std::nullopt;
+            if (*freelist == 0) break;
+
+            int64_t pages = std::min(step_pages, *freelist);
+            if (options.max_vacuum_pages > 0) {
+                pages = std::min(pages, options.max_vacuum_pages - report.pages_reclaimed);
+            }
+            if (pages <= 0) {
+                // Page budget for this run spent
+                report.budget_exhausted = true;
+                break;
+            }
+            if (!budget_left()) {
+                report.budget_exhausted = true;
+                return finish();
+            }
+
+            bool vacuumed = false;
+            const std::string vacuum_sql = "PRAGMA incremental_vacuum(" + std::to_string(pages) + ");";
+            if (!step(vacuum_sql, vacuumed)) {
+                return report.skipped_busy ? finish() : std::nullopt;
+            }
+
+            // Count what was released, not what was asked for; stop if another connection keeps refilling the freelist
+            std::optional<int64_t> remaining = queryPragmaInt(db, "PRAGMA freelist_count;");
+            if (!remaining) return std::nullopt;
+            if (*remaining >= *freelist) break;
+            report.pages_reclaimed += *freelist - *remaining;
+        }
+    }
+
+    return finish();
+}
+
+
+MaintenanceScheduler::MaintenanceScheduler(std::string db_path, std::chrono::milliseconds interval, MaintenanceOptions options)
+    : db_path_(std::move(db_path)), interval_(interval), options_(std::move(options))
+{
+    thread_ = std::thread(&MaintenanceScheduler::run, this);
+}
+
+
+MaintenanceScheduler::~MaintenanceScheduler() {
+    stop();
+}
+
+
+void MaintenanceScheduler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    stop_cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+}
+
+
+int64_t MaintenanceScheduler::runs() const {
+    return runs_;
+}
+
+
+std::optional<MaintenanceReport> MaintenanceScheduler::lastReport() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_report_;
+}
+
+
+void MaintenanceScheduler::run() {
+    sqlite3* db = nullptr;
+    if (sqlite3_open_v2(db_path_.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Maintenance scheduler cannot open database: " << sqlite3_errmsg(db);
+        sqlite3_close(db);
+        return;
+    }
+    sqlite3_busy_timeout(db, kSchedulerBusyTimeoutMs);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_cv_.wait_for(lock, interval_, [this] { return stopping_; })) {
+        lock.unlock();
+        std::optional<MaintenanceReport> report = runMaintenance(db, options_);
+        lock.lock();
+
+        if (report) last_report_ = report;
+        ++runs_;
+    }
+    lock.unlock();
+
+    sqlite3_close(db);
+}
@@ -0,0 +1,345 @@
+#include "meal_planner.h"
+#include "database.h"
+#include <algorithm>
+#include <bit>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+
+using PlannerClock = std::chrono::steady_clock;
+
+
+// Random perturbations applied to a local optimum before searching again
+constexpr size_t kPerturbedMeals = 2;
+
+
+MealPlanCandidates buildMealPlanCandidates(std::vector<long long> recipe_ids, const std::vector<std::pair<long long, long long>>& links,
+                                           const std::vector<long long>& pantry) {
+    MealPlanCandidates candidates;
+    candidates.recipe_ids = std::move(recipe_ids);
+    std::unordered_set<long long> on_hand(pantry.begin(), pantry.end());
+    std::unordered_map<long long, size_t> bit_of;
+
+    // Bits are numbered once every ingredient is known, so collect them per candidate first
+    std::vector<std::vector<size_t>> ingredient_bits(candidates.recipe_ids.size());
+    for (const auto& [recipe_id, ingredient_id] : links) {
+        auto candidate = std::lower_bound(candidates.recipe_ids.begin(), candidates.recipe_ids.end(), recipe_id);
+        if (candidate == candidates.recipe_ids.end() || *candidate != recipe_id || on_hand.count(ingredient_id)) continue;
+        auto [bit, inserted] = bit_of.try_emplace(ingredient_id, candidates.ingredient_ids.size());
+        if (inserted) candidates.ingredient_ids.push_back(ingredient_id);
+        ingredient_bits[candidate - candidates.recipe_ids.begin()].push_back(bit->second);
+    }
+
+    candidates.words = std::max<size_t>(1, (candidates.ingredient_ids.size() + 63) / 64);
+    candidates.bits.assign(candidates.recipe_ids.size() * candidates.words, 0);
+    for (size_t candidate = 0; candidate < ingredient_bits.size(); ++candidate) {
+        uint64_t* row = candidates.bits.data() + candidate * candidates.words;
+        for (size_t bit : ingredient_bits[candidate]) row[bit / 64] |= uint64_t{1} << (bit % 64);
+    }
+    return candidates;
+}
+
+
+// A complete or partial plan
+struct PlanState {
+    std::vector<uint32_t> picks;    // Candidate indices
+    std::vector<uint64_t> covered;  // Union of the picks' bitsets: the shopping list
+    uint32_t distinct = 0;          // Ingredients on the shopping list
+    uint32_t total = 0;             // Sum of the picks' ingredient counts
+    uint64_t key = 0;               // Order-independent hash of the picks, to spot the same set reached twice
+};
+
+
+// Fewer ingredients to buy first, then more ingredient uses shared between meals
+bool betterScore(uint32_t distinct, uint32_t total, uint32_t other_distinct, uint32_t other_total) {
+    return distinct != other_distinct ? distinct < other_distinct : total > other_total;
+}
+
+
+uint32_t bitCount(const uint64_t* bits, size_t words) {
+    uint32_t count = 0;
+    for (size_t i = 0; i < words; ++i) count += std::popcount(bits[i]);
+    return count;
+}
+
+
+uint32_t unionCount(const uint64_t* a, const uint64_t* b, size_t words) {
+    uint32_t count = 0;
+    for (size_t i = 0; i < words; ++i) count += std::popcount(a[i] | b[i]);
+    return count;
+}
+
+
+uint64_t pickHash(uint32_t candidate) {
+    uint64_t x = candidate + 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+
+// State of one search thread
+struct PlannerThread {
+    const MealPlanCandidates& candidates;
+    const std::vector<uint32_t>& sizes;     // Ingredient count of each candidate
+    size_t meals;
+    PlannerClock::time_point deadline;
+    bool timed;                             // False for a budget of 0: build and descend once, however long it takes
+    bool randomized;                        // Break ties at random instead of by candidate index
+    std::mt19937_64 rng;
+    uint64_t evaluated = 0;
+
+    bool timeUp() const { return timed && PlannerClock::now() >= deadline; }
+
+    void addPick(PlanState& plan, uint32_t candidate) const {
+        const uint64_t* row = candidates.row(candidate);
+        for (size_t i = 0; i < candidates.words; ++i) plan.covered[i] |= row[i];
+        plan.picks.push_back(candidate);
+        plan.total += sizes[candidate];
+        plan.key += pickHash(candidate);
+        plan.distinct = bitCount(plan.covered.data(), candidates.words);
+    }
+
+    void recompute(PlanState& plan) const {
+        std::vector<uint32_t> picks = std::move(plan.picks);
+        plan = PlanState();
+        plan.covered.assign(candidates.words, 0);
+        for (uint32_t candidate : picks) addPick(plan, candidate);
+    }
+
+    /**
+     * Adds the candidate that grows the shopping list least until the plan has `meals` recipes.
+     */
+    void completeGreedily(PlanState& plan) {
+        const uint32_t candidate_count = static_cast<uint32_t>(candidates.recipe_ids.size());
+        while (plan.picks.size() < meals) {
+            uint32_t best_candidate = candidate_count;
+            uint32_t best_distinct = 0;
+            uint32_t best_total = 0;
+            for (uint32_t candidate = 0; candidate < candidate_count; ++candidate) {
+                if (std::find(plan.picks.begin(), plan.picks.end(), candidate) != plan.picks.end()) continue;
+                uint32_t distinct = unionCount(plan.covered.data(), candidates.row(candidate), candidates.words);
+                uint32_t total = plan.total + sizes[candidate];
+                ++evaluated;
+                if (best_candidate == candidate_count || betterScore(distinct, total, best_distinct, best_total)) {
+                    best_candidate = candidate;
+                    best_distinct = distinct;
+                    best_total = total;
+                }
+            }
+            if (best_candidate == candidate_count) return;
+            addPick(plan, best_candidate);
+        }
+    }
+
+    /**
+     * Beam search: extends each of the best beam_width partial plans by every candidate and keeps the best
+     * beam_width distinct results, one meal at a time. A step costs beam_width * candidates evaluations, so once
+     * the time budget is spent the best partial plan is completed greedily instead.
+     */
+    PlanState beamSearch(size_t beam_width) {
+        struct Extension {
+            uint32_t distinct;
+            uint32_t total;
+            uint64_t tie_break;
+            uint32_t state;
+            uint32_t candidate;
+            uint64_t key;
+        };
+        auto better = [](const Extension& a, const Extension& b) {
+            if (a.distinct != b.distinct || a.total != b.total) return betterScore(a.distinct, a.total, b.distinct, b.total);
+            if (a.tie_break != b.tie_break) return a.tie_break < b.tie_break;
+            return a.state != b.state ? a.state < b.state : a.candidate < b.candidate;
+        };
+
+        std::vector<PlanState> beam(1);
+        beam[0].covered.assign(candidates.words, 0);
+        const uint32_t candidate_count = static_cast<uint32_t>(candidates.recipe_ids.size());
+        std::vector<Extension> extensions;
+        std::vector<Extension> best_of_state;
+        for (size_t step = 0; step < meals; ++step) {
+            if (timeUp()) {
+                completeGreedily(beam[0]);
+                break;
+            }
+            extensions.clear();
+            for (uint32_t state = 0; state < beam.size(); ++state) {
+                const PlanState& plan = beam[state];
+                // Heap with the worst of this state's best beam_width extensions on top
+                best_of_state.clear();
+                for (uint32_t candidate = 0; candidate < candidate_count; ++candidate) {
+                    if (std::find(plan.picks.begin(), plan.picks.end(), candidate) != plan.picks.end()) continue;
+                    Extension extension{unionCount(plan.covered.data(), candidates.row(candidate), candidates.words),
+                                        plan.total + sizes[candidate], randomized ? rng() : 0, state, candidate,
+                                        plan.key + pickHash(candidate)};
+                    ++evaluated;
+                    if (best_of_state.size() < beam_width) {
+                        best_of_state.push_back(extension);
+                        std::push_heap(best_of_state.begin(), best_of_state.end(), better);
+                    } else if (better(extension, best_of_state.front())) {
+                        std::pop_heap(best_of_state.begin(), best_of_state.end(), better);
+                        best_of_state.back() = extension;
+                        std::push_heap(best_of_state.begin(), best_of_state.end(), better);
+                    }
+                }
+                extensions.insert(extensions.end(), best_of_state.begin(), best_of_state.end());
+            }
+            if (extensions.empty()) break;
+
+            std::sort(extensions.begin(), extensions.end(), better);
+            std::vector<PlanState> next;
+            std::unordered_set<uint64_t> seen;
+            for (const Extension& extension : extensions) {
+                if (next.size() == beam_width) break;
+                if (!seen.insert(extension.key).second) continue;
+                PlanState plan = beam[extension.state];
+                addPick(plan, extension.candidate);
+                next.push_back(std::move(plan));
+            }
+            beam = std::move(next);
+        }
+        return std::move(beam[0]);
+    }
+
+    /**
+     * Replaces the meal at `position` with the candidate that leaves the shortest shopping list.
+     * @return true if the plan got better.
+     */
+    bool improvePosition(PlanState& plan, size_t position) {
+        std::vector<uint64_t> others(candidates.words, 0);
+        uint32_t others_total = 0;
+        for (size_t i = 0; i < plan.picks.size(); ++i) {
+            if (i == position) continue;
+            const uint64_t* row = candidates.row(plan.picks[i]);
+            for (size_t word = 0; word < candidates.words; ++word) others[word] |= row[word];
+            others_total += sizes[plan.picks[i]];
+        }
+
+        uint32_t best_candidate = plan.picks[position];
+        uint32_t best_distinct = plan.distinct;
+        uint32_t best_total = plan.total;
+        uint64_t best_tie_break = 0;
+        const uint32_t candidate_count = static_cast<uint32_t>(candidates.recipe_ids.size());
+        for (uint32_t candidate = 0; candidate < candidate_count; ++candidate) {
+            if (std::find(plan.picks.begin(), plan.picks.end(), candidate) != plan.picks.end()) continue;
+            uint32_t distinct = unionCount(others.data(), candidates.row(candidate), candidates.words);
+            uint32_t total = others_total + sizes[candidate];
+            ++evaluated;
+            if (betterScore(distinct, total, best_distinct, best_total)) {
+                best_candidate = candidate;
+                best_distinct = distinct;
+                best_total = total;
+                best_tie_break = randomized ? rng() : 0;
+            } else if (randomized && distinct == best_distinct && total == best_total && best_candidate != plan.picks[position]) {
+                // Reservoir-style choice among equally good replacements
+                uint64_t tie_break = rng();
+                if (tie_break < best_tie_break) {
+                    best_candidate = candidate;
+                    best_tie_break = tie_break;
+                }
+            }
+        }
+        if (best_candidate == plan.picks[position]) return false;
+        plan.picks[position] = best_candidate;
+        recompute(plan);
+        return true;
+    }
+
+    /**
+     * Local search: improves one meal at a time until no single replacement helps, then perturbs the local
+     * optimum and searches again while time remains. The deadline is checked before every pass over the meals.
+     * @return The best plan seen.
+     */
+    PlanState localSearch(PlanState plan) {
+        PlanState best = plan;
+        if (plan.picks.empty() || plan.picks.size() >= candidates.recipe_ids.size()) return best;
+
+        while (true) {
+            // Descend to a local optimum: stop after a full pass over the meals without improvement
+            size_t unchanged = 0;
+            for (size_t position = 0; unchanged < plan.picks.size(); position = (position + 1) % plan.picks.size()) {
+                if (position == 0 && timeUp()) break;
+                unchanged = improvePosition(plan, position) ? 0 : unchanged + 1;
+            }
+            if (betterScore(plan.distinct, plan.total, best.distinct, best.total)) best = plan;
+            if (!timed || timeUp()) return best;
+
+            // Restart from the best plan with a few meals swapped for random candidates
+            plan = best;
+            const uint32_t candidate_count = static_cast<uint32_t>(candidates.recipe_ids.size());
+            for (size_t i = 0; i < std::min(kPerturbedMeals, plan.picks.size()); ++i) {
+                uint32_t candidate = static_cast<uint32_t>(rng() % candidate_count);
+                if (std::find(plan.picks.begin(), plan.picks.end(), candidate) != plan.picks.end()) continue;
+                plan.picks[rng() % plan.picks.size()] = candidate;
+            }
+            recompute(plan);
+        }
+    }
+};
+
+
+MealPlan searchMealPlan(const MealPlanCandidates& candidates, const MealPlanQuery& query) {
+    const auto start = PlannerClock::now();
+    const size_t candidate_count = candidates.recipe_ids.size();
+    const size_t meals = std::min(query.meals, candidate_count);
+
+    std::vector<uint32_t> sizes(candidate_count);
+    for (size_t candidate = 0; candidate < candidate_count; ++candidate) {
+        sizes[candidate] = bitCount(candidates.row(candidate), candidates.words);
+    }
+
+    size_t thread_count = query.threads > 0 ? query.threads : std::max(1u, std::thread::hardware_concurrency());
+    // Every thread but the first only adds randomized restarts, which need a choice of plans and time to run
+    if (meals == 0 || meals == candidate_count || query.time_budget.count() == 0) thread_count = 1;
+
+    std::vector<PlanState> results(thread_count);
+    std::vector<uint64_t> evaluated(thread_count, 0);
+    auto run = [&](size_t index) {
+        PlannerThread thread{candidates, sizes, meals, start + query.time_budget, query.time_budget.count() > 0, index > 0,
+                             std::mt19937_64(query.seed + index)};
+        results[index] = thread.localSearch(thread.beamSearch(std::max<size_t>(1, query.beam_width)));
+        evaluated[index] = thread.evaluated;
+    };
+    std::vector<std::thread> threads;
+    for (size_t index = 1; index < thread_count; ++index) threads.emplace_back(run, index);
+    run(0);
+    for (std::thread& thread : threads) thread.join();
+
+    // Ties go to the lowest recipe ids, so the result does not depend on which thread finished first
+    for (PlanState& result : results) std::sort(result.picks.begin(), result.picks.end());
+    const PlanState* best = &results[0];
+    for (const PlanState& result : results) {
+        if (betterScore(result.distinct, result.total, best->distinct, best->total) ||
+            (result.distinct == best->distinct && result.total == best->total && result.picks < best->picks)) {
+            best = &result;
+        }
+    }
+
+    MealPlan plan;
+    for (uint32_t candidate : best->picks) plan.recipe_ids.push_back(candidates.recipe_ids[candidate]);
+    plan.total_ingredients = best->total;
+    plan.shared_ingredients = best->total - best->distinct;
+    plan.candidates = candidate_count;
+    for (uint64_t count : evaluated) plan.plans_evaluated += count;
+    return plan;
+}
+
+
+std::vector<long long> mealPlanShoppingIds(const MealPlanCandidates& candidates, const std::vector<long long>& recipe_ids) {
+    std::vector<uint64_t> covered(candidates.words, 0);
+    for (long long recipe_id : recipe_ids) {
+        auto candidate = std::lower_bound(candidates.recipe_ids.begin(), candidates.recipe_ids.end(), recipe_id);
+        if (candidate == candidates.recipe_ids.end() || *candidate != recipe_id) continue;
+        const uint64_t* row = candidates.row(candidate - candidates.recipe_ids.begin());
+        for (size_t i = 0; i < candidates.words; ++i) covered[i] |= row[i];
+    }
+
+    std::vector<long long> ingredient_ids;
+    for (size_t bit = 0; bit < candidates.ingredient_ids.size(); ++bit) {
+        if ((covered[bit / 64] >> (bit % 64)) & 1) ingredient_ids.push_back(candidates.ingredient_ids[bit]);
+    }
+    std::sort(ingredient_ids.begin(), ingredient_ids.end());
+    return ingredient_ids;
+}
@@ -0,0 +1,75 @@
+#include "memory_report.h"
+#include "logging.h"
+
+
+bool setProcessHeapLimits(int64_t soft_bytes, int64_t hard_bytes) {
+    int64_t soft = soft_bytes >= 0 ? soft_bytes : sqlite3_soft_heap_limit64(-1);
+    int64_t hard = hard_bytes >= 0 ? hard_bytes : sqlite3_hard_heap_limit64(-1);
+    if (hard > 0 && soft > hard) {
+        LogLine(LogLevel::Error, __func__) << "Soft heap limit " << soft << " exceeds hard heap limit " << hard;
+        return false;
+    }
+    // SQLite clamps the soft limit to the hard limit, so set the hard limit first
+    if (hard_bytes >= 0) sqlite3_hard_heap_limit64(hard_bytes);
+    if (soft_bytes >= 0) sqlite3_soft_heap_limit64(soft_bytes);
+    return true;
+}
+
+
+SqliteHeapStats readSqliteHeapStats() {
+    SqliteHeapStats stats;
+    sqlite3_int64 current = 0;
+    sqlite3_int64 highwater = 0;
+    sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &current, &highwater, 0);
+    stats.memory_used = current;
+    stats.memory_highwater = highwater;
+    sqlite3_status64(SQLITE_STATUS_MALLOC_COUNT, &current, &highwater, 0);
+    stats.allocations = current;
+    sqlite3_status64(SQLITE_STATUS_MALLOC_SIZE, &current, &highwater, 0);
+    stats.largest_allocation = highwater;
+    sqlite3_status64(SQLITE_STATUS_PAGECACHE_OVERFLOW, &current, &highwater, 0);
+    stats.pagecache_overflow = current;
+    stats.soft_heap_limit = sqlite3_soft_heap_limit64(-1);
+    stats.hard_heap_limit = sqlite3_hard_heap_limit64(-1);
+    return stats;
+}
+
+
+std::optional<ConnectionMemoryStats> readConnectionMemoryStats(sqlite3* db) {
+    if (db == nullptr) return std::nullopt;
+
+    ConnectionMemoryStats stats;
+    int current = 0;
+    int highwater = 0;
+    // Reads one figure; counters are reset so the next report shows activity since this one
+    auto read = [&](int op, bool reset) {
+        current = 0;
+        highwater = 0;
+        return sqlite3_db_status(db, op, &current, &highwater, reset ? 1 : 0) == SQLITE_OK;
+    };
+
+    if (!read(SQLITE_DBSTATUS_CACHE_USED, false)) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Failed to read connection memory status";
+        return std::nullopt;
+    }
+    stats.page_cache = current;
+    if (read(SQLITE_DBSTATUS_SCHEMA_USED, false)) stats.schema = current;
+    if (read(SQLITE_DBSTATUS_STMT_USED, false)) stats.statements = current;
+    if (read(SQLITE_DBSTATUS_LOOKASIDE_USED, false)) stats.lookaside_slots_used = current;
+    if (read(SQLITE_DBSTATUS_LOOKASIDE_HIT, true)) stats.lookaside_hits = highwater;
+    if (read(SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, true)) stats.lookaside_misses += highwater;
+    if (read(SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, true)) stats.lookaside_misses += highwater;
+    if (read(SQLITE_DBSTATUS_CACHE_HIT, true)) stats.cache_hits = current;
+    if (read(SQLITE_DBSTATUS_CACHE_MISS, true)) stats.cache_misses = current;
+
+    // cache_size is in pages when positive and in KiB when negative
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT cache_size, page_size FROM pragma_cache_size, pragma_page_size;", -1, &stmt, nullptr) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW) {
+        int64_t cache_size = sqlite3_column_int64(stmt, 0);
+        int64_t page_size = sqlite3_column_int64(stmt, 1);
+        stats.page_cache_limit = cache_size >= 0 ? cache_size * page_size : -cache_size * 1024;
+    }
+    sqlite3_finalize(stmt);
+    return stats;
+}
@@ -0,0 +1,148 @@
+#include "name_id_cache.h"
+#include <mutex>
+
+
+// Estimated heap cost of one entry besides its name: the hash node, its bucket and the string header
+constexpr size_t kNameIdEntryOverhead = sizeof(std::string) + sizeof(long long) + 4 * sizeof(void*);
+
+
+size_t entryBytes(const std::string& name) {
+    // Names that fit the small-string buffer have no separate allocation
+    return kNameIdEntryOverhead + (name.size() >= sizeof(std::string) ? name.size() + 1 : 0);
+}
+
+
+std::optional<long long> NameIdCache::find(const std::string& name) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = ids_.find(name);
+    if (it == ids_.end()) return std::nullopt;
+    return it->second;
+}
+
+
+void NameIdCache::insert(const std::string& name, long long id, bool in_transaction) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (ids_.insert_or_assign(name, id).second) {
+        bytes_ += entryBytes(name);
+        if (in_transaction) tentative_.push_back(name);
+        if (max_bytes_ > 0 && bytes_ > max_bytes_) evictLocked();
+    }
+}
+
+
+void NameIdCache::erase(const std::string& name) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (ids_.erase(name) > 0) bytes_ -= entryBytes(name);
+}
+
+
+void NameIdCache::clear() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    ids_.clear();
+    tentative_.clear();
+    bytes_ = 0;
+}
+
+
+void NameIdCache::commit() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    tentative_.clear();
+}
+
+
+void NameIdCache::rollback() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    for (const std::string& name : tentative_) {
+        if (ids_.erase(name) > 0) bytes_ -= entryBytes(name);
+    }
+    tentative_.clear();
+}
+
+
+size_t NameIdCache::size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return ids_.size();
+}
+
+
+size_t NameIdCache::bytes() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return bytes_;
+}
+
+
+void NameIdCache::setMaxBytes(size_t max_bytes) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    max_bytes_ = max_bytes;
+    if (max_bytes_ > 0 && bytes_ > max_bytes_) evictLocked();
+}
+
+
+uint64_t NameIdCache::evictions() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return evictions_;
+}
+
+
+void NameIdCache::evictLocked() {
+    // Tentative names may be evicted too: a rollback of a name that is no longer cached does nothing
+    auto it = ids_.begin();
+    while (it != ids_.end() && bytes_ > max_bytes_ / 2) {
+        bytes_ -= entryBytes(it->first);
+        it = ids_.erase(it);
+        ++evictions_;
+    }
+}
+
+
+NameIdCaches::~NameIdCaches() {
+    detach();
+}
+
+
+void NameIdCaches::attach(sqlite3* db) {
+    detach();
+    data_version_ = -1;     // Versions are per connection
+    if (sqlite3_prepare_v3(db, "PRAGMA data_version;", -1, SQLITE_PREPARE_PERSISTENT, &data_version_stmt_, nullptr) != SQLITE_OK) {
+        sqlite3_finalize(data_version_stmt_);
+        data_version_stmt_ = nullptr;
+    }
+    db_ = db;
+    // No commit hook: SQLite calls it before the commit can still fail, see confirmCommitted()
+    sqlite3_rollback_hook(db, [](void* caches) {
+        static_cast<NameIdCaches*>(caches)->ingredients.rollback();
+        static_cast<NameIdCaches*>(caches)->tags.rollback();
+    }, this);
+}
+
+
+void NameIdCaches::detach() {
+    sqlite3_finalize(data_version_stmt_);
+    data_version_stmt_ = nullptr;
+    db_ = nullptr;
+}
+
+
+void NameIdCaches::confirmCommitted() {
+    if (db_ == nullptr || !sqlite3_get_autocommit(db_)) return;
+    ingredients.commit();
+    tags.commit();
+}
+
+
+void NameIdCaches::syncWithDatabase() {
+    confirmCommitted();
+    // Without the statement nothing can be verified, so nothing cached is trusted
+    if (data_version_stmt_ == nullptr) {
+        clear();
+        return;
+    }
+    if (sqlite3_step(data_version_stmt_) == SQLITE_ROW) {
+        long long version = sqlite3_column_int64(data_version_stmt_, 0);
+        if (version != data_version_) {
+            if (data_version_ != -1) clear();
+            data_version_ = version;
+        }
+    }
+    sqlite3_reset(data_version_stmt_);
+}
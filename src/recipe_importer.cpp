@@ -0,0 +1,529 @@
+#include "recipe_importer.h"
+#include "ingredient_parser.h"
+#include "logging.h"
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <algorithm>
+#include <limits>
+#include <unordered_set>
+
+
+// Named HTML entities that turn up in scraped recipe text
+struct HtmlEntity {
+    std::string_view name;
+    std::string_view text;
+};
+
+
+constexpr HtmlEntity kHtmlEntities[] = {
+    {"amp", "&"}, {"lt", "<"}, {"gt", ">"}, {"quot", "\""}, {"apos", "'"}, {"nbsp", " "},
+    {"frac12", "\xC2\xBD"}, {"frac14", "\xC2\xBC"}, {"frac34", "\xC2\xBE"}, {"deg", "\xC2\xB0"},
+    {"ndash", "\xE2\x80\x93"}, {"mdash", "\xE2\x80\x94"}, {"lsquo", "\xE2\x80\x98"}, {"rsquo", "\xE2\x80\x99"},
+    {"ldquo", "\xE2\x80\x9C"}, {"rdquo", "\xE2\x80\x9D"}, {"hellip", "\xE2\x80\xA6"},
+};
+
+
+char asciiLower(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+
+/**
+ * @return Position of the first case-insensitive occurrence of lower (a lower-case ASCII needle) at or after from,
+ *         std::string_view::npos if there is none.
+ */
+size_t findIgnoreCase(std::string_view haystack, std::string_view lower, size_t from = 0) {
+    if (lower.empty() || haystack.size() < lower.size()) return std::string_view::npos;
+    for (size_t i = from; i + lower.size() <= haystack.size(); ++i) {
+        if (asciiLower(haystack[i]) != lower[0]) continue;
+        size_t j = 1;
+        while (j < lower.size() && asciiLower(haystack[i + j]) == lower[j]) ++j;
+        if (j == lower.size()) return i;
+    }
+    return std::string_view::npos;
+}
+
+
+void appendCodePoint(std::string& out, unsigned long code) {
+    if (code == 0 || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF)) code = 0xFFFD;
+    if (code < 0x80) {
+        out += static_cast<char>(code);
+    } else if (code < 0x800) {
+        out += static_cast<char>(0xC0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out += static_cast<char>(0xE0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+}
+
+
+/**
+ * Turns text from a JSON-LD string into plain text: drops HTML tags, decodes entities and collapses whitespace.
+ */
+std::string cleanText(std::string_view text) {
+    std::string out;
+    out.reserve(text.size());
+    bool pending_space = false;
+    auto append = [&](std::string_view piece) {
+        if (pending_space && !out.empty()) out += ' ';
+        pending_space = false;
+        out += piece;
+    };
+
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (c == '<') {
+            size_t close = text.find('>', i);
+            if (close != std::string_view::npos) {
+                pending_space = true;
+                i = close;
+                continue;
+            }
+        }
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            pending_space = true;
+            continue;
+        }
+        if (c == '&') {
+            size_t semicolon = text.find(';', i);
+            if (semicolon != std::string_view::npos && semicolon - i <= 10) {
+                std::string_view entity = text.substr(i + 1, semicolon - i - 1);
+                std::string decoded;
+                if (entity.size() > 1 && entity[0] == '#') {
+                    bool hex = entity[1] == 'x' || entity[1] == 'X';
+                    std::string digits(entity.substr(hex ? 2 : 1));
+                    char* end = nullptr;
+                    unsigned long code = std::strtoul(digits.c_str(), &end, hex ? 16 : 10);
+                    if (!digits.empty() && end && *end == '\0') appendCodePoint(decoded, code);
+                } else {
+                    for (const HtmlEntity& known : kHtmlEntities) {
+                        if (entity == known.name) decoded = known.text;
+                    }
+                }
+                if (decoded == " " || decoded == "\xC2\xA0") {
+                    pending_space = true;
+                    i = semicolon;
+                    continue;
+                }
+                if (!decoded.empty()) {
+                    append(decoded);
+                    i = semicolon;
+                    continue;
+                }
+            }
+        }
+        append(std::string_view(&text[i], 1));
+    }
+    return out;
+}
+
+
+std::optional<int> parseIsoDuration(std::string_view duration) {
+    if (duration.empty() || (duration[0] != 'P' && duration[0] != 'p')) return std::nullopt;
+    double seconds = 0;
+    bool in_time = false;
+    bool any = false;
+    size_t i = 1;
+    while (i < duration.size()) {
+        char c = duration[i];
+        if (c == 'T' || c == 't') {
+            in_time = true;
+            ++i;
+            continue;
+        }
+        size_t start = i;
+        while (i < duration.size() && ((duration[i] >= '0' && duration[i] <= '9') || duration[i] == '.' || duration[i] == ',')) ++i;
+        if (i == start || i >= duration.size()) return std::nullopt;
+        std::string number(duration.substr(start, i - start));
+        std::replace(number.begin(), number.end(), ',', '.');
+        double value = std::strtod(number.c_str(), nullptr);
+        switch (asciiLower(duration[i])) {
+            case 'y': if (in_time) return std::nullopt; seconds += value * 365 * 86400; break;
+            case 'w': if (in_time) return std::nullopt; seconds += value * 7 * 86400; break;
+            case 'd': if (in_time) return std::nullopt; seconds += value * 86400; break;
+            case 'h': if (!in_time) return std::nullopt; seconds += value * 3600; break;
+            case 's': if (!in_time) return std::nullopt; seconds += value; break;
+            // M is months in the date part and minutes in the time part
+            case 'm': seconds += in_time ? value * 60 : value * 30 * 86400; break;
+            default: return std::nullopt;
+        }
+        any = true;
+        ++i;
+    }
+    if (!any) return std::nullopt;
+    double minutes = seconds / 60.0;
+    if (minutes > std::numeric_limits<int>::max()) return std::nullopt;
+    int whole = static_cast<int>(minutes);
+    return whole < minutes ? whole + 1 : whole;
+}
+
+
+uint16_t clampMinutes(int minutes) {
+    return static_cast<uint16_t>(std::clamp(minutes, 0, static_cast<int>(std::numeric_limits<uint16_t>::max())));
+}
+
+
+/**
+ * @return Whether a JSON-LD @type value names schema.org Recipe, as "Recipe", "schema:Recipe" or a full IRI.
+ */
+bool isRecipeType(const JsonValue* type) {
+    if (!type) return false;
+    if (type->isArray()) {
+        return std::any_of(type->array.begin(), type->array.end(), [](const JsonValue& entry) { return isRecipeType(&entry); });
+    }
+    if (!type->isString()) return false;
+    std::string_view name = type->string;
+    size_t separator = name.find_last_of(":/");
+    if (separator != std::string_view::npos) name.remove_prefix(separator + 1);
+    return name == "Recipe";
+}
+
+
+/**
+ * @return The text of a string, the "name" of an object or the joined names of an array, e.g. for author.
+ */
+std::string nameOf(const JsonValue* value) {
+    if (!value) return "";
+    if (value->isString()) return cleanText(value->string);
+    if (value->isObject()) return nameOf(value->find("name"));
+    if (value->isArray()) {
+        std::string names;
+        for (const JsonValue& entry : value->array) {
+            std::string name = nameOf(&entry);
+            if (name.empty()) continue;
+            if (!names.empty()) names += ", ";
+            names += name;
+        }
+        return names;
+    }
+    return "";
+}
+
+
+/**
+ * @return A URL given as a string, or as an object with "@id" or "url".
+ */
+std::string urlOf(const JsonValue* value) {
+    if (!value) return "";
+    if (value->isString()) return value->string;
+    if (value->isObject()) {
+        if (const JsonValue* id = value->find("@id"); id && id->isString()) return id->string;
+        return urlOf(value->find("url"));
+    }
+    if (value->isArray() && !value->array.empty()) return urlOf(&value->array.front());
+    return "";
+}
+
+
+/**
+ * @return Servings from recipeYield, which may be a number, a string such as "4 servings" or an array of those.
+ */
+std::optional<int> yieldOf(const JsonValue* value) {
+    if (!value) return std::nullopt;
+    if (value->isNumber()) return static_cast<int>(value->number);
+    if (value->isString()) {
+        const std::string& text = value->string;
+        size_t digit = text.find_first_of("0123456789");
+        if (digit == std::string::npos) return std::nullopt;
+        return std::atoi(text.c_str() + digit);
+    }
+    if (value->isArray()) {
+        for (const JsonValue& entry : value->array) {
+            if (std::optional<int> servings = yieldOf(&entry)) return servings;
+        }
+    }
+    return std::nullopt;
+}
+
+
+std::optional<int> minutesOf(const JsonValue* value) {
+    if (!value || !value->isString()) return std::nullopt;
+    return parseIsoDuration(value->string);
+}
+
+
+/**
+ * Appends instruction steps from a string, a HowToStep, a HowToSection or ItemList, or an array of those.
+ */
+void collectInstructions(const JsonValue* value, std::vector<std::string>& steps, int depth = 0) {
+    if (!value || depth > 8) return;
+    if (value->isString()) {
+        // A single string often holds every step, one per line
+        std::string_view text = value->string;
+        while (!text.empty()) {
+            size_t end = text.find('\n');
+            std::string step = cleanText(text.substr(0, end));
+            if (!step.empty()) steps.push_back(std::move(step));
+            text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+        }
+    } else if (value->isArray()) {
+        for (const JsonValue& entry : value->array) collectInstructions(&entry, steps, depth + 1);
+    } else if (value->isObject()) {
+        if (const JsonValue* items = value->find("itemListElement")) {
+            collectInstructions(items, steps, depth + 1);
+        } else if (const JsonValue* text = value->find("text")) {
+            collectInstructions(text, steps, depth + 1);
+        } else {
+            collectInstructions(value->find("name"), steps, depth + 1);
+        }
+    }
+}
+
+
+/**
+ * Adds lower-case tags from a comma-separated string or an array of strings, skipping duplicates.
+ */
+void collectTags(const JsonValue* value, std::vector<std::string>& tags) {
+    if (!value) return;
+    if (value->isArray()) {
+        for (const JsonValue& entry : value->array) collectTags(&entry, tags);
+        return;
+    }
+    if (!value->isString()) return;
+    std::string_view text = value->string;
+    while (!text.empty()) {
+        size_t end = text.find(',');
+        std::string tag = cleanText(text.substr(0, end));
+        std::transform(tag.begin(), tag.end(), tag.begin(), asciiLower);
+        if (!tag.empty() && std::find(tags.begin(), tags.end(), tag) == tags.end()) tags.push_back(std::move(tag));
+        text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    }
+}
+
+
+std::optional<RecipeData> mapJsonLdRecipe(const JsonValue& recipe) {
+    RecipeData data;
+    data.name = nameOf(recipe.find("name"));
+    if (data.name.empty()) return std::nullopt;
+
+    if (const JsonValue* description = recipe.find("description"); description && description->isString()) {
+        data.description = cleanText(description->string);
+    }
+
+    std::optional<int> prep = minutesOf(recipe.find("prepTime"));
+    std::optional<int> cook = minutesOf(recipe.find("cookTime"));
+    std::optional<int> total = minutesOf(recipe.find("totalTime"));
+    if (!cook && total) cook = std::max(0, *total - prep.value_or(0));
+    data.prep_time_minutes = clampMinutes(prep.value_or(0));
+    data.cook_time_minutes = clampMinutes(cook.value_or(0));
+    data.servings = clampMinutes(yieldOf(recipe.find("recipeYield")).value_or(0));
+    data.is_favorite = false;
+
+    data.author = nameOf(recipe.find("author"));
+    data.source_url = urlOf(recipe.find("url"));
+    if (data.source_url.empty()) data.source_url = urlOf(recipe.find("mainEntityOfPage"));
+    data.source = nameOf(recipe.find("publisher"));
+    if (data.source.empty() && !data.source_url.empty()) {
+        // Fall back to the host name of the page
+        std::string_view host = data.source_url;
+        if (size_t scheme = host.find("://"); scheme != std::string_view::npos) host.remove_prefix(scheme + 3);
+        data.source = std::string(host.substr(0, host.find('/')));
+    }
+
+    const JsonValue* ingredients = recipe.find("recipeIngredient");
+    if (!ingredients) ingredients = recipe.find("ingredients");
+    if (ingredients && ingredients->isArray()) {
+        // A recipe links each ingredient once; later lines naming the same ingredient are dropped
+        std::unordered_set<std::string> seen;
+        for (const JsonValue& line : ingredients->array) {
+            if (!line.isString()) continue;
+            RecipeIngredientInfo ingredient;
+            if (!parseIngredientLine(cleanText(line.string), ingredient)) continue;
+            if (seen.insert(ingredient.name).second) data.ingredients.push_back(std::move(ingredient));
+        }
+    }
+
+    collectInstructions(recipe.find("recipeInstructions"), data.instructions);
+
+    collectTags(recipe.find("recipeCategory"), data.tags);
+    collectTags(recipe.find("recipeCuisine"), data.tags);
+    collectTags(recipe.find("keywords"), data.tags);
+    return data;
+}
+
+
+/**
+ * Finds Recipe objects in a JSON-LD value: the value itself, array entries, @graph members and mainEntity.
+ */
+void collectJsonLdRecipes(const JsonValue& value, std::vector<RecipeData>& recipes, int depth = 0) {
+    if (depth > 8) return;
+    if (value.isArray()) {
+        for (const JsonValue& entry : value.array) collectJsonLdRecipes(entry, recipes, depth + 1);
+        return;
+    }
+    if (!value.isObject()) return;
+    if (isRecipeType(value.find("@type"))) {
+        if (std::optional<RecipeData> recipe = mapJsonLdRecipe(value)) recipes.push_back(std::move(*recipe));
+        return;
+    }
+    if (const JsonValue* graph = value.find("@graph")) collectJsonLdRecipes(*graph, recipes, depth + 1);
+    if (const JsonValue* entity = value.find("mainEntity")) collectJsonLdRecipes(*entity, recipes, depth + 1);
+}
+
+
+std::vector<RecipeData> extractJsonLdRecipes(std::string_view html, size_t* invalid_blocks) {
+    std::vector<RecipeData> recipes;
+    size_t pos = 0;
+    while ((pos = findIgnoreCase(html, "<script", pos)) != std::string_view::npos) {
+        size_t tag_end = html.find('>', pos);
+        if (tag_end == std::string_view::npos) break;
+        std::string_view tag = html.substr(pos, tag_end - pos);
+        size_t close = findIgnoreCase(html, "</script", tag_end);
+        if (close == std::string_view::npos) break;
+        pos = close;
+        if (findIgnoreCase(tag, "application/ld+json") == std::string_view::npos) continue;
+
+        std::string_view body = html.substr(tag_end + 1, close - tag_end - 1);
+        // Some pages wrap the block in an HTML comment or CDATA section
+        auto strip = [&body](std::string_view open, std::string_view close_marker) {
+            size_t first = body.find_first_not_of(" \t\r\n");
+            if (first == std::string_view::npos || body.substr(first, open.size()) != open) return;
+            body.remove_prefix(first + open.size());
+            size_t last = body.rfind(close_marker);
+            if (last != std::string_view::npos) body = body.substr(0, last);
+        };
+        strip("<!--", "-->");
+        strip("<![CDATA[", "]]>");
+        size_t first = body.find_first_not_of(" \t\r\n");
+        size_t last = body.find_last_not_of(" \t\r\n;");
+        body = first == std::string_view::npos ? std::string_view() : body.substr(first, last - first + 1);
+
+        std::optional<JsonValue> json = parseJson(body);
+        if (!json) {
+            if (invalid_blocks) ++*invalid_blocks;
+            continue;
+        }
+        collectJsonLdRecipes(*json, recipes);
+    }
+    return recipes;
+}
+
+
+std::optional<ImportReport> importRecipePages(Database& db, const std::filesystem::path& directory, const ImportOptions& options) {
+    if (!db.isOpen()) {
+        LogLine(LogLevel::Error, __func__) << "Database not open. Cannot import recipes.";
+        return std::nullopt;
+    }
+
+    const auto started = std::chrono::steady_clock::now();
+    std::vector<std::filesystem::path> files;
+    std::error_code error;
+    for (std::filesystem::recursive_directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+        if (!it->is_regular_file()) continue;
+        std::string extension = it->path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), asciiLower);
+        if (extension == ".html" || extension == ".htm") files.push_back(it->path());
+    }
+    if (error) {
+        LogLine(LogLevel::Error, __func__) << "Cannot read directory " << directory.string() << ": " << error.message();
+        return std::nullopt;
+    }
+    std::sort(files.begin(), files.end());
+
+    ImportReport report;
+    report.pages = files.size();
+    const size_t batch_size = std::max<size_t>(1, options.batch_size);
+    const size_t capacity = std::max(batch_size, options.queue_capacity);
+    size_t thread_count = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    thread_count = std::max<size_t>(1, std::min(thread_count, files.size()));
+
+    // Parser threads claim files through next_file and hand recipes to this thread through a bounded queue
+    std::atomic<size_t> next_file{0};
+    std::atomic<size_t> unreadable{0};
+    std::atomic<size_t> with_recipes{0};
+    std::atomic<size_t> invalid_blocks{0};
+    std::atomic<size_t> found{0};
+    std::mutex mutex;
+    std::condition_variable ready_cv;
+    std::condition_variable space_cv;
+    std::deque<RecipeData> queue;
+    size_t running = thread_count;
+    bool aborted = false;
+
+    auto parse = [&] {
+        std::string html;
+        while (true) {
+            size_t index = next_file++;
+            if (index >= files.size()) break;
+
+            std::ifstream in(files[index], std::ios::binary);
+            if (!in) {
+                ++unreadable;
+                continue;
+            }
+            std::ostringstream contents;
+            contents << in.rdbuf();
+            html = std::move(contents).str();
+
+            size_t invalid = 0;
+            std::vector<RecipeData> recipes = extractJsonLdRecipes(html, &invalid);
+            invalid_blocks += invalid;
+            if (recipes.empty()) continue;
+            ++with_recipes;
+            found += recipes.size();
+
+            // Wake the inserting thread as soon as a batch is ready, not after the whole page: a page holding more
+            // recipes than the queue does would otherwise wait for space that is never made
+            std::unique_lock<std::mutex> lock(mutex);
+            for (RecipeData& recipe : recipes) {
+                space_cv.wait(lock, [&] { return queue.size() < capacity || aborted; });
+                if (aborted) return;
+                queue.push_back(std::move(recipe));
+                if (queue.size() >= batch_size) ready_cv.notify_one();
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        --running;
+        ready_cv.notify_one();
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(thread_count);
+    for (size_t i = 0; i < thread_count && !files.empty(); ++i) workers.emplace_back(parse);
+
+    std::vector<RecipeData> batch;
+    batch.reserve(batch_size);
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready_cv.wait(lock, [&] { return queue.size() >= batch_size || running == 0; });
+            while (!queue.empty() && batch.size() < batch_size) {
+                batch.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+            if (batch.empty() && running == 0) break;
+        }
+        space_cv.notify_all();
+
+        std::vector<long long> ids = db.addRecipes(batch);
+        if (ids.empty()) {
+            LogLine(LogLevel::Error, __func__) << "Failed to add a batch of " << batch.size() << " recipes; stopping the import.";
+            std::lock_guard<std::mutex> lock(mutex);
+            aborted = true;
+            space_cv.notify_all();
+            break;
+        }
+        report.recipes_added += static_cast<size_t>(std::count_if(ids.begin(), ids.end(), [](long long id) { return id != -1; }));
+        batch.clear();
+    }
+    for (std::thread& worker : workers) worker.join();
+
+    report.unreadable_pages = unreadable;
+    report.pages_with_recipes = with_recipes;
+    report.invalid_blocks = invalid_blocks;
+    report.recipes_found = found;
+    report.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    return report;
+}
@@ -0,0 +1,309 @@
+#include "recipe_signatures.h"
+#include "logging.h"
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+
+// Pruning bounds add the query's weights in a different order than the scores do, so they may come out
+// lower by a rounding error; a candidate is only skipped when its bound is below the threshold by more.
+constexpr double kBoundSlack = 1e-9;
+
+// Changed recipes are merged into the loaded signatures unless there are more than this many and more than half
+// the recipes; then reading recipe_ingredients again is no slower
+constexpr size_t kMinChangesBeforeReload = 1024;
+
+
+bool RecipeSignatures::refresh(sqlite3* db) {
+    const bool in_transaction = sqlite3_get_autocommit(db) == 0;
+    // What was read inside the last transaction may have been rolled back since
+    if (uncommitted_ && !in_transaction) clear();
+
+    long long data_version = -1;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "PRAGMA data_version;", -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        data_version = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    const int64_t total_changes = sqlite3_total_changes64(db);
+    if (loaded_ && data_version == data_version_ && total_changes == total_changes_) return true;
+
+    // One read transaction, so the change sequence and the links come from the same snapshot
+    if (!in_transaction && sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Failed to begin a read transaction: " << sqlite3_errmsg(db);
+        return false;
+    }
+    bool ok = loaded_ ? applyChanges(db) : load(db);
+    if (!ok) LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Failed to load ingredient signatures: " << sqlite3_errmsg(db);
+    if (!in_transaction) sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    if (!ok) {
+        clear();
+        return false;
+    }
+
+    data_version_ = data_version;
+    total_changes_ = total_changes;
+    if (in_transaction) uncommitted_ = true;
+    return true;
+}
+
+
+/**
+ * Reads the range of recipe_ingredient_changes entries.
+ * @return false if the query failed.
+ */
+bool readChangeRange(sqlite3* db, long long& first_change_seq, long long& last_change_seq) {
+    sqlite3_stmt* stmt = nullptr;
+    const char* sql = "SELECT COALESCE(MIN(change_seq), 0), COALESCE(MAX(change_seq), 0) FROM recipe_ingredient_changes;";
+    bool ok = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW;
+    if (ok) {
+        first_change_seq = sqlite3_column_int64(stmt, 0);
+        last_change_seq = sqlite3_column_int64(stmt, 1);
+    }
+    sqlite3_finalize(stmt);
+    return ok;
+}
+
+
+bool RecipeSignatures::load(sqlite3* db) {
+    long long first_change_seq = 0;
+    long long last_change_seq = 0;
+    if (!readChangeRange(db, first_change_seq, last_change_seq)) return false;
+
+    // The primary key index of recipe_ingredients hands the links back already grouped by recipe
+    std::vector<std::pair<long long, long long>> links;
+    sqlite3_stmt* stmt = nullptr;
+    int rc = sqlite3_prepare_v2(db, "SELECT recipe_id, ingredient_id FROM recipe_ingredients ORDER BY recipe_id, ingredient_id;", -1, &stmt, nullptr);
+    if (rc == SQLITE_OK) {
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            links.emplace_back(sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1));
+        }
+    }
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) return false;
+
+    assign(links);
+    last_change_seq_ = last_change_seq;
+    return true;
+}
+
+
+bool RecipeSignatures::applyChanges(sqlite3* db) {
+    long long first_change_seq = 0;
+    long long last_change_seq = 0;
+    if (!readChangeRange(db, first_change_seq, last_change_seq)) return false;
+    // Writes that left every ingredient link alone added no entry
+    if (last_change_seq == last_change_seq_) return true;
+
+    // Load from scratch if maintenance trimmed entries not applied yet, or if most recipes changed anyway
+    const bool trimmed = first_change_seq > last_change_seq_ + 1;
+    const size_t pending = static_cast<size_t>(last_change_seq - last_change_seq_);
+    if (trimmed || last_change_seq < last_change_seq_ || pending > std::max<size_t>(kMinChangesBeforeReload, recipe_ids_.size() / 2)) {
+        return load(db);
+    }
+
+    // The new links of every changed recipe; a recipe left without ingredients comes back with a NULL ingredient
+    std::vector<std::pair<long long, long long>> changed;
+    std::vector<long long> changed_recipes;
+    sqlite3_stmt* stmt = nullptr;
+    const char* sql = "SELECT c.recipe_id, ri.ingredient_id "
+                      "FROM (SELECT DISTINCT recipe_id FROM recipe_ingredient_changes WHERE change_seq > ?) AS c "
+                      "LEFT JOIN recipe_ingredients AS ri ON ri.recipe_id = c.recipe_id ORDER BY c.recipe_id;";
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, last_change_seq_);
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            const long long recipe_id = sqlite3_column_int64(stmt, 0);
+            if (changed_recipes.empty() || changed_recipes.back() != recipe_id) changed_recipes.push_back(recipe_id);
+            if (sqlite3_column_type(stmt, 1) != SQLITE_NULL) changed.emplace_back(recipe_id, sqlite3_column_int64(stmt, 1));
+        }
+    }
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) return false;
+
+    // Merge the unchanged rows with the changed recipes' links, both in recipe_id order, without reading the table
+    // again. The weights depend on every recipe, so they are recomputed in full.
+    std::vector<std::pair<long long, long long>> links;
+    links.reserve(ingredients_.size() + changed.size());
+    size_t next_changed = 0;
+    for (size_t row = 0; row < recipe_ids_.size(); ++row) {
+        const long long recipe_id = recipe_ids_[row];
+        while (next_changed < changed.size() && changed[next_changed].first < recipe_id) links.push_back(changed[next_changed++]);
+        if (std::binary_search(changed_recipes.begin(), changed_recipes.end(), recipe_id)) continue;
+        for (uint32_t i = ingredient_offsets_[row]; i < ingredient_offsets_[row + 1]; ++i) {
+            links.emplace_back(recipe_id, ingredient_ids_[ingredients_[i]]);
+        }
+    }
+    links.insert(links.end(), changed.begin() + static_cast<std::ptrdiff_t>(next_changed), changed.end());
+
+    assign(links);
+    last_change_seq_ = last_change_seq;
+    return true;
+}
+
+
+void RecipeSignatures::assign(const std::vector<std::pair<long long, long long>>& links) {
+    clear();
+    std::unordered_map<long long, uint32_t> dense;
+    std::vector<uint32_t> document_frequency;
+    for (const auto& [recipe_id, ingredient_id] : links) {
+        if (recipe_ids_.empty() || recipe_ids_.back() != recipe_id) {
+            recipe_ids_.push_back(recipe_id);
+            ingredient_offsets_.push_back(static_cast<uint32_t>(ingredients_.size()));
+        }
+        auto [entry, inserted] = dense.try_emplace(ingredient_id, static_cast<uint32_t>(document_frequency.size()));
+        if (inserted) {
+            document_frequency.push_back(0);
+            ingredient_ids_.push_back(ingredient_id);
+        }
+        ++document_frequency[entry->second];
+        ingredients_.push_back(entry->second);
+    }
+    ingredient_offsets_.push_back(static_cast<uint32_t>(ingredients_.size()));
+    const size_t rows = recipe_ids_.size();
+
+    // Dense numbers follow first appearance, not ingredient_id, so sort each row again
+    for (size_t row = 0; row < rows; ++row) {
+        std::sort(ingredients_.begin() + ingredient_offsets_[row], ingredients_.begin() + ingredient_offsets_[row + 1]);
+    }
+
+    weights_.resize(document_frequency.size());
+    for (size_t ingredient = 0; ingredient < weights_.size(); ++ingredient) {
+        weights_[ingredient] = static_cast<float>(std::log(1.0 + static_cast<double>(rows) / document_frequency[ingredient]));
+    }
+    row_weights_.assign(rows, 0);
+
+    // Counting sort into posting lists; rows are visited in order, so every list comes out ascending
+    posting_offsets_.assign(document_frequency.size() + 1, 0);
+    for (size_t ingredient = 0; ingredient < document_frequency.size(); ++ingredient) {
+        posting_offsets_[ingredient + 1] = posting_offsets_[ingredient] + document_frequency[ingredient];
+    }
+    postings_.resize(ingredients_.size());
+    std::vector<uint32_t> fill(posting_offsets_.begin(), posting_offsets_.end() - 1);
+    for (uint32_t row = 0; row < rows; ++row) {
+        for (uint32_t i = ingredient_offsets_[row]; i < ingredient_offsets_[row + 1]; ++i) {
+            postings_[fill[ingredients_[i]]++] = row;
+            row_weights_[row] += weights_[ingredients_[i]];
+        }
+    }
+    loaded_ = true;
+}
+
+
+void RecipeSignatures::clear() {
+    recipe_ids_.clear();
+    ingredient_offsets_.clear();
+    ingredients_.clear();
+    row_weights_.clear();
+    posting_offsets_.clear();
+    postings_.clear();
+    weights_.clear();
+    ingredient_ids_.clear();
+    loaded_ = false;
+    uncommitted_ = false;
+    last_change_seq_ = 0;
+    data_version_ = -1;
+    total_changes_ = -1;
+}
+
+
+size_t RecipeSignatures::recipeCount() const {
+    return recipe_ids_.size();
+}
+
+
+size_t RecipeSignatures::bytes() const {
+    return recipe_ids_.capacity() * sizeof(long long) + (ingredient_offsets_.capacity() + ingredients_.capacity() +
+           posting_offsets_.capacity() + postings_.capacity()) * sizeof(uint32_t) + row_weights_.capacity() * sizeof(double) +
+           weights_.capacity() * sizeof(float) + ingredient_ids_.capacity() * sizeof(long long);
+}
+
+
+std::vector<SimilarRecipe> RecipeSignatures::mostSimilar(long long recipe_id, size_t k, SimilarityMeasure measure,
+                                                         const std::vector<long long>* allowed) const {
+    auto found = std::lower_bound(recipe_ids_.begin(), recipe_ids_.end(), recipe_id);
+    if (k == 0 || found == recipe_ids_.end() || *found != recipe_id) return {};
+    const uint32_t query_row = static_cast<uint32_t>(found - recipe_ids_.begin());
+    const uint32_t* query = ingredients_.data() + ingredient_offsets_[query_row];
+    const uint32_t query_size = ingredient_offsets_[query_row + 1] - ingredient_offsets_[query_row];
+
+    const bool weighted = measure == SimilarityMeasure::WeightedJaccard;
+    auto weight = [&](uint32_t ingredient) { return weighted ? static_cast<double>(weights_[ingredient]) : 1.0; };
+    auto rowWeight = [&](uint32_t row) {
+        return weighted ? row_weights_[row] : static_cast<double>(ingredient_offsets_[row + 1] - ingredient_offsets_[row]);
+    };
+    const double query_weight = rowWeight(query_row);
+
+    // Rarest ingredients first: their posting lists are the shortest and, weighted, carry the most weight
+    std::vector<uint32_t> order(query, query + query_size);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        uint32_t length_a = posting_offsets_[a + 1] - posting_offsets_[a];
+        uint32_t length_b = posting_offsets_[b + 1] - posting_offsets_[b];
+        return length_a != length_b ? length_a < length_b : a < b;
+    });
+
+    // Worst result on top, so the heap holds the best k seen so far
+    auto better = [](const SimilarRecipe& a, const SimilarRecipe& b) {
+        return a.similarity != b.similarity ? a.similarity > b.similarity : a.recipe_id < b.recipe_id;
+    };
+    std::vector<SimilarRecipe> top;
+    std::vector<uint64_t> seen((recipe_ids_.size() + 63) / 64, 0);
+    seen[query_row / 64] |= uint64_t{1} << (query_row % 64);
+
+    double remaining = query_weight;
+    for (uint32_t ingredient : order) {
+        const double threshold = top.size() == k ? top.front().similarity : 0.0;
+        // A recipe not seen yet shares only this and the following ingredients, and its union with the query
+        // weighs at least the query, so it cannot score more than remaining / query_weight
+        if (top.size() == k && remaining < (threshold - kBoundSlack) * query_weight) break;
+        const double reachable = remaining;
+        remaining -= weight(ingredient);
+
+        for (uint32_t p = posting_offsets_[ingredient]; p < posting_offsets_[ingredient + 1]; ++p) {
+            const uint32_t row = postings_[p];
+            uint64_t& word = seen[row / 64];
+            const uint64_t bit = uint64_t{1} << (row % 64);
+            if (word & bit) continue;
+            word |= bit;
+
+            // The recipe shares at most `reachable` with the query, and no more than its own weight
+            const double row_weight = rowWeight(row);
+            const double most_shared = std::min(reachable, row_weight);
+            if (top.size() == k && most_shared / (query_weight + row_weight - most_shared) < top.front().similarity - kBoundSlack) continue;
+            if (allowed && !std::binary_search(allowed->begin(), allowed->end(), recipe_ids_[row])) continue;
+
+            // Both rows are sorted, so the intersection is a merge
+            const uint32_t* other = ingredients_.data() + ingredient_offsets_[row];
+            const uint32_t* other_end = ingredients_.data() + ingredient_offsets_[row + 1];
+            const uint32_t* mine = query;
+            const uint32_t* mine_end = query + query_size;
+            double shared_weight = 0;
+            size_t shared = 0;
+            while (mine != mine_end && other != other_end) {
+                if (*mine < *other) {
+                    ++mine;
+                } else if (*other < *mine) {
+                    ++other;
+                } else {
+                    shared_weight += weight(*mine);
+                    ++shared;
+                    ++mine;
+                    ++other;
+                }
+            }
+
+            SimilarRecipe match{recipe_ids_[row], shared_weight / (query_weight + row_weight - shared_weight), shared};
+            if (top.size() < k) {
+                top.push_back(match);
+                std::push_heap(top.begin(), top.end(), better);
+            } else if (better(match, top.front())) {
+                std::pop_heap(top.begin(), top.end(), better);
+                top.back() = match;
+                std::push_heap(top.begin(), top.end(), better);
+            }
+        }
+    }
+
+    std::sort(top.begin(), top.end(), better);
+    return top;
+}
@@ -0,0 +1,525 @@
+#include "recipe_text_index.h"
+#include "logging.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+
+// Common English words that say nothing about a recipe; sorted for binary search
+constexpr std::array<std::string_view, 32> kTextStopWords = {
+    "an", "and", "are", "as", "at", "be", "but", "by", "for", "from", "has", "have", "in", "into", "is", "it",
+    "its", "of", "on", "or", "that", "the", "then", "this", "to", "until", "was", "were", "when", "while", "will", "with"
+};
+
+// Changes applied one by one before the index compacts itself, however small it is
+constexpr size_t kMinChangesBeforeCompaction = 1024;
+
+// Postings per block of a posting list; each block records its largest weight for block-max pruning
+constexpr size_t kPostingBlock = 64;
+
+// Relative slack on WAND's upper bounds, so rounding in the sums never prunes a document that ties the k-th score
+constexpr double kTextBoundSlack = 1e-9;
+
+// Entry overhead of the term dictionary and the appended-document map: node, bucket and allocator bookkeeping
+constexpr size_t kTextHashEntryOverhead = 4 * sizeof(void*);
+
+
+// Calls term(const std::string&) for every index term of text, reusing buffer for it; see recipeTextTerms()
+template <typename TermFunction>
+void forEachRecipeTextTerm(std::string_view text, std::string& buffer, TermFunction&& term) {
+    // Bytes of multi-byte UTF-8 characters count as letters, so accented words stay whole
+    auto isWordByte = [](unsigned char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80; };
+    size_t i = 0;
+    while (i < text.size()) {
+        while (i < text.size() && !isWordByte(static_cast<unsigned char>(text[i]))) ++i;
+        size_t start = i;
+        bool digits_only = true;
+        while (i < text.size() && isWordByte(static_cast<unsigned char>(text[i]))) {
+            digits_only = digits_only && text[i] >= '0' && text[i] <= '9';
+            ++i;
+        }
+        if (i - start < 2 || digits_only) continue;
+
+        buffer.assign(text.substr(start, i - start));
+        for (char& c : buffer) {
+            if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+        }
+        if (std::binary_search(kTextStopWords.begin(), kTextStopWords.end(), std::string_view(buffer))) continue;
+        if (buffer.size() > 4 && buffer.ends_with("ies")) {
+            buffer.replace(buffer.size() - 3, 3, "y");
+        } else if (buffer.size() > 3 && buffer.back() == 's' && buffer[buffer.size() - 2] != 's') {
+            buffer.pop_back();
+        }
+        term(buffer);
+    }
+}
+
+
+std::vector<std::string> recipeTextTerms(std::string_view text) {
+    std::vector<std::string> terms;
+    std::string buffer;
+    forEachRecipeTextTerm(text, buffer, [&](const std::string& term) { terms.push_back(term); });
+    return terms;
+}
+
+
+bool RecipeTextIndex::refresh(sqlite3* db) {
+    const bool in_transaction = sqlite3_get_autocommit(db) == 0;
+    // What was read inside the last transaction may have been rolled back since
+    if (uncommitted_ && !in_transaction) clear();
+
+    long long data_version = -1;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "PRAGMA data_version;", -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        data_version = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    const int64_t total_changes = sqlite3_total_changes64(db);
+    if (loaded_ && data_version == data_version_ && total_changes == total_changes_) return true;
+
+    // One read transaction, so the change sequence and the text come from the same snapshot
+    if (!in_transaction && sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Failed to begin a read transaction: " << sqlite3_errmsg(db);
+        return false;
+    }
+    bool ok = loaded_ ? applyChanges(db) : load(db);
+    if (!ok) LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Failed to read recipe text: " << sqlite3_errmsg(db);
+    if (!in_transaction) sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    if (!ok) {
+        clear();
+        return false;
+    }
+
+    data_version_ = data_version;
+    total_changes_ = total_changes;
+    if (in_transaction) uncommitted_ = true;
+    return true;
+}
+
+
+// Description and instructions of each recipe; the order of the steps does not matter to a bag of words
+const char* const kRecipeTextColumnsSql = R"(
+        r.description,
+        (SELECT group_concat(instruction, ' ') FROM instructions AS i WHERE i.recipe_id = r.recipe_id)
+    )";
+
+
+std::string recipeTextOf(sqlite3_stmt* stmt, int first_column) {
+    std::string text;
+    for (int column = first_column; column < first_column + 2; ++column) {
+        if (const unsigned char* value = sqlite3_column_text(stmt, column)) {
+            if (!text.empty()) text += ' ';
+            text += reinterpret_cast<const char*>(value);
+        }
+    }
+    return text;
+}
+
+
+bool RecipeTextIndex::load(sqlite3* db) {
+    clear();
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT COALESCE(MAX(change_seq), 0) FROM recipe_text_changes;", -1, &stmt, nullptr) != SQLITE_OK ||
+        sqlite3_step(stmt) != SQLITE_ROW) {
+        sqlite3_finalize(stmt);
+        return false;
+    }
+    last_change_seq_ = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+
+    const std::string sql = std::string("SELECT r.recipe_id,") + kRecipeTextColumnsSql + "FROM recipes AS r ORDER BY r.recipe_id;";
+    stmt = nullptr;
+    int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
+    if (rc == SQLITE_OK) {
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            appendDocument(sqlite3_column_int64(stmt, 0), recipeTextOf(stmt, 1));
+        }
+    }
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) return false;
+
+    compact();
+    loaded_ = true;
+    return true;
+}
+
+
+bool RecipeTextIndex::applyChanges(sqlite3* db) {
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT COALESCE(MIN(change_seq), 0), COALESCE(MAX(change_seq), 0) FROM recipe_text_changes;", -1, &stmt, nullptr) != SQLITE_OK ||
+        sqlite3_step(stmt) != SQLITE_ROW) {
+        sqlite3_finalize(stmt);
+        return false;
+    }
+    const long long first_change_seq = sqlite3_column_int64(stmt, 0);
+    const long long last_change_seq = sqlite3_column_int64(stmt, 1);
+    sqlite3_finalize(stmt);
+    // Writes that left every recipe's text alone added no entry
+    if (last_change_seq == last_change_seq_) return true;
+
+    // Load from scratch if maintenance trimmed entries not applied yet, or if there are too many to apply one by one
+    const bool trimmed = first_change_seq > last_change_seq_ + 1;
+    const size_t pending = static_cast<size_t>(last_change_seq - last_change_seq_);
+    if (trimmed || last_change_seq < last_change_seq_ || pending > std::max(kMinChangesBeforeCompaction, live_documents_ / 2)) return load(db);
+
+    const std::string sql = std::string("SELECT c.recipe_id, r.recipe_id IS NOT NULL,") + kRecipeTextColumnsSql +
+                            "FROM (SELECT DISTINCT recipe_id FROM recipe_text_changes WHERE change_seq > ?) AS c "
+                            "LEFT JOIN recipes AS r ON r.recipe_id = c.recipe_id;";
+    stmt = nullptr;
+    int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, last_change_seq_);
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            const long long recipe_id = sqlite3_column_int64(stmt, 0);
+            if (sqlite3_column_int(stmt, 1)) {
+                addDocument(recipe_id, recipeTextOf(stmt, 2));
+            } else {
+                removeDocument(recipe_id);
+            }
+        }
+    }
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) return false;
+    last_change_seq_ = last_change_seq;
+    return true;
+}
+
+
+bool RecipeTextIndex::appendDocument(long long recipe_id, std::string_view text) {
+    const uint32_t offset = static_cast<uint32_t>(term_counts_.size());
+    std::vector<uint32_t> terms;
+    forEachRecipeTextTerm(text, term_buffer_, [&](const std::string& term) {
+        auto entry = term_ids_.find(term);
+        if (entry == term_ids_.end()) {
+            entry = term_ids_.emplace(term, static_cast<uint32_t>(idf_.size())).first;
+            // Fixed until the next compaction, so documents indexed before and after agree on the term's weight
+            idf_.push_back(static_cast<float>(std::log(1.0 + static_cast<double>(live_documents_ + 1))));
+            max_weights_.push_back(0);
+            postings_.emplace_back();
+            block_max_weights_.emplace_back();
+        }
+        terms.push_back(entry->second);
+    });
+    if (terms.empty()) return false;
+
+    std::sort(terms.begin(), terms.end());
+    for (size_t i = 0; i < terms.size();) {
+        size_t run = i;
+        while (run < terms.size() && terms[run] == terms[i]) ++run;
+        term_counts_.push_back({terms[i], static_cast<uint32_t>(run - i)});
+        i = run;
+    }
+    documents_.push_back({recipe_id, offset, static_cast<uint32_t>(term_counts_.size() - offset), 0, true});
+    ++live_documents_;
+    return true;
+}
+
+
+void RecipeTextIndex::addDocument(long long recipe_id, std::string_view text) {
+    removeDocument(recipe_id);
+    if (!appendDocument(recipe_id, text)) return;
+
+    const uint32_t index = static_cast<uint32_t>(documents_.size() - 1);
+    Document& document = documents_[index];
+    const TermCount* terms = term_counts_.data() + document.offset;
+    double squares = 0;
+    for (uint32_t i = 0; i < document.length; ++i) squares += static_cast<double>(termWeight(terms[i])) * termWeight(terms[i]);
+    document.norm = static_cast<float>(std::sqrt(squares));
+    for (uint32_t i = 0; i < document.length; ++i) {
+        addPosting(terms[i].term, index, termWeight(terms[i]) / document.norm);
+    }
+    appended_[recipe_id] = index;
+
+    if (++changes_since_compaction_ > std::max(kMinChangesBeforeCompaction, live_documents_ / 4)) compact();
+}
+
+
+void RecipeTextIndex::removeDocument(long long recipe_id) {
+    const Document* document = find(recipe_id);
+    if (!document) return;
+    documents_[document - documents_.data()].live = false;
+    --live_documents_;
+    appended_.erase(recipe_id);
+
+    if (++changes_since_compaction_ > std::max(kMinChangesBeforeCompaction, live_documents_ / 4)) compact();
+}
+
+
+void RecipeTextIndex::compact() {
+    std::vector<Document> live;
+    live.reserve(live_documents_);
+    for (const Document& document : documents_) {
+        if (document.live) live.push_back(document);
+    }
+    std::sort(live.begin(), live.end(), [](const Document& a, const Document& b) { return a.recipe_id < b.recipe_id; });
+
+    // Renumber the terms still in use; new numbers follow the old ones, so every document's terms stay sorted
+    std::vector<uint32_t> document_frequency(idf_.size(), 0);
+    for (const Document& document : live) {
+        for (uint32_t i = 0; i < document.length; ++i) ++document_frequency[term_counts_[document.offset + i].term];
+    }
+    constexpr uint32_t kUnusedTerm = UINT32_MAX;
+    std::vector<uint32_t> renumbered(idf_.size(), kUnusedTerm);
+    std::vector<uint32_t> frequency;
+    for (size_t term = 0; term < idf_.size(); ++term) {
+        if (document_frequency[term] == 0) continue;
+        renumbered[term] = static_cast<uint32_t>(frequency.size());
+        frequency.push_back(document_frequency[term]);
+    }
+    for (auto it = term_ids_.begin(); it != term_ids_.end();) {
+        if (renumbered[it->second] == kUnusedTerm) {
+            it = term_ids_.erase(it);
+        } else {
+            it->second = renumbered[it->second];
+            ++it;
+        }
+    }
+    const uint32_t term_count = static_cast<uint32_t>(frequency.size());
+
+    std::vector<TermCount> term_counts;
+    term_counts.reserve(term_counts_.size());
+    for (Document& document : live) {
+        const uint32_t offset = static_cast<uint32_t>(term_counts.size());
+        for (uint32_t i = 0; i < document.length; ++i) {
+            const TermCount& term_count_entry = term_counts_[document.offset + i];
+            term_counts.push_back({renumbered[term_count_entry.term], term_count_entry.count});
+        }
+        document.offset = offset;
+    }
+
+    idf_.assign(term_count, 0);
+    for (uint32_t term = 0; term < term_count; ++term) {
+        idf_[term] = static_cast<float>(std::log(1.0 + static_cast<double>(live.size()) / frequency[term]));
+    }
+    documents_ = std::move(live);
+    term_counts_ = std::move(term_counts);
+    max_weights_.assign(term_count, 0);
+    postings_.assign(term_count, {});
+    block_max_weights_.assign(term_count, {});
+    for (uint32_t term = 0; term < term_count; ++term) {
+        postings_[term].reserve(frequency[term]);
+        block_max_weights_[term].reserve((frequency[term] + kPostingBlock - 1) / kPostingBlock);
+    }
+    for (uint32_t index = 0; index < documents_.size(); ++index) {
+        Document& document = documents_[index];
+        const TermCount* terms = term_counts_.data() + document.offset;
+        double squares = 0;
+        for (uint32_t i = 0; i < document.length; ++i) squares += static_cast<double>(termWeight(terms[i])) * termWeight(terms[i]);
+        document.norm = static_cast<float>(std::sqrt(squares));
+        for (uint32_t i = 0; i < document.length; ++i) {
+            addPosting(terms[i].term, index, termWeight(terms[i]) / document.norm);
+        }
+    }
+
+    sorted_documents_ = documents_.size();
+    live_documents_ = documents_.size();
+    appended_.clear();
+    changes_since_compaction_ = 0;
+}
+
+
+void RecipeTextIndex::clear() {
+    term_ids_.clear();
+    idf_.clear();
+    max_weights_.clear();
+    postings_.clear();
+    block_max_weights_.clear();
+    documents_.clear();
+    term_counts_.clear();
+    sorted_documents_ = 0;
+    appended_.clear();
+    live_documents_ = 0;
+    changes_since_compaction_ = 0;
+    loaded_ = false;
+    uncommitted_ = false;
+    last_change_seq_ = 0;
+    data_version_ = -1;
+    total_changes_ = -1;
+}
+
+
+size_t RecipeTextIndex::documentCount() const {
+    return live_documents_;
+}
+
+
+size_t RecipeTextIndex::bytes() const {
+    size_t total = (idf_.capacity() + max_weights_.capacity()) * sizeof(float) + postings_.capacity() * sizeof(std::vector<Posting>) +
+                   documents_.capacity() * sizeof(Document) + term_counts_.capacity() * sizeof(TermCount);
+    for (const std::vector<Posting>& list : postings_) total += list.capacity() * sizeof(Posting);
+    total += block_max_weights_.capacity() * sizeof(std::vector<float>);
+    for (const std::vector<float>& blocks : block_max_weights_) total += blocks.capacity() * sizeof(float);
+    // An empty table's single bucket is not heap memory
+    if (!term_ids_.empty()) total += term_ids_.bucket_count() * sizeof(void*);
+    if (!appended_.empty()) total += appended_.bucket_count() * sizeof(void*);
+    for (const auto& [term, id] : term_ids_) {
+        total += kTextHashEntryOverhead + sizeof(std::string) + sizeof(uint32_t) + (term.size() >= sizeof(std::string) ? term.size() + 1 : 0);
+    }
+    total += appended_.size() * (kTextHashEntryOverhead + sizeof(long long) + sizeof(uint32_t));
+    return total;
+}
+
+
+const RecipeTextIndex::Document* RecipeTextIndex::find(long long recipe_id) const {
+    if (auto it = appended_.find(recipe_id); it != appended_.end()) return &documents_[it->second];
+    auto sorted_end = documents_.begin() + static_cast<std::ptrdiff_t>(sorted_documents_);
+    auto it = std::lower_bound(documents_.begin(), sorted_end, recipe_id,
+                               [](const Document& document, long long id) { return document.recipe_id < id; });
+    return it != sorted_end && it->recipe_id == recipe_id && it->live ? &*it : nullptr;
+}
+
+
+void RecipeTextIndex::addPosting(uint32_t term, uint32_t document, float weight) {
+    std::vector<Posting>& list = postings_[term];
+    std::vector<float>& blocks = block_max_weights_[term];
+    list.push_back({document, weight});
+    if (list.size() % kPostingBlock == 1) {
+        blocks.push_back(weight);
+    } else {
+        blocks.back() = std::max(blocks.back(), weight);
+    }
+    max_weights_[term] = std::max(max_weights_[term], weight);
+}
+
+
+float RecipeTextIndex::termWeight(const TermCount& term_count) const {
+    return static_cast<float>(1.0 + std::log(static_cast<double>(term_count.count))) * idf_[term_count.term];
+}
+
+
+double RecipeTextIndex::similarity(long long first_recipe_id, long long second_recipe_id) const {
+    const Document* first = find(first_recipe_id);
+    const Document* second = find(second_recipe_id);
+    if (!first || !second) return 0;
+
+    const TermCount* a = term_counts_.data() + first->offset;
+    const TermCount* a_end = a + first->length;
+    const TermCount* b = term_counts_.data() + second->offset;
+    const TermCount* b_end = b + second->length;
+    double score = 0;
+    while (a != a_end && b != b_end) {
+        if (a->term < b->term) {
+            ++a;
+        } else if (b->term < a->term) {
+            ++b;
+        } else {
+            score += static_cast<double>(termWeight(*a) / first->norm) * (termWeight(*b) / second->norm);
+            ++a;
+            ++b;
+        }
+    }
+    return score;
+}
+
+
+std::vector<TextMatch> RecipeTextIndex::mostSimilar(long long recipe_id, size_t k, const std::vector<long long>* allowed) const {
+    const Document* query = find(recipe_id);
+    if (k == 0 || !query) return {};
+    const uint32_t query_document = static_cast<uint32_t>(query - documents_.data());
+
+    // One cursor per query term, positioned on the next posting of its list
+    struct Cursor {
+        const Posting* begin;
+        const Posting* at;
+        const Posting* end;
+        const float* block_max_weights;
+        float weight;           // The query's scaled weight for the term
+        double bound;           // Highest contribution any document of the list can make
+    };
+    std::vector<Cursor> cursors;
+    cursors.reserve(query->length);
+    for (uint32_t i = 0; i < query->length; ++i) {
+        const TermCount& term_count = term_counts_[query->offset + i];
+        const std::vector<Posting>& list = postings_[term_count.term];
+        const float weight = termWeight(term_count) / query->norm;
+        cursors.push_back({list.data(), list.data(), list.data() + list.size(), block_max_weights_[term_count.term].data(), weight,
+                           static_cast<double>(weight) * max_weights_[term_count.term]});
+    }
+    auto byDocument = [](const Cursor& a, const Cursor& b) { return a.at->document < b.at->document; };
+    std::sort(cursors.begin(), cursors.end(), byDocument);
+    auto skipTo = [](Cursor& cursor, uint32_t document) {
+        cursor.at = std::lower_bound(cursor.at, cursor.end, document, [](const Posting& posting, uint32_t target) { return posting.document < target; });
+    };
+
+    // Worst result on top, so the heap holds the best k seen so far
+    auto better = [](const TextMatch& a, const TextMatch& b) {
+        return a.similarity != b.similarity ? a.similarity > b.similarity : a.recipe_id < b.recipe_id;
+    };
+    std::vector<TextMatch> top;
+
+    while (!cursors.empty()) {
+        const bool full = top.size() == k;
+        const double threshold = full ? top.front().similarity * (1 - kTextBoundSlack) : 0;
+
+        // The pivot is the first cursor at which the lists reached so far could lift a document to the threshold;
+        // no document before the pivot's can, so the cursors behind it skip ahead to it
+        double reachable = 0;
+        size_t pivot = cursors.size();
+        for (size_t i = 0; i < cursors.size(); ++i) {
+            reachable += cursors[i].bound;
+            if (!full || reachable >= threshold) {
+                pivot = i;
+                break;
+            }
+        }
+        if (pivot == cursors.size()) break;
+        const uint32_t pivot_document = cursors[pivot].at->document;
+        for (size_t i = 0; i < pivot; ++i) skipTo(cursors[i], pivot_document);
+
+        // A tighter bound from the blocks holding the pivot document. Until the first of those blocks ends, no
+        // document can beat it, since lists not holding the pivot document only continue after that point.
+        double block_bound = 0;
+        uint32_t next_document = UINT32_MAX;
+        for (const Cursor& cursor : cursors) {
+            if (cursor.at == cursor.end) continue;
+            if (cursor.at->document != pivot_document) {
+                next_document = std::min(next_document, cursor.at->document);
+                continue;
+            }
+            const size_t block = static_cast<size_t>(cursor.at - cursor.begin) / kPostingBlock;
+            const Posting* block_end = std::min(cursor.end, cursor.begin + (block + 1) * kPostingBlock);
+            block_bound += static_cast<double>(cursor.weight) * cursor.block_max_weights[block];
+            next_document = std::min(next_document, (block_end - 1)->document + 1);
+        }
+
+        if (!full || block_bound >= threshold) {
+            double score = 0;
+            size_t shared = 0;
+            for (Cursor& cursor : cursors) {
+                if (cursor.at == cursor.end || cursor.at->document != pivot_document) continue;
+                score += static_cast<double>(cursor.weight) * cursor.at->weight;
+                ++shared;
+                ++cursor.at;
+            }
+            const Document& document = documents_[pivot_document];
+            if (pivot_document != query_document && document.live &&
+                (!allowed || std::binary_search(allowed->begin(), allowed->end(), document.recipe_id))) {
+                TextMatch match{document.recipe_id, score, shared};
+                if (top.size() < k) {
+                    top.push_back(match);
+                    std::push_heap(top.begin(), top.end(), better);
+                } else if (better(match, top.front())) {
+                    std::pop_heap(top.begin(), top.end(), better);
+                    top.back() = match;
+                    std::push_heap(top.begin(), top.end(), better);
+                }
+            }
+        } else {
+            for (Cursor& cursor : cursors) {
+                if (cursor.at != cursor.end && cursor.at->document == pivot_document) skipTo(cursor, next_document);
+            }
+        }
+
+        // Mostly the front cursors moved, so an insertion sort restores document order cheaply
+        cursors.erase(std::remove_if(cursors.begin(), cursors.end(), [](const Cursor& cursor) { return cursor.at == cursor.end; }), cursors.end());
+        for (size_t i = 1; i < cursors.size(); ++i) {
+            Cursor cursor = cursors[i];
+            size_t j = i;
+            for (; j > 0 && cursors[j - 1].at->document > cursor.at->document; --j) cursors[j] = cursors[j - 1];
+            cursors[j] = cursor;
+        }
+    }
+
+    std::sort(top.begin(), top.end(), better);
+    return top;
+}
@@ -0,0 +1,728 @@
+#include "search_bundle.h"
+#include "database.h"
+#include "logging.h"
+#include <fstream>
+#include <filesystem>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+
+
+// Identifies a bundle file
+constexpr char kBundleMagic[8] = {'R', 'C', 'P', 'B', 'N', 'D', 'L', '\0'};
+
+
+// Sections of a bundle, in file order
+enum BundleSection : size_t {
+    kIdSection,             // Recipe ids, varint deltas
+    kPrepSection,           // uint16 per recipe
+    kCookSection,           // uint16 per recipe
+    kServingsSection,       // uint16 per recipe
+    kDateSection,           // uint32 seconds since the epoch per recipe
+    kFavoriteSection,       // One bit per recipe
+    kSummaryOffsetSection,  // uint32 offset of each recipe's summary, plus the end offset
+    kSummarySection,        // Per recipe: name, author, source, source_url as varint length + bytes
+    kTermSection,           // Dictionary of full-text terms; postings carry field flags
+    kTagSection,            // Dictionary of tag names
+    kIngredientSection,     // Dictionary of ingredient names
+    kFamilySection,         // Dictionary of ingredients with variants: recipes using the ingredient or any variant
+    kSectionCount
+};
+
+
+// Header: magic, version, recipe count, section count, then offset and length of every section
+constexpr size_t kBundleHeaderSize = sizeof(kBundleMagic) + 3 * sizeof(uint32_t) + kSectionCount * 2 * sizeof(uint32_t);
+
+
+// Field flags of term postings
+constexpr uint8_t kNameField = 1;
+constexpr uint8_t kDescriptionField = 2;
+constexpr uint8_t kAuthorField = 4;
+constexpr uint8_t kIngredientField = 8;
+constexpr uint8_t kTagField = 16;
+
+
+// Order of the strings in a summary record
+constexpr size_t kSummaryName = 0;
+constexpr size_t kSummaryAuthor = 1;
+constexpr size_t kSummarySource = 2;
+constexpr size_t kSummarySourceUrl = 3;
+constexpr size_t kSummaryFieldCount = 4;
+
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+
+/**
+ * Reads a varint and advances pos past it.
+ * @return false if the varint runs past the end of the data.
+ */
+bool getVarint(std::string_view data, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < data.size(); shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(data[pos++]);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+
+template <typename T>
+void putFixed(std::string& out, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) out += static_cast<char>((static_cast<uint64_t>(value) >> (8 * i)) & 0xFF);
+}
+
+
+template <typename T>
+T getFixed(std::string_view data, size_t pos) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) value |= static_cast<uint64_t>(static_cast<uint8_t>(data[pos + i])) << (8 * i);
+    return static_cast<T>(value);
+}
+
+
+/**
+ * Reduces plural forms to a shared stem ("tomatoes" and "tomato", "berries" and "berry"), the same way on both
+ * sides of the index, so simple plurals match without a full stemmer.
+ */
+void foldPlural(std::string& term) {
+    size_t n = term.size();
+    auto endsWith = [&](std::string_view suffix) {
+        return n >= suffix.size() && std::string_view(term).substr(n - suffix.size()) == suffix;
+    };
+    if (n > 4 && endsWith("ies")) {
+        term.replace(n - 3, 3, "y");
+    } else if (n > 4 && (endsWith("oes") || endsWith("ses") || endsWith("xes") || endsWith("zes") || endsWith("ches") || endsWith("shes"))) {
+        term.resize(n - 2);
+    } else if (n > 3 && term.back() == 's' && !endsWith("ss") && !endsWith("us") && !endsWith("is")) {
+        term.resize(n - 1);
+    }
+}
+
+
+bool isTermByte(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || static_cast<uint8_t>(c) >= 0x80;
+}
+
+
+/**
+ * Splits text into lower-case words and calls visit(word, is_prefix) for each; is_prefix is set when the word is
+ * directly followed by '*'. Words are plural-folded unless they are prefixes.
+ */
+template <typename Visit>
+void forEachTerm(std::string_view text, Visit visit) {
+    std::string term;
+    size_t i = 0;
+    while (i < text.size()) {
+        while (i < text.size() && !isTermByte(text[i])) ++i;
+        size_t start = i;
+        while (i < text.size() && isTermByte(text[i])) ++i;
+        if (i == start) break;
+        term.assign(text.substr(start, i - start));
+        for (char& c : term) {
+            if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+        }
+        bool is_prefix = i < text.size() && text[i] == '*';
+        if (!is_prefix) foldPlural(term);
+        visit(term, is_prefix);
+    }
+}
+
+
+/**
+ * Appends a dictionary section: sorted keys, each with the offset and length of its posting list, then the postings.
+ * @param lists Posting lists by key; docs in increasing order, with field flags if fields is set
+ */
+void putDictionary(std::string& out, const std::map<std::string, std::vector<std::pair<uint32_t, uint8_t>>>& lists, bool fields) {
+    std::string postings;
+    std::string entries;
+    for (const auto& [key, list] : lists) {
+        putVarint(entries, key.size());
+        entries += key;
+        putVarint(entries, postings.size());
+        putVarint(entries, list.size());
+        uint32_t previous = 0;
+        for (const auto& [doc, flags] : list) {
+            putVarint(postings, doc - previous);
+            previous = doc;
+            if (fields) postings += static_cast<char>(flags);
+        }
+    }
+    putVarint(out, lists.size());
+    out += entries;
+    out += postings;
+}
+
+
+// A recipe as exported, in recipe_id order
+struct BundleRecipe {
+    long long recipe_id = 0;
+    std::string name;
+    std::string description;
+    std::string author;
+    std::string source;
+    std::string source_url;
+    uint16_t prep = 0;
+    uint16_t cook = 0;
+    uint16_t servings = 0;
+    bool favorite = false;
+    uint32_t date_added = 0;
+};
+
+
+std::string columnText(sqlite3_stmt* stmt, int column) {
+    const unsigned char* text = sqlite3_column_text(stmt, column);
+    return text ? std::string(reinterpret_cast<const char*>(text), sqlite3_column_bytes(stmt, column)) : std::string();
+}
+
+
+/**
+ * Reads every recipe and link needed for a bundle and encodes the sections.
+ * @return The encoded sections, std::nullopt on a read error.
+ */
+std::optional<std::vector<std::string>> encodeBundleSections(sqlite3* db, SearchBundleStats& stats) {
+    std::vector<BundleRecipe> recipes;
+    std::unordered_map<long long, uint32_t> doc_of;
+    {
+        SqliteStatement stmt(db, R"(
+            SELECT recipe_id, name, description, author, source, source_url,
+                   prep_time_minutes, cook_time_minutes, servings, is_favorite,
+                   COALESCE(CAST(strftime('%s', date_added) AS INTEGER), 0)
+            FROM recipes ORDER BY recipe_id;
+        )");
+        if (!stmt.stmt) return std::nullopt;
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            BundleRecipe recipe;
+            recipe.recipe_id = sqlite3_column_int64(stmt, 0);
+            recipe.name = columnText(stmt, 1);
+            recipe.description = columnText(stmt, 2);
+            recipe.author = columnText(stmt, 3);
+            recipe.source = columnText(stmt, 4);
+            recipe.source_url = columnText(stmt, 5);
+            recipe.prep = static_cast<uint16_t>(sqlite3_column_int(stmt, 6));
+            recipe.cook = static_cast<uint16_t>(sqlite3_column_int(stmt, 7));
+            recipe.servings = static_cast<uint16_t>(sqlite3_column_int(stmt, 8));
+            recipe.favorite = sqlite3_column_int(stmt, 9) != 0;
+            recipe.date_added = static_cast<uint32_t>(std::max<int64_t>(0, sqlite3_column_int64(stmt, 10)));
+            doc_of.emplace(recipe.recipe_id, static_cast<uint32_t>(recipes.size()));
+            recipes.push_back(std::move(recipe));
+        }
+        if (rc != SQLITE_DONE) return std::nullopt;
+    }
+
+    // Link tables as (recipe, name), read in recipe order so posting lists come out sorted
+    using PostingMap = std::map<std::string, std::vector<std::pair<uint32_t, uint8_t>>>;
+    auto readLinks = [&](const char* sql, PostingMap& lists, std::vector<std::vector<std::string>>& names_by_doc) {
+        SqliteStatement stmt(db, sql);
+        if (!stmt.stmt) return false;
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            auto doc = doc_of.find(sqlite3_column_int64(stmt, 0));
+            if (doc == doc_of.end()) continue;
+            std::string name = columnText(stmt, 1);
+            names_by_doc[doc->second].push_back(name);
+            lists[std::move(name)].emplace_back(doc->second, 0);
+        }
+        return rc == SQLITE_DONE;
+    };
+    PostingMap tag_lists;
+    PostingMap ingredient_lists;
+    std::vector<std::vector<std::string>> tags_by_doc(recipes.size());
+    std::vector<std::vector<std::string>> ingredients_by_doc(recipes.size());
+    if (!readLinks(R"(
+            SELECT rt.recipe_id, t.name FROM recipe_tags rt JOIN tags t ON rt.tag_id = t.tag_id
+            ORDER BY rt.recipe_id;
+        )", tag_lists, tags_by_doc)
+        || !readLinks(R"(
+            SELECT ri.recipe_id, i.name FROM recipe_ingredients ri JOIN ingredients i ON ri.ingredient_id = i.ingredient_id
+            ORDER BY ri.recipe_id;
+        )", ingredient_lists, ingredients_by_doc)) {
+        return std::nullopt;
+    }
+
+    // An ingredient family is the ingredient and everything below it in the hierarchy
+    PostingMap family_lists;
+    {
+        std::map<std::string, std::vector<std::string>> variants;
+        SqliteStatement stmt(db, R"(
+            SELECT a.name, d.name FROM ingredient_closure c
+            JOIN ingredients a ON a.ingredient_id = c.ancestor_id
+            JOIN ingredients d ON d.ingredient_id = c.descendant_id;
+        )");
+        if (!stmt.stmt) return std::nullopt;
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            variants[columnText(stmt, 0)].push_back(columnText(stmt, 1));
+        }
+        if (rc != SQLITE_DONE) return std::nullopt;
+
+        for (auto& [ancestor, descendants] : variants) {
+            std::vector<uint32_t> docs;
+            descendants.push_back(ancestor);
+            for (const std::string& name : descendants) {
+                auto list = ingredient_lists.find(name);
+                if (list == ingredient_lists.end()) continue;
+                for (const auto& posting : list->second) docs.push_back(posting.first);
+            }
+            std::sort(docs.begin(), docs.end());
+            docs.erase(std::unique(docs.begin(), docs.end()), docs.end());
+            auto& family = family_lists[ancestor];
+            for (uint32_t doc : docs) family.emplace_back(doc, 0);
+        }
+    }
+
+    // Full-text terms with the fields each recipe uses them in
+    PostingMap term_lists;
+    std::unordered_map<std::string, uint8_t> doc_terms;
+    for (uint32_t doc = 0; doc < recipes.size(); ++doc) {
+        const BundleRecipe& recipe = recipes[doc];
+        doc_terms.clear();
+        auto add = [&](std::string_view text, uint8_t field) {
+            forEachTerm(text, [&](const std::string& term, bool) { doc_terms[term] |= field; });
+        };
+        add(recipe.name, kNameField);
+        add(recipe.description, kDescriptionField);
+        add(recipe.author, kAuthorField);
+        for (const std::string& name : ingredients_by_doc[doc]) add(name, kIngredientField);
+        for (const std::string& name : tags_by_doc[doc]) add(name, kTagField);
+        for (const auto& [term, fields] : doc_terms) term_lists[term].emplace_back(doc, fields);
+    }
+
+    std::vector<std::string> sections(kSectionCount);
+    long long previous_id = 0;
+    for (const BundleRecipe& recipe : recipes) {
+        putVarint(sections[kIdSection], static_cast<uint64_t>(recipe.recipe_id - previous_id));
+        previous_id = recipe.recipe_id;
+        putFixed<uint16_t>(sections[kPrepSection], recipe.prep);
+        putFixed<uint16_t>(sections[kCookSection], recipe.cook);
+        putFixed<uint16_t>(sections[kServingsSection], recipe.servings);
+        putFixed<uint32_t>(sections[kDateSection], recipe.date_added);
+
+        putFixed<uint32_t>(sections[kSummaryOffsetSection], static_cast<uint32_t>(sections[kSummarySection].size()));
+        for (const std::string* field : {&recipe.name, &recipe.author, &recipe.source, &recipe.source_url}) {
+            putVarint(sections[kSummarySection], field->size());
+            sections[kSummarySection] += *field;
+        }
+    }
+    putFixed<uint32_t>(sections[kSummaryOffsetSection], static_cast<uint32_t>(sections[kSummarySection].size()));
+    sections[kFavoriteSection].assign((recipes.size() + 7) / 8, '\0');
+    for (size_t doc = 0; doc < recipes.size(); ++doc) {
+        if (recipes[doc].favorite) sections[kFavoriteSection][doc / 8] |= static_cast<char>(1 << (doc % 8));
+    }
+    putDictionary(sections[kTermSection], term_lists, true);
+    putDictionary(sections[kTagSection], tag_lists, false);
+    putDictionary(sections[kIngredientSection], ingredient_lists, false);
+    putDictionary(sections[kFamilySection], family_lists, false);
+
+    stats.recipes = recipes.size();
+    stats.terms = term_lists.size();
+    stats.id_bytes = sections[kIdSection].size();
+    stats.column_bytes = sections[kPrepSection].size() + sections[kCookSection].size() + sections[kServingsSection].size()
+                       + sections[kDateSection].size() + sections[kFavoriteSection].size();
+    stats.summary_bytes = sections[kSummaryOffsetSection].size() + sections[kSummarySection].size();
+    stats.term_bytes = sections[kTermSection].size();
+    stats.tag_bytes = sections[kTagSection].size();
+    stats.ingredient_bytes = sections[kIngredientSection].size() + sections[kFamilySection].size();
+    return sections;
+}
+
+
+std::optional<SearchBundleStats> writeSearchBundle(sqlite3* db, const std::string& path) {
+    SearchBundleStats stats;
+    if (sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Failed to begin transaction: " << sqlite3_errmsg(db);
+        return std::nullopt;
+    }
+    std::optional<std::vector<std::string>> sections = encodeBundleSections(db, stats);
+    if (!sections) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Failed to read recipes: " << sqlite3_errmsg(db);
+    }
+    sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    if (!sections) return std::nullopt;
+
+    std::string header(kBundleMagic, sizeof(kBundleMagic));
+    putFixed<uint32_t>(header, kSearchBundleVersion);
+    putFixed<uint32_t>(header, static_cast<uint32_t>(stats.recipes));
+    putFixed<uint32_t>(header, static_cast<uint32_t>(kSectionCount));
+    size_t offset = kBundleHeaderSize;
+    for (const std::string& section : *sections) {
+        putFixed<uint32_t>(header, static_cast<uint32_t>(offset));
+        putFixed<uint32_t>(header, static_cast<uint32_t>(section.size()));
+        offset += section.size();
+    }
+    if (offset > UINT32_MAX) {
+        LogLine(LogLevel::Error, __func__) << "Search bundle would exceed 4 GiB.";
+        return std::nullopt;
+    }
+
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(header.data(), static_cast<std::streamsize>(header.size()));
+        for (const std::string& section : *sections) out.write(section.data(), static_cast<std::streamsize>(section.size()));
+        if (!out.flush()) {
+            LogLine(LogLevel::Error, __func__) << "Failed to write " << temporary;
+            std::filesystem::remove(temporary);
+            return std::nullopt;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        LogLine(LogLevel::Error, __func__) << "Failed to move search bundle into place: " << error.message();
+        std::filesystem::remove(temporary);
+        return std::nullopt;
+    }
+
+    stats.total_bytes = offset;
+    return stats;
+}
+
+
+bool SearchBundle::Dictionary::parse(std::string_view section, bool fields, uint32_t doc_count) {
+    keys.clear();
+    offsets.clear();
+    counts.clear();
+    with_fields = fields;
+
+    size_t pos = 0;
+    uint64_t count = 0;
+    if (!getVarint(section, pos, count) || count > section.size()) return false;
+    keys.reserve(count);
+    offsets.reserve(count);
+    counts.reserve(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t length = 0;
+        uint64_t offset = 0;
+        uint64_t postings_count = 0;
+        if (!getVarint(section, pos, length) || length > section.size() - pos) return false;
+        keys.push_back(section.substr(pos, length));
+        pos += length;
+        if (!getVarint(section, pos, offset) || !getVarint(section, pos, postings_count)) return false;
+        offsets.push_back(static_cast<uint32_t>(offset));
+        counts.push_back(static_cast<uint32_t>(postings_count));
+    }
+    postings = section.substr(pos);
+
+    // Decode every list once so that lookups can trust the keys' order and the document numbers
+    for (size_t entry = 0; entry < keys.size(); ++entry) {
+        if (entry > 0 && keys[entry - 1] >= keys[entry]) return false;
+        if (offsets[entry] > postings.size() || counts[entry] > postings.size() - offsets[entry]) return false;
+        size_t list_pos = offsets[entry];
+        uint64_t doc = 0;
+        for (uint32_t i = 0; i < counts[entry]; ++i) {
+            uint64_t delta = 0;
+            if (!getVarint(postings, list_pos, delta) || (i > 0 && delta == 0) || delta >= doc_count - doc) return false;
+            doc += delta;
+            if (fields && list_pos++ >= postings.size()) return false;
+        }
+    }
+    return true;
+}
+
+
+std::vector<uint32_t> SearchBundle::Dictionary::postingsOf(size_t entry, uint8_t field_mask) const {
+    std::vector<uint32_t> docs;
+    docs.reserve(counts[entry]);
+    size_t pos = offsets[entry];
+    uint64_t doc = 0;
+    for (uint32_t i = 0; i < counts[entry]; ++i) {
+        uint64_t delta = 0;
+        if (!getVarint(postings, pos, delta)) break;
+        doc += delta;
+        uint8_t fields = 0xFF;
+        if (with_fields) {
+            if (pos >= postings.size()) break;
+            fields = static_cast<uint8_t>(postings[pos++]);
+        }
+        if (fields & field_mask) docs.push_back(static_cast<uint32_t>(doc));
+    }
+    return docs;
+}
+
+
+std::vector<uint32_t> SearchBundle::Dictionary::postingsOf(std::string_view key) const {
+    auto it = std::lower_bound(keys.begin(), keys.end(), key);
+    if (it == keys.end() || *it != key) return {};
+    return postingsOf(static_cast<size_t>(it - keys.begin()));
+}
+
+
+bool SearchBundle::load(const std::string& path) {
+    *this = SearchBundle();
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        LogLine(LogLevel::Error, __func__) << "Cannot open search bundle " << path;
+        return false;
+    }
+    std::streamsize size = in.tellg();
+    in.seekg(0);
+    data_.resize(static_cast<size_t>(std::max<std::streamsize>(0, size)));
+    if (!in.read(data_.data(), size)) {
+        LogLine(LogLevel::Error, __func__) << "Cannot read search bundle " << path;
+        data_.clear();
+        return false;
+    }
+
+    auto fail = [this, &path](const char* reason) {
+        LogLine(LogLevel::Error, "SearchBundle::load") << "Invalid search bundle " << path << ": " << reason;
+        *this = SearchBundle();
+        return false;
+    };
+
+    std::string_view data(data_.data(), data_.size());
+    if (data.size() < kBundleHeaderSize || std::memcmp(data.data(), kBundleMagic, sizeof(kBundleMagic)) != 0) return fail("bad header");
+    size_t pos = sizeof(kBundleMagic);
+    if (getFixed<uint32_t>(data, pos) != kSearchBundleVersion) return fail("unsupported version");
+    const uint32_t recipe_count = getFixed<uint32_t>(data, pos + 4);
+    if (getFixed<uint32_t>(data, pos + 8) != kSectionCount) return fail("unexpected section count");
+    pos += 12;
+
+    std::vector<std::string_view> sections;
+    for (size_t i = 0; i < kSectionCount; ++i, pos += 8) {
+        uint32_t offset = getFixed<uint32_t>(data, pos);
+        uint32_t length = getFixed<uint32_t>(data, pos + 4);
+        if (offset > data.size() || length > data.size() - offset) return fail("section out of bounds");
+        sections.push_back(data.substr(offset, length));
+    }
+
+    const size_t n = recipe_count;
+    if (sections[kPrepSection].size() != 2 * n || sections[kCookSection].size() != 2 * n || sections[kServingsSection].size() != 2 * n
+        || sections[kDateSection].size() != 4 * n || sections[kFavoriteSection].size() != (n + 7) / 8
+        || sections[kSummaryOffsetSection].size() != 4 * (n + 1)) {
+        return fail("column size mismatch");
+    }
+
+    recipe_ids_.reserve(n);
+    size_t id_pos = 0;
+    long long id = 0;
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t delta = 0;
+        if (!getVarint(sections[kIdSection], id_pos, delta)) return fail("truncated recipe ids");
+        id += static_cast<long long>(delta);
+        recipe_ids_.push_back(id);
+    }
+
+    prep_column_ = sections[kPrepSection];
+    cook_column_ = sections[kCookSection];
+    servings_column_ = sections[kServingsSection];
+    date_column_ = sections[kDateSection];
+    favorite_bits_ = sections[kFavoriteSection];
+    summary_offsets_ = sections[kSummaryOffsetSection];
+    summaries_ = sections[kSummarySection];
+    if (getFixed<uint32_t>(summary_offsets_, 4 * n) > summaries_.size()) return fail("summary out of bounds");
+
+    if (!terms_.parse(sections[kTermSection], true, recipe_count) || !tags_.parse(sections[kTagSection], false, recipe_count)
+        || !ingredients_.parse(sections[kIngredientSection], false, recipe_count)
+        || !families_.parse(sections[kFamilySection], false, recipe_count)) {
+        return fail("corrupt dictionary");
+    }
+    return true;
+}
+
+
+std::string_view SearchBundle::summaryField(uint32_t doc, size_t field) const {
+    size_t pos = getFixed<uint32_t>(summary_offsets_, 4 * doc);
+    size_t end = getFixed<uint32_t>(summary_offsets_, 4 * (doc + 1));
+    std::string_view record = summaries_.substr(0, std::min<size_t>(end, summaries_.size()));
+    for (size_t i = 0; i < kSummaryFieldCount; ++i) {
+        uint64_t length = 0;
+        if (!getVarint(record, pos, length) || length > record.size() - pos) return {};
+        if (i == field) return record.substr(pos, length);
+        pos += length;
+    }
+    return {};
+}
+
+
+RecipeSummary SearchBundle::summaryAt(uint32_t doc) const {
+    RecipeSummary summary;
+    summary.recipe_id = recipe_ids_[doc];
+    summary.name = summaryField(doc, kSummaryName);
+    summary.author = summaryField(doc, kSummaryAuthor);
+    summary.source = summaryField(doc, kSummarySource);
+    summary.source_url = summaryField(doc, kSummarySourceUrl);
+    summary.prep_time_minutes = getFixed<uint16_t>(prep_column_, 2 * doc);
+    summary.cook_time_minutes = getFixed<uint16_t>(cook_column_, 2 * doc);
+    summary.servings = getFixed<uint16_t>(servings_column_, 2 * doc);
+    summary.is_favorite = (static_cast<uint8_t>(favorite_bits_[doc / 8]) >> (doc % 8)) & 1;
+    summary.date_added = getFixed<uint32_t>(date_column_, 4 * doc);
+    return summary;
+}
+
+
+std::optional<RecipeSummary> SearchBundle::summary(long long recipe_id) const {
+    auto it = std::lower_bound(recipe_ids_.begin(), recipe_ids_.end(), recipe_id);
+    if (it == recipe_ids_.end() || *it != recipe_id) return std::nullopt;
+    return summaryAt(static_cast<uint32_t>(it - recipe_ids_.begin()));
+}
+
+
+std::vector<uint32_t> intersectSorted(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+    std::vector<uint32_t> result;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
+    return result;
+}
+
+
+std::optional<std::vector<uint32_t>> SearchBundle::termMatches(std::string_view text, uint8_t field_mask) const {
+    std::optional<std::vector<uint32_t>> matches;
+    forEachTerm(text, [&](const std::string& term, bool is_prefix) {
+        std::vector<uint32_t> docs;
+        if (is_prefix) {
+            auto first = std::lower_bound(terms_.keys.begin(), terms_.keys.end(), std::string_view(term));
+            for (auto it = first; it != terms_.keys.end() && it->substr(0, term.size()) == term; ++it) {
+                std::vector<uint32_t> more = terms_.postingsOf(static_cast<size_t>(it - terms_.keys.begin()), field_mask);
+                std::vector<uint32_t> merged;
+                std::set_union(docs.begin(), docs.end(), more.begin(), more.end(), std::back_inserter(merged));
+                docs = std::move(merged);
+            }
+        } else {
+            auto it = std::lower_bound(terms_.keys.begin(), terms_.keys.end(), std::string_view(term));
+            if (it != terms_.keys.end() && *it == term) docs = terms_.postingsOf(static_cast<size_t>(it - terms_.keys.begin()), field_mask);
+        }
+        matches = matches ? intersectSorted(*matches, docs) : std::move(docs);
+    });
+    return matches;
+}
+
+
+/**
+ * Formats seconds since the epoch as the UTC date "YYYY-MM-DD", like SQLite's date().
+ */
+std::string utcDate(int64_t seconds) {
+    // Civil-from-days over the proleptic Gregorian calendar
+    int64_t z = seconds / 86400 + 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    int64_t doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    int64_t day = doy - (153 * mp + 2) / 5 + 1;
+    int64_t month = mp < 10 ? mp + 3 : mp - 9;
+    int64_t year = yoe + era * 400 + (month <= 2 ? 1 : 0);
+    char buffer[16];
+    std::snprintf(buffer, sizeof(buffer), "%04d-%02d-%02d", static_cast<int>(year), static_cast<int>(month), static_cast<int>(day));
+    return buffer;
+}
+
+
+std::vector<long long> SearchBundle::search(const SearchData& criteria) const {
+    // Posting-list filters narrow the candidates first; std::nullopt means every recipe is still a candidate
+    std::optional<std::vector<uint32_t>> candidates;
+    auto restrict = [&candidates](std::vector<uint32_t> docs) {
+        candidates = candidates ? intersectSorted(*candidates, docs) : std::move(docs);
+    };
+
+    if (!criteria.keywords.empty()) {
+        if (auto docs = termMatches(criteria.keywords, 0xFF)) restrict(std::move(*docs));
+    }
+    if (!criteria.name.empty()) {
+        if (auto docs = termMatches(criteria.name, kNameField)) restrict(std::move(*docs));
+    }
+    if (!criteria.author.empty()) {
+        if (auto docs = termMatches(criteria.author, kAuthorField)) restrict(std::move(*docs));
+    }
+    for (const std::string& tag : criteria.tags) restrict(tags_.postingsOf(tag));
+    auto ingredientDocs = [this](const std::string& name, bool expand) {
+        if (expand) {
+            auto family = std::lower_bound(families_.keys.begin(), families_.keys.end(), std::string_view(name));
+            if (family != families_.keys.end() && *family == name) return families_.postingsOf(static_cast<size_t>(family - families_.keys.begin()));
+        }
+        return ingredients_.postingsOf(name);
+    };
+    for (const std::string& ingredient : criteria.ingredients) restrict(ingredientDocs(ingredient, criteria.expand_ingredients));
+
+    std::vector<uint32_t> excluded;
+    auto exclude = [&excluded](const std::vector<uint32_t>& docs) {
+        std::vector<uint32_t> merged;
+        std::set_union(excluded.begin(), excluded.end(), docs.begin(), docs.end(), std::back_inserter(merged));
+        excluded = std::move(merged);
+    };
+    for (const std::string& tag : criteria.exclude_tags) exclude(tags_.postingsOf(tag));
+    for (const std::string& ingredient : criteria.exclude_ingredients) exclude(ingredientDocs(ingredient, criteria.expand_exclude_ingredients));
+
+    if (!candidates) {
+        candidates.emplace(recipe_ids_.size());
+        for (uint32_t doc = 0; doc < recipe_ids_.size(); ++doc) (*candidates)[doc] = doc;
+    }
+
+    // Column filters over the remaining candidates
+    const bool by_date = criteria.dates.size() == 2 && !criteria.dates[0].empty() && !criteria.dates[1].empty();
+    auto inRange = [](const std::vector<uint16_t>& range, uint16_t value) {
+        return range.size() != 2 || (value >= range[0] && value <= range[1]);
+    };
+    std::vector<uint32_t> matches;
+    matches.reserve(candidates->size());
+    for (uint32_t doc : *candidates) {
+        if (std::binary_search(excluded.begin(), excluded.end(), doc)) continue;
+        if (!inRange(criteria.prep_time_range, getFixed<uint16_t>(prep_column_, 2 * doc))) continue;
+        if (!inRange(criteria.cook_time_range, getFixed<uint16_t>(cook_column_, 2 * doc))) continue;
+        if (!inRange(criteria.servings_range, getFixed<uint16_t>(servings_column_, 2 * doc))) continue;
+        if (criteria.is_favorite && !((static_cast<uint8_t>(favorite_bits_[doc / 8]) >> (doc % 8)) & 1)) continue;
+        if (!criteria.exact_name.empty() && summaryField(doc, kSummaryName) != criteria.exact_name) continue;
+        if (!criteria.exact_author.empty() && summaryField(doc, kSummaryAuthor) != criteria.exact_author) continue;
+        if (!criteria.source.empty() && summaryField(doc, kSummarySource) != criteria.source) continue;
+        if (!criteria.source_url.empty() && summaryField(doc, kSummarySourceUrl) != criteria.source_url) continue;
+        if (by_date) {
+            std::string date = utcDate(getFixed<uint32_t>(date_column_, 4 * doc));
+            if (date < criteria.dates[0] || date > criteria.dates[1]) continue;
+        }
+        matches.push_back(doc);
+    }
+
+    // Ties are broken by recipe_id in the sort direction, as in the database; doc order is recipe_id order
+    const bool descending = criteria.sort_direction == SortDirection::Descending;
+    auto sortBy = [&](auto key) {
+        // Keys are computed once per match; with a limit only the first k are fully sorted
+        using Key = decltype(key(0u));
+        std::vector<std::pair<Key, uint32_t>> keyed;
+        keyed.reserve(matches.size());
+        for (uint32_t doc : matches) keyed.emplace_back(key(doc), doc);
+        auto before = [descending](const std::pair<Key, uint32_t>& a, const std::pair<Key, uint32_t>& b) {
+            return descending ? b < a : a < b;
+        };
+        size_t k = criteria.limit > 0 ? std::min(criteria.limit, keyed.size()) : keyed.size();
+        std::partial_sort(keyed.begin(), keyed.begin() + k, keyed.end(), before);
+        matches.resize(k);
+        for (size_t i = 0; i < k; ++i) matches[i] = keyed[i].second;
+    };
+    switch (criteria.sort_by) {
+        case SortKey::None:
+            break;
+        case SortKey::DateAdded:
+            sortBy([&](uint32_t doc) { return getFixed<uint32_t>(date_column_, 4 * doc); });
+            break;
+        case SortKey::TotalTime:
+            sortBy([&](uint32_t doc) { return getFixed<uint16_t>(prep_column_, 2 * doc) + getFixed<uint16_t>(cook_column_, 2 * doc); });
+            break;
+        case SortKey::PrepTime:
+            sortBy([&](uint32_t doc) { return getFixed<uint16_t>(prep_column_, 2 * doc); });
+            break;
+        case SortKey::CookTime:
+            sortBy([&](uint32_t doc) { return getFixed<uint16_t>(cook_column_, 2 * doc); });
+            break;
+        case SortKey::Name:
+            sortBy([&](uint32_t doc) { return summaryField(doc, kSummaryName); });
+            break;
+        case SortKey::Relevance:
+            // No rank in the bundle; like the database without FTS criteria, fall back to recipe_id
+            sortBy([](uint32_t) { return 0; });
+            break;
+    }
+
+    if (criteria.limit > 0 && matches.size() > criteria.limit) matches.resize(criteria.limit);
+    std::vector<long long> recipe_ids;
+    recipe_ids.reserve(matches.size());
+    for (uint32_t doc : matches) recipe_ids.push_back(recipe_ids_[doc]);
+    return recipe_ids;
+}
@@ -0,0 +1,480 @@
+#include "search_index_job.h"
+#include "database.h"
+#include "logging.h"
+
+
+// How long the job's connection waits for locks held by other connections
+constexpr int kJobBusyTimeoutMs = 10000;
+
+// A rebuild whose heartbeat is older than this is taken to have died, and its leftovers are dropped
+constexpr long long kAbandonedRebuildSeconds = 300;
+
+
+std::string searchTableSql(const std::string& table_name) {
+    return R"(
+        CREATE VIRTUAL TABLE IF NOT EXISTS )" + table_name + R"( USING fts5(
+            recipe_id,
+            name,
+            description,
+            author,
+            ingredients,
+            tags,
+            tokenize = 'porter unicode61'
+        );
+    )";
+}
+
+
+const char* const kSearchTriggersSql = R"(
+        CREATE TRIGGER IF NOT EXISTS recipe_after_insert
+        AFTER INSERT ON recipes
+        BEGIN
+            INSERT OR REPLACE INTO search(rowid, name, description, author)
+            VALUES (new.recipe_id, new.name, new.description, new.author);
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS recipe_after_update AFTER UPDATE ON recipes
+        BEGIN
+            UPDATE search
+            SET
+                name = new.name,
+                description = new.description,
+                author = new.author
+            WHERE rowid = new.recipe_id;
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS recipe_after_delete AFTER DELETE ON recipes
+        BEGIN
+            DELETE FROM search WHERE rowid = old.recipe_id;
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS update_ingredients_on_insert
+        AFTER INSERT ON recipe_ingredients
+        BEGIN
+            UPDATE search
+            SET ingredients = (
+                SELECT COALESCE(group_concat(name, '|'), '')
+                from INGREDIENTS i
+                JOIN recipe_ingredients ri ON i.ingredient_id = ri.ingredient_id
+                WHERE ri.recipe_id = new.recipe_id
+            )
+            WHERE rowid = NEW.recipe_id;
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS update_ingredients_on_delete
+        AFTER DELETE ON recipe_ingredients
+        BEGIN
+            UPDATE search
+            SET ingredients = (
+                SELECT COALESCE(group_concat(name, '|'), '')
+                FROM ingredients i
+                JOIN recipe_ingredients ri ON i.ingredient_id = ri.ingredient_id
+                WHERE ri.recipe_id = OLD.recipe_id
+            )
+            WHERE rowid = OLD.recipe_id;
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS update_tags_on_insert
+        AFTER INSERT ON recipe_tags
+        BEGIN
+            UPDATE search
+            SET tags = (
+                SELECT COALESCE(group_concat(name, '|'), '')
+                FROM tags t
+                JOIN recipe_tags rt ON t.tag_id = rt.tag_id
+                WHERE rt.recipe_id = NEW.recipe_id
+            )
+            WHERE rowid = NEW.recipe_id;
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS update_tags_on_delete
+        AFTER DELETE ON recipe_tags
+        BEGIN
+            UPDATE search
+            SET tags = (
+                SELECT COALESCE(group_concat(name, '|'), '')
+                FROM tags t
+                JOIN recipe_tags rt ON t.tag_id = rt.tag_id
+                WHERE rt.recipe_id = OLD.recipe_id
+            )
+            WHERE rowid = OLD.recipe_id;
+        END;
+    )";
+
+
+const char* const kDropSearchTriggersSql = R"(
+        DROP TRIGGER IF EXISTS recipe_after_insert;
+        DROP TRIGGER IF EXISTS recipe_after_update;
+        DROP TRIGGER IF EXISTS recipe_after_delete;
+        DROP TRIGGER IF EXISTS update_ingredients_on_insert;
+        DROP TRIGGER IF EXISTS update_ingredients_on_delete;
+        DROP TRIGGER IF EXISTS update_tags_on_insert;
+        DROP TRIGGER IF EXISTS update_tags_on_delete;
+    )";
+
+
+// Correlated subqueries rather than joins, so a recipe's ingredients and tags are not multiplied together
+const char* const kSearchRowsSql = R"(
+        SELECT
+            r.recipe_id AS recipe_id,
+            r.name AS name,
+            r.description AS description,
+            r.author AS author,
+            (SELECT COALESCE(group_concat(i.name, '|'), '')
+            FROM recipe_ingredients ri JOIN ingredients i ON ri.ingredient_id = i.ingredient_id
+            WHERE ri.recipe_id = r.recipe_id) AS ingredients,
+            (SELECT COALESCE(group_concat(t.name, '|'), '')
+            FROM recipe_tags rt JOIN tags t ON rt.tag_id = t.tag_id
+            WHERE rt.recipe_id = r.recipe_id) AS tags
+        FROM recipes AS r
+    )";
+
+
+// While a rebuild runs, every recipe written by any connection is recorded so it can be re-indexed before the swap
+const char* const kRebuildLogSql = R"(
+        CREATE TABLE IF NOT EXISTS search_rebuild_log (recipe_id INTEGER PRIMARY KEY);
+        DELETE FROM search_rebuild_log;
+
+        CREATE TRIGGER IF NOT EXISTS search_rebuild_log_recipe_insert AFTER INSERT ON recipes
+        BEGIN INSERT OR IGNORE INTO search_rebuild_log VALUES (new.recipe_id); END;
+        CREATE TRIGGER IF NOT EXISTS search_rebuild_log_recipe_update AFTER UPDATE ON recipes
+        BEGIN
+            INSERT OR IGNORE INTO search_rebuild_log VALUES (old.recipe_id);
+            INSERT OR IGNORE INTO search_rebuild_log VALUES (new.recipe_id);
+        END;
+        CREATE TRIGGER IF NOT EXISTS search_rebuild_log_recipe_delete AFTER DELETE ON recipes
+        BEGIN INSERT OR IGNORE INTO search_rebuild_log VALUES (old.recipe_id); END;
+        CREATE TRIGGER IF NOT EXISTS search_rebuild_log_ingredient_insert AFTER INSERT ON recipe_ingredients
+        BEGIN INSERT OR IGNORE INTO search_rebuild_log VALUES (new.recipe_id); END;
+        CREATE TRIGGER IF NOT EXISTS search_rebuild_log_ingredient_delete AFTER DELETE ON recipe_ingredients
+        BEGIN INSERT OR IGNORE INTO search_rebuild_log VALUES (old.recipe_id); END;
+        CREATE TRIGGER IF NOT EXISTS search_rebuild_log_tag_insert AFTER INSERT ON recipe_tags
+        BEGIN INSERT OR IGNORE INTO search_rebuild_log VALUES (new.recipe_id); END;
+        CREATE TRIGGER IF NOT EXISTS search_rebuild_log_tag_delete AFTER DELETE ON recipe_tags
+        BEGIN INSERT OR IGNORE INTO search_rebuild_log VALUES (old.recipe_id); END;
+    )";
+
+
+const char* const kDropRebuildLogSql = R"(
+        DROP TRIGGER IF EXISTS search_rebuild_log_recipe_insert;
+        DROP TRIGGER IF EXISTS search_rebuild_log_recipe_update;
+        DROP TRIGGER IF EXISTS search_rebuild_log_recipe_delete;
+        DROP TRIGGER IF EXISTS search_rebuild_log_ingredient_insert;
+        DROP TRIGGER IF EXISTS search_rebuild_log_ingredient_delete;
+        DROP TRIGGER IF EXISTS search_rebuild_log_tag_insert;
+        DROP TRIGGER IF EXISTS search_rebuild_log_tag_delete;
+        DROP TABLE IF EXISTS search_rebuild_log;
+        DELETE FROM metadata WHERE key = 'search_rebuild_heartbeat';
+    )";
+
+
+// Written in every transaction of a rebuild, so other connections can tell a running rebuild from a dead one
+const char* const kRebuildHeartbeatSql =
+    "INSERT OR REPLACE INTO metadata (key, value) VALUES ('search_rebuild_heartbeat', CAST(strftime('%s', 'now') AS INTEGER));";
+
+
+// Columns of the search table that rows from kSearchRowsSql are inserted into
+const char* const kSearchInsertColumns = "(rowid, name, description, author, ingredients, tags)";
+
+
+bool execJobSQL(sqlite3* db, const std::string& sql) {
+    char* err_msg = nullptr;
+    int rc = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &err_msg);
+    if (rc != SQLITE_OK) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Search index job SQL error: " << (err_msg ? err_msg : sqlite3_errmsg(db));
+        sqlite3_free(err_msg);
+        return false;
+    }
+    return true;
+}
+
+
+// Returns the first value of a single-row query with up to two integer parameters, or `fallback` if it yields NULL
+long long queryInt64(sqlite3* db, const std::string& sql, long long fallback, std::initializer_list<long long> params = {}) {
+    SqliteStatement stmt_wrapper(db, sql.c_str());
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
+    if (stmt == nullptr) return fallback;
+
+    int index = 1;
+    for (long long param : params) {
+        sqlite3_bind_int64(stmt, index++, param);
+    }
+    if (sqlite3_step(stmt) != SQLITE_ROW || sqlite3_column_type(stmt, 0) == SQLITE_NULL) return fallback;
+    return sqlite3_column_int64(stmt, 0);
+}
+
+
+// Highest recipe_id of the next batch after `after`, or -1 if there are no more recipes
+long long nextBatchEnd(sqlite3* db, long long after, size_t batch_size) {
+    return queryInt64(db, "SELECT MAX(recipe_id) FROM (SELECT recipe_id FROM recipes WHERE recipe_id > ? ORDER BY recipe_id LIMIT ?);",
+                      -1, {after, static_cast<long long>(batch_size)});
+}
+
+
+SearchIndexJob::SearchIndexJob(std::string db_path, Mode mode, IndexJobOptions options)
+    : db_path_(std::move(db_path)), mode_(mode), options_(std::move(options))
+{
+    if (options_.batch_size == 0) options_.batch_size = 1;
+    thread_ = std::thread(&SearchIndexJob::run, this);
+}
+
+
+SearchIndexJob::~SearchIndexJob() {
+    cancel();
+    if (thread_.joinable()) thread_.join();
+}
+
+
+void SearchIndexJob::cancel() {
+    cancelled_ = true;
+}
+
+
+IndexJobProgress SearchIndexJob::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    finished_cv_.wait(lock, [this] { return finished_; });
+    return progress_;
+}
+
+
+IndexJobProgress SearchIndexJob::progress() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return progress_;
+}
+
+
+bool SearchIndexJob::finished() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return finished_;
+}
+
+
+void SearchIndexJob::report(IndexJobProgress::Phase phase, long long processed, long long total) {
+    IndexJobProgress snapshot;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        progress_.phase = phase;
+        progress_.processed = processed;
+        progress_.total = total;
+        snapshot = progress_;
+    }
+    if (options_.on_progress) options_.on_progress(snapshot);
+}
+
+
+void SearchIndexJob::throttle() {
+    if (options_.pause.count() > 0 && !cancelled_) {
+        std::this_thread::sleep_for(options_.pause);
+    }
+}
+
+
+void SearchIndexJob::run() {
+    report(IndexJobProgress::Phase::Starting, 0, 0);
+
+    sqlite3* db = nullptr;
+    bool succeeded = false;
+    if (sqlite3_open_v2(db_path_.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Search index job cannot open database: " << sqlite3_errmsg(db);
+    } else {
+        sqlite3_busy_timeout(db, kJobBusyTimeoutMs);
+        succeeded = (mode_ == Mode::Rebuild) ? rebuild(db) : verify(db);
+    }
+    sqlite3_close(db);
+
+    IndexJobProgress snapshot;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cancelled_) {
+            progress_.phase = IndexJobProgress::Phase::Cancelled;
+        } else {
+            progress_.phase = succeeded ? IndexJobProgress::Phase::Done : IndexJobProgress::Phase::Failed;
+        }
+        finished_ = true;
+        snapshot = progress_;
+    }
+    finished_cv_.notify_all();
+    if (options_.on_progress) options_.on_progress(snapshot);
+}
+
+
+bool dropAbandonedRebuild(sqlite3* db) {
+    // Cheap enough for every open: sqlite_schema is small and nothing is locked unless there is something to drop
+    const char* leftovers_sql = "SELECT COUNT(*) FROM sqlite_schema WHERE name IN ('search_rebuild_log', 'search_shadow');";
+    if (queryInt64(db, leftovers_sql, 0) == 0) return true;
+
+    if (!execJobSQL(db, "BEGIN IMMEDIATE;")) return false;
+    const long long heartbeat = queryInt64(db, "SELECT CAST(value AS INTEGER) FROM metadata WHERE key = 'search_rebuild_heartbeat';", 0);
+    const long long now = queryInt64(db, "SELECT CAST(strftime('%s', 'now') AS INTEGER);", 0);
+    if (queryInt64(db, leftovers_sql, 0) == 0 || now - heartbeat < kAbandonedRebuildSeconds) {
+        return execJobSQL(db, "COMMIT;");
+    }
+
+    LogLine(LogLevel::Warning, __func__) << "Dropping the log and shadow table of a search index rebuild that stopped " << (now - heartbeat) << " s ago.";
+    if (!execJobSQL(db, std::string(kDropRebuildLogSql) + "DROP TABLE IF EXISTS search_shadow; COMMIT;")) {
+        execJobSQL(db, "ROLLBACK;");
+        return false;
+    }
+    return true;
+}
+
+
+bool SearchIndexJob::reindexLogged(sqlite3* db, size_t max_recipes, long long& reindexed) {
+    // Must be called inside a transaction; takes up to max_recipes (0 for all) recipes off the log
+    if (!execJobSQL(db, "CREATE TEMP TABLE IF NOT EXISTS search_rebuild_batch (recipe_id INTEGER PRIMARY KEY); DELETE FROM temp.search_rebuild_batch;")) {
+        return false;
+    }
+
+    SqliteStatement stmt_wrapper(db, "INSERT INTO temp.search_rebuild_batch SELECT recipe_id FROM search_rebuild_log ORDER BY recipe_id LIMIT ?;");
+    sqlite3_stmt* stmt = stmt_wrapper.stmt;
+    if (stmt == nullptr) return false;
+    sqlite3_bind_int64(stmt, 1, max_recipes == 0 ? -1 : static_cast<long long>(max_recipes));
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Failed to read search rebuild log: " << sqlite3_errmsg(db);
+        return false;
+    }
+    reindexed = sqlite3_changes(db);
+
+    return execJobSQL(db, std::string(R"(
+        DELETE FROM search_shadow WHERE rowid IN temp.search_rebuild_batch;
+        INSERT INTO search_shadow )") + kSearchInsertColumns + kSearchRowsSql + R"( WHERE r.recipe_id IN temp.search_rebuild_batch;
+        DELETE FROM search_rebuild_log WHERE recipe_id IN temp.search_rebuild_batch;
+    )");
+}
+
+
+bool SearchIndexJob::rebuild(sqlite3* db) {
+    auto abandon = [&]() {
+        if (!sqlite3_get_autocommit(db)) execJobSQL(db, "ROLLBACK;");
+        execJobSQL(db, std::string("BEGIN IMMEDIATE;") + kDropRebuildLogSql + "DROP TABLE IF EXISTS search_shadow; COMMIT;");
+        return false;
+    };
+
+    // Fresh shadow table, and start logging writes made by other connections from here on
+    if (!execJobSQL(db, "BEGIN IMMEDIATE; DROP TABLE IF EXISTS search_shadow;" + searchTableSql("search_shadow") + kRebuildLogSql + kRebuildHeartbeatSql + "COMMIT;")) {
+        return abandon();
+    }
+
+    // Copy recipes across in recipe_id order, one bounded transaction per batch
+    const long long total = queryInt64(db, "SELECT COUNT(*) FROM recipes;", 0);
+    const std::string batch_sql = std::string("INSERT INTO search_shadow ") + kSearchInsertColumns + kSearchRowsSql
+        + " WHERE r.recipe_id > ? AND r.recipe_id <= ?;";
+    long long last_id = 0;
+    long long processed = 0;
+    report(IndexJobProgress::Phase::Building, processed, total);
+    while (!cancelled_) {
+        if (!execJobSQL(db, std::string("BEGIN IMMEDIATE;") + kRebuildHeartbeatSql)) return abandon();
+
+        long long batch_end = nextBatchEnd(db, last_id, options_.batch_size);
+        if (batch_end == -1) {
+            if (!execJobSQL(db, "COMMIT;")) return abandon();
+            break;
+        }
+
+        SqliteStatement stmt_wrapper(db, batch_sql.c_str());
+        sqlite3_stmt* stmt = stmt_wrapper.stmt;
+        if (stmt == nullptr) return abandon();
+        sqlite3_bind_int64(stmt, 1, last_id);
+        sqlite3_bind_int64(stmt, 2, batch_end);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Failed to copy recipes into shadow search index: " << sqlite3_errmsg(db);
+            return abandon();
+        }
+        processed += sqlite3_changes(db);
+
+        if (!execJobSQL(db, "COMMIT;")) return abandon();
+        last_id = batch_end;
+        report(IndexJobProgress::Phase::Building, processed, total);
+        throttle();
+    }
+    if (cancelled_) return abandon();
+
+    // Re-index what other connections wrote meanwhile until only a small tail is left
+    long long caught_up = 0;
+    while (!cancelled_) {
+        long long reindexed = 0;
+        if (!execJobSQL(db, std::string("BEGIN IMMEDIATE;") + kRebuildHeartbeatSql) || !reindexLogged(db, options_.batch_size, reindexed) ||
+            !execJobSQL(db, "COMMIT;")) {
+            return abandon();
+        }
+        caught_up += reindexed;
+        report(IndexJobProgress::Phase::CatchingUp, caught_up, caught_up);
+        if (reindexed < static_cast<long long>(options_.batch_size)) break;
+        throttle();
+    }
+    if (cancelled_) return abandon();
+
+    // Apply the remaining tail and swap the tables atomically; searches see either the old or the new index
+    report(IndexJobProgress::Phase::Swapping, 0, 0);
+    long long tail = 0;
+    if (!execJobSQL(db, "BEGIN IMMEDIATE;") || !reindexLogged(db, 0, tail)) return abandon();
+    const std::string swap_sql = std::string(kDropRebuildLogSql) + kDropSearchTriggersSql + R"(
+        DROP TABLE search;
+        ALTER TABLE search_shadow RENAME TO search;
+    )" + kSearchTriggersSql + "COMMIT;";
+    if (!execJobSQL(db, swap_sql)) return abandon();
+    execJobSQL(db, "DROP TABLE IF EXISTS temp.search_rebuild_batch;");
+
+    report(IndexJobProgress::Phase::Swapping, 1, 1);
+    return true;
+}
+
+
+bool SearchIndexJob::verify(sqlite3* db) {
+    // FTS5's own consistency check of the index structures against the stored content
+    report(IndexJobProgress::Phase::IntegrityCheck, 0, 1);
+    char* err_msg = nullptr;
+    int rc = sqlite3_exec(db, "INSERT INTO search(search, rank) VALUES('integrity-check', 0);", nullptr, nullptr, &err_msg);
+    if ((rc & 0xFF) == SQLITE_CORRUPT) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        progress_.integrity_ok = false;
+    } else if (rc != SQLITE_OK) {
+        LogLine(LogLevel::Error, __func__).sqlite(sqlite3_extended_errcode(db)) << "Search index integrity-check failed to run: " << (err_msg ? err_msg : sqlite3_errmsg(db));
+        sqlite3_free(err_msg);
+        return false;
+    }
+    sqlite3_free(err_msg);
+    report(IndexJobProgress::Phase::IntegrityCheck, 1, 1);
+    throttle();
+
+    // Compare each index row with what the recipe tables say it should contain, one read transaction per batch
+    const long long total = queryInt64(db, "SELECT COUNT(*) FROM recipes;", 0);
+    const std::string batch_sql = std::string("SELECT COUNT(*) FROM (") + kSearchRowsSql + R"( WHERE r.recipe_id > ? AND r.recipe_id <= ?) AS expected
+        LEFT JOIN search AS s ON s.rowid = expected.recipe_id
+        WHERE s.rowid IS NULL
+            OR COALESCE(s.name, '') != COALESCE(expected.name, '')
+            OR COALESCE(s.description, '') != COALESCE(expected.description, '')
+            OR COALESCE(s.author, '') != COALESCE(expected.author, '')
+            OR COALESCE(s.ingredients, '') != expected.ingredients
+            OR COALESCE(s.tags, '') != expected.tags;
+    )";
+    long long last_id = 0;
+    long long processed = 0;
+    long long mismatches = 0;
+    report(IndexJobProgress::Phase::Verifying, processed, total);
+    while (!cancelled_) {
+        if (!execJobSQL(db, "BEGIN;")) return false;
+        long long batch_end = nextBatchEnd(db, last_id, options_.batch_size);
+        if (batch_end == -1) {
+            // Index rows whose recipe no longer exists
+            mismatches += queryInt64(db, "SELECT COUNT(*) FROM search WHERE rowid NOT IN (SELECT recipe_id FROM recipes);", 0);
+            execJobSQL(db, "COMMIT;");
+            break;
+        }
+        mismatches += queryInt64(db, batch_sql, 0, {last_id, batch_end});
+        processed += queryInt64(db, "SELECT COUNT(*) FROM recipes WHERE recipe_id > ? AND recipe_id <= ?;", 0, {last_id, batch_end});
+        if (!execJobSQL(db, "COMMIT;")) return false;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            progress_.mismatches = mismatches;
+        }
+        last_id = batch_end;
+        report(IndexJobProgress::Phase::Verifying, processed, total);
+        throttle();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    progress_.mismatches = mismatches;
+    return !cancelled_;
+}
@@ -0,0 +1,316 @@
+#include "sqlite_memory.h"
+#include "logging.h"
+#include "sqlite3.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+
+
+// Size classes of the pooled allocator: powers of two from 32 to 2048 bytes
+constexpr size_t kSmallestPoolClass = 32;
+constexpr size_t kPoolClassCount = 7;
+constexpr size_t kLargestPoolClass = kSmallestPoolClass << (kPoolClassCount - 1);
+
+// Free blocks a thread keeps per size class; frees beyond this go back to malloc
+constexpr size_t kMaxPooledBlocks = 256;
+
+// Every block starts with its usable size, which keeps payloads 8-byte aligned as SQLite requires
+constexpr size_t kBlockHeader = 8;
+
+// Thread-local counters are added to the shared totals after this many events, so counting does not contend
+constexpr uint32_t kStatsFlushInterval = 1024;
+
+
+std::atomic<uint64_t> g_pool_hits{0};
+std::atomic<uint64_t> g_pool_misses{0};
+std::atomic<uint64_t> g_large_allocations{0};
+
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+
+// One thread's free lists. Blocks freed on another thread than the one that allocated them simply join
+// the freeing thread's lists.
+struct ThreadBlockPool {
+    std::array<FreeBlock*, kPoolClassCount> heads{};
+    std::array<size_t, kPoolClassCount> counts{};
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t large = 0;
+    uint32_t pending = 0;
+
+    void flushStats() {
+        g_pool_hits.fetch_add(hits, std::memory_order_relaxed);
+        g_pool_misses.fetch_add(misses, std::memory_order_relaxed);
+        g_large_allocations.fetch_add(large, std::memory_order_relaxed);
+        hits = misses = large = 0;
+        pending = 0;
+    }
+
+    void countEvent() {
+        if (++pending >= kStatsFlushInterval) flushStats();
+    }
+
+    ~ThreadBlockPool() {
+        for (FreeBlock*& head : heads) {
+            while (head) {
+                FreeBlock* next = head->next;
+                std::free(reinterpret_cast<char*>(head) - kBlockHeader);
+                head = next;
+            }
+        }
+        flushStats();
+    }
+};
+
+// The pool lives on the heap behind trivially destructible thread_locals, which stay usable until the thread is
+// gone: SQLite may still allocate and free from other thread_local destructors after the pool was released.
+thread_local ThreadBlockPool* t_block_pool = nullptr;
+thread_local bool t_block_pool_released = false;   // Later calls on this thread go straight to malloc and free
+
+// Releases the calling thread's pool at thread exit
+struct ThreadBlockPoolReleaser {
+    ~ThreadBlockPoolReleaser() {
+        delete t_block_pool;
+        t_block_pool = nullptr;
+        t_block_pool_released = true;
+    }
+};
+
+thread_local ThreadBlockPoolReleaser t_block_pool_releaser;
+
+
+/**
+ * @return The calling thread's pool, created on first use; nullptr once it was released or if it cannot be allocated.
+ */
+ThreadBlockPool* threadBlockPool() {
+    if (t_block_pool || t_block_pool_released) return t_block_pool;
+    t_block_pool = new (std::nothrow) ThreadBlockPool();
+    static_cast<void>(&t_block_pool_releaser);  // First use registers the releaser's destructor for this thread
+    return t_block_pool;
+}
+
+
+size_t poolClassOf(size_t size) {
+    size_t class_index = 0;
+    for (size_t class_size = kSmallestPoolClass; class_size < size; class_size <<= 1) ++class_index;
+    return class_index;
+}
+
+
+uint64_t& blockSize(void* payload) {
+    return *reinterpret_cast<uint64_t*>(static_cast<char*>(payload) - kBlockHeader);
+}
+
+
+void* allocateBlock(size_t usable) {
+    char* raw = static_cast<char*>(std::malloc(kBlockHeader + usable));
+    if (!raw) return nullptr;
+    *reinterpret_cast<uint64_t*>(raw) = usable;
+    return raw + kBlockHeader;
+}
+
+
+void* pooledMalloc(int n) {
+    size_t size = n > 0 ? static_cast<size_t>(n) : 1;
+    ThreadBlockPool* pool = threadBlockPool();
+    if (!pool) return allocateBlock((size + 7) & ~size_t{7});
+    if (size > kLargestPoolClass) {
+        ++pool->large;
+        pool->countEvent();
+        return allocateBlock((size + 7) & ~size_t{7});
+    }
+
+    size_t class_index = poolClassOf(size);
+    if (FreeBlock* block = pool->heads[class_index]) {
+        pool->heads[class_index] = block->next;
+        --pool->counts[class_index];
+        ++pool->hits;
+        pool->countEvent();
+        return block;
+    }
+    ++pool->misses;
+    pool->countEvent();
+    return allocateBlock(kSmallestPoolClass << class_index);
+}
+
+
+void pooledFree(void* p) {
+    if (!p) return;
+    size_t size = blockSize(p);
+    // Only blocks of exactly a class size are pooled: blocks of other sizes come from the headered system
+    // allocator, installed while some of them may still be live
+    if (size <= kLargestPoolClass && size == (kSmallestPoolClass << poolClassOf(size))) {
+        ThreadBlockPool* pool = threadBlockPool();
+        size_t class_index = poolClassOf(size);
+        if (pool && pool->counts[class_index] < kMaxPooledBlocks) {
+            FreeBlock* block = static_cast<FreeBlock*>(p);
+            block->next = pool->heads[class_index];
+            pool->heads[class_index] = block;
+            ++pool->counts[class_index];
+            return;
+        }
+    }
+    std::free(static_cast<char*>(p) - kBlockHeader);
+}
+
+
+int pooledSize(void* p) {
+    return p ? static_cast<int>(blockSize(p)) : 0;
+}
+
+
+int pooledRoundup(int n) {
+    size_t size = n > 0 ? static_cast<size_t>(n) : 1;
+    if (size > kLargestPoolClass) return static_cast<int>((size + 7) & ~size_t{7});
+    return static_cast<int>(kSmallestPoolClass << poolClassOf(size));
+}
+
+
+void* pooledRealloc(void* p, int n) {
+    if (!p) return pooledMalloc(n);
+    size_t old_size = blockSize(p);
+    if (n > 0 && static_cast<size_t>(pooledRoundup(n)) == old_size) return p;
+    void* resized = pooledMalloc(n);
+    if (!resized) return nullptr;
+    std::memcpy(resized, p, std::min(old_size, static_cast<size_t>(n > 0 ? n : 0)));
+    pooledFree(p);
+    return resized;
+}
+
+
+int pooledInit(void*) {
+    return SQLITE_OK;
+}
+
+
+void pooledShutdown(void*) {
+}
+
+
+const sqlite3_mem_methods kPooledMethods = {
+    pooledMalloc, pooledFree, pooledRealloc, pooledSize, pooledRoundup, pooledInit, pooledShutdown, nullptr
+};
+
+
+// Plain malloc and free with the pooled allocator's block header. Once the pool was installed, the System
+// setting uses these instead of SQLite's own methods, so blocks handed out by the pool and still held by SQLite
+// (or by the application, from sqlite3_malloc) can be freed or resized after switching back.
+void* headeredMalloc(int n) {
+    return allocateBlock((static_cast<size_t>(n > 0 ? n : 1) + 7) & ~size_t{7});
+}
+
+
+void headeredFree(void* p) {
+    if (p) std::free(static_cast<char*>(p) - kBlockHeader);
+}
+
+
+int headeredRoundup(int n) {
+    return static_cast<int>((static_cast<size_t>(n > 0 ? n : 1) + 7) & ~size_t{7});
+}
+
+
+void* headeredRealloc(void* p, int n) {
+    if (!p) return headeredMalloc(n);
+    size_t usable = static_cast<size_t>(headeredRoundup(n));
+    char* raw = static_cast<char*>(std::realloc(static_cast<char*>(p) - kBlockHeader, kBlockHeader + usable));
+    if (!raw) return nullptr;
+    *reinterpret_cast<uint64_t*>(raw) = usable;
+    return raw + kBlockHeader;
+}
+
+
+const sqlite3_mem_methods kHeaderedSystemMethods = {
+    headeredMalloc, headeredFree, headeredRealloc, pooledSize, headeredRoundup, pooledInit, pooledShutdown, nullptr
+};
+
+
+std::mutex g_config_mutex;
+SqliteMemoryConfig g_config;
+std::unique_ptr<char[]> g_page_cache_arena;     // Must outlive SQLite's use of it, i.e. until the next shutdown
+sqlite3_mem_methods g_system_methods{};
+bool g_system_methods_saved = false;
+bool g_pool_installed = false;                  // Blocks with the pool's header may be live from here on
+
+
+/**
+ * Applies every setting in turn; SQLite must be shut down.
+ * @return The first SQLite error, SQLITE_OK if all settings were accepted.
+ */
+int configureShutDownSqlite(const SqliteMemoryConfig& config, std::unique_ptr<char[]>& arena) {
+    const sqlite3_mem_methods* methods = &g_system_methods;
+    if (config.allocator == SqliteAllocator::Pooled) methods = &kPooledMethods;
+    else if (g_pool_installed) methods = &kHeaderedSystemMethods;
+    int rc = sqlite3_config(SQLITE_CONFIG_MALLOC, methods);
+    if (rc == SQLITE_OK && config.allocator == SqliteAllocator::Pooled) g_pool_installed = true;
+    if (rc == SQLITE_OK) rc = sqlite3_config(SQLITE_CONFIG_MEMSTATUS, config.memory_statistics ? 1 : 0);
+    if (rc == SQLITE_OK) rc = sqlite3_config(SQLITE_CONFIG_LOOKASIDE, static_cast<int>(config.lookaside_slot_size), static_cast<int>(config.lookaside_slots));
+    if (rc != SQLITE_OK) return rc;
+
+    if (config.page_cache_slots == 0) return sqlite3_config(SQLITE_CONFIG_PAGECACHE, nullptr, 0, 0);
+    int header_size = 0;
+    rc = sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &header_size);
+    if (rc != SQLITE_OK) return rc;
+    size_t slot_size = (config.page_size + static_cast<size_t>(header_size) + 7) & ~size_t{7};
+    arena.reset(new (std::nothrow) char[slot_size * config.page_cache_slots]);
+    if (!arena) return SQLITE_NOMEM;
+    return sqlite3_config(SQLITE_CONFIG_PAGECACHE, arena.get(), static_cast<int>(slot_size), static_cast<int>(config.page_cache_slots));
+}
+
+
+bool applySqliteMemoryConfig(const SqliteMemoryConfig& config) {
+    std::lock_guard<std::mutex> lock(g_config_mutex);
+    if (sqlite3_shutdown() != SQLITE_OK) {
+        LogLine(LogLevel::Error, __func__) << "SQLite could not be shut down to apply the memory configuration.";
+        return false;
+    }
+    if (!g_system_methods_saved) {
+        sqlite3_config(SQLITE_CONFIG_GETMALLOC, &g_system_methods);
+        g_system_methods_saved = true;
+    }
+
+    // The old arena is no longer referenced once SQLite is shut down
+    std::unique_ptr<char[]> arena;
+    int rc = configureShutDownSqlite(config, arena);
+    if (rc == SQLITE_OK) rc = sqlite3_initialize();
+    if (rc != SQLITE_OK) {
+        LogLine(LogLevel::Error, __func__).sqlite(rc) << "SQLite rejected the memory configuration: " << sqlite3_errstr(rc);
+        sqlite3_shutdown();
+        configureShutDownSqlite(SqliteMemoryConfig(), arena);
+        sqlite3_initialize();
+        g_config = SqliteMemoryConfig();
+        g_page_cache_arena.reset();
+        return false;
+    }
+
+    g_page_cache_arena = std::move(arena);
+    g_config = config;
+    if (config.allocator == SqliteAllocator::Pooled) {
+        g_pool_hits = 0;
+        g_pool_misses = 0;
+        g_large_allocations = 0;
+    }
+    return true;
+}
+
+
+SqliteMemoryConfig currentSqliteMemoryConfig() {
+    std::lock_guard<std::mutex> lock(g_config_mutex);
+    return g_config;
+}
+
+
+PooledAllocatorStats pooledAllocatorStats() {
+    if (currentSqliteMemoryConfig().allocator != SqliteAllocator::Pooled) return {};
+    if (ThreadBlockPool* pool = t_block_pool) pool->flushStats();
+    return {g_pool_hits.load(std::memory_order_relaxed), g_pool_misses.load(std::memory_order_relaxed),
+            g_large_allocations.load(std::memory_order_relaxed)};
+}
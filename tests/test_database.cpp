@@ -4,15 +4,23 @@
 #include <filesystem>
 #include <algorithm>
 #include <set>
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <cmath>
 #include "database.h"
+#include "logging.h"
+#include "ingredient_parser.h"
+#include "recipe_importer.h"
+#include <mutex>
 
 // A test fixture for setting up and tearing down the database for each test.
 struct TestDB {
+    Database database;
     Database* db;
     std::string db_path;
 
-    TestDB(const std::string& path) : db_path(path) {
-        db = Database::instance();
+    TestDB(const std::string& path) : db(&database), db_path(path) {
         // Ensure a clean slate before each test
         std::filesystem::remove(db_path);
         assert(db->open(db_path));
@@ -69,6 +77,1327 @@ void testCoreFunctionality() {
     std::cout << "Core Functionality Tests Passed!" << std::endl;
 }
 
+void testReopenAndRebuild() {
+    std::cout << "\n--- Testing Reopen and Index Rebuild ---" << std::endl;
+    TestDB test_db("test_reopen.db");
+
+    long long id = test_db.db->addRecipe(createRecipe("Goulash", "Oma", {"Paprika", "Beef"}, {"hungarian"}));
+
+    // Reopening an up-to-date database skips the schema script but keeps everything usable
+    test_db.db->close();
+    assert(test_db.db->open(test_db.db_path));
+    SearchData criteria;
+    criteria.keywords = "paprika";
+    assert((test_db.db->search(criteria) == std::vector<long long>{id}));
+
+    // The explicit rebuild reproduces ingredient and tag text without duplicating it
+    assert(test_db.db->rebuildSearchIndex());
+    assert((test_db.db->search(criteria) == std::vector<long long>{id}));
+    criteria.keywords = "hungarian";
+    assert((test_db.db->search(criteria) == std::vector<long long>{id}));
+    long long other = test_db.db->addRecipe(createRecipe("Stew", "Oma", {"Beef"}, {"winter"}));
+    criteria.keywords = "beef";
+    assert(test_db.db->search(criteria).size() == 2);
+    assert(test_db.db->deleteRecipe(other));
+
+    std::cout << "Reopen and Index Rebuild Tests Passed!" << std::endl;
+}
+
+void testBackgroundIndexJob() {
+    std::cout << "\n--- Testing Background Index Jobs ---" << std::endl;
+    TestDB test_db("test_index_job.db");
+
+    std::vector<long long> ids;
+    for (int i = 0; i < 30; ++i) {
+        ids.push_back(test_db.db->addRecipe(createRecipe("Soup " + std::to_string(i), "Chef", {"Leek", "Potato"}, {"soup"})));
+    }
+
+    IndexJobOptions options;
+    options.batch_size = 7;
+    int progress_calls = 0;
+    options.on_progress = [&progress_calls](const IndexJobProgress&) { ++progress_calls; };
+
+    // A consistent index verifies cleanly
+    assert(test_db.db->startSearchIndexVerification(options));
+    std::optional<IndexJobProgress> result = test_db.db->waitForIndexJob();
+    assert(result && result->phase == IndexJobProgress::Phase::Done);
+    assert(result->integrity_ok && result->mismatches == 0 && result->processed == 30);
+    assert(progress_calls > 5);
+
+    // Damage one index row behind the library's back; verification reports it
+    sqlite3* raw = nullptr;
+    assert(sqlite3_open(test_db.db_path.c_str(), &raw) == SQLITE_OK);
+    std::string tamper_sql = "UPDATE search SET name = 'Bogus' WHERE rowid = " + std::to_string(ids[3]) + ";";
+    assert(sqlite3_exec(raw, tamper_sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK);
+    sqlite3_close(raw);
+    assert(test_db.db->startSearchIndexVerification(options));
+    result = test_db.db->waitForIndexJob();
+    assert(result && result->phase == IndexJobProgress::Phase::Done && result->mismatches == 1);
+
+    // A rebuild repairs it while this connection keeps writing
+    options.pause = std::chrono::milliseconds(2);
+    assert(test_db.db->startSearchIndexRebuild(options));
+    assert(!test_db.db->startSearchIndexVerification(options));
+    long long added = test_db.db->addRecipe(createRecipe("Borscht", "Chef", {"Beetroot"}, {"soup"}));
+    assert(test_db.db->deleteRecipe(ids[0]));
+    result = test_db.db->waitForIndexJob();
+    assert(result && result->phase == IndexJobProgress::Phase::Done);
+
+    SearchData criteria;
+    criteria.keywords = "beetroot";
+    assert((test_db.db->search(criteria) == std::vector<long long>{added}));
+    criteria.keywords = "soup";
+    assert(test_db.db->search(criteria).size() == 30);
+    assert(test_db.db->startSearchIndexVerification());
+    result = test_db.db->waitForIndexJob();
+    assert(result && result->integrity_ok && result->mismatches == 0);
+
+    // A cancelled rebuild leaves the live index in place
+    options.batch_size = 1;
+    options.pause = std::chrono::milliseconds(20);
+    assert(test_db.db->startSearchIndexRebuild(options));
+    test_db.db->cancelIndexJob();
+    assert(test_db.db->indexJobProgress()->phase == IndexJobProgress::Phase::Cancelled);
+    assert(test_db.db->search(criteria).size() == 30);
+
+    // The log of a rebuild that died is dropped on open, once its heartbeat is old enough
+    auto leftovers = [&test_db]() {
+        sqlite3* conn = nullptr;
+        assert(sqlite3_open(test_db.db_path.c_str(), &conn) == SQLITE_OK);
+        sqlite3_stmt* stmt = nullptr;
+        assert(sqlite3_prepare_v2(conn, "SELECT (SELECT COUNT(*) FROM sqlite_schema WHERE name LIKE 'search_rebuild_log%') + "
+                                        "(SELECT COUNT(*) FROM metadata WHERE key = 'search_rebuild_heartbeat');", -1, &stmt, nullptr) == SQLITE_OK);
+        assert(sqlite3_step(stmt) == SQLITE_ROW);
+        int count = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+        sqlite3_close(conn);
+        return count;
+    };
+    test_db.db->close();
+    assert(sqlite3_open(test_db.db_path.c_str(), &raw) == SQLITE_OK);
+    assert(sqlite3_exec(raw, R"(
+        CREATE TABLE search_rebuild_log (recipe_id INTEGER PRIMARY KEY);
+        CREATE TRIGGER search_rebuild_log_recipe_insert AFTER INSERT ON recipes
+        BEGIN INSERT OR IGNORE INTO search_rebuild_log VALUES (new.recipe_id); END;
+        INSERT INTO metadata (key, value) VALUES ('search_rebuild_heartbeat', CAST(strftime('%s', 'now') AS INTEGER));
+    )", nullptr, nullptr, nullptr) == SQLITE_OK);
+    sqlite3_close(raw);
+    assert(test_db.db->open(test_db.db_path));
+    assert(leftovers() == 3);
+    test_db.db->close();
+    assert(sqlite3_open(test_db.db_path.c_str(), &raw) == SQLITE_OK);
+    assert(sqlite3_exec(raw, "UPDATE metadata SET value = value - 600 WHERE key = 'search_rebuild_heartbeat';", nullptr, nullptr, nullptr) == SQLITE_OK);
+    sqlite3_close(raw);
+    assert(test_db.db->open(test_db.db_path));
+    assert(leftovers() == 0);
+
+    std::cout << "Background Index Job Tests Passed!" << std::endl;
+}
+
+void testMaintenance() {
+    std::cout << "\n--- Testing Maintenance ---" << std::endl;
+    TestDB test_db("test_maintenance.db");
+
+    auto fill_and_empty = [&test_db]() {
+        for (int i = 0; i < 200; ++i) {
+            RecipeData recipe = createRecipe("Bread " + std::to_string(i), "Baker", {"Flour", "Water", "Salt"}, {"bread"});
+            recipe.description = std::string(2000, 'x');
+            test_db.db->addRecipe(recipe);
+        }
+        assert(test_db.db->emptyDatabase());
+    };
+
+    // New databases use incremental auto-vacuum, so emptied pages can be handed back in small steps
+    fill_and_empty();
+    std::optional<StorageStats> stats = test_db.db->storageStats(true);
+    assert(stats && stats->auto_vacuum == 2 && stats->freelist_count > 50 && stats->unused_bytes >= 0);
+
+    // Emptying keeps only the newest entry of each change log
+    sqlite3* raw = nullptr;
+    assert(sqlite3_open(test_db.db_path.c_str(), &raw) == SQLITE_OK);
+    sqlite3_stmt* stmt = nullptr;
+    assert(sqlite3_prepare_v2(raw, "SELECT (SELECT count(*) FROM recipe_text_changes), (SELECT count(*) FROM recipe_ingredient_changes);",
+                              -1, &stmt, nullptr) == SQLITE_OK);
+    assert(sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) == 1 && sqlite3_column_int(stmt, 1) == 1);
+    sqlite3_reset(stmt);
+
+    // Without maintenance, writes keep a change log at about 100000 entries
+    assert(sqlite3_exec(raw, "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 150000) "
+                             "INSERT INTO recipe_ingredient_changes (recipe_id) SELECT 1 FROM n;", nullptr, nullptr, nullptr) == SQLITE_OK);
+    std::vector<RecipeData> batch;
+    for (int i = 0; i < 200; ++i) batch.push_back(createRecipe("Roll " + std::to_string(i), "Baker", {"Flour", "Yeast"}, {"bread"}));
+    assert(test_db.db->addRecipes(batch).size() == 200);
+    assert(sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 1) >= 100000 && sqlite3_column_int(stmt, 1) <= 100000 + 400);
+    sqlite3_finalize(stmt);
+    sqlite3_close(raw);
+    assert(test_db.db->emptyDatabase());
+
+    MaintenanceOptions limited;
+    limited.vacuum_step_pages = 3;
+    limited.max_vacuum_pages = 10;
+    std::optional<MaintenanceReport> report = test_db.db->runMaintenance(limited);
+    assert(report && report->analyzed && report->search_merged);
+    assert(report->pages_reclaimed == 10 && report->budget_exhausted);
+    assert(report->after.page_count < report->before.page_count && report->after.freelist_count > 0);
+
+    MaintenanceOptions unlimited;
+    unlimited.time_budget = std::chrono::milliseconds(10000);
+    unlimited.full_analyze = true;
+    report = test_db.db->runMaintenance(unlimited);
+    assert(report && !report->budget_exhausted && report->after.freelist_count == 0);
+    assert(report->pages_reclaimed == report->before.freelist_count);
+
+    // The background schedule reclaims pages on its own connection
+    fill_and_empty();
+    assert(test_db.db->startMaintenanceScheduler(std::chrono::milliseconds(10), unlimited));
+    for (int i = 0; i < 500 && !test_db.db->lastScheduledMaintenance(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::optional<MaintenanceReport> scheduled = test_db.db->lastScheduledMaintenance();
+    test_db.db->stopMaintenanceScheduler();
+    assert(scheduled && scheduled->after.freelist_count == 0);
+    assert(test_db.db->lastScheduledMaintenance() == std::nullopt);
+    assert(test_db.db->storageStats()->freelist_count == 0);
+
+    std::cout << "Maintenance Tests Passed!" << std::endl;
+}
+
+void testWalCheckpointer() {
+    std::cout << "\n--- Testing WAL Checkpointer ---" << std::endl;
+    TestDB test_db("test_wal.db");
+
+    CheckpointPolicy policy;
+    policy.mode = CheckpointMode::Truncate;
+    policy.wal_size_pages = 20;
+    policy.idle_after = std::chrono::milliseconds(20);
+    policy.poll_interval = std::chrono::milliseconds(5);
+    policy.busy_timeout_ms = 10;
+    policy.reader_backoff_max = std::chrono::milliseconds(40);
+    assert(test_db.db->enableWal(policy));
+
+    for (int i = 0; i < 50; ++i) {
+        test_db.db->addRecipe(createRecipe("Pie " + std::to_string(i), "Baker", {"Apple", "Butter"}, {"dessert"}));
+    }
+
+    // Once commits stop, the idle trigger copies the rest of the WAL and truncates the file
+    std::optional<CheckpointMetrics> metrics;
+    const std::string wal_path = test_db.db_path + "-wal";
+    for (int i = 0; i < 400; ++i) {
+        metrics = test_db.db->checkpointMetrics();
+        if (metrics->truncate > 0 && metrics->wal_frames == 0 && std::filesystem::file_size(wal_path) == 0) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    assert(metrics->checkpoints > 0 && metrics->truncate == metrics->checkpoints);
+    assert(metrics->frames_copied > 0 && metrics->max_wal_frames > 0 && metrics->max_duration.count() > 0);
+    assert(std::filesystem::file_size(wal_path) == 0);
+
+    // A reader on an old snapshot keeps frames from being copied: retries back off instead of running every poll,
+    // and after a few of them a Truncate checkpoint waits for the reader
+    sqlite3* reader = nullptr;
+    assert(sqlite3_open(test_db.db_path.c_str(), &reader) == SQLITE_OK);
+    assert(sqlite3_exec(reader, "BEGIN; SELECT count(*) FROM recipes;", nullptr, nullptr, nullptr) == SQLITE_OK);
+    test_db.db->addRecipe(createRecipe("Tart", "Baker", {"Pastry"}, {"dessert"}));
+    const int64_t before_reader = test_db.db->checkpointMetrics()->checkpoints;
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    metrics = test_db.db->checkpointMetrics();
+    assert(metrics->checkpoints - before_reader < 20 && metrics->reader_escalations > 0);
+    assert(sqlite3_exec(reader, "COMMIT;", nullptr, nullptr, nullptr) == SQLITE_OK);
+    sqlite3_close(reader);
+    for (int i = 0; i < 400 && (metrics->wal_frames > 0 || std::filesystem::file_size(wal_path) > 0); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        metrics = test_db.db->checkpointMetrics();
+    }
+    assert(metrics->wal_frames == 0 && std::filesystem::file_size(wal_path) == 0);
+
+    // Checkpointing does not change what the connection sees, and it stops with the connection
+    SearchData criteria;
+    criteria.keywords = "apple";
+    assert(test_db.db->search(criteria).size() == 50);
+    test_db.db->close();
+    assert(test_db.db->checkpointMetrics() == std::nullopt);
+    assert(test_db.db->open(test_db.db_path));
+    assert(test_db.db->search(criteria).size() == 50);
+
+    std::cout << "WAL Checkpointer Tests Passed!" << std::endl;
+}
+
+void testMultipleInstances() {
+    std::cout << "\n--- Testing Multiple Database Instances ---" << std::endl;
+    TestDB first("test_instances_1.db");
+    TestDB second("test_instances_2.db");
+
+    // Two libraries open side by side do not see each other's recipes
+    long long soup = first.db->addRecipe(createRecipe("Soup", "Ann", {"Leek"}, {"soup"}));
+    second.db->addRecipe(createRecipe("Salad", "Bob", {"Lettuce"}, {"salad"}));
+    second.db->addRecipe(createRecipe("Slaw", "Bob", {"Cabbage"}, {"salad"}));
+    assert(first.db->search({}).size() == 1);
+    assert(second.db->search({}).size() == 2);
+
+    // Moving hands over the open connection and leaves the source closed
+    Database moved(std::move(first.database));
+    assert(moved.isOpen() && !first.db->isOpen());
+    assert(moved.getRecipeById(soup)->name == "Soup");
+    assert(first.db->addRecipe(createRecipe("Stew", "Ann", {"Beef"}, {})) == -1);
+
+    // Move assignment closes the target's own connection first
+    Database target;
+    assert(target.open("test_instances_3.db"));
+    target = std::move(moved);
+    assert(target.isOpen() && !moved.isOpen());
+    assert(target.search({}).size() == 1);
+    target.close();
+    std::filesystem::remove("test_instances_3.db");
+
+    // The compatibility shim still hands out one shared object
+    assert(Database::instance() == Database::instance());
+    assert(!Database::instance()->isOpen());
+
+    std::cout << "Multiple Database Instances Tests Passed!" << std::endl;
+}
+
+// A VFS over the default one whose writes to main database files fail with SQLITE_FULL while g_fail_db_commits is
+// set. Without WAL those writes happen while committing, so a COMMIT fails after SQLite has called the commit hook
+bool g_fail_db_commits = false;
+sqlite3_vfs* g_default_vfs = nullptr;
+
+struct FailingDbFile {
+    sqlite3_file base;
+    sqlite3_file* real;
+    bool main_db;
+};
+
+sqlite3_file* realFile(sqlite3_file* file) {
+    return reinterpret_cast<FailingDbFile*>(file)->real;
+}
+
+const sqlite3_io_methods kFailingDbMethods = {
+    3,
+    [](sqlite3_file* f) { return realFile(f)->pMethods->xClose(realFile(f)); },
+    [](sqlite3_file* f, void* buffer, int amount, sqlite3_int64 offset) { return realFile(f)->pMethods->xRead(realFile(f), buffer, amount, offset); },
+    [](sqlite3_file* f, const void* buffer, int amount, sqlite3_int64 offset) {
+        if (g_fail_db_commits && reinterpret_cast<FailingDbFile*>(f)->main_db) return SQLITE_FULL;
+        return realFile(f)->pMethods->xWrite(realFile(f), buffer, amount, offset);
+    },
+    [](sqlite3_file* f, sqlite3_int64 size) { return realFile(f)->pMethods->xTruncate(realFile(f), size); },
+    [](sqlite3_file* f, int flags) { return realFile(f)->pMethods->xSync(realFile(f), flags); },
+    [](sqlite3_file* f, sqlite3_int64* size) { return realFile(f)->pMethods->xFileSize(realFile(f), size); },
+    [](sqlite3_file* f, int lock) { return realFile(f)->pMethods->xLock(realFile(f), lock); },
+    [](sqlite3_file* f, int lock) { return realFile(f)->pMethods->xUnlock(realFile(f), lock); },
+    [](sqlite3_file* f, int* reserved) { return realFile(f)->pMethods->xCheckReservedLock(realFile(f), reserved); },
+    [](sqlite3_file* f, int op, void* arg) { return realFile(f)->pMethods->xFileControl(realFile(f), op, arg); },
+    [](sqlite3_file* f) { return realFile(f)->pMethods->xSectorSize(realFile(f)); },
+    [](sqlite3_file* f) { return realFile(f)->pMethods->xDeviceCharacteristics(realFile(f)); },
+    [](sqlite3_file* f, int page, int size, int extend, void volatile** region) { return realFile(f)->pMethods->xShmMap(realFile(f), page, size, extend, region); },
+    [](sqlite3_file* f, int offset, int n, int flags) { return realFile(f)->pMethods->xShmLock(realFile(f), offset, n, flags); },
+    [](sqlite3_file* f) { realFile(f)->pMethods->xShmBarrier(realFile(f)); },
+    [](sqlite3_file* f, int delete_flag) { return realFile(f)->pMethods->xShmUnmap(realFile(f), delete_flag); },
+    [](sqlite3_file* f, sqlite3_int64 offset, int amount, void** pointer) { return realFile(f)->pMethods->xFetch(realFile(f), offset, amount, pointer); },
+    [](sqlite3_file* f, sqlite3_int64 offset, void* pointer) { return realFile(f)->pMethods->xUnfetch(realFile(f), offset, pointer); },
+};
+
+int failingDbOpen(sqlite3_vfs*, sqlite3_filename name, sqlite3_file* file, int flags, int* out_flags) {
+    FailingDbFile* wrapper = reinterpret_cast<FailingDbFile*>(file);
+    wrapper->real = reinterpret_cast<sqlite3_file*>(wrapper + 1);
+    wrapper->real->pMethods = nullptr;
+    wrapper->main_db = (flags & SQLITE_OPEN_MAIN_DB) != 0;
+    int rc = g_default_vfs->xOpen(g_default_vfs, name, wrapper->real, flags, out_flags);
+    file->pMethods = wrapper->real->pMethods ? &kFailingDbMethods : nullptr;
+    return rc;
+}
+
+void testNameIdCache() {
+    std::cout << "\n--- Testing Ingredient and Tag Name Cache ---" << std::endl;
+    TestDB test_db("test_name_cache.db");
+
+    // Cached ids of orphans removed by deleteRecipe must not be reused (foreign keys would reject them)
+    long long first = test_db.db->addRecipe(createRecipe("Pesto", "Nonna", {"Basil", "Pine Nuts"}, {"sauce"}));
+    assert(test_db.db->deleteRecipe(first));
+    long long second = test_db.db->addRecipe(createRecipe("Caprese", "Nonna", {"Basil", "Tomato"}, {"sauce"}));
+    assert(second > 0);
+    std::optional<RecipeData> recipe = test_db.db->getRecipeById(second);
+    assert(recipe && recipe->ingredients.size() == 2 && recipe->tags == std::vector<std::string>{"sauce"});
+
+    // Repeated names resolve to the same rows
+    long long third = test_db.db->addRecipe(createRecipe("Bruschetta", "Nonna", {"Tomato", "Basil"}, {"sauce"}));
+    SearchData criteria;
+    criteria.ingredients = {"Tomato"};
+    assert(test_db.db->search(criteria).size() == 2);
+    criteria = {};
+    criteria.tags = {"sauce"};
+    assert(test_db.db->search(criteria).size() == 2);
+
+    // emptyDatabase() restarts the id sequences, so nothing cached may survive it
+    assert(test_db.db->deleteRecipe(third));
+    assert(test_db.db->emptyDatabase());
+    long long fourth = test_db.db->addRecipe(createRecipe("Gazpacho", "Pepa", {"Tomato", "Cucumber"}, {"soup"}));
+    recipe = test_db.db->getRecipeById(fourth);
+    assert(recipe && recipe->ingredients.size() == 2 && recipe->ingredients[0].name == "Tomato");
+
+    // Orphans removed through another connection invalidate this connection's cache too
+    Database other;
+    assert(other.open(test_db.db_path));
+    long long saffron = test_db.db->addRecipe(createRecipe("Paella", "Pepa", {"Saffron"}, {"rice"}));
+    assert(other.deleteRecipe(saffron));
+    long long risotto = test_db.db->addRecipe(createRecipe("Risotto", "Pepa", {"Saffron"}, {"rice"}));
+    assert(risotto > 0);
+    recipe = test_db.db->getRecipeById(risotto);
+    assert(recipe && recipe->ingredients.size() == 1 && recipe->tags == std::vector<std::string>{"rice"});
+    other.close();
+
+    // Names created inside a rolled-back transaction are forgotten
+    NameIdCache cache;
+    cache.insert("Leek", 1, false);
+    cache.insert("Chive", 2, true);
+    cache.rollback();
+    assert(cache.find("Leek") == 1 && !cache.find("Chive"));
+    cache.insert("Chive", 3, true);
+    cache.commit();
+    cache.rollback();
+    assert(cache.find("Chive") == 3 && cache.size() == 2);
+
+    // So are names whose COMMIT failed after the commit hook ran: the next recipe using them must not get stale ids
+    g_default_vfs = sqlite3_vfs_find(nullptr);
+    sqlite3_vfs failing_vfs = *g_default_vfs;
+    failing_vfs.zName = "failing_db";
+    failing_vfs.szOsFile = static_cast<int>(sizeof(FailingDbFile)) + g_default_vfs->szOsFile;
+    failing_vfs.xOpen = failingDbOpen;
+    assert(sqlite3_vfs_register(&failing_vfs, 1) == SQLITE_OK);
+    {
+        TestDB failing_db("test_name_cache_commit.db");
+        assert(failing_db.db->addRecipe(createRecipe("Toast", "Cy", {"Bread"}, {"breakfast"})) > 0);
+        const size_t cached = failing_db.db->memoryReport()->library.name_cache_entries;
+        g_fail_db_commits = true;
+        assert(failing_db.db->addRecipe(createRecipe("Chili", "Cy", {"Ghost Pepper"}, {"spicy"})) == -1);
+        g_fail_db_commits = false;
+        assert(failing_db.db->memoryReport()->library.name_cache_entries == cached);
+        long long chili = failing_db.db->addRecipe(createRecipe("Chili", "Cy", {"Ghost Pepper", "Bread"}, {"spicy"}));
+        assert(chili > 0);
+        recipe = failing_db.db->getRecipeById(chili);
+        assert(recipe && recipe->ingredients.size() == 2 && recipe->tags == std::vector<std::string>{"spicy"});
+    }
+    sqlite3_vfs_unregister(&failing_vfs);
+    sqlite3_vfs_register(g_default_vfs, 1);
+
+    std::cout << "Ingredient and Tag Name Cache Tests Passed!" << std::endl;
+}
+
+void testBulkNameResolution() {
+    std::cout << "\n--- Testing Bulk Name Resolution ---" << std::endl;
+    TestDB test_db("test_bulk_resolve.db");
+
+    long long small = test_db.db->addRecipe(createRecipe("Toast", "Sam", {"Bread", "Butter"}, {"breakfast"}));
+
+    // More than a few links: existing and new names are resolved together
+    std::vector<std::string> ingredients = {"Bread", "Butter", "Egg", "Milk", "Cinnamon", "Sugar"};
+    std::vector<std::string> tags = {"breakfast", "sweet", "quick", "vegetarian", "weekend"};
+    long long big = test_db.db->addRecipe(createRecipe("French Toast", "Sam", ingredients, tags));
+    assert(big > small);
+    std::optional<RecipeData> recipe = test_db.db->getRecipeById(big);
+    assert(recipe && recipe->ingredients.size() == ingredients.size() && recipe->tags.size() == tags.size());
+
+    SearchData criteria;
+    criteria.ingredients = {"Bread"};
+    assert(test_db.db->search(criteria).size() == 2);
+    criteria = {};
+    criteria.keywords = "cinnamon";
+    assert((test_db.db->search(criteria) == std::vector<long long>{big}));
+    criteria = {};
+    criteria.tags = {"breakfast", "weekend"};
+    assert((test_db.db->search(criteria) == std::vector<long long>{big}));
+
+    // A failing link rolls back the names the upsert created, and the cache forgets them too
+    std::vector<std::string> broken = {"Flour", "Yeast", "Salt", "Water", "Oil", "Flour"};
+    assert(test_db.db->addRecipe(createRecipe("Focaccia", "Sam", broken, {})) == -1);
+    broken.pop_back();
+    long long fixed = test_db.db->addRecipe(createRecipe("Focaccia", "Sam", broken, {}));
+    recipe = test_db.db->getRecipeById(fixed);
+    assert(recipe && recipe->ingredients.size() == broken.size());
+
+    std::cout << "Bulk Name Resolution Tests Passed!" << std::endl;
+}
+
+// Collects records in memory so tests can inspect what the library logged
+struct CapturingSink : LogSink {
+    std::mutex mutex;
+    std::vector<LogRecord> records;
+
+    void write(const LogRecord& record) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        records.push_back(record);
+    }
+};
+
+void testLogging() {
+    std::cout << "\n--- Testing Logging ---" << std::endl;
+    TestDB test_db("test_logging.db");
+    std::shared_ptr<LogSink> previous = logSink();
+
+    // Failures arrive at a custom sink as structured records
+    auto capture = std::make_shared<CapturingSink>();
+    setLogSink(capture);
+    assert(!test_db.db->deleteRecipe(-5));
+    assert(capture->records.size() == 1);
+    assert(capture->records[0].level == LogLevel::Error && capture->records[0].operation == "deleteRecipe");
+    assert(capture->records[0].recipe_id == -5);
+    assert(!test_db.db->deleteRecipe(-1) && capture->records.back().recipe_id == -1);
+    LogLine(LogLevel::Error, "test") << "no recipe";
+    assert(!capture->records.back().recipe_id);
+
+    // Statements that fail to prepare are reported through the sink as well
+    capture->records.clear();
+    sqlite3* raw = nullptr;
+    assert(sqlite3_open(":memory:", &raw) == SQLITE_OK);
+    assert(SqliteStatement(raw, "SELEC 1;").stmt == nullptr);
+    sqlite3_close(raw);
+    assert(capture->records.size() == 1 && capture->records[0].operation == "SqliteStatement");
+    assert(capture->records[0].sqlite_code == SQLITE_ERROR);
+
+    assert(test_db.db->addRecipe(createRecipe("Stew", "Ann", {"Beef", "Beef"}, {})) == -1);
+    assert(std::any_of(capture->records.begin(), capture->records.end(), [](const LogRecord& record) {
+        return record.sqlite_code == SQLITE_CONSTRAINT_PRIMARYKEY;
+    }));
+
+    // Records below the level are dropped before they are formatted
+    capture->records.clear();
+    setLogLevel(LogLevel::Off);
+    assert(!test_db.db->deleteRecipe(-5));
+    setLogLevel(LogLevel::Error);
+    LogLine(LogLevel::Warning, "test") << "not logged";
+    assert(capture->records.empty());
+    setLogLevel(LogLevel::Warning);
+
+    // The ring buffer accepts concurrent producers; what does not fit is counted, never blocked on
+    auto inner = std::make_shared<CapturingSink>();
+    auto ring = std::make_shared<AsyncRingSink>(inner, 8);
+    setLogSink(ring);
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; ++t) {
+        producers.emplace_back([] {
+            for (int i = 0; i < 1000; ++i) {
+                LogLine(LogLevel::Error, "producer").recipe(i) << "record " << i;
+            }
+        });
+    }
+    for (std::thread& producer : producers) producer.join();
+    flushLog();
+    assert(inner->records.size() + ring->dropped() == 4000);
+    assert(!inner->records.empty() && inner->records[0].message.rfind("record ", 0) == 0);
+
+    setLogSink(previous);
+    std::cout << "Logging Tests Passed!" << std::endl;
+}
+
+void testIngredientParser() {
+    std::cout << "\n--- Testing Ingredient Parser ---" << std::endl;
+    RecipeIngredientInfo info;
+
+    // Mixed fraction, unit alias, comma and parenthetical notes, optional marker
+    assert(parseIngredientLine("1 1/2 cups all-purpose flour, sifted (optional)", info));
+    assert(info.name == "all-purpose flour" && info.quantity == 1.5 && info.unit == "cup");
+    assert(info.notes == "sifted" && info.optional);
+
+    // Unicode vulgar fractions, attached or separated
+    assert(parseIngredientLine("½ tsp salt", info) && info.quantity == 0.5 && info.unit == "tsp" && info.name == "salt");
+    assert(parseIngredientLine("1¾ Tablespoons olive oil", info) && info.quantity == 1.75 && info.unit == "tbsp");
+    assert(parseIngredientLine("2 ⅓ c. milk", info) && std::abs(info.quantity - 7.0 / 3) < 1e-9 && info.unit == "cup");
+    assert(parseIngredientLine("1⁄2 lb. ground beef", info) && info.quantity == 0.5 && info.unit == "lb" && info.name == "ground beef");
+
+    // Ranges keep the lower bound and note the upper one
+    ParsedIngredientLine parsed;
+    assert(parseIngredientLine("2-3 cloves garlic, minced", parsed));
+    assert(parsed.has_quantity && parsed.quantity == 2 && parsed.quantity_max == 3 && parsed.unit == "clove" && parsed.name == "garlic");
+    assert(parseIngredientLine("2 to 3 cloves garlic, minced", info) && info.quantity == 2 && info.notes == "minced, up to 3");
+    assert(parseIngredientLine("1 – 1.5 kg potatoes", parsed) && parsed.quantity == 1 && parsed.quantity_max == 1.5 && parsed.unit == "kg");
+
+    // A hyphen before a proper fraction joins a mixed number; a range must end above its start
+    assert(parseIngredientLine("1-1/2 cups sugar", parsed) && parsed.quantity == 1.5 && !parsed.isRange() && parsed.unit == "cup" && parsed.name == "sugar");
+    assert(parseIngredientLine("2-1/4 tsp yeast", parsed) && parsed.quantity == 2.25 && !parsed.isRange() && parsed.unit == "tsp");
+    assert(parseIngredientLine("1/2-3/4 cup water", parsed) && parsed.quantity == 0.5 && parsed.quantity_max == 0.75);
+    assert(parseIngredientLine("3-2 eggs", parsed) && parsed.quantity == 3 && !parsed.isRange());
+
+    // Case-sensitive single letters, two-word units, attached units, "of", number words
+    assert(parseIngredientLine("1 T butter", info) && info.unit == "tbsp");
+    assert(parseIngredientLine("1 t vanilla", info) && info.unit == "tsp");
+    assert(parseIngredientLine("8 fl. oz. cream", info) && info.unit == "fl oz" && info.name == "cream");
+    assert(parseIngredientLine("200g dark chocolate", info) && info.quantity == 200 && info.unit == "g" && info.name == "dark chocolate");
+    assert(parseIngredientLine("A pinch of nutmeg", info) && info.quantity == 1 && info.unit == "pinch" && info.name == "nutmeg");
+    assert(parseIngredientLine("two large eggs, beaten", info) && info.quantity == 2 && info.unit.empty() && info.name == "large eggs");
+
+    // Package sizes, leading markers and lines without an amount
+    assert(parseIngredientLine("1 (14 oz) can diced tomatoes, drained", info));
+    assert(info.unit == "can" && info.name == "diced tomatoes" && info.notes == "14 oz, drained");
+    assert(parseIngredientLine("Optional: fresh parsley (for garnish)", info));
+    assert(info.optional && info.name == "fresh parsley" && info.notes == "for garnish" && info.quantity == 0);
+    assert(parseIngredientLine("salt to taste", parsed) && !parsed.has_quantity && parsed.quantity == 0 && !parsed.isRange());
+    assert(parseIngredientLine("- Salt and pepper, to taste", info) && info.name == "Salt and pepper" && info.notes == "to taste");
+    assert(parseIngredientLine("3 cloves", info) && info.name == "cloves" && info.unit.empty() && info.quantity == 3);
+    assert(!parseIngredientLine("   ", info));
+    assert(!parseIngredientLine("(optional)", parsed) && parsed.optional);
+
+    // Blocks of lines skip blanks and handle CRLF
+    std::vector<RecipeIngredientInfo> lines = parseIngredientLines("1 cup rice\r\n\r\n2 eggs (optional)\n");
+    assert(lines.size() == 2 && lines[0].name == "rice" && lines[1].name == "eggs" && lines[1].optional);
+    std::cout << "Ingredient Parser Tests Passed!" << std::endl;
+}
+
+void testRecipeImporter() {
+    std::cout << "\n--- Testing Recipe Importer ---" << std::endl;
+    TestDB test_db("test_import.db");
+
+    assert(parseIsoDuration("PT1H30M") == 90);
+    assert(parseIsoDuration("P1DT2H") == 26 * 60);
+    assert(parseIsoDuration("PT45S") == 1);
+    assert(!parseIsoDuration("90 minutes") && !parseIsoDuration("P"));
+
+    // A failing recipe in a batch is skipped; the others are committed
+    std::vector<long long> ids = test_db.db->addRecipes({
+        createRecipe("Soup", "Ann", {"Leek"}, {"soup"}),
+        createRecipe("Broken", "Ann", {"Beef", "Beef"}, {}),
+        createRecipe("", "Ann", {}, {}),
+        createRecipe("Salad", "Bo", {"Leek", "Cress"}, {}),
+    });
+    assert(ids.size() == 4 && ids[0] > 0 && ids[1] == -1 && ids[2] == -1 && ids[3] > 0);
+    assert(test_db.db->getRecipeById(ids[3])->ingredients.size() == 2);
+    assert(test_db.db->emptyDatabase());
+
+    // A directory of pages: @graph, arrays of types, HowToSection instructions, a broken block and a page without recipes
+    std::filesystem::path dir = "test_import_pages";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir / "nested");
+    auto write = [&](const std::filesystem::path& path, const std::string& html) {
+        std::ofstream(dir / path) << html;
+    };
+    write("pancakes.html", R"(<html><head><script type="application/ld+json">
+        {"@context": "https://schema.org", "@graph": [{"@type": "WebPage", "name": "Page"},
+         {"@type": ["Recipe"], "name": "Fluffy Pancakes &amp; Syrup", "author": {"@type": "Person", "name": "Mia"},
+          "url": "https://cooking.example.com/pancakes", "prepTime": "PT10M", "totalTime": "PT25M", "recipeYield": "4 servings",
+          "recipeIngredient": ["1 1/2 cups flour, sifted", "2 tbsp sugar", "&frac12; tsp salt", "1 cup flour"],
+          "recipeInstructions": [{"@type": "HowToSection", "name": "Batter", "itemListElement": [
+              {"@type": "HowToStep", "text": "Whisk the <b>dry</b> ingredients."}, {"@type": "HowToStep", "text": "Add milk."}]},
+              "Fry until golden."],
+          "keywords": "Breakfast, Sweet", "recipeCuisine": ["American"]}]}
+        </script></head><body></body></html>)");
+    write("nested/stew.HTM", R"(<script type='application/ld+json'>[{"@type": "Recipe", "name": "Stew",
+        "author": [{"name": "Al"}, {"name": "Bea"}], "cookTime": "PT2H", "recipeYield": 6,
+        "recipeIngredient": ["2-3 carrots", "salt, to taste"], "recipeInstructions": "Chop.\nSimmer."}]</script>
+        <script type="application/ld+json">{"@type": "Recipe", "name": </script>)");
+    write("about.html", "<html><script>var x = 1;</script></html>");
+    write("notes.txt", R"(<script type="application/ld+json">{"@type": "Recipe", "name": "Ignored"}</script>)");
+
+    ImportOptions options;
+    options.threads = 2;
+    options.batch_size = 1;
+    std::optional<ImportReport> report = importRecipePages(*test_db.db, dir, options);
+    assert(report && report->pages == 3 && report->pages_with_recipes == 2 && report->invalid_blocks == 1);
+    assert(report->recipes_found == 2 && report->recipes_added == 2);
+
+    SearchData criteria;
+    criteria.exact_name = "Fluffy Pancakes & Syrup";
+    std::vector<long long> found = test_db.db->search(criteria);
+    assert(found.size() == 1);
+    RecipeData pancakes = *test_db.db->getRecipeById(found[0]);
+    assert(pancakes.author == "Mia" && pancakes.source == "cooking.example.com" && pancakes.servings == 4);
+    assert(pancakes.prep_time_minutes == 10 && pancakes.cook_time_minutes == 15);
+    assert(pancakes.ingredients.size() == 3);
+    assert(pancakes.instructions.size() == 3 && pancakes.instructions[0] == "Whisk the dry ingredients.");
+    assert(std::set<std::string>(pancakes.tags.begin(), pancakes.tags.end()) == std::set<std::string>({"breakfast", "sweet", "american"}));
+
+    criteria.exact_name = "Stew";
+    found = test_db.db->search(criteria);
+    assert(found.size() == 1);
+    RecipeData stew = *test_db.db->getRecipeById(found[0]);
+    assert(stew.author == "Al, Bea" && stew.cook_time_minutes == 120 && stew.servings == 6 && stew.instructions.size() == 2);
+    // Lines without an amount are stored with the library's quantity of 0
+    auto salt = std::find_if(stew.ingredients.begin(), stew.ingredients.end(), [](const RecipeIngredientInfo& i) { return i.name == "salt"; });
+    assert(salt != stew.ingredients.end() && salt->quantity == 0 && salt->notes == "to taste");
+
+    assert(!importRecipePages(*test_db.db, dir / "missing"));
+    std::filesystem::remove_all(dir);
+
+    // A page with more recipes than the queue holds is drained batch by batch while it is being queued
+    std::filesystem::create_directories(dir);
+    std::string graph;
+    for (int i = 0; i < 5; ++i) {
+        graph += std::string(i ? ", " : "") + R"({"@type": "Recipe", "name": "Bulk )" + std::to_string(i) + R"(", "recipeIngredient": ["1 leek"]})";
+    }
+    write("bulk.html", R"(<script type="application/ld+json">{"@graph": [)" + graph + "]}</script>");
+    options.threads = 1;
+    options.batch_size = 2;
+    options.queue_capacity = 2;
+    report = importRecipePages(*test_db.db, dir, options);
+    assert(report && report->recipes_found == 5 && report->recipes_added == 5);
+    std::filesystem::remove_all(dir);
+    std::cout << "Recipe Importer Tests Passed!" << std::endl;
+}
+
+void testSearchBundle() {
+    std::cout << "\n--- Testing Search Bundle ---" << std::endl;
+    TestDB test_db("test_bundle.db");
+    Database* db = test_db.db;
+
+    db->addRecipe(createRecipe("Tomato Soup", "Ann Lee", {"Tomato", "Onion", "Butter"}, {"soup", "vegetarian"}, 30));
+    db->addRecipe(createRecipe("Beef Stew", "Bob", {"Beef", "Onion", "Carrot"}, {"dinner"}, 120, true));
+    db->addRecipe(createRecipe("Garlic Butter Pasta", "Ann Lee", {"Pasta", "Unsalted Butter", "Garlic"}, {"dinner", "quick"}, 15));
+    db->addRecipe(createRecipe("Carrot Cake", "Cy", {"Carrot", "Flour", "Sugar"}, {"dessert", "baking"}, 45, true));
+    RecipeData salad = createRecipe("Tomatoes on Toast", "Bob", {"Tomato", "Bread"}, {"quick", "vegetarian"}, 5);
+    salad.source = "Cafe";
+    salad.servings = 1;
+    db->addRecipe(salad);
+    assert(db->addIngredientRelation("Butter", "Unsalted Butter"));
+
+    std::string bundle_path = "test_bundle.bundle";
+    std::optional<SearchBundleStats> stats = db->exportSearchBundle(bundle_path);
+    assert(stats && stats->recipes == 5 && stats->total_bytes == std::filesystem::file_size(bundle_path));
+    SearchBundle bundle;
+    assert(bundle.load(bundle_path) && bundle.recipeCount() == 5);
+
+    // Every non-text filter gives the same result as the database
+    std::vector<SearchData> queries(16);
+    queries[1].tags = {"dinner"};
+    queries[2].tags = {"quick", "vegetarian"};
+    queries[3].exclude_tags = {"dinner"};
+    queries[4].ingredients = {"Onion"};
+    queries[5].ingredients = {"Butter"};
+    queries[6].ingredients = {"Butter"};
+    queries[6].expand_ingredients = true;
+    queries[7].exclude_ingredients = {"Butter"};
+    queries[7].expand_exclude_ingredients = true;
+    queries[8].cook_time_range = {10, 60};
+    queries[9].is_favorite = true;
+    queries[10].exact_author = "Ann Lee";
+    queries[11].source = "Cafe";
+    queries[12].servings_range = {2, 8};
+    queries[12].sort_by = SortKey::CookTime;
+    queries[13].sort_by = SortKey::Name;
+    queries[13].sort_direction = SortDirection::Descending;
+    queries[13].limit = 3;
+    queries[14].sort_by = SortKey::TotalTime;
+    queries[14].sort_direction = SortDirection::Descending;
+    queries[15].exact_name = "Beef Stew";
+    for (const SearchData& query : queries) {
+        std::vector<long long> expected = db->search(query);
+        // Without a sort key the database returns matches in whatever order its plan produces
+        if (query.sort_by == SortKey::None) std::sort(expected.begin(), expected.end());
+        assert(bundle.search(query) == expected);
+    }
+
+    // Text filters match words, with plurals folded and '*' for prefixes
+    SearchData text;
+    text.keywords = "tomato";
+    assert(bundle.search(text).size() == 2);
+    text.keywords = "carrot cake";
+    assert(bundle.search(text) == std::vector<long long>({4}));
+    text.keywords = "garl*";
+    assert(bundle.search(text) == std::vector<long long>({3}));
+    text = {};
+    text.author = "ann";
+    assert(bundle.search(text) == db->search(text));
+    text = {};
+    text.name = "stew";
+    assert(bundle.search(text) == std::vector<long long>({2}));
+
+    std::optional<RecipeSummary> summary = bundle.summary(5);
+    assert(summary && summary->name == "Tomatoes on Toast" && summary->source == "Cafe" && summary->servings == 1);
+    assert(summary->date_added > 0 && !bundle.summary(99));
+
+    // Damaged files are rejected
+    std::filesystem::resize_file(bundle_path, 40);
+    assert(!bundle.load(bundle_path) && bundle.recipeCount() == 0);
+
+    // So are posting lists naming documents past the recipe count. The tag dictionary is the tenth section; its
+    // header entry is a little-endian offset after the magic, version, recipe count and section count.
+    assert(db->exportSearchBundle(bundle_path));
+    std::string bytes;
+    {
+        std::ifstream in(bundle_path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    size_t header_entry = 8 + 3 * 4 + 9 * 2 * 4;
+    size_t pos = 0;
+    for (size_t i = 0; i < 4; ++i) pos |= static_cast<size_t>(static_cast<unsigned char>(bytes[header_entry + i])) << (8 * i);
+    size_t tag_count = static_cast<unsigned char>(bytes[pos++]);
+    assert(tag_count == 6);
+    for (size_t i = 0; i < tag_count; ++i) pos += 1 + static_cast<unsigned char>(bytes[pos]) + 2;   // Key length, key, offset, count
+    bytes[pos] = 5;     // First posting of "baking" becomes document 5 of 5
+    {
+        std::ofstream out(bundle_path, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    }
+    assert(!bundle.load(bundle_path) && bundle.recipeCount() == 0);
+    std::filesystem::remove(bundle_path);
+    std::cout << "Search Bundle Tests Passed!" << std::endl;
+}
+
+void testCallTrace() {
+    std::cout << "\n--- Testing Call Trace Recording and Replay ---" << std::endl;
+    TestDB recorded("test_trace_recorded.db");
+    TestDB replayed("test_trace_replayed.db");
+    const std::string trace_path = "test_trace.trace";
+
+    // Record a session of writes and reads on one connection
+    std::shared_ptr<TraceRecorder> recorder = TraceRecorder::create(trace_path);
+    assert(recorder);
+    recorded.db->setTraceRecorder(recorder);
+    long long soup = recorded.db->addRecipe(createRecipe("Tomato Soup", "Ann", {"Tomato", "Onion"}, {"soup"}));
+    recorded.db->addRecipes({createRecipe("Beef Stew", "Bob", {"Beef", "Onion"}, {"dinner"}, 90),
+                             createRecipe("Salad", "Cy", {"Lettuce"}, {"quick"}, 0)});
+    SearchData criteria;
+    criteria.ingredients = {"Onion"};
+    criteria.sort_by = SortKey::CookTime;
+    assert(recorded.db->search(criteria).size() == 2);
+    assert(recorded.db->searchExpression(SearchExpression::negate(SearchExpression::leaf(criteria))).size() == 1);
+    CoverageQuery coverage;
+    coverage.ingredients = {"Tomato", "Onion"};
+    assert(recorded.db->searchByCoverage(coverage).size() == 2);
+    assert(recorded.db->getRecipeById(soup)->name == "Tomato Soup");
+    assert(recorded.db->deleteRecipe(soup));
+    assert(!recorded.db->getRecipeById(soup).has_value());
+    recorded.db->setTraceRecorder(nullptr);
+    recorded.db->search({});    // Not recorded
+    assert(recorder->eventCount() == 8);
+    recorder.reset();
+
+    std::optional<std::vector<TraceEvent>> events = readTrace(trace_path);
+    assert(events && events->size() == 8);
+    assert((*events)[0].call == TraceCall::AddRecipe && (*events)[1].call == TraceCall::AddRecipes);
+    assert((*events)[3].call == TraceCall::SearchExpression && (*events)[7].call == TraceCall::GetRecipeById);
+    for (size_t i = 1; i < events->size(); ++i) assert((*events)[i].start_us >= (*events)[i - 1].start_us);
+
+    // Replaying on an identical database reproduces every result
+    for (const TraceEvent& event : *events) {
+        std::optional<uint64_t> hash = replayTraceEvent(*replayed.db, event);
+        assert(hash && *hash == event.result_hash);
+    }
+    assert(replayed.db->search({}).size() == 2);
+
+    // Replaying on a database with different contents diverges
+    TraceEvent search = (*events)[2];
+    replayed.db->addRecipe(createRecipe("Onion Tart", "Di", {"Onion"}, {}));
+    assert(replayTraceEvent(*replayed.db, search) != search.result_hash);
+
+    // Corrupt arguments and files are rejected
+    search.arguments.pop_back();
+    assert(!replayTraceEvent(*replayed.db, search));
+    {
+        std::ofstream truncated(trace_path, std::ios::binary | std::ios::app);
+        truncated << '\x06';
+    }
+    assert(!readTrace(trace_path));
+    std::filesystem::remove(trace_path);
+
+    std::cout << "Call Trace Recording and Replay Tests Passed!" << std::endl;
+}
+
+void testMemoryReport() {
+    std::cout << "\n--- Testing Memory Report and Limits ---" << std::endl;
+    TestDB test_db("test_memory.db");
+    Database* db = test_db.db;
+
+    std::vector<long long> ids;
+    for (int i = 0; i < 40; ++i) {
+        ids.push_back(db->addRecipe(createRecipe("Dish " + std::to_string(i), "Cook", {"Shared", "Ingredient number " + std::to_string(i)}, {"tag " + std::to_string(i % 7)})));
+    }
+    assert(db->search({}).size() == 40);
+
+    std::optional<MemoryReport> report = db->memoryReport();
+    assert(report && report->process.memory_used > 0 && report->process.memory_highwater >= report->process.memory_used);
+    assert(report->connection.page_cache > 0 && report->connection.schema > 0);
+    assert(report->connection.page_cache_limit == 2000 * 1024);    // SQLite's default cache_size of -2000
+    assert(report->library.name_cache_entries == 48 && report->library.name_cache_bytes > 0);
+    assert(report->connectionBytes() > report->connection.page_cache);
+
+    // Per-connection bounds: a smaller page cache and a name cache that has to evict
+    ConnectionMemoryLimits limits;
+    limits.page_cache_bytes = 256 * 1024;
+    limits.name_cache_bytes = 4096;
+    assert(db->setMemoryLimits(limits));
+    for (int i = 40; i < 80; ++i) {
+        ids.push_back(db->addRecipe(createRecipe("Dish " + std::to_string(i), "Cook", {"Shared", "Ingredient number " + std::to_string(i)}, {"extra"})));
+    }
+    report = db->memoryReport();
+    assert(report->connection.page_cache_limit == 256 * 1024);
+    assert(report->library.name_cache_bytes <= 4096 && report->library.name_cache_evictions > 0);
+    std::optional<RecipeData> recipe = db->getRecipeById(ids[79]);
+    assert(recipe && recipe->ingredients.size() == 2 && recipe->ingredients[1].name == "Ingredient number 79");
+
+    // Limits survive reopening; invalid ones are rejected
+    db->close();
+    assert(db->open(test_db.db_path));
+    assert(db->memoryReport()->connection.page_cache_limit == 256 * 1024);
+    limits.pressure_threshold = 0;
+    assert(!db->setMemoryLimits(limits));
+
+    // Near the process soft limit the connection sheds its caches but keeps working
+    assert(!setProcessHeapLimits(64 * 1024 * 1024, 32 * 1024 * 1024));
+    assert(setProcessHeapLimits(1, -1));
+    assert(readSqliteHeapStats().soft_heap_limit == 1);
+    SearchData criteria;
+    criteria.tags = {"extra"};
+    assert(db->search(criteria).size() == 40);
+    report = db->memoryReport();
+    assert(report->library.pressure_releases > 0);
+    // The similarity indexes are not on SQLite's heap, so the pressure leaves them loaded
+    assert(!db->similarRecipes(ids[0], 3).empty());
+    db->similarRecipesByText(ids[0], 3);
+    assert(db->search(criteria).size() == 40);
+    assert(db->memoryReport()->library.signature_bytes > 0 && db->memoryReport()->library.text_index_bytes > 0);
+    assert(db->addRecipe(createRecipe("Under pressure", "Cook", {"Shared"}, {"extra"})) > 0);
+    assert(setProcessHeapLimits(0, 0));
+    assert(readSqliteHeapStats().soft_heap_limit == 0);
+
+    assert(db->releaseMemory() >= 0);
+    assert(db->memoryReport()->library.name_cache_entries == 0);
+
+    std::cout << "Memory Report and Limits Tests Passed!" << std::endl;
+}
+
+void testSqliteMemoryConfig() {
+    std::cout << "\n--- Testing SQLite Memory Configuration ---" << std::endl;
+    SqliteMemoryConfig config;
+    config.allocator = SqliteAllocator::Pooled;
+    config.page_cache_slots = 64;
+    config.lookaside_slot_size = 256;
+    config.lookaside_slots = 32;
+
+    // Refused while a connection is open
+    {
+        TestDB test_db("test_sqlite_memory.db");
+        assert(!Database::configureSqliteMemory(config));
+        assert(currentSqliteMemoryConfig().allocator == SqliteAllocator::System);
+    }
+
+    SqliteMemoryConfig invalid = config;
+    invalid.page_size = 1000;
+    assert(!Database::configureSqliteMemory(invalid));
+
+    assert(Database::configureSqliteMemory(config));
+    assert(currentSqliteMemoryConfig().page_cache_slots == 64);
+    {
+        TestDB test_db("test_sqlite_memory.db");
+        Database* db = test_db.db;
+        long long id = db->addRecipe(createRecipe("Pooled Pie", "Cook", {"Apple", "Flour"}, {"baking"}));
+        assert(id > 0);
+        SearchData query;
+        query.tags = {"baking"};
+        assert(db->search(query) == std::vector<long long>{id});
+        std::optional<RecipeData> recipe = db->getRecipeById(id);
+        assert(recipe && recipe->name == "Pooled Pie" && recipe->ingredients.size() == 2);
+
+        PooledAllocatorStats stats = pooledAllocatorStats();
+        assert(stats.pool_hits > 0 && stats.pool_misses > 0);
+        std::optional<MemoryReport> report = db->memoryReport();
+        assert(report && report->process.memory_used > 0);
+    }
+
+    // Threads that used the pool can exit, and SQLite can still allocate on them afterwards
+    std::thread worker([] {
+        TestDB thread_db("test_sqlite_memory_thread.db");
+        assert(thread_db.db->addRecipe(createRecipe("Thread Tart", "Cook", {"Pear"}, {"baking"})) > 0);
+    });
+    worker.join();
+
+    // Back to SQLite's defaults, with blocks from the pool still live
+    void* kept = sqlite3_malloc(40);
+    void* kept_large = sqlite3_malloc(5000);
+    assert(kept && kept_large);
+    assert(Database::configureSqliteMemory(SqliteMemoryConfig()));
+    assert(currentSqliteMemoryConfig().allocator == SqliteAllocator::System);
+    assert(pooledAllocatorStats().pool_hits == 0);
+    assert(sqlite3_msize(kept) == 64);
+    kept = sqlite3_realloc(kept, 100);
+    assert(kept && sqlite3_msize(kept) >= 100);
+    void* system_block = sqlite3_malloc(40);
+    sqlite3_free(kept);
+    sqlite3_free(kept_large);
+
+    // And blocks from the system allocator stay valid under the pool
+    assert(Database::configureSqliteMemory(config));
+    sqlite3_free(system_block);
+    assert(Database::configureSqliteMemory(SqliteMemoryConfig()));
+    std::cout << "SQLite Memory Configuration Tests Passed!" << std::endl;
+}
+
+
+void testListingIndexes() {
+    std::cout << "\n--- Testing Listing Indexes and Summaries ---" << std::endl;
+    TestDB test_db("test_listing.db");
+    Database* db = test_db.db;
+
+    std::vector<long long> ids;
+    for (int i = 0; i < 12; ++i) {
+        RecipeData recipe = createRecipe("Listed " + std::to_string(i), i % 3 == 0 ? "Ada" : "Bo", {"Salt"}, {i % 2 ? "odd" : "even"}, 10 + i, i % 4 == 0);
+        recipe.source = i < 6 ? "Book" : "Blog";
+        recipe.source_url = "https://example.com/" + std::to_string(i);
+        ids.push_back(db->addRecipe(recipe));
+    }
+
+    // Favorites: 0, 4 and 8, with every summary column filled in from the index
+    SearchData favorites;
+    favorites.is_favorite = true;
+    favorites.sort_by = SortKey::CookTime;
+    favorites.sort_direction = SortDirection::Descending;
+    std::vector<RecipeSummary> summaries = db->searchSummaries(favorites);
+    assert(summaries.size() == 3);
+    assert(summaries[0].recipe_id == ids[8] && summaries[1].recipe_id == ids[4] && summaries[2].recipe_id == ids[0]);
+    assert(summaries[0].name == "Listed 8" && summaries[0].author == "Bo" && summaries[0].source == "Blog");
+    assert(summaries[0].source_url == "https://example.com/8" && summaries[0].cook_time_minutes == 18);
+    assert(summaries[0].is_favorite && summaries[0].servings == 4 && summaries[0].date_added > 0);
+    assert((db->search(favorites) == std::vector<long long>{ids[8], ids[4], ids[0]}));
+
+    // Author and source listings, alone and combined with other criteria and a limit
+    SearchData by_author;
+    by_author.exact_author = "Ada";
+    by_author.sort_by = SortKey::DateAdded;
+    assert((db->search(by_author) == std::vector<long long>{ids[0], ids[3], ids[6], ids[9]}));
+    by_author.is_favorite = true;
+    by_author.sort_by = SortKey::Name;
+    assert((db->search(by_author) == std::vector<long long>{ids[0]}));
+
+    SearchData by_source;
+    by_source.source = "Blog";
+    by_source.tags = {"odd"};
+    by_source.sort_by = SortKey::CookTime;
+    by_source.limit = 2;
+    summaries = db->searchSummaries(by_source);
+    assert(summaries.size() == 2 && summaries[0].recipe_id == ids[7] && summaries[1].recipe_id == ids[9]);
+    by_source.keywords = "Listed";
+    by_source.sort_by = SortKey::Relevance;
+    by_source.limit = 0;
+    assert(db->searchSummaries(by_source).size() == 3);
+
+    // Summaries of queries without a listing term come from the table
+    SearchData everything;
+    everything.sort_by = SortKey::Name;
+    assert(db->searchSummaries(everything).size() == 12);
+
+    // A database from before the listing indexes gains them on its next open
+    db->close();
+    sqlite3* raw = nullptr;
+    assert(sqlite3_open(test_db.db_path.c_str(), &raw) == SQLITE_OK);
+    assert(sqlite3_exec(raw, "DROP INDEX idx_recipes_author_listing; DROP INDEX idx_recipes_source_listing; "
+                             "DROP INDEX idx_recipes_favorites; PRAGMA user_version = 1;", nullptr, nullptr, nullptr) == SQLITE_OK);
+    sqlite3_close(raw);
+    assert(db->open(test_db.db_path));
+    assert(sqlite3_open(test_db.db_path.c_str(), &raw) == SQLITE_OK);
+    sqlite3_stmt* stmt = nullptr;
+    assert(sqlite3_prepare_v2(raw, "SELECT count(*) FROM sqlite_master WHERE type = 'index' AND name IN "
+                                   "('idx_recipes_author_listing', 'idx_recipes_source_listing', 'idx_recipes_favorites');", -1, &stmt, nullptr) == SQLITE_OK);
+    assert(sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) == 3);
+    sqlite3_finalize(stmt);
+    sqlite3_close(raw);
+    assert(db->searchSummaries(favorites).size() == 3);
+
+    std::cout << "Listing Indexes and Summaries Tests Passed!" << std::endl;
+}
+
+
+void testMealPlanner() {
+    std::cout << "\n--- Testing Meal Planner ---" << std::endl;
+    TestDB test_db("test_meal_plan.db");
+    Database* db = test_db.db;
+
+    // Three dinners share a pantry of four ingredients; the others need their own
+    RecipeData tomato_pasta = createRecipe("Tomato Pasta", "Cook", {"Pasta", "Tomato", "Garlic"}, {"dinner"}, 20);
+    tomato_pasta.ingredients.push_back({"Parmesan", 1, "cup", "", true});
+    long long tomato = db->addRecipe(tomato_pasta);
+    long long pesto = db->addRecipe(createRecipe("Pesto Pasta", "Cook", {"Pasta", "Tomato", "Basil"}, {"dinner"}, 15));
+    long long aglio = db->addRecipe(createRecipe("Basil Aglio", "Cook", {"Pasta", "Garlic", "Basil"}, {"dinner"}, 10));
+    long long curry = db->addRecipe(createRecipe("Curry", "Cook", {"Rice", "Coconut Milk", "Chili"}, {"dinner", "spicy"}, 30));
+    db->addRecipe(createRecipe("Stew", "Cook", {"Beef", "Carrot", "Potato", "Onion"}, {"dinner"}, 120));
+    long long salad = db->addRecipe(createRecipe("Salad", "Cook", {"Lettuce", "Cucumber"}, {"dinner"}, 0));
+    db->addRecipe(createRecipe("Porridge", "Cook", {"Oats"}, {"breakfast"}, 5));
+
+    MealPlanQuery query;
+    query.meals = 3;
+    query.filters.tags = {"dinner"};
+    query.time_budget = std::chrono::milliseconds(0);
+    query.threads = 1;
+    std::optional<MealPlan> plan = db->planMeals(query);
+    assert(plan && plan->candidates == 6 && plan->plans_evaluated > 0);
+    assert((plan->recipe_ids == std::vector<long long>{tomato, pesto, aglio}));
+    assert((plan->shopping_list == std::vector<std::string>{"Basil", "Garlic", "Pasta", "Tomato"}));
+    assert(plan->total_ingredients == 9 && plan->shared_ingredients == 5);
+
+    // Several threads with a time budget find an equally short list
+    query.threads = 4;
+    query.time_budget = std::chrono::milliseconds(20);
+    plan = db->planMeals(query);
+    assert(plan && plan->recipe_ids.size() == 3 && plan->shopping_list.size() == 4);
+
+    // Pantry items are not bought; constraints restrict the candidates
+    query.pantry = {"Pasta", "Tomato"};
+    plan = db->planMeals(query);
+    assert((plan->shopping_list == std::vector<std::string>{"Basil", "Garlic"}));
+    query.pantry.clear();
+    query.filters.exclude_ingredients = {"Pasta"};
+    query.filters.cook_time_range = {0, 60};
+    query.meals = 2;
+    plan = db->planMeals(query);
+    assert(plan && plan->candidates == 2);
+    assert((plan->recipe_ids == std::vector<long long>{curry, salad}) && plan->shopping_list.size() == 5);
+
+    // Asking for more meals than there are candidates returns them all
+    query.meals = 10;
+    plan = db->planMeals(query);
+    assert(plan && plan->recipe_ids.size() == 2);
+    query.filters = {};
+    query.filters.tags = {"none"};
+    plan = db->planMeals(query);
+    assert(plan && plan->recipe_ids.empty() && plan->shopping_list.empty());
+
+    std::cout << "Meal Planner Tests Passed!" << std::endl;
+}
+
+
+void testSimilarRecipes() {
+    std::cout << "\n--- Testing Similar Recipes ---" << std::endl;
+    TestDB test_db("test_similar.db");
+    Database* db = test_db.db;
+
+    long long base = db->addRecipe(createRecipe("Base", "Cook", {"Pasta", "Tomato", "Garlic", "Basil"}, {"dinner"}));
+    long long close = db->addRecipe(createRecipe("Close", "Cook", {"Pasta", "Tomato", "Garlic"}, {"dinner"}));
+    long long middle = db->addRecipe(createRecipe("Middle", "Cook", {"Pasta", "Tomato", "Onion"}, {"dinner"}));
+    long long far = db->addRecipe(createRecipe("Far", "Cook", {"Pasta", "Salt"}, {"dinner"}));
+    db->addRecipe(createRecipe("Unrelated", "Cook", {"Rice", "Salt"}, {"dinner"}));
+    long long twin = db->addRecipe(createRecipe("Twin", "Cook", {"Basil", "Garlic", "Pasta", "Tomato"}, {"dessert"}));
+
+    std::vector<SimilarRecipe> similar = db->similarRecipes(base, 3);
+    assert(similar.size() == 3);
+    assert(similar[0].recipe_id == twin && similar[0].similarity == 1.0 && similar[0].shared_ingredients == 4);
+    assert(similar[1].recipe_id == close && std::abs(similar[1].similarity - 0.75) < 1e-9);
+    assert(similar[2].recipe_id == middle && std::abs(similar[2].similarity - 0.4) < 1e-9 && similar[2].shared_ingredients == 2);
+
+    // Only recipes sharing an ingredient are returned; filters restrict them
+    assert(db->similarRecipes(base, 10).size() == 4);
+    SearchData filters;
+    filters.exclude_tags = {"dessert"};
+    similar = db->similarRecipes(base, 10, filters);
+    assert(similar.size() == 3 && similar[0].recipe_id == close && similar[2].recipe_id == far);
+
+    // Rarity weighting: sharing the rare Basil counts for more than sharing the common Pasta
+    similar = db->similarRecipes(base, 10, {}, SimilarityMeasure::WeightedJaccard);
+    assert(similar[0].recipe_id == twin && std::abs(similar[0].similarity - 1.0) < 1e-6);
+    assert(similar.back().recipe_id == far);
+    assert(db->similarRecipes(-5, 3).empty() && db->similarRecipes(base, 0).empty());
+
+    // Changes by this connection and by others are picked up
+    long long copy = db->addRecipe(createRecipe("Copy", "Cook", {"Pasta", "Tomato", "Garlic", "Basil"}, {"dinner"}));
+    similar = db->similarRecipes(base, 2);
+    assert(similar[0].recipe_id == twin && similar[1].recipe_id == copy);
+    // Weighted scores of identical sets are exactly 1, so the tie still goes to the lower recipe_id
+    similar = db->similarRecipes(base, 2, {}, SimilarityMeasure::WeightedJaccard);
+    assert(similar[0].recipe_id == twin && similar[0].similarity == 1.0 && similar[1].recipe_id == copy && similar[1].similarity == 1.0);
+    {
+        Database other;
+        assert(other.open(test_db.db_path));
+        assert(other.deleteRecipe(twin) && other.deleteRecipe(copy));
+    }
+    assert(db->similarRecipes(base, 1)[0].recipe_id == close);
+
+    // Ingredient edits by another connection are merged in, next to writes that leave the links alone
+    sqlite3* raw = nullptr;
+    assert(sqlite3_open(test_db.db_path.c_str(), &raw) == SQLITE_OK);
+    auto exec = [raw](const std::string& sql) { assert(sqlite3_exec(raw, sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK); };
+    auto ingredient = [](const std::string& name) { return "(SELECT ingredient_id FROM ingredients WHERE name COLLATE NOCASE = '" + name + "')"; };
+    exec("UPDATE recipes SET is_favorite = 1;");
+    exec("INSERT INTO recipe_ingredients (recipe_id, ingredient_id) SELECT " + std::to_string(far) +
+         ", ingredient_id FROM ingredients WHERE name COLLATE NOCASE IN ('Tomato', 'Garlic', 'Basil');");
+    similar = db->similarRecipes(base, 1);
+    assert(similar[0].recipe_id == far && std::abs(similar[0].similarity - 0.8) < 1e-9);
+    exec("DELETE FROM recipe_ingredients WHERE recipe_id = " + std::to_string(far) + " AND ingredient_id = " + ingredient("Salt") + ";");
+    assert(db->similarRecipes(base, 1)[0].similarity == 1.0);
+
+    // Entries trimmed from the change log before this connection applied them make it reload
+    exec("DELETE FROM recipe_ingredients WHERE recipe_id = " + std::to_string(far) + " AND ingredient_id IN (" + ingredient("Basil") + ", " +
+         ingredient("Garlic") + ");");
+    sqlite3_close(raw);
+    MaintenanceOptions trim;
+    trim.ingredient_changes_kept = 1;
+    std::optional<MaintenanceReport> report = db->runMaintenance(trim);
+    assert(report && report->ingredient_changes_trimmed > 0);
+    similar = db->similarRecipes(base, 2);
+    assert(similar[0].recipe_id == close && similar[1].recipe_id == far && std::abs(similar[1].similarity - 0.5) < 1e-9);
+    assert(db->memoryReport()->library.signature_bytes > 0);
+    db->releaseMemory();
+    assert(db->memoryReport()->library.signature_bytes == 0);
+
+    // Pruned top-k equals brute force on random ingredient sets
+    std::vector<std::pair<long long, long long>> links;
+    std::vector<std::vector<long long>> sets(300);
+    uint64_t state = 12345;
+    auto next = [&state]() { state = state * 6364136223846793005ULL + 1442695040888963407ULL; return state >> 33; };
+    for (long long recipe = 0; recipe < 300; ++recipe) {
+        for (size_t i = 0, count = 1 + next() % 8; i < count; ++i) {
+            long long ingredient = (next() % 40) * (next() % 40) / 40;      // Skewed towards small ids
+            if (std::find(sets[recipe].begin(), sets[recipe].end(), ingredient) == sets[recipe].end()) sets[recipe].push_back(ingredient);
+        }
+        std::sort(sets[recipe].begin(), sets[recipe].end());
+        for (long long ingredient : sets[recipe]) links.emplace_back(recipe, ingredient);
+    }
+    RecipeSignatures signatures;
+    signatures.assign(links);
+    assert(signatures.recipeCount() == 300);
+    for (long long query = 0; query < 300; query += 7) {
+        std::vector<SimilarRecipe> expected;
+        for (long long recipe = 0; recipe < 300; ++recipe) {
+            if (recipe == query) continue;
+            std::vector<long long> shared;
+            std::set_intersection(sets[query].begin(), sets[query].end(), sets[recipe].begin(), sets[recipe].end(), std::back_inserter(shared));
+            if (shared.empty()) continue;
+            double jaccard = static_cast<double>(shared.size()) / (sets[query].size() + sets[recipe].size() - shared.size());
+            expected.push_back({recipe, jaccard, shared.size()});
+        }
+        std::sort(expected.begin(), expected.end(), [](const SimilarRecipe& a, const SimilarRecipe& b) {
+            return a.similarity != b.similarity ? a.similarity > b.similarity : a.recipe_id < b.recipe_id;
+        });
+        expected.resize(std::min<size_t>(expected.size(), 5));
+        std::vector<SimilarRecipe> actual = signatures.mostSimilar(query, 5, SimilarityMeasure::Jaccard, nullptr);
+        assert(actual.size() == expected.size());
+        for (size_t i = 0; i < actual.size(); ++i) {
+            assert(actual[i].recipe_id == expected[i].recipe_id && actual[i].shared_ingredients == expected[i].shared_ingredients);
+        }
+    }
+
+    std::cout << "Similar Recipes Tests Passed!" << std::endl;
+}
+
+
+void testTextSimilarity() {
+    std::cout << "\n--- Testing Text Similarity ---" << std::endl;
+    TestDB test_db("test_text_similarity.db");
+    Database* db = test_db.db;
+
+    assert((recipeTextTerms("The Berries, 2 braises and a glass!") == std::vector<std::string>{"berry", "braise", "glass"}));
+
+    auto textRecipe = [](const std::string& name, const std::string& description, const std::vector<std::string>& steps, const std::string& tag) {
+        RecipeData recipe = createRecipe(name, "Cook", {"Salt"}, {tag});
+        recipe.description = description;
+        recipe.instructions = steps;
+        return recipe;
+    };
+    long long base = db->addRecipe(textRecipe("Base", "Slow braised beef in red wine", {"Brown the beef", "Braise slowly in red wine"}, "dinner"));
+    long long lamb = db->addRecipe(textRecipe("Lamb", "Slow braised lamb in red wine", {"Brown the lamb", "Braise in the oven"}, "dinner"));
+    long long stew = db->addRecipe(textRecipe("Stew", "One-pot beef stew", {"Simmer the beef with potatoes"}, "lunch"));
+    long long salad = db->addRecipe(textRecipe("Salad", "Quick green salad", {"Toss the leaves with dressing"}, "lunch"));
+
+    // Only recipes sharing a term are returned, best first
+    std::vector<TextMatch> similar = db->similarRecipesByText(base, 10);
+    assert(similar.size() == 2);
+    assert(similar[0].recipe_id == lamb && similar[0].shared_terms == 6 && similar[0].similarity > similar[1].similarity);
+    assert(similar[1].recipe_id == stew && similar[1].shared_terms == 1 && similar[1].similarity > 0);
+    SearchData filters;
+    filters.tags = {"lunch"};
+    similar = db->similarRecipesByText(base, 10, filters);
+    assert(similar.size() == 1 && similar[0].recipe_id == stew);
+    assert(db->similarRecipesByText(-5, 3).empty() && db->similarRecipesByText(base, 0).empty());
+
+    // An identical text scores 1; changes by other connections, including edits of the text, are picked up
+    long long copy = db->addRecipe(textRecipe("Copy", "Slow braised beef in red wine", {"Braise slowly in red wine", "Brown the beef"}, "dinner"));
+    similar = db->similarRecipesByText(base, 1);
+    assert(similar[0].recipe_id == copy && std::abs(similar[0].similarity - 1.0) < 1e-6);
+    sqlite3* raw = nullptr;
+    assert(sqlite3_open(test_db.db_path.c_str(), &raw) == SQLITE_OK);
+    assert(sqlite3_exec(raw, ("PRAGMA foreign_keys = ON; DELETE FROM recipes WHERE recipe_id = " + std::to_string(copy) + "; "
+                              "UPDATE recipes SET description = 'Quick green salad' WHERE recipe_id = " + std::to_string(lamb) + "; "
+                              "UPDATE instructions SET instruction = 'Toss the leaves' WHERE recipe_id = " + std::to_string(lamb) + ";").c_str(),
+                        nullptr, nullptr, nullptr) == SQLITE_OK);
+    sqlite3_close(raw);
+    similar = db->similarRecipesByText(base, 10);
+    assert(similar.size() == 1 && similar[0].recipe_id == stew);
+    similar = db->similarRecipesByText(salad, 10);
+    assert(similar.size() == 1 && similar[0].recipe_id == lamb);
+    assert(db->memoryReport()->library.text_index_bytes > 0);
+    db->releaseMemory();
+    assert(db->memoryReport()->library.text_index_bytes == 0);
+    assert(db->similarRecipesByText(salad, 10)[0].recipe_id == lamb);
+
+    // Writes that leave the text alone, here favorites toggled by another connection, do not touch the index
+    const int64_t text_bytes = db->memoryReport()->library.text_index_bytes;
+    assert(sqlite3_open(test_db.db_path.c_str(), &raw) == SQLITE_OK);
+    const std::string toggle_sql = "UPDATE recipes SET is_favorite = NOT is_favorite WHERE recipe_id = " + std::to_string(lamb) + ";";
+    for (int i = 0; i < 50; ++i) {
+        assert(sqlite3_exec(raw, toggle_sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK);
+        assert(db->similarRecipesByText(salad, 10)[0].recipe_id == lamb);
+    }
+    sqlite3_close(raw);
+    assert(db->memoryReport()->library.text_index_bytes == text_bytes);
+
+    // A version 3 database gets the current triggers, not just the ones it lacks
+    db->close();
+    assert(sqlite3_open(test_db.db_path.c_str(), &raw) == SQLITE_OK);
+    assert(sqlite3_exec(raw, "DROP TRIGGER recipe_text_after_update; CREATE TRIGGER recipe_text_after_update AFTER UPDATE OF description ON recipes "
+                             "WHEN new.recipe_id IS NOT (SELECT recipe_id FROM recipe_text_changes ORDER BY change_seq DESC LIMIT 1) "
+                             "BEGIN INSERT INTO recipe_text_changes (recipe_id) VALUES (new.recipe_id); END; PRAGMA user_version = 3;",
+                        nullptr, nullptr, nullptr) == SQLITE_OK);
+    sqlite3_close(raw);
+    assert(db->open(test_db.db_path));
+    assert(sqlite3_open(test_db.db_path.c_str(), &raw) == SQLITE_OK);
+    sqlite3_stmt* stmt = nullptr;
+    assert(sqlite3_prepare_v2(raw, "SELECT sql FROM sqlite_master WHERE type = 'trigger' AND name = 'recipe_text_after_update';", -1, &stmt, nullptr) == SQLITE_OK);
+    assert(sqlite3_step(stmt) == SQLITE_ROW);
+    assert(std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0))).find("WHEN") == std::string::npos);
+    sqlite3_finalize(stmt);
+    sqlite3_close(raw);
+    assert(db->similarRecipesByText(salad, 10)[0].recipe_id == lamb);
+
+    // Entries trimmed from the change log before this connection applied them make it reload
+    long long twin = -1;
+    {
+        Database other;
+        assert(other.open(test_db.db_path));
+        twin = other.addRecipe(textRecipe("Twin", "Quick green salad", {"Toss the leaves with dressing"}, "lunch"));
+    }
+    MaintenanceOptions trim;
+    trim.text_changes_kept = 1;
+    std::optional<MaintenanceReport> report = db->runMaintenance(trim);
+    assert(report && report->text_changes_trimmed > 0);
+    similar = db->similarRecipesByText(salad, 1);
+    assert(similar[0].recipe_id == twin && std::abs(similar[0].similarity - 1.0) < 1e-6);
+
+    // WAND equals exhaustive scoring, with appended and dead documents and after compaction
+    const std::vector<std::string> words = {"braise", "roast", "simmer", "whisk", "fold", "knead", "grill", "saute", "chop", "dice",
+                                            "beef", "lamb", "tofu", "bean", "rice", "noodle", "pepper", "onion", "garlic", "lemon"};
+    uint64_t state = 777;
+    auto next = [&state]() { state = state * 6364136223846793005ULL + 1442695040888963407ULL; return state >> 33; };
+    auto randomText = [&]() {
+        std::string text;
+        for (size_t i = 0, count = 1 + next() % 12; i < count; ++i) text += words[(next() % 20) * (next() % 20) / 20] + " ";
+        return text;
+    };
+    // Enough documents for posting lists of many blocks and an automatic compaction along the way
+    constexpr long long kDocuments = 2000;
+    RecipeTextIndex index;
+    for (long long recipe = 0; recipe < kDocuments; ++recipe) index.addDocument(recipe, randomText());
+    for (long long recipe = 0; recipe < kDocuments; recipe += 5) index.addDocument(recipe, randomText());
+    for (long long recipe = 1; recipe < kDocuments; recipe += 9) index.removeDocument(recipe);
+    assert(index.documentCount() == kDocuments - 223);
+    auto checkAgainstExhaustive = [&]() {
+        for (long long query = 0; query < kDocuments; query += 37) {
+            std::vector<double> expected;
+            for (long long recipe = 0; recipe < kDocuments; ++recipe) {
+                double score = recipe == query ? 0 : index.similarity(query, recipe);
+                if (score > 0) expected.push_back(score);
+            }
+            std::sort(expected.rbegin(), expected.rend());
+            expected.resize(std::min<size_t>(expected.size(), 5));
+            std::vector<TextMatch> actual = index.mostSimilar(query, 5, nullptr);
+            assert(actual.size() == expected.size());
+            for (size_t i = 0; i < actual.size(); ++i) {
+                assert(std::abs(actual[i].similarity - expected[i]) < 1e-6);
+                assert(std::abs(actual[i].similarity - index.similarity(query, actual[i].recipe_id)) < 1e-6 && actual[i].shared_terms > 0);
+                assert(actual[i].recipe_id % 9 != 1);
+            }
+        }
+    };
+    checkAgainstExhaustive();
+    index.compact();
+    assert(index.documentCount() == kDocuments - 223);
+    checkAgainstExhaustive();
+
+    std::cout << "Text Similarity Tests Passed!" << std::endl;
+}
+
+
 void testRecipeManagement() {
     std::cout << "\n--- Testing Recipe Management ---" << std::endl;
     TestDB test_db("test_recipes.db");
@@ -153,6 +1482,258 @@ void testSearchFunctionality() {
     std::cout << "Search Functionality Tests Passed!" << std::endl;
 }
 
+void testSortedSearch() {
+    std::cout << "\n--- Testing Sorted Search ---" << std::endl;
+    TestDB test_db("test_sorted.db");
+
+    long long soup = test_db.db->addRecipe(createRecipe("Tomato Soup", "Chef", {"Tomato"}, {"lunch"}, 45));
+    long long salad = test_db.db->addRecipe(createRecipe("Bean Salad", "Chef", {"Beans"}, {"lunch"}, 5));
+    long long stew = test_db.db->addRecipe(createRecipe("Apple Tomato Stew", "Chef", {"Tomato", "Apple"}, {"dinner"}, 90));
+
+    // Name order
+    SearchData criteria;
+    criteria.sort_by = SortKey::Name;
+    auto results = test_db.db->search(criteria);
+    assert((results == std::vector<long long>{stew, salad, soup}));
+
+    // Quickest first, top-2 only
+    criteria = {};
+    criteria.sort_by = SortKey::TotalTime;
+    criteria.limit = 2;
+    results = test_db.db->search(criteria);
+    assert((results == std::vector<long long>{salad, soup}));
+
+    // Longest cook time first, combined with a filter
+    criteria = {};
+    criteria.tags = {"lunch"};
+    criteria.sort_by = SortKey::CookTime;
+    criteria.sort_direction = SortDirection::Descending;
+    results = test_db.db->search(criteria);
+    assert((results == std::vector<long long>{soup, salad}));
+
+    // Newest first (all added in the same second, so recipe_id breaks the tie)
+    criteria = {};
+    criteria.sort_by = SortKey::DateAdded;
+    criteria.sort_direction = SortDirection::Descending;
+    results = test_db.db->search(criteria);
+    assert((results == std::vector<long long>{stew, salad, soup}));
+
+    // Relevance only has something to rank with FTS criteria
+    criteria = {};
+    criteria.keywords = "tomato";
+    criteria.sort_by = SortKey::Relevance;
+    criteria.sort_direction = SortDirection::Descending;
+    results = test_db.db->search(criteria);
+    assert(results.size() == 2);
+    assert(std::find(results.begin(), results.end(), salad) == results.end());
+    criteria.limit = 1;
+    assert(test_db.db->search(criteria).size() == 1);
+
+    std::cout << "Sorted Search Tests Passed!" << std::endl;
+}
+
+void testExpressionSearch() {
+    std::cout << "\n--- Testing Expression Search ---" << std::endl;
+    TestDB test_db("test_expression.db");
+
+    long long tacos = test_db.db->addRecipe(createRecipe("Tacos", "Rosa", {"Tortilla", "Beef"}, {"mexican"}, 20));
+    long long chili = test_db.db->addRecipe(createRecipe("Chili", "Rosa", {"Beans", "Beef"}, {"mexican", "spicy"}, 25));
+    long long arrabbiata = test_db.db->addRecipe(createRecipe("Arrabbiata", "Nonna", {"Penne", "Chili Flakes"}, {"italian", "spicy"}, 15));
+    long long lasagna = test_db.db->addRecipe(createRecipe("Lasagna", "Nonna", {"Pasta Sheets", "Beef"}, {"italian"}, 60));
+    long long curry = test_db.db->addRecipe(createRecipe("Curry", "Dad", {"Chicken"}, {"indian"}, 20));
+
+    auto tagged = [](const std::string& tag) {
+        SearchData criteria;
+        criteria.tags = {tag};
+        return SearchExpression::leaf(criteria);
+    };
+    SearchData quick;
+    quick.cook_time_range = {0, 29};
+
+    // (italian OR mexican) AND NOT spicy AND cook_time < 30
+    SearchExpression expression = SearchExpression::allOf({
+        SearchExpression::anyOf({tagged("italian"), tagged("mexican")}),
+        SearchExpression::negate(tagged("spicy")),
+        SearchExpression::leaf(quick)
+    });
+    auto results = test_db.db->searchExpression(expression);
+    assert((results == std::vector<long long>{tacos}));
+
+    // NOT (italian OR mexican) pushes down to NOT italian AND NOT mexican
+    results = test_db.db->searchExpression(SearchExpression::negate(SearchExpression::anyOf({tagged("italian"), tagged("mexican")})));
+    assert((results == std::vector<long long>{curry}));
+
+    // Shared predicates across OR branches: (beef AND italian) OR (beef AND mexican)
+    SearchData beef;
+    beef.ingredients = {"Beef"};
+    expression = SearchExpression::anyOf({
+        SearchExpression::allOf({SearchExpression::leaf(beef), tagged("italian")}),
+        SearchExpression::allOf({SearchExpression::leaf(beef), tagged("mexican")})
+    });
+    results = test_db.db->searchExpression(expression, SortKey::Name);
+    assert((results == std::vector<long long>{chili, lasagna, tacos}));
+
+    // Double negation and empty groups
+    results = test_db.db->searchExpression(SearchExpression::negate(SearchExpression::negate(tagged("spicy"))));
+    assert((results == std::vector<long long>{chili, arrabbiata}));
+    assert(test_db.db->searchExpression(SearchExpression::allOf({})).size() == 5);
+    assert(test_db.db->searchExpression(SearchExpression::anyOf({})).empty());
+
+    // Relevance ordering with the FTS predicate at the top level
+    SearchData keyword;
+    keyword.keywords = "beef";
+    expression = SearchExpression::allOf({SearchExpression::leaf(keyword), SearchExpression::negate(tagged("italian"))});
+    results = test_db.db->searchExpression(expression, SortKey::Relevance, SortDirection::Descending);
+    assert(results.size() == 2);
+
+    std::cout << "Expression Search Tests Passed!" << std::endl;
+}
+
+void testCoverageSearch() {
+    std::cout << "\n--- Testing Coverage Search ---" << std::endl;
+    TestDB test_db("test_coverage.db");
+
+    RecipeData omelette = createRecipe("Omelette", "Chef", {"Egg", "Butter"}, {"breakfast"});
+    omelette.ingredients.push_back({"Cheese", 1, "cup", "", true});
+    omelette.ingredients.push_back({"Chives", 1, "tbsp", "", true});
+    long long omelette_id = test_db.db->addRecipe(omelette);
+    long long frittata = test_db.db->addRecipe(createRecipe("Frittata", "Chef", {"Egg", "Butter", "Potato", "Onion"}, {"breakfast"}));
+    long long toast = test_db.db->addRecipe(createRecipe("Cheese Toast", "Chef", {"Bread", "Cheese"}, {"snack"}));
+    long long scrambled = test_db.db->addRecipe(createRecipe("Scrambled Eggs", "Chef", {"Egg", "Butter"}, {"breakfast"}));
+
+    CoverageQuery query;
+    query.ingredients = {"Egg", "Butter", "Cheese", "Potato"};
+    query.min_matches = 2;
+    auto results = test_db.db->searchByCoverage(query);
+
+    // Scrambled eggs and the omelette are fully covered; the omelette only misses an optional ingredient
+    assert(results.size() == 3);
+    assert(results[0].recipe_id == scrambled && results[0].score == 1.0 && results[0].missing_optional == 0);
+    assert(results[1].recipe_id == omelette_id && results[1].score == 1.0 && results[1].missing_optional == 1);
+    assert(results[1].matched == 3 && results[1].required == 2);
+    assert(results[2].recipe_id == frittata && results[2].score == 0.75);
+    assert(std::none_of(results.begin(), results.end(), [&](const CoverageMatch& m) { return m.recipe_id == toast; }));
+
+    // Top-k
+    query.limit = 1;
+    results = test_db.db->searchByCoverage(query);
+    assert(results.size() == 1 && results[0].recipe_id == scrambled);
+
+    // k = 1 picks up the toast, and filters apply on top
+    query.limit = 0;
+    query.min_matches = 1;
+    query.filters.tags = {"snack"};
+    results = test_db.db->searchByCoverage(query);
+    assert(results.size() == 1 && results[0].recipe_id == toast && results[0].score == 0.5);
+
+    // Asking for more matches than ingredients yields nothing
+    query = {};
+    query.ingredients = {"Egg"};
+    query.min_matches = 2;
+    assert(test_db.db->searchByCoverage(query).empty());
+
+    std::cout << "Coverage Search Tests Passed!" << std::endl;
+}
+
+void testIngredientHierarchy() {
+    std::cout << "\n--- Testing Ingredient Hierarchy ---" << std::endl;
+    TestDB test_db("test_hierarchy.db");
+
+    long long shortbread = test_db.db->addRecipe(createRecipe("Shortbread", "Gran", {"Flour", "Unsalted Butter", "Sugar"}, {"baking"}));
+    long long vegan_cookies = test_db.db->addRecipe(createRecipe("Vegan Cookies", "Gran", {"Flour", "Margarine", "Sugar"}, {"baking"}));
+    long long porridge = test_db.db->addRecipe(createRecipe("Porridge", "Gran", {"Oats", "Milk"}, {"breakfast"}));
+    long long flapjack = test_db.db->addRecipe(createRecipe("Flapjack", "Gran", {"Oats", "Syrup"}, {"baking"}));
+
+    assert(test_db.db->addIngredientRelation("Butter", "Unsalted Butter"));
+    assert(test_db.db->addIngredientRelation("Butter", "Margarine"));
+    assert(test_db.db->addIngredientRelation("Dairy", "Butter"));
+    assert(test_db.db->addIngredientRelation("Dairy", "Milk"));
+    assert(test_db.db->addIngredientRelation("Dairy", "Milk")); // Already recorded
+    assert(!test_db.db->addIngredientRelation("Milk", "Milk"));
+
+    // Without expansion only the literal name matches
+    SearchData criteria;
+    criteria.ingredients = {"Butter"};
+    assert(test_db.db->search(criteria).empty());
+
+    criteria.expand_ingredients = true;
+    auto results = test_db.db->search(criteria);
+    assert((results == std::vector<long long>{shortbread, vegan_cookies}));
+
+    criteria.ingredients = {"Butter", "Flour"};
+    assert(test_db.db->search(criteria).size() == 2);
+
+    // Excluding dairy reaches butter's variants through the closure
+    criteria = {};
+    criteria.exclude_ingredients = {"Dairy"};
+    assert(test_db.db->search(criteria).size() == 4);
+    criteria.expand_exclude_ingredients = true;
+    results = test_db.db->search(criteria);
+    assert((results == std::vector<long long>{flapjack}));
+
+    // Removing a relation recomputes the closure below it
+    assert(test_db.db->removeIngredientRelation("Dairy", "Butter"));
+    results = test_db.db->search(criteria);
+    assert((results == std::vector<long long>{shortbread, vegan_cookies, flapjack}));
+
+    // Ingredients that only appear in the hierarchy survive orphan cleanup
+    assert(test_db.db->deleteRecipe(porridge));
+    criteria = {};
+    criteria.ingredients = {"Butter"};
+    criteria.expand_ingredients = true;
+    assert(test_db.db->search(criteria).size() == 2);
+
+    std::cout << "Ingredient Hierarchy Tests Passed!" << std::endl;
+}
+
+void testAttachments() {
+    std::cout << "\n--- Testing Attachments ---" << std::endl;
+    TestDB test_db("test_attachments.db");
+
+    long long id = test_db.db->addRecipe(createRecipe("Bread", "Baker", {"Flour", "Water"}, {"baking"}));
+
+    // Larger than one streaming chunk, with a partial final chunk
+    std::string photo(200 * 1024 + 123, '\0');
+    for (size_t i = 0; i < photo.size(); ++i) photo[i] = static_cast<char>(i * 31 % 251);
+    std::istringstream photo_in(photo);
+
+    AttachmentInfo info;
+    info.mime_type = "image/jpeg";
+    info.width = 1024;
+    info.height = 768;
+    std::vector<unsigned char> thumbnail = {0xFF, 0xD8, 0xFF, 0xD9};
+    long long attachment_id = test_db.db->addAttachment(id, info, photo_in, photo.size(), thumbnail);
+    assert(attachment_id != -1);
+
+    auto attachments = test_db.db->getAttachments(id);
+    assert(attachments.size() == 1);
+    assert(attachments[0].attachment_id == attachment_id && attachments[0].mime_type == "image/jpeg");
+    assert(attachments[0].width == 1024 && attachments[0].height == 768);
+    assert(attachments[0].byte_size == static_cast<int64_t>(photo.size()));
+
+    std::ostringstream photo_out;
+    assert(test_db.db->readAttachment(attachment_id, photo_out));
+    assert(photo_out.str() == photo);
+    assert(test_db.db->getAttachmentThumbnail(attachment_id).value() == thumbnail);
+
+    // A stream shorter than the declared size leaves nothing behind
+    std::istringstream short_in("abc");
+    assert(test_db.db->addAttachment(id, info, short_in, 10) == -1);
+    assert(test_db.db->getAttachments(id).size() == 1);
+
+    // Attachments are not part of the recipe itself, and go away with it
+    assert(test_db.db->getRecipeById(id).has_value());
+    assert(test_db.db->deleteAttachment(attachment_id));
+    assert(!test_db.db->deleteAttachment(attachment_id));
+    std::istringstream again_in(photo);
+    attachment_id = test_db.db->addAttachment(id, info, again_in, photo.size());
+    assert(test_db.db->getAttachmentThumbnail(attachment_id).value().empty());
+    assert(test_db.db->deleteRecipe(id));
+    assert(!test_db.db->getAttachmentThumbnail(attachment_id).has_value());
+
+    std::cout << "Attachment Tests Passed!" << std::endl;
+}
+
 void testMergeFunctionality() {
     std::cout << "\n--- Testing Merge Functionality ---" << std::endl;
 
@@ -163,21 +1744,18 @@ void testMergeFunctionality() {
     // Add the initial recipe to main.db
     db->addRecipe(createRecipe("Pizza", "Papa John", {"Dough", "Cheese", "Tomato"}, {"italian"}));
 
-    // Now, we'll manually create the second database using the same singleton instance.
-    // First, close the connection to main.db so we can switch to other.db
-    db->close();
-
-    // Open and populate other.db
-    assert(db->open("other.db"));
-    db->emptyDatabase();
-    db->addRecipe(createRecipe("Burger", "Ronald", {"Bun", "Beef", "Lettuce"}, {"american"}));
-    db->addRecipe(createRecipe("Pizza", "Papa John", {"Dough", "Cheese", "Tomato"}, {"italian"})); // Exact duplicate
-    db->addRecipe(createRecipe("Pizza", "Pizza Hut", {"Dough", "Cheese", "Pepperoni"}, {"fast-food"}));
-    db->close(); // Close the connection to other.db
+    // Now, we'll create the second database with its own Database object while main.db stays open
+    std::filesystem::remove("other.db");
+    {
+        Database other;
+        assert(other.open("other.db"));
+        other.addRecipe(createRecipe("Burger", "Ronald", {"Bun", "Beef", "Lettuce"}, {"american"}));
+        other.addRecipe(createRecipe("Pizza", "Papa John", {"Dough", "Cheese", "Tomato"}, {"italian"})); // Exact duplicate
+        other.addRecipe(createRecipe("Pizza", "Pizza Hut", {"Dough", "Cheese", "Pepperoni"}, {"fast-food"}));
+    } // Closes the connection to other.db
 
     // --- The Actual Test ---
-    // Re-open main.db to perform the merge. The TestDB fixture will handle cleanup.
-    assert(db->open("main.db"));
+    // The TestDB fixture will handle cleanup of main.db.
     assert(db->mergeDatabase("other.db"));
 
     // Check the results of the merge
@@ -228,8 +1806,31 @@ int main() {
     std::cout << "Starting RecipeApp Robust Test Suite" << std::endl;
 
     testCoreFunctionality();
+    testReopenAndRebuild();
+    testBackgroundIndexJob();
+    testMaintenance();
+    testWalCheckpointer();
+    testMultipleInstances();
+    testNameIdCache();
+    testBulkNameResolution();
+    testLogging();
+    testIngredientParser();
+    testRecipeImporter();
+    testSearchBundle();
+    testCallTrace();
+    testMemoryReport();
+    testSqliteMemoryConfig();
+    testListingIndexes();
+    testMealPlanner();
+    testSimilarRecipes();
+    testTextSimilarity();
     testRecipeManagement();
     testSearchFunctionality();
+    testSortedSearch();
+    testExpressionSearch();
+    testCoverageSearch();
+    testIngredientHierarchy();
+    testAttachments();
     testMergeFunctionality();
     testEdgeCasesAndErrors();
 
@@ -0,0 +1,94 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+#include <bit>
+
+// Log-linear histogram of latencies in microseconds: exact below 8us, then 8 buckets per power of two,
+// so every bucket is within 12.5% of the values it holds. Not thread-safe; merge per-thread copies instead.
+class LatencyHistogram {
+public:
+    void record(uint64_t micros) {
+        ++buckets_[bucketOf(micros)];
+        ++count_;
+        sum_ += micros;
+        max_ = std::max(max_, micros);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < buckets_.size(); ++i) buckets_[i] += other.buckets_[i];
+        count_ += other.count_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t max() const { return max_; }
+    double mean() const { return count_ > 0 ? static_cast<double>(sum_) / static_cast<double>(count_) : 0.0; }
+
+    /**
+     * @param fraction Percentile as a fraction, e.g. 0.99
+     * @return Upper bound of the bucket holding that percentile, capped at the largest recorded value.
+     */
+    uint64_t percentile(double fraction) const {
+        if (count_ == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(count_ - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets_.size(); ++i) {
+            seen += buckets_[i];
+            if (seen >= rank) return std::min(upperBound(i) - 1, max_);
+        }
+        return max_;
+    }
+
+    /**
+     * Writes one line per non-empty bucket: its range, count, cumulative percentage and a bar.
+     */
+    void print(std::ostream& out, const std::string& indent = "  ") const {
+        uint64_t largest = *std::max_element(buckets_.begin(), buckets_.end());
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets_.size(); ++i) {
+            if (buckets_[i] == 0) continue;
+            seen += buckets_[i];
+            size_t bar = static_cast<size_t>(40 * buckets_[i] / largest);
+            out << indent << "[" << std::setw(9) << lowerBound(i) << ", " << std::setw(9) << upperBound(i) << ") us "
+                << std::setw(9) << buckets_[i] << " " << std::fixed << std::setprecision(2) << std::setw(7)
+                << 100.0 * static_cast<double>(seen) / static_cast<double>(count_) << "% " << std::string(std::max<size_t>(bar, 1), '#') << "\n";
+        }
+    }
+
+private:
+    static constexpr int kSubBucketBits = 3;
+    static constexpr uint64_t kSubBuckets = 1 << kSubBucketBits;
+
+    std::array<uint64_t, 64 * kSubBuckets> buckets_{};
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t max_ = 0;
+
+    static size_t bucketOf(uint64_t value) {
+        if (value < kSubBuckets) return static_cast<size_t>(value);
+        int msb = std::bit_width(value) - 1;
+        int shift = msb - kSubBucketBits;
+        uint64_t sub = (value >> shift) & (kSubBuckets - 1);
+        return static_cast<size_t>(((shift + 1) << kSubBucketBits) + sub);
+    }
+
+    static uint64_t lowerBound(size_t bucket) {
+        if (bucket < kSubBuckets) return bucket;
+        size_t group = bucket >> kSubBucketBits;
+        return (kSubBuckets + (bucket & (kSubBuckets - 1))) << (group - 1);
+    }
+
+    static uint64_t upperBound(size_t bucket) {
+        if (bucket < kSubBuckets) return bucket + 1;
+        return lowerBound(bucket) + (uint64_t{1} << ((bucket >> kSubBucketBits) - 1));
+    }
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -0,0 +1,40 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include "database.h"
+#include "recipe_importer.h"
+
+// Imports schema.org Recipe JSON-LD from a directory of saved HTML pages.
+// Usage: recipe_import <html_directory> [db_path] [threads]
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <html_directory> [db_path] [threads]" << std::endl;
+        return 2;
+    }
+    std::string directory = argv[1];
+    std::string db_path = argc > 2 ? argv[2] : "recipes.db";
+    ImportOptions options;
+    if (argc > 3) options.threads = std::strtoull(argv[3], nullptr, 10);
+
+    Database db;
+    if (!db.open(db_path)) {
+        std::cerr << "Failed to open database " << db_path << std::endl;
+        return 1;
+    }
+
+    std::optional<ImportReport> report = importRecipePages(db, directory, options);
+    db.close();
+    if (!report) {
+        std::cerr << "Import failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "pages=" << report->pages << " with_recipes=" << report->pages_with_recipes
+              << " unreadable=" << report->unreadable_pages << " invalid_blocks=" << report->invalid_blocks << std::endl;
+    std::cout << "recipes_found=" << report->recipes_found << " recipes_added=" << report->recipes_added << std::endl;
+    std::cout << std::fixed << std::setprecision(1) << "elapsed=" << report->elapsed.count() << "ms  "
+              << report->pagesPerSecond() << " pages/s" << std::endl;
+    return 0;
+}
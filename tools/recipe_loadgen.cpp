@@ -0,0 +1,426 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <optional>
+#include <cstdlib>
+#include "database.h"
+#include "logging.h"
+#include "latency_histogram.h"
+
+// Runs a concurrent mix of operations against a database, one connection per thread, and reports
+// a latency histogram per operation type.
+// Usage: recipe_loadgen [--db PATH] [--threads N] [--duration S] [--warmup S] [--mode closed|open] [--rate OPS]
+//                       [--mix search=60,hydrate=25,add=10,delete=4,merge=1]
+//                       [--search-mix tag=40,ingredient=30,keyword=20,range=10]
+//                       [--preload N] [--merge-recipes N] [--seed N] [--trace FILE] [--log]
+// --trace records the calls of the measured run (after setup) for recipe_replay.
+
+using Clock = std::chrono::steady_clock;
+
+enum Operation : size_t { kSearch, kHydrate, kAdd, kDelete, kMerge, kOperationCount };
+constexpr std::array<const char*, kOperationCount> kOperationNames = {"search", "hydrate", "add", "delete", "merge"};
+
+enum SearchKind : size_t { kTagSearch, kIngredientSearch, kKeywordSearch, kRangeSearch, kSearchKindCount };
+constexpr std::array<const char*, kSearchKindCount> kSearchKindNames = {"tag", "ingredient", "keyword", "range"};
+
+const std::vector<std::string> kIngredientNames = {
+    "Flour", "Sugar", "Butter", "Egg", "Milk", "Salt", "Pepper", "Garlic", "Onion", "Tomato",
+    "Olive Oil", "Chicken", "Beef", "Pork", "Rice", "Pasta", "Cheese", "Basil", "Parsley", "Lemon",
+    "Potato", "Carrot", "Celery", "Mushroom", "Spinach", "Cream", "Yogurt", "Honey", "Cinnamon", "Ginger"
+};
+
+const std::vector<std::string> kTagNames = {
+    "breakfast", "lunch", "dinner", "dessert", "snack", "italian", "mexican", "indian", "chinese", "french",
+    "quick", "easy", "vegetarian", "vegan", "spicy", "healthy", "comfort", "baking", "grill", "soup"
+};
+
+const std::vector<std::string> kWords = {
+    "classic", "simple", "hearty", "creamy", "crispy", "roasted", "slow", "braised", "fresh", "golden",
+    "rustic", "zesty", "smoky", "sweet", "savory", "weeknight", "family", "holiday", "summer", "winter"
+};
+
+
+struct Options {
+    std::string db_path = "loadgen.db";
+    size_t threads = 4;
+    double duration_s = 10;
+    double warmup_s = 2;
+    bool open_loop = false;
+    double rate = 1000;         // Total arrivals per second in open-loop mode
+    std::array<double, kOperationCount> mix = {60, 25, 10, 4, 1};
+    std::array<double, kSearchKindCount> search_mix = {40, 30, 20, 10};
+    size_t preload = 2000;
+    size_t merge_recipes = 10;
+    uint64_t seed = 1;
+    std::string trace_path;
+    bool log = false;
+};
+
+
+struct Lcg {
+    uint64_t state;
+    explicit Lcg(uint64_t seed) : state(seed * 2862933555777941757ULL + 3037000493ULL) {}
+    uint32_t next() {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<uint32_t>(state >> 33);
+    }
+    size_t below(size_t n) { return next() % n; }
+    double unit() { return next() / 2147483648.0; }     // next() yields 31 bits
+};
+
+
+/**
+ * @return Index drawn with probability proportional to its weight.
+ */
+template <size_t N>
+size_t pickWeighted(Lcg& rng, const std::array<double, N>& weights) {
+    double total = 0;
+    for (double weight : weights) total += weight;
+    double point = rng.unit() * total;
+    for (size_t i = 0; i < N; ++i) {
+        if (point < weights[i]) return i;
+        point -= weights[i];
+    }
+    return N - 1;
+}
+
+
+RecipeData generateRecipe(Lcg& rng, const std::string& suffix) {
+    RecipeData recipe;
+    recipe.name = kWords[rng.below(kWords.size())] + " " + kWords[rng.below(kWords.size())] + " " +
+                  kIngredientNames[rng.below(kIngredientNames.size())] + " " + suffix;
+    recipe.description = "A " + kWords[rng.below(kWords.size())] + " dish.";
+    recipe.prep_time_minutes = 5 + rng.below(60);
+    recipe.cook_time_minutes = rng.below(180);
+    recipe.servings = 1 + rng.below(8);
+    recipe.is_favorite = rng.below(10) == 0;
+    recipe.source = "Loadgen";
+    recipe.author = "Author " + std::to_string(rng.below(200));
+    size_t ingredient_count = 3 + rng.below(8);
+    std::vector<size_t> picks;
+    while (picks.size() < ingredient_count) {
+        size_t pick = rng.below(kIngredientNames.size());
+        if (std::find(picks.begin(), picks.end(), pick) == picks.end()) picks.push_back(pick);
+    }
+    for (size_t pick : picks) recipe.ingredients.push_back({kIngredientNames[pick], 1.0 + rng.below(4), "cup", "", false});
+    size_t tag_count = 1 + rng.below(3);
+    while (recipe.tags.size() < tag_count) {
+        const std::string& tag = kTagNames[rng.below(kTagNames.size())];
+        if (std::find(recipe.tags.begin(), recipe.tags.end(), tag) == recipe.tags.end()) recipe.tags.push_back(tag);
+    }
+    recipe.instructions = {"Prepare.", "Cook.", "Serve."};
+    return recipe;
+}
+
+
+SearchData generateSearch(Lcg& rng, const Options& options) {
+    SearchData criteria;
+    switch (pickWeighted(rng, options.search_mix)) {
+        case kTagSearch:
+            criteria.tags = {kTagNames[rng.below(kTagNames.size())]};
+            if (rng.below(2) == 0) criteria.exclude_tags = {kTagNames[rng.below(kTagNames.size())]};
+            break;
+        case kIngredientSearch:
+            criteria.ingredients = {kIngredientNames[rng.below(kIngredientNames.size())]};
+            if (rng.below(2) == 0) criteria.ingredients.push_back(kIngredientNames[rng.below(kIngredientNames.size())]);
+            break;
+        case kKeywordSearch:
+            criteria.keywords = kWords[rng.below(kWords.size())];
+            criteria.sort_by = SortKey::Relevance;
+            criteria.sort_direction = SortDirection::Descending;
+            criteria.limit = 20;
+            break;
+        default: {
+            uint16_t low = static_cast<uint16_t>(rng.below(120));
+            criteria.cook_time_range = {low, static_cast<uint16_t>(low + 30)};
+            criteria.sort_by = SortKey::TotalTime;
+            criteria.limit = 20;
+            break;
+        }
+    }
+    return criteria;
+}
+
+
+// Ids of live recipes, shared by all threads so hydrate and delete pick recipes that exist
+class IdPool {
+public:
+    void add(long long id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ids_.push_back(id);
+    }
+
+    std::optional<long long> pick(Lcg& rng) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (ids_.empty()) return std::nullopt;
+        return ids_[rng.below(ids_.size())];
+    }
+
+    std::optional<long long> take(Lcg& rng) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (ids_.empty()) return std::nullopt;
+        size_t index = rng.below(ids_.size());
+        long long id = ids_[index];
+        ids_[index] = ids_.back();
+        ids_.pop_back();
+        return id;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return ids_.size();
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<long long> ids_;
+};
+
+
+struct ThreadResult {
+    std::array<LatencyHistogram, kOperationCount> latency;
+    std::array<uint64_t, kOperationCount> errors{};
+    uint64_t max_lag_us = 0;    // Open loop: furthest an operation started behind its scheduled time
+};
+
+
+template <size_t N>
+bool parseMix(const std::string& text, const std::array<const char*, N>& names, std::array<double, N>& weights) {
+    std::array<double, N> parsed{};
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find(',', pos);
+        std::string item = text.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        pos = end == std::string::npos ? text.size() : end + 1;
+        size_t equals = item.find('=');
+        if (equals == std::string::npos) return false;
+        auto name = std::find_if(names.begin(), names.end(), [&](const char* candidate) { return item.substr(0, equals) == candidate; });
+        if (name == names.end()) return false;
+        parsed[static_cast<size_t>(name - names.begin())] = std::strtod(item.c_str() + equals + 1, nullptr);
+    }
+    weights = parsed;
+    return true;
+}
+
+
+std::optional<Options> parseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string { return i + 1 < argc ? argv[++i] : ""; };
+        if (arg == "--db") options.db_path = value();
+        else if (arg == "--threads") options.threads = std::max<size_t>(1, std::strtoull(value().c_str(), nullptr, 10));
+        else if (arg == "--duration") options.duration_s = std::strtod(value().c_str(), nullptr);
+        else if (arg == "--warmup") options.warmup_s = std::strtod(value().c_str(), nullptr);
+        else if (arg == "--mode") {
+            std::string mode = value();
+            if (mode != "open" && mode != "closed") return std::nullopt;
+            options.open_loop = mode == "open";
+        }
+        else if (arg == "--rate") options.rate = std::strtod(value().c_str(), nullptr);
+        else if (arg == "--mix") { if (!parseMix(value(), kOperationNames, options.mix)) return std::nullopt; }
+        else if (arg == "--search-mix") { if (!parseMix(value(), kSearchKindNames, options.search_mix)) return std::nullopt; }
+        else if (arg == "--preload") options.preload = std::strtoull(value().c_str(), nullptr, 10);
+        else if (arg == "--merge-recipes") options.merge_recipes = std::strtoull(value().c_str(), nullptr, 10);
+        else if (arg == "--seed") options.seed = std::strtoull(value().c_str(), nullptr, 10);
+        else if (arg == "--trace") options.trace_path = value();
+        else if (arg == "--log") options.log = true;
+        else return std::nullopt;
+    }
+    if (options.open_loop && options.rate <= 0) return std::nullopt;
+    return options;
+}
+
+
+/**
+ * Runs one operation.
+ * @return false if the operation failed.
+ */
+bool runOperation(Operation operation, Database& db, Lcg& rng, IdPool& pool, const Options& options,
+                  const std::string& merge_path, size_t thread_index, uint64_t& add_counter) {
+    switch (operation) {
+        case kSearch:
+            db.search(generateSearch(rng, options));
+            return db.isOpen();
+        case kHydrate: {
+            std::optional<long long> id = pool.pick(rng);
+            // A concurrent delete may have removed the recipe; only a missing pool counts as a failure
+            if (!id) return false;
+            db.getRecipeById(*id);
+            return true;
+        }
+        case kAdd: {
+            long long id = db.addRecipe(generateRecipe(rng, "t" + std::to_string(thread_index) + "-" + std::to_string(add_counter++)));
+            if (id == -1) return false;
+            pool.add(id);
+            return true;
+        }
+        case kDelete: {
+            std::optional<long long> id = pool.take(rng);
+            return id && db.deleteRecipe(*id);
+        }
+        case kMerge:
+            return db.mergeDatabase(merge_path);
+        default:
+            return false;
+    }
+}
+
+
+void runWorker(size_t thread_index, const Options& options, IdPool& pool, const std::string& merge_path,
+               std::shared_ptr<TraceRecorder> recorder, Clock::time_point start, ThreadResult& result) {
+    Database db;
+    if (!db.open(options.db_path)) {
+        std::cerr << "Thread " << thread_index << " failed to open " << options.db_path << std::endl;
+        return;
+    }
+    db.setTraceRecorder(recorder);
+    Lcg rng(options.seed * 1000 + thread_index);
+    const auto warmup_end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.warmup_s));
+    const auto end = warmup_end + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.duration_s));
+    uint64_t add_counter = 0;
+
+    // Open loop: each thread owns an evenly spaced share of the arrivals, offset so threads interleave
+    const auto interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(static_cast<double>(options.threads) / std::max(options.rate, 1e-9)));
+    auto scheduled = start + interval * thread_index / options.threads;
+
+    while (true) {
+        Clock::time_point begin;
+        if (options.open_loop) {
+            if (scheduled >= end) break;
+            std::this_thread::sleep_until(scheduled);
+            begin = scheduled;
+            scheduled += interval;
+        } else {
+            begin = Clock::now();
+            if (begin >= end) break;
+        }
+
+        Operation operation = static_cast<Operation>(pickWeighted(rng, options.mix));
+        const auto started = Clock::now();
+        bool ok = runOperation(operation, db, rng, pool, options, merge_path, thread_index, add_counter);
+        const auto finished = Clock::now();
+
+        // Latency counts from the scheduled arrival, so a backlog shows up instead of being hidden
+        if (begin >= warmup_end) {
+            result.latency[operation].record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(finished - begin).count()));
+            if (!ok) ++result.errors[operation];
+            if (options.open_loop) {
+                result.max_lag_us = std::max<uint64_t>(result.max_lag_us,
+                    static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(started - begin).count()));
+            }
+        }
+    }
+    db.close();
+}
+
+
+int main(int argc, char** argv) {
+    std::optional<Options> parsed = parseOptions(argc, argv);
+    if (!parsed) {
+        std::cerr << "Usage: " << argv[0] << " [--db PATH] [--threads N] [--duration S] [--warmup S] [--mode closed|open] [--rate OPS]\n"
+                  << "       [--mix search=60,hydrate=25,add=10,delete=4,merge=1] [--search-mix tag=40,ingredient=30,keyword=20,range=10]\n"
+                  << "       [--preload N] [--merge-recipes N] [--seed N] [--trace FILE] [--log]" << std::endl;
+        return 2;
+    }
+    const Options options = *parsed;
+    setLogLevel(options.log ? LogLevel::Warning : LogLevel::Off);
+
+    // Setup: WAL so readers and the writer overlap, preloaded recipes and a small database to merge from
+    Database db;
+    if (!db.open(options.db_path) || !db.enableWal()) {
+        std::cerr << "Failed to open " << options.db_path << std::endl;
+        return 1;
+    }
+    IdPool pool;
+    for (long long id : db.search(SearchData())) pool.add(id);
+    Lcg setup_rng(options.seed);
+    std::vector<RecipeData> batch;
+    for (size_t i = pool.size(); i < options.preload; ++i) {
+        batch.push_back(generateRecipe(setup_rng, "p" + std::to_string(i)));
+        if (batch.size() == 500 || i + 1 == options.preload) {
+            for (long long id : db.addRecipes(batch)) {
+                if (id != -1) pool.add(id);
+            }
+            batch.clear();
+        }
+    }
+
+    const std::string merge_path = options.db_path + ".merge-source.db";
+    {
+        std::filesystem::remove(merge_path);
+        Database source;
+        if (!source.open(merge_path)) {
+            std::cerr << "Failed to create " << merge_path << std::endl;
+            return 1;
+        }
+        for (size_t i = 0; i < options.merge_recipes; ++i) source.addRecipe(generateRecipe(setup_rng, "m" + std::to_string(i)));
+        source.close();
+    }
+
+    std::cout << "recipe_loadgen: " << options.threads << " threads, " << (options.open_loop ? "open" : "closed") << " loop";
+    if (options.open_loop) std::cout << " at " << options.rate << " ops/s";
+    std::cout << ", " << options.warmup_s << "s warm-up + " << options.duration_s << "s, " << pool.size() << " recipes" << std::endl;
+
+    std::shared_ptr<TraceRecorder> recorder;
+    if (!options.trace_path.empty()) {
+        recorder = TraceRecorder::create(options.trace_path);
+        if (!recorder) {
+            std::cerr << "Failed to create trace " << options.trace_path << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<ThreadResult> results(options.threads);
+    std::vector<std::thread> threads;
+    const auto start = Clock::now();
+    for (size_t i = 0; i < options.threads; ++i) {
+        threads.emplace_back(runWorker, i, std::cref(options), std::ref(pool), std::cref(merge_path), recorder, start, std::ref(results[i]));
+    }
+    for (std::thread& thread : threads) thread.join();
+    if (recorder) {
+        recorder->flush();
+        std::cout << "recorded " << recorder->eventCount() << " calls to " << options.trace_path << std::endl;
+    }
+
+    ThreadResult total;
+    for (const ThreadResult& result : results) {
+        for (size_t op = 0; op < kOperationCount; ++op) {
+            total.latency[op].merge(result.latency[op]);
+            total.errors[op] += result.errors[op];
+        }
+        total.max_lag_us = std::max(total.max_lag_us, result.max_lag_us);
+    }
+
+    uint64_t all = 0;
+    for (const LatencyHistogram& histogram : total.latency) all += histogram.count();
+    std::cout << std::fixed << std::setprecision(1) << "\ntotal " << all << " ops, " << all / options.duration_s << " ops/s";
+    if (options.open_loop) std::cout << ", max start lag " << total.max_lag_us << "us";
+    std::cout << std::endl;
+
+    for (size_t op = 0; op < kOperationCount; ++op) {
+        const LatencyHistogram& histogram = total.latency[op];
+        if (histogram.count() == 0) continue;
+        std::cout << "\n" << std::left << std::setw(8) << kOperationNames[op] << std::right
+                  << " n=" << histogram.count() << " errors=" << total.errors[op]
+                  << " rate=" << std::setprecision(1) << histogram.count() / options.duration_s << "/s"
+                  << " mean=" << histogram.mean() << "us p50=" << histogram.percentile(0.50) << "us p90=" << histogram.percentile(0.90)
+                  << "us p99=" << histogram.percentile(0.99) << "us p99.9=" << histogram.percentile(0.999)
+                  << "us max=" << histogram.max() << "us" << std::endl;
+        histogram.print(std::cout);
+    }
+
+    db.close();
+    // A recorded trace refers to the merge source, so keep it for replay
+    if (!recorder) std::filesystem::remove(merge_path);
+    return 0;
+}
@@ -0,0 +1,193 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <optional>
+#include "database.h"
+#include "logging.h"
+#include "call_trace.h"
+#include "latency_histogram.h"
+
+// Re-executes a trace recorded with Database::setTraceRecorder against a database and compares results and latencies.
+// Replay against a copy of the database the trace was recorded on: results depend on its contents.
+// Usage: recipe_replay --trace FILE --db PATH [--speed original|max] [--serial] [--log]
+//   --speed original  waits for each call's recorded start time; max (the default) issues calls back to back
+//   --serial          replays every call on one connection in recorded start order instead of one thread per
+//                     recorded connection, which makes the result of concurrent writes deterministic
+// Exits with 3 if any result diverged from the recording.
+
+using Clock = std::chrono::steady_clock;
+
+// Divergent calls printed individually before only counting the rest
+constexpr size_t kMaxListedDivergences = 20;
+
+
+struct Options {
+    std::string trace_path;
+    std::string db_path;
+    bool original_speed = false;
+    bool serial = false;
+    bool log = false;
+};
+
+
+struct ReplayResult {
+    std::array<LatencyHistogram, kTraceCallCount> recorded;
+    std::array<LatencyHistogram, kTraceCallCount> replayed;
+    std::array<uint64_t, kTraceCallCount> diverged{};
+    uint64_t undecodable = 0;
+    std::vector<size_t> divergent_events;   // Indexes into the trace, at most kMaxListedDivergences
+};
+
+
+std::optional<Options> parseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string { return i + 1 < argc ? argv[++i] : ""; };
+        if (arg == "--trace") options.trace_path = value();
+        else if (arg == "--db") options.db_path = value();
+        else if (arg == "--speed") {
+            std::string speed = value();
+            if (speed != "original" && speed != "max") return std::nullopt;
+            options.original_speed = speed == "original";
+        }
+        else if (arg == "--serial") options.serial = true;
+        else if (arg == "--log") options.log = true;
+        else return std::nullopt;
+    }
+    if (options.trace_path.empty() || options.db_path.empty()) return std::nullopt;
+    return options;
+}
+
+
+/**
+ * Replays a list of events on one connection.
+ * @param indexes Positions of the events to replay in the trace, in replay order
+ */
+void replayEvents(const Options& options, const std::vector<TraceEvent>& events, const std::vector<size_t>& indexes,
+                  Clock::time_point start, ReplayResult& result) {
+    Database db;
+    if (!db.open(options.db_path)) {
+        std::cerr << "Failed to open " << options.db_path << std::endl;
+        return;
+    }
+    for (size_t index : indexes) {
+        const TraceEvent& event = events[index];
+        if (options.original_speed) std::this_thread::sleep_until(start + std::chrono::microseconds(event.start_us));
+
+        const auto begin = Clock::now();
+        std::optional<uint64_t> hash = replayTraceEvent(db, event);
+        const auto end = Clock::now();
+
+        const size_t call = static_cast<size_t>(event.call);
+        if (!hash) {
+            ++result.undecodable;
+            continue;
+        }
+        result.recorded[call].record(event.duration_us);
+        result.replayed[call].record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count()));
+        if (*hash != event.result_hash) {
+            ++result.diverged[call];
+            if (result.divergent_events.size() < kMaxListedDivergences) result.divergent_events.push_back(index);
+        }
+    }
+    db.close();
+}
+
+
+std::string deltaPercent(double recorded, double replayed) {
+    if (recorded <= 0) return "n/a";
+    std::ostringstream out;
+    out << std::showpos << std::fixed << std::setprecision(1) << 100.0 * (replayed - recorded) / recorded << "%";
+    return out.str();
+}
+
+
+int main(int argc, char** argv) {
+    std::optional<Options> parsed = parseOptions(argc, argv);
+    if (!parsed) {
+        std::cerr << "Usage: " << argv[0] << " --trace FILE --db PATH [--speed original|max] [--serial] [--log]" << std::endl;
+        return 2;
+    }
+    const Options options = *parsed;
+    setLogLevel(options.log ? LogLevel::Warning : LogLevel::Off);
+
+    std::optional<std::vector<TraceEvent>> trace = readTrace(options.trace_path);
+    if (!trace) {
+        std::cerr << "Failed to read trace " << options.trace_path << std::endl;
+        return 1;
+    }
+    const std::vector<TraceEvent>& events = *trace;
+
+    // One schedule per replaying connection; each keeps its recorded order
+    std::map<uint32_t, std::vector<size_t>> schedules;
+    for (size_t i = 0; i < events.size(); ++i) schedules[options.serial ? 0 : events[i].connection].push_back(i);
+    if (options.serial) {
+        std::stable_sort(schedules[0].begin(), schedules[0].end(),
+                         [&](size_t a, size_t b) { return events[a].start_us < events[b].start_us; });
+    }
+
+    std::cout << "recipe_replay: " << events.size() << " calls on " << schedules.size() << " connection(s), "
+              << (options.original_speed ? "original" : "maximum") << " speed" << std::endl;
+
+    std::vector<ReplayResult> results(schedules.size());
+    std::vector<std::thread> threads;
+    const auto start = Clock::now();
+    size_t next = 0;
+    for (const auto& [connection, indexes] : schedules) {
+        threads.emplace_back(replayEvents, std::cref(options), std::cref(events), std::cref(indexes), start, std::ref(results[next++]));
+    }
+    for (std::thread& thread : threads) thread.join();
+    const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    ReplayResult total;
+    for (const ReplayResult& result : results) {
+        for (size_t call = 0; call < kTraceCallCount; ++call) {
+            total.recorded[call].merge(result.recorded[call]);
+            total.replayed[call].merge(result.replayed[call]);
+            total.diverged[call] += result.diverged[call];
+        }
+        total.undecodable += result.undecodable;
+        total.divergent_events.insert(total.divergent_events.end(), result.divergent_events.begin(), result.divergent_events.end());
+    }
+    std::sort(total.divergent_events.begin(), total.divergent_events.end());
+    if (total.divergent_events.size() > kMaxListedDivergences) total.divergent_events.resize(kMaxListedDivergences);
+
+    uint64_t diverged = 0;
+    for (uint64_t count : total.diverged) diverged += count;
+    std::cout << "replayed in " << std::fixed << std::setprecision(2) << elapsed << "s, " << diverged << " diverged, "
+              << total.undecodable << " undecodable\n\n";
+
+    std::cout << std::left << std::setw(26) << "call" << std::right << std::setw(8) << "n" << std::setw(10) << "diverged"
+              << std::setw(12) << "rec p50" << std::setw(12) << "rep p50" << std::setw(12) << "rec p99" << std::setw(12) << "rep p99"
+              << std::setw(12) << "rec mean" << std::setw(12) << "rep mean" << std::setw(10) << "delta" << "\n";
+    for (size_t call = 1; call < kTraceCallCount; ++call) {
+        const LatencyHistogram& recorded = total.recorded[call];
+        const LatencyHistogram& replayed = total.replayed[call];
+        if (recorded.count() == 0) continue;
+        std::cout << std::left << std::setw(26) << traceCallName(static_cast<TraceCall>(call)) << std::right
+                  << std::setw(8) << recorded.count() << std::setw(10) << total.diverged[call]
+                  << std::setw(10) << recorded.percentile(0.50) << "us" << std::setw(10) << replayed.percentile(0.50) << "us"
+                  << std::setw(10) << recorded.percentile(0.99) << "us" << std::setw(10) << replayed.percentile(0.99) << "us"
+                  << std::setprecision(0) << std::setw(10) << recorded.mean() << "us" << std::setw(10) << replayed.mean() << "us"
+                  << std::setw(10) << deltaPercent(recorded.mean(), replayed.mean()) << "\n";
+    }
+
+    if (!total.divergent_events.empty()) {
+        std::cout << "\nfirst divergent calls:\n";
+        for (size_t index : total.divergent_events) {
+            const TraceEvent& event = events[index];
+            std::cout << "  #" << index << " " << traceCallName(event.call) << " on connection " << event.connection
+                      << " at " << event.start_us << "us\n";
+        }
+    }
+    std::cout << std::flush;
+    return diverged > 0 ? 3 : 0;
+}